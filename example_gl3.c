@@ -63,7 +63,7 @@ int main(int argc, char *argv[])
 	imdd_shape_store_t *const store = imdd_init(malloc(shape_mem_size), shape_mem_size);
 
 	imdd_gl3_context_t ctx;
-	imdd_gl3_init(&ctx, shape_count, shape_count, shape_count);
+	imdd_gl3_init(&ctx, shape_count, shape_count, shape_count, 0);
 
 	float angle = 0.f;
 	while (!glfwWindowShouldClose(window)) {
@@ -93,7 +93,7 @@ int main(int argc, char *argv[])
 
 		// emit debug draw
 		imdd_shape_store_t const *draw_store = store;
-		imdd_gl3_update(&ctx, &draw_store, 1);
+		imdd_gl3_update(&ctx, &draw_store, 1, NULL);
 		imdd_gl3_draw(&ctx, proj_from_world.m[0]);
 
 		// flip
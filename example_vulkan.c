@@ -469,11 +469,14 @@ int main(int argc, char *argv[])
 {
 	bool is_debug = false;
 	bool is_perf = false;
+	uint32_t imdd_flags = 0;
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-d") == 0) {
 			is_debug = true;
 		} else if (strcmp(argv[i], "-p") == 0) {
 			is_perf = true;
+		} else if (strcmp(argv[i], "-n") == 0) {
+			imdd_flags |= IMDD_VULKAN_FLAG_NON_TEMPORAL;
 		} else {
 			fprintf(stderr, "unknown argument: %s\n", argv[i]);
 			exit(-1);
@@ -566,7 +569,7 @@ int main(int argc, char *argv[])
 
 		imdd_vulkan_init(
 			&ctx, shape_count, shape_count, shape_count,
-			&fp, &vk_verify, ex.physical_device, ex.device, 0);
+			&fp, &vk_verify, ex.physical_device, ex.device, imdd_flags);
 	}
 
 	swapchain_t swapchain;
@@ -600,7 +603,7 @@ int main(int argc, char *argv[])
 		// flush shapes to vulkan before the render pass begins
 		double const update_time_start = time_now();
 		imdd_shape_store_t const *draw_stores = store;
-		imdd_vulkan_update(&ctx, &draw_stores, 1, ex.device, command_buffer);
+		imdd_vulkan_update(&ctx, &draw_stores, 1, ex.device, command_buffer, NULL);
 		double const update_time_diff = time_now() - update_time_start;
 
 		// start the render pass
@@ -49,10 +49,22 @@ typedef struct imdd_shape_store_tag imdd_shape_store_t;
 
 #define IMDD_APPROX_SHAPE_SIZE_IN_BYTES		64
 
+// layers are drawn in order with render state chosen by the renderer (such as depth bias or line width)
+#define IMDD_LAYER_COUNT	4
+
 imdd_shape_store_t *imdd_init(void *mem, uint32_t size);
 
 void imdd_reset(imdd_shape_store_t *store);
 
+/*
+	Sets the layer of shapes emitted into this store afterwards, until the
+	next reset.  The layer belongs to the store rather than to each thread,
+	so while layers are in use each store should have a single producer (or
+	producers that only emit between the same two calls to this), otherwise
+	the layer of each shape depends on how the threads interleave.
+*/
+void imdd_set_layer(imdd_shape_store_t *store, uint32_t layer);
+
 void imdd_reserve(
 	imdd_shape_store_t *store,
 	imdd_shape_enum_t shape,
@@ -327,7 +339,10 @@ imdd_shape_store_t *imdd_init(void *mem, uint32_t size)
 		return NULL;
 	}
 	imdd_v4 *const data_mem = (imdd_v4 *)mem_start;
-	uint32_t const data_capacity = (uint32_t)(mem_end - mem_start)/sizeof(imdd_v4);
+	uint32_t data_capacity = (uint32_t)(mem_end - mem_start)/sizeof(imdd_v4);
+	if (data_capacity > IMDD_MAX_DATA_QW_COUNT) {
+		data_capacity = IMDD_MAX_DATA_QW_COUNT;
+	}
 
 	// write the store out
 	imdd_atomic_store(&store->header_count, 0);
@@ -336,6 +351,8 @@ imdd_shape_store_t *imdd_init(void *mem, uint32_t size)
 	store->data_qw_store = data_mem;
 	store->header_capacity = header_capacity;
 	store->data_qw_capacity = data_capacity;
+	imdd_atomic_store(&store->layer, 0);
+	store->generation = 0;
 	return store;
 }
 
@@ -344,6 +361,13 @@ void imdd_reset(imdd_shape_store_t *store)
 	// empty the store
 	imdd_atomic_store(&store->header_count, 0);
 	imdd_atomic_store(&store->data_qw_count, 0);
+	imdd_atomic_store(&store->layer, 0);
+	++store->generation;
+}
+
+void imdd_set_layer(imdd_shape_store_t *store, uint32_t layer)
+{
+	imdd_atomic_store(&store->layer, (layer < IMDD_LAYER_COUNT) ? layer : (IMDD_LAYER_COUNT - 1));
 }
 
 void imdd_reserve(
@@ -376,6 +400,7 @@ void imdd_reserve(
 	header.zmode = zmode;
 	header.blend = ((color >> 24) != 0xff) ? IMDD_BLEND_ALPHA : IMDD_BLEND_OPAQUE;
 	header.shape = shape;
+	header.layer = imdd_atomic_load(&store->layer);
 	header.data_qw_offset = data_qw_offset;
 	header.color = color;
 	store->header_store[header_offset] = header;
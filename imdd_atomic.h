@@ -7,6 +7,7 @@ typedef LONG volatile imdd_atomic_uint;
 #define imdd_atomic_store(addr, val)		InterlockedExchange(addr, val)
 #define imdd_atomic_load(addr)				InterlockedCompareExchange((imdd_atomic_uint *)addr, 0, 0)
 #define imdd_atomic_fetch_add(addr, val)	(InterlockedAdd(addr, val) - val)
+#define imdd_atomic_compare_exchange(addr, expected, desired)	(uint32_t)InterlockedCompareExchange(addr, desired, expected)
 
 #elif defined(__clang__)
 
@@ -15,6 +16,15 @@ typedef atomic_uint imdd_atomic_uint;
 #define imdd_atomic_store(addr, val)        atomic_store_explicit(addr, val, memory_order_release)
 #define imdd_atomic_load(addr)              atomic_load_explicit(addr, memory_order_acquire)
 #define imdd_atomic_fetch_add(addr, val)    atomic_fetch_add_explicit(addr, val, memory_order_relaxed)
+#define imdd_atomic_compare_exchange(addr, expected, desired)	imdd_atomic_compare_exchange_c11(addr, expected, desired)
+
+// returns the value before the exchange, like the other implementations
+static inline
+uint32_t imdd_atomic_compare_exchange_c11(imdd_atomic_uint *addr, uint32_t expected, uint32_t desired)
+{
+	atomic_compare_exchange_strong_explicit(addr, &expected, desired, memory_order_acq_rel, memory_order_acquire);
+	return expected;
+}
 
 #else
 
@@ -22,5 +32,6 @@ typedef uint32_t imdd_atomic_uint;
 #define imdd_atomic_store(addr, val)        __atomic_store_n(addr, val, __ATOMIC_RELEASE)
 #define imdd_atomic_load(addr)              __atomic_load_n(addr, __ATOMIC_ACQUIRE)
 #define imdd_atomic_fetch_add(addr, val)    __atomic_fetch_add(addr, val, __ATOMIC_RELAXED)
+#define imdd_atomic_compare_exchange(addr, expected, desired)	__sync_val_compare_and_swap(addr, expected, desired)
 
 #endif
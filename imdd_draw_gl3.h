@@ -20,30 +20,95 @@ typedef struct {
 	GLenum draw_mode;
 } imdd_gl3_mesh_buffer_t;
 
+// resize the staging memory to fit the shapes of the previous frame, using the capacities from init as the minimum
+#define IMDD_GL3_FLAG_GROW		(1 << 0)
+
+// render state for the shapes of each layer, layers are drawn in order
 typedef struct {
-	imdd_gl3_program_t instance_program[IMDD_STYLE_COUNT];
-	imdd_gl3_program_t array_program[IMDD_STYLE_COUNT];
+	float depth_bias_factor;	// for glPolygonOffset on filled shapes, unused if both are zero
+	float depth_bias_units;
+	float line_width;			// widths other than 1 are optional in core profiles
+	int additive;				// alpha blended shapes are added to the target
+} imdd_gl3_layer_t;
 
-	imdd_gl3_mesh_buffer_t mesh_buffer[IMDD_STYLE_COUNT];
+// GL buffers and batches for the shapes from one conversion
+typedef struct {
 	GLuint instance_transform_buf;
 	GLuint instance_color_buf;
-	GLuint instance_vertex_array[IMDD_STYLE_COUNT];
+	GLuint instance_vertex_array[IMDD_INSTANCE_FORMAT_COUNT][IMDD_STYLE_COUNT];
 	GLuint filled_vertex_buf;
 	GLuint filled_vertex_array;
 	GLuint wire_vertex_buf;
 	GLuint wire_vertex_array;
 
+	imdd_batch_t instance_batches[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_batch_t filled_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	imdd_batch_t wire_array_batches[IMDD_ARRAY_BATCH_COUNT];
+} imdd_gl3_output_t;
+
+// stores converted by imdd_gl3_update_cached, which are only converted again when their contents change
+#define IMDD_GL3_CACHED_STORE_COUNT		4
+
+typedef struct {
+	imdd_shape_store_t const *store;	// NULL if this slot is not drawn
+	uint32_t generation;
+	uint32_t header_count;
+	uint32_t data_qw_count;
+	int has_output;
+	imdd_gl3_output_t output;
+} imdd_gl3_cached_store_t;
+
+// stores converted between imdd_gl3_begin_update and imdd_gl3_end_update, later stores are counted in imdd_emit_stats_t::dropped_counts
+#define IMDD_GL3_MAX_SUBMISSION_COUNT	16
+
+// the part of staging memory written by one imdd_gl3_submit_stores, with batches relative to it
+typedef struct {
+	uint32_t instance_offset;
+	uint32_t instance_qw_offset;
+	uint32_t filled_vertex_offset;
+	uint32_t wire_vertex_offset;
+	imdd_batch_t instance_batches[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_batch_t filled_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	imdd_batch_t wire_array_batches[IMDD_ARRAY_BATCH_COUNT];
+} imdd_gl3_submission_t;
+
+typedef struct {
+	uint32_t flags;
+	imdd_gl3_layer_t layers[IMDD_LAYER_COUNT];	// can be changed before each draw
+
+	imdd_gl3_program_t instance_program[IMDD_INSTANCE_FORMAT_COUNT][IMDD_STYLE_COUNT];
+	imdd_gl3_program_t array_program[IMDD_STYLE_COUNT];
+
+	imdd_gl3_mesh_buffer_t mesh_buffer[IMDD_STYLE_COUNT];
+	GLuint wire_triangle_index_buf;
+	imdd_gl3_output_t frame_output;
+	imdd_gl3_cached_store_t cached_stores[IMDD_GL3_CACHED_STORE_COUNT];
+
+	imdd_emit_options_t submit_options;
+	imdd_emit_stats_t submit_stats;
+	imdd_gl3_submission_t submissions[IMDD_GL3_MAX_SUBMISSION_COUNT];
+	uint32_t submission_count;
+	uint32_t submit_instance_count;
+	uint32_t submit_instance_qw_count;
+	uint32_t submit_filled_vertex_count;
+	uint32_t submit_wire_vertex_count;
+
+	imdd_emit_scratch_t emit_scratch;			// used when the options have no scratch, conversions are one at a time
+	imdd_scheduler_t const *async_scheduler;	// set by imdd_gl3_set_async_scheduler
+	imdd_shape_store_t const *const *async_stores;
+	uint32_t async_store_count;
+	int async_pending;
+
 	imdd_instance_transform_t *instance_transform_staging;
 	imdd_instance_color_t *instance_color_staging;
 	uint32_t instance_capacity;
-	imdd_array_filled_vertex_t *filled_vertex_staging;
+	imdd_array_flat_vertex_t *filled_vertex_staging;
 	uint32_t filled_vertex_capacity;
 	imdd_array_wire_vertex_t *wire_vertex_staging;
 	uint32_t wire_vertex_capacity;
-
-	imdd_batch_t instance_batches[IMDD_INSTANCE_BATCH_COUNT];
-	imdd_batch_t filled_array_batches[IMDD_ARRAY_BATCH_COUNT];
-	imdd_batch_t wire_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	imdd_capacity_tracker_t instance_tracker;
+	imdd_capacity_tracker_t filled_vertex_tracker;
+	imdd_capacity_tracker_t wire_vertex_tracker;
 } imdd_gl3_context_t;
 
 static
@@ -154,110 +219,156 @@ void imdd_gl3_init_mesh_buffer(imdd_gl3_context_t *ctx, imdd_style_enum_t style)
 	mesh_buffer->draw_mode = (style == IMDD_STYLE_FILLED) ? GL_TRIANGLES : GL_LINES;
 }
 
+// instance data for a format starts qw_bias imdd_v4 into the transform buffer, expects the vertex array to be bound
 static
-void imdd_gl3_init_filled_instance_buffer(imdd_gl3_context_t *ctx)
+void imdd_gl3_set_instance_data_pointers(imdd_gl3_output_t const *output, imdd_instance_format_enum_t format, uint32_t qw_bias)
 {
-	imdd_gl3_mesh_buffer_t *const mesh_buffer = &ctx->mesh_buffer[IMDD_STYLE_FILLED];
-	GLuint *const vertex_array = &ctx->instance_vertex_array[IMDD_STYLE_FILLED];
+	uint32_t const qw_size = g_imdd_instance_format_qw_size[format];
+	glBindBuffer(GL_ARRAY_BUFFER, output->instance_transform_buf);
+	for (uint32_t i = 0; i < qw_size; ++i) {
+		glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, qw_size*sizeof(imdd_v4), (void *)(sizeof(imdd_v4)*(qw_bias + i)));
+	}
+}
 
-	imdd_gl3_init_mesh_buffer(ctx, IMDD_STYLE_FILLED);
+static
+void imdd_gl3_init_instance_vertex_array(imdd_gl3_context_t *ctx, imdd_gl3_output_t *output, imdd_instance_format_enum_t format, imdd_style_enum_t style)
+{
+	imdd_gl3_mesh_buffer_t *const mesh_buffer = &ctx->mesh_buffer[style];
+	GLuint *const vertex_array = &output->instance_vertex_array[format][style];
+	uint32_t const qw_size = g_imdd_instance_format_qw_size[format];
 
 	glGenVertexArrays(1, vertex_array);
 	glBindVertexArray(*vertex_array);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->instance_transform_buf);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(imdd_instance_transform_t), (void *)offsetof(imdd_instance_transform_t, row0));
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(imdd_instance_transform_t), (void *)offsetof(imdd_instance_transform_t, row1));
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(imdd_instance_transform_t), (void *)offsetof(imdd_instance_transform_t, row2));
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->instance_color_buf);
+	imdd_gl3_set_instance_data_pointers(output, format, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, output->instance_color_buf);
 	glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(imdd_instance_color_t), 0);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer->vertex_buf);
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_mesh_filled_vertex_t), (void *)offsetof(imdd_mesh_filled_vertex_t, pos));
-	glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_mesh_filled_vertex_t), (void *)offsetof(imdd_mesh_filled_vertex_t, normal));
+	if (style == IMDD_STYLE_FILLED) {
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_mesh_filled_vertex_t), (void *)offsetof(imdd_mesh_filled_vertex_t, pos));
+		glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_mesh_filled_vertex_t), (void *)offsetof(imdd_mesh_filled_vertex_t, normal));
+		glEnableVertexAttribArray(5);
+	} else {
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_mesh_wire_vertex_t), (void *)offsetof(imdd_mesh_wire_vertex_t, pos));
+	}
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_buffer->index_buf);
-	for (uint32_t i = 0; i < 6; ++i) {
+	for (uint32_t i = 0; i < qw_size; ++i) {
 		glEnableVertexAttribArray(i);
-	}
-	for (uint32_t i = 0; i < 4; ++i) {
 		glVertexAttribDivisor(i, 1);
 	}
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(4);
 	glBindVertexArray(0);
 }
 
 static
-void imdd_gl3_init_wire_instance_buffer(imdd_gl3_context_t *ctx)
+void imdd_gl3_init_filled_array_buffer(imdd_gl3_output_t *output)
 {
-	imdd_gl3_mesh_buffer_t *const mesh_buffer = &ctx->mesh_buffer[IMDD_STYLE_WIRE];
-	GLuint *const vertex_array = &ctx->instance_vertex_array[IMDD_STYLE_WIRE];
+	glGenBuffers(1, &output->filled_vertex_buf);
+	glGenVertexArrays(1, &output->filled_vertex_array);
 
-	imdd_gl3_init_mesh_buffer(ctx, IMDD_STYLE_WIRE);
-
-	glGenVertexArrays(1, vertex_array);
-	glBindVertexArray(*vertex_array);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->instance_transform_buf);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(imdd_instance_transform_t), (void *)offsetof(imdd_instance_transform_t, row0));
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(imdd_instance_transform_t), (void *)offsetof(imdd_instance_transform_t, row1));
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(imdd_instance_transform_t), (void *)offsetof(imdd_instance_transform_t, row2));
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->instance_color_buf);
-	glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(imdd_instance_color_t), 0);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer->vertex_buf);
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_mesh_wire_vertex_t), (void *)offsetof(imdd_mesh_wire_vertex_t, pos));
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_buffer->index_buf);
-	for (uint32_t i = 0; i < 5; ++i) {
+	glBindVertexArray(output->filled_vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, output->filled_vertex_buf);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_array_flat_vertex_t), (void *)0);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(imdd_array_flat_vertex_t), (void *)(3*sizeof(float)));
+	for (uint32_t i = 0; i < 2; ++i) {
 		glEnableVertexAttribArray(i);
 	}
-	for (uint32_t i = 0; i < 4; ++i) {
-		glVertexAttribDivisor(i, 1);
-	}
 	glBindVertexArray(0);
 }
 
 static
-void imdd_gl3_init_filled_array_buffer(imdd_gl3_context_t *ctx)
+void imdd_gl3_init_wire_triangle_index_buffer(imdd_gl3_context_t *ctx)
 {
-	glGenBuffers(1, &ctx->filled_vertex_buf);
-	glGenVertexArrays(1, &ctx->filled_vertex_array);
+	uint16_t *const indices = (uint16_t *)malloc(IMDD_WIRE_TRIANGLE_INDEX_COUNT*sizeof(uint16_t));
+	imdd_wire_triangle_indices_write(indices);
 
-	glBindVertexArray(ctx->filled_vertex_array);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->filled_vertex_buf);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_array_filled_vertex_t), (void *)0);
-	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(imdd_array_filled_vertex_t), (void *)(3*sizeof(float)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_array_filled_vertex_t), (void *)(sizeof(imdd_v4)));
-	for (uint32_t i = 0; i < 3; ++i) {
-		glEnableVertexAttribArray(i);
-	}
-	glBindVertexArray(0);
+	glGenBuffers(1, &ctx->wire_triangle_index_buf);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->wire_triangle_index_buf);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, IMDD_WIRE_TRIANGLE_INDEX_COUNT*sizeof(uint16_t), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	free(indices);
 }
 
 static
-void imdd_gl3_init_wire_array_buffer(imdd_gl3_context_t *ctx)
+void imdd_gl3_init_wire_array_buffer(imdd_gl3_context_t *ctx, imdd_gl3_output_t *output)
 {
-	glGenBuffers(1, &ctx->wire_vertex_buf);
-	glGenVertexArrays(1, &ctx->wire_vertex_array);
+	glGenBuffers(1, &output->wire_vertex_buf);
+	glGenVertexArrays(1, &output->wire_vertex_array);
 
-	glBindVertexArray(ctx->wire_vertex_array);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->wire_vertex_buf);
+	glBindVertexArray(output->wire_vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, output->wire_vertex_buf);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(imdd_array_wire_vertex_t), (void *)0);
 	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(imdd_array_wire_vertex_t), (void *)(3*sizeof(float)));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->wire_triangle_index_buf);
 	for (uint32_t i = 0; i < 2; ++i) {
 		glEnableVertexAttribArray(i);
 	}
 	glBindVertexArray(0);
 }
 
+// creates the buffers and vertex arrays to draw one conversion, once the mesh buffers exist
+static
+void imdd_gl3_init_output(imdd_gl3_context_t *ctx, imdd_gl3_output_t *output)
+{
+	glGenBuffers(1, &output->instance_transform_buf);
+	glGenBuffers(1, &output->instance_color_buf);
+	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
+		for (imdd_instance_format_enum_t format = (imdd_instance_format_enum_t)0; format < IMDD_INSTANCE_FORMAT_COUNT; format = (imdd_instance_format_enum_t)(format + 1)) {
+			imdd_gl3_init_instance_vertex_array(ctx, output, format, style);
+		}
+	}
+	imdd_gl3_init_filled_array_buffer(output);
+	imdd_gl3_init_wire_array_buffer(ctx, output);
+	memset(output->instance_batches, 0, sizeof(output->instance_batches));
+	memset(output->filled_array_batches, 0, sizeof(output->filled_array_batches));
+	memset(output->wire_array_batches, 0, sizeof(output->wire_array_batches));
+}
+
 #define IMDD_GL3_QUOTE(...) "#version 330\n" #__VA_ARGS__
 
 void imdd_gl3_init(
 	imdd_gl3_context_t *ctx,
 	uint32_t shape_capacity,
 	uint32_t triangle_capacity,
-	uint32_t line_capacity)
+	uint32_t line_capacity,
+	uint32_t flags)
 {
 	uint32_t const instance_capacity = shape_capacity;
 	uint32_t const filled_vertex_capacity = 3*triangle_capacity;
 	uint32_t const wire_vertex_capacity = 2*line_capacity;
+	ctx->flags = flags;
+	for (uint32_t layer = 0; layer < IMDD_LAYER_COUNT; ++layer) {
+		ctx->layers[layer].depth_bias_factor = 0.f;
+		ctx->layers[layer].depth_bias_units = 0.f;
+		ctx->layers[layer].line_width = 1.f;
+		ctx->layers[layer].additive = 0;
+	}
+
+	// instance programs for each format share the same fragment shaders
+	char const *const instance_filled_fs = IMDD_GL3_QUOTE(
+		in vec3 v_nvec_ws;
+		in vec4 v_col;
+		out vec4 o_col;
+		void main(void)
+		{
+			vec3 normal_ws = normalize(v_nvec_ws);
+			vec3 light_dir_ws = normalize(vec3(1.0, 2.0, 0.5));
+
+			float n_dot_l = dot(normal_ws, light_dir_ws);
+			o_col = vec4(v_col.xyz*(0.5 + 0.45*n_dot_l), v_col.w);
+		});
+	char const *const instance_wire_fs = IMDD_GL3_QUOTE(
+		in vec4 v_col;
+		out vec4 o_col;
+		void main(void)
+		{
+			o_col = v_col;
+		});
 
 	imdd_gl3_create_program(
-		&ctx->instance_program[IMDD_STYLE_FILLED],
+		&ctx->instance_program[IMDD_INSTANCE_FORMAT_TRANSFORM][IMDD_STYLE_FILLED],
 		IMDD_GL3_QUOTE(
 		uniform mat4 g_proj_from_world;
 		layout (location = 0) in vec4 a_world0;
@@ -280,21 +391,10 @@ void imdd_gl3_init(
 			v_nvec_ws = nvec_ws;
 			v_col = a_col;
 		}),
-		IMDD_GL3_QUOTE(
-		in vec3 v_nvec_ws;
-		in vec4 v_col;
-		out vec4 o_col;
-		void main(void)
-		{
-			vec3 normal_ws = normalize(v_nvec_ws);
-			vec3 light_dir_ws = normalize(vec3(1.0, 2.0, 0.5));
-
-			float n_dot_l = dot(normal_ws, light_dir_ws);
-			o_col = vec4(v_col.xyz*(0.5 + 0.45*n_dot_l), v_col.w);
-		}));
+		instance_filled_fs);
 
 	imdd_gl3_create_program(
-		&ctx->instance_program[IMDD_STYLE_WIRE],
+		&ctx->instance_program[IMDD_INSTANCE_FORMAT_TRANSFORM][IMDD_STYLE_WIRE],
 		IMDD_GL3_QUOTE(
 		uniform mat4 g_proj_from_world;
 		layout (location = 0) in vec4 a_world0;
@@ -311,13 +411,86 @@ void imdd_gl3_init(
 			gl_Position = g_proj_from_world*vec4(pos_ws, 1.0);
 			v_col = a_col;
 		}),
+		instance_wire_fs);
+
+	imdd_gl3_create_program(
+		&ctx->instance_program[IMDD_INSTANCE_FORMAT_BOX][IMDD_STYLE_FILLED],
 		IMDD_GL3_QUOTE(
-		in vec4 v_col;
-		out vec4 o_col;
+		uniform mat4 g_proj_from_world;
+		layout (location = 0) in vec4 a_centre;
+		layout (location = 1) in vec4 a_half_extent;
+		layout (location = 3) in vec4 a_col;
+		layout (location = 4) in vec3 a_pos_ls;
+		layout (location = 5) in vec3 a_normal_ls;
+		out vec3 v_nvec_ws;
+		out vec4 v_col;
 		void main(void)
 		{
-			o_col = v_col;
-		}));
+			vec3 pos_ws = a_centre.xyz + a_half_extent.xyz*a_pos_ls;
+
+			// inverse transpose of the scale, multiplied through by its determinant
+			vec3 nvec_ws = a_half_extent.yzx*a_half_extent.zxy*a_normal_ls;
+
+			gl_Position = g_proj_from_world*vec4(pos_ws, 1.0);
+			v_nvec_ws = nvec_ws;
+			v_col = a_col;
+		}),
+		instance_filled_fs);
+
+	imdd_gl3_create_program(
+		&ctx->instance_program[IMDD_INSTANCE_FORMAT_BOX][IMDD_STYLE_WIRE],
+		IMDD_GL3_QUOTE(
+		uniform mat4 g_proj_from_world;
+		layout (location = 0) in vec4 a_centre;
+		layout (location = 1) in vec4 a_half_extent;
+		layout (location = 3) in vec4 a_col;
+		layout (location = 4) in vec3 a_pos_ls;
+		out vec4 v_col;
+		void main(void)
+		{
+			vec3 pos_ws = a_centre.xyz + a_half_extent.xyz*a_pos_ls;
+
+			gl_Position = g_proj_from_world*vec4(pos_ws, 1.0);
+			v_col = a_col;
+		}),
+		instance_wire_fs);
+
+	imdd_gl3_create_program(
+		&ctx->instance_program[IMDD_INSTANCE_FORMAT_SPHERE][IMDD_STYLE_FILLED],
+		IMDD_GL3_QUOTE(
+		uniform mat4 g_proj_from_world;
+		layout (location = 0) in vec4 a_centre_radius;
+		layout (location = 3) in vec4 a_col;
+		layout (location = 4) in vec3 a_pos_ls;
+		layout (location = 5) in vec3 a_normal_ls;
+		out vec3 v_nvec_ws;
+		out vec4 v_col;
+		void main(void)
+		{
+			vec3 pos_ws = a_centre_radius.xyz + a_centre_radius.w*a_pos_ls;
+
+			gl_Position = g_proj_from_world*vec4(pos_ws, 1.0);
+			v_nvec_ws = a_normal_ls;
+			v_col = a_col;
+		}),
+		instance_filled_fs);
+
+	imdd_gl3_create_program(
+		&ctx->instance_program[IMDD_INSTANCE_FORMAT_SPHERE][IMDD_STYLE_WIRE],
+		IMDD_GL3_QUOTE(
+		uniform mat4 g_proj_from_world;
+		layout (location = 0) in vec4 a_centre_radius;
+		layout (location = 3) in vec4 a_col;
+		layout (location = 4) in vec3 a_pos_ls;
+		out vec4 v_col;
+		void main(void)
+		{
+			vec3 pos_ws = a_centre_radius.xyz + a_centre_radius.w*a_pos_ls;
+
+			gl_Position = g_proj_from_world*vec4(pos_ws, 1.0);
+			v_col = a_col;
+		}),
+		instance_wire_fs);
 
 	imdd_gl3_create_program(
 		&ctx->array_program[IMDD_STYLE_FILLED],
@@ -325,22 +498,23 @@ void imdd_gl3_init(
 		uniform mat4 g_proj_from_world;
 		layout (location = 0) in vec3 a_pos_ws;
 		layout (location = 1) in vec4 a_col;
-		layout (location = 2) in vec3 a_normal_ws;
-		out vec3 v_nvec_ws;
+		out vec3 v_pos_ws;
 		out vec4 v_col;
 		void main(void)
 		{
 			gl_Position = g_proj_from_world*vec4(a_pos_ws, 1.0);
-			v_nvec_ws = a_normal_ws;
+			v_pos_ws = a_pos_ws;
 			v_col = a_col;
 		}),
 		IMDD_GL3_QUOTE(
-		in vec3 v_nvec_ws;
+		in vec3 v_pos_ws;
 		in vec4 v_col;
 		out vec4 o_col;
 		void main(void)
 		{
-			vec3 normal_ws = normalize(v_nvec_ws);
+			// triangles are flat, so get the normal from screen-space derivatives, facing the same way as the winding
+			vec3 nvec_ws = cross(dFdx(v_pos_ws), dFdy(v_pos_ws));
+			vec3 normal_ws = normalize(gl_FrontFacing ? nvec_ws : -nvec_ws);
 			vec3 light_dir_ws = normalize(vec3(1.0, 2.0, 0.5));
 
 			float n_dot_l = dot(normal_ws, light_dir_ws);
@@ -367,156 +541,765 @@ void imdd_gl3_init(
 			o_col = v_col;
 		}));
 
-	glGenBuffers(1, &ctx->instance_transform_buf);
-	glGenBuffers(1, &ctx->instance_color_buf);
-	imdd_gl3_init_filled_instance_buffer(ctx);
-	imdd_gl3_init_wire_instance_buffer(ctx);
-	imdd_gl3_init_filled_array_buffer(ctx);
-	imdd_gl3_init_wire_array_buffer(ctx);
+	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
+		imdd_gl3_init_mesh_buffer(ctx, style);
+	}
+	imdd_gl3_init_wire_triangle_index_buffer(ctx);
+	imdd_gl3_init_output(ctx, &ctx->frame_output);
+
+	// cached stores get buffers when first used
+	memset(ctx->cached_stores, 0, sizeof(ctx->cached_stores));
+	ctx->submission_count = 0;
+	ctx->async_scheduler = NULL;
+	ctx->async_pending = 0;
+
+	// enough to split conversion between as many threads as it can use
+	ctx->emit_scratch.size = imdd_emit_scratch_size(IMDD_EMIT_MAX_CHUNK_COUNT, 0);
+	ctx->emit_scratch.memory = malloc(ctx->emit_scratch.size);
 
 	ctx->instance_transform_staging = (imdd_instance_transform_t *)malloc(sizeof(imdd_instance_transform_t)*instance_capacity);
 	ctx->instance_color_staging = (imdd_instance_color_t *)malloc(sizeof(imdd_instance_color_t)*instance_capacity);
 	ctx->instance_capacity = instance_capacity;
-	ctx->filled_vertex_staging = (imdd_array_filled_vertex_t *)malloc(sizeof(imdd_array_filled_vertex_t)*filled_vertex_capacity);
+	ctx->filled_vertex_staging = (imdd_array_flat_vertex_t *)malloc(sizeof(imdd_array_flat_vertex_t)*filled_vertex_capacity);
 	ctx->filled_vertex_capacity = filled_vertex_capacity;
 	ctx->wire_vertex_staging = (imdd_array_wire_vertex_t *)malloc(sizeof(imdd_array_wire_vertex_t)*wire_vertex_capacity);
 	ctx->wire_vertex_capacity = wire_vertex_capacity;
+	imdd_capacity_tracker_init(&ctx->instance_tracker, instance_capacity);
+	imdd_capacity_tracker_init(&ctx->filled_vertex_tracker, filled_vertex_capacity);
+	imdd_capacity_tracker_init(&ctx->wire_vertex_tracker, wire_vertex_capacity);
 }
 
-void imdd_gl3_update(
+// grows staging memory to at least the required counts, the contents are not kept
+static
+void imdd_gl3_reserve_staging(imdd_gl3_context_t *ctx, imdd_emit_stats_t const *stats)
+{
+	if (stats->required_instance_count > ctx->instance_capacity) {
+		free(ctx->instance_transform_staging);
+		free(ctx->instance_color_staging);
+		ctx->instance_capacity = stats->required_instance_count;
+		ctx->instance_transform_staging = (imdd_instance_transform_t *)malloc(sizeof(imdd_instance_transform_t)*ctx->instance_capacity);
+		ctx->instance_color_staging = (imdd_instance_color_t *)malloc(sizeof(imdd_instance_color_t)*ctx->instance_capacity);
+	}
+	if (stats->required_filled_vertex_count > ctx->filled_vertex_capacity) {
+		free(ctx->filled_vertex_staging);
+		ctx->filled_vertex_capacity = stats->required_filled_vertex_count;
+		ctx->filled_vertex_staging = (imdd_array_flat_vertex_t *)malloc(sizeof(imdd_array_flat_vertex_t)*ctx->filled_vertex_capacity);
+	}
+	if (stats->required_wire_vertex_count > ctx->wire_vertex_capacity) {
+		free(ctx->wire_vertex_staging);
+		ctx->wire_vertex_capacity = stats->required_wire_vertex_count;
+		ctx->wire_vertex_staging = (imdd_array_wire_vertex_t *)malloc(sizeof(imdd_array_wire_vertex_t)*ctx->wire_vertex_capacity);
+	}
+}
+
+// reallocates staging memory for the next frame, the contents are not kept
+static
+void imdd_gl3_resize_staging(imdd_gl3_context_t *ctx, imdd_emit_stats_t const *stats)
+{
+	uint32_t const instance_capacity = imdd_capacity_tracker_update(&ctx->instance_tracker, ctx->instance_capacity, stats->required_instance_count);
+	if (instance_capacity != ctx->instance_capacity) {
+		free(ctx->instance_transform_staging);
+		free(ctx->instance_color_staging);
+		ctx->instance_transform_staging = (imdd_instance_transform_t *)malloc(sizeof(imdd_instance_transform_t)*instance_capacity);
+		ctx->instance_color_staging = (imdd_instance_color_t *)malloc(sizeof(imdd_instance_color_t)*instance_capacity);
+		ctx->instance_capacity = instance_capacity;
+	}
+	uint32_t const filled_vertex_capacity = imdd_capacity_tracker_update(&ctx->filled_vertex_tracker, ctx->filled_vertex_capacity, stats->required_filled_vertex_count);
+	if (filled_vertex_capacity != ctx->filled_vertex_capacity) {
+		free(ctx->filled_vertex_staging);
+		ctx->filled_vertex_staging = (imdd_array_flat_vertex_t *)malloc(sizeof(imdd_array_flat_vertex_t)*filled_vertex_capacity);
+		ctx->filled_vertex_capacity = filled_vertex_capacity;
+	}
+	uint32_t const wire_vertex_capacity = imdd_capacity_tracker_update(&ctx->wire_vertex_tracker, ctx->wire_vertex_capacity, stats->required_wire_vertex_count);
+	if (wire_vertex_capacity != ctx->wire_vertex_capacity) {
+		free(ctx->wire_vertex_staging);
+		ctx->wire_vertex_staging = (imdd_array_wire_vertex_t *)malloc(sizeof(imdd_array_wire_vertex_t)*wire_vertex_capacity);
+		ctx->wire_vertex_capacity = wire_vertex_capacity;
+	}
+}
+
+// compact instances follow the transforms, at offsets that depend on the batches of the output
+static
+void imdd_gl3_set_compact_data_pointers(imdd_gl3_output_t const *output)
+{
+	for (imdd_instance_format_enum_t format = IMDD_INSTANCE_FORMAT_BOX; format < IMDD_INSTANCE_FORMAT_COUNT; format = (imdd_instance_format_enum_t)(format + 1)) {
+		uint32_t const qw_bias = imdd_instance_format_qw_bias(output->instance_batches, format);
+		for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
+			glBindVertexArray(output->instance_vertex_array[format][style]);
+			imdd_gl3_set_instance_data_pointers(output, format, qw_bias);
+		}
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// uploads the shapes in staging memory to the GL vertex buffers of an output
+static
+void imdd_gl3_upload(
+	imdd_gl3_context_t *ctx,
+	imdd_gl3_output_t *output,
+	uint32_t instance_count,
+	uint32_t filled_vertex_count,
+	uint32_t wire_vertex_count,
+	GLenum usage)
+{
+	// upload to GL vertex buffers (consoles would emit directly into graphics memory)
+	glBindBuffer(GL_ARRAY_BUFFER, output->instance_transform_buf);
+	glBufferData(GL_ARRAY_BUFFER, imdd_instance_qw_count(output->instance_batches, instance_count)*sizeof(imdd_v4), ctx->instance_transform_staging, usage);
+	glBindBuffer(GL_ARRAY_BUFFER, output->instance_color_buf);
+	glBufferData(GL_ARRAY_BUFFER, instance_count*sizeof(imdd_instance_color_t), ctx->instance_color_staging, usage);
+	glBindBuffer(GL_ARRAY_BUFFER, output->filled_vertex_buf);
+	glBufferData(GL_ARRAY_BUFFER, filled_vertex_count*sizeof(imdd_array_flat_vertex_t), ctx->filled_vertex_staging, usage);
+	glBindBuffer(GL_ARRAY_BUFFER, output->wire_vertex_buf);
+	glBufferData(GL_ARRAY_BUFFER, wire_vertex_count*sizeof(imdd_array_wire_vertex_t), ctx->wire_vertex_staging, usage);
+	imdd_gl3_set_compact_data_pointers(output);
+}
+
+// converts shapes into staging memory for the frame, uploading them unless streaming (when flush uploads each window instead)
+static
+void imdd_gl3_emit(
 	imdd_gl3_context_t *ctx,
 	imdd_shape_store_t const *const *stores,
-	uint32_t store_count)
+	uint32_t store_count,
+	imdd_emit_options_t const *options,
+	imdd_emit_stream_t const *stream,
+	uint32_t *instance_count,
+	uint32_t *filled_vertex_count,
+	uint32_t *wire_vertex_count)
 {
+	// when growing, make sure there are stats to read the required counts from
+	imdd_emit_options_t emit_options;
+	imdd_emit_stats_t stats;
+	if (options) {
+		emit_options = *options;
+	} else {
+		memset(&emit_options, 0, sizeof(emit_options));
+	}
+	if ((ctx->flags & IMDD_GL3_FLAG_GROW) && !emit_options.stats) {
+		emit_options.stats = &stats;
+	}
+	emit_options.layout = NULL;		// we always draw from our own buffers
+	emit_options.stream = stream;
+	if (!emit_options.scratch) {
+		emit_options.scratch = &ctx->emit_scratch;
+	}
+
+	// boxes and spheres are drawn from compact instances, triangle normals are computed in the fragment shader,
+	// and wire triangles are drawn with an index buffer
+	emit_options.flags |= IMDD_EMIT_FLAG_COMPACT_INSTANCES | IMDD_EMIT_FLAG_FLAT_TRIANGLES | IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES;
+
 	// partition our memory between shapes based on usage, emit all the shapes into it
-	uint32_t instance_count = 0;
-	uint32_t filled_vertex_count = 0;
-	uint32_t wire_vertex_count = 0;
 	imdd_emit_shapes(
 		stores,
 		store_count,
 		ctx->instance_transform_staging,
 		ctx->instance_color_staging,
 		ctx->instance_capacity,
-		ctx->instance_batches,
-		&instance_count,
-		ctx->filled_vertex_staging,
+		ctx->frame_output.instance_batches,
+		instance_count,
+		(imdd_array_filled_vertex_t *)ctx->filled_vertex_staging,
 		ctx->filled_vertex_capacity,
-		ctx->filled_array_batches,
-		&filled_vertex_count,
+		ctx->frame_output.filled_array_batches,
+		filled_vertex_count,
 		ctx->wire_vertex_staging,
 		ctx->wire_vertex_capacity,
-		ctx->wire_array_batches,
-		&wire_vertex_count);
+		ctx->frame_output.wire_array_batches,
+		wire_vertex_count,
+		&emit_options);
+	if (!stream) {
+		imdd_gl3_upload(ctx, &ctx->frame_output, *instance_count, *filled_vertex_count, *wire_vertex_count, GL_STREAM_DRAW);
+	}
 
-	// upload to GL vertex buffers (consoles would emit directly into graphics memory)
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->instance_transform_buf);
-	glBufferData(GL_ARRAY_BUFFER, instance_count*sizeof(imdd_instance_transform_t), ctx->instance_transform_staging, GL_STREAM_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->instance_color_buf);
-	glBufferData(GL_ARRAY_BUFFER, instance_count*sizeof(imdd_instance_color_t), ctx->instance_color_staging, GL_STREAM_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->filled_vertex_buf);
-	glBufferData(GL_ARRAY_BUFFER, filled_vertex_count*sizeof(imdd_array_filled_vertex_t), ctx->filled_vertex_staging, GL_STREAM_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, ctx->wire_vertex_buf);
-	glBufferData(GL_ARRAY_BUFFER, wire_vertex_count*sizeof(imdd_array_wire_vertex_t), ctx->wire_vertex_staging, GL_STREAM_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// GL buffers are sized by each upload, so only staging memory needs to fit the next frame
+	if (ctx->flags & IMDD_GL3_FLAG_GROW) {
+		imdd_gl3_resize_staging(ctx, emit_options.stats);
+	}
+}
+
+/*
+	Stores that are finished at different times can be converted as each one
+	is ready, instead of waiting for all of them as imdd_gl3_update does.
+	After imdd_gl3_begin_update, each call to imdd_gl3_submit_stores converts
+	its stores straight away into the staging memory left by previous calls.
+	It makes no GL calls, so can run on any thread (one at a time) while the
+	rest of the frame is still being built.  imdd_gl3_end_update then joins
+	the batches of every submission and uploads each part to its place in
+	the joined batches, so each batch draws its shapes in submission order.
+
+	Alpha blended shapes are only sorted within each submission, views,
+	bounds and layouts from the options are not used, and stats are written
+	by imdd_gl3_end_update.  Not for use with an async scheduler.
+*/
+void imdd_gl3_begin_update(imdd_gl3_context_t *ctx, imdd_emit_options_t const *options)
+{
+	if (options) {
+		ctx->submit_options = *options;
+	} else {
+		memset(&ctx->submit_options, 0, sizeof(ctx->submit_options));
+	}
+	ctx->submit_options.views = NULL;
+	ctx->submit_options.bounds = NULL;
+	ctx->submit_options.layout = NULL;
+	ctx->submit_options.stream = NULL;
+	if (!ctx->submit_options.scratch) {
+		ctx->submit_options.scratch = &ctx->emit_scratch;
+	}
+	ctx->submit_options.flags |= IMDD_EMIT_FLAG_COMPACT_INSTANCES | IMDD_EMIT_FLAG_FLAT_TRIANGLES | IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES;
+	memset(&ctx->submit_stats, 0, sizeof(ctx->submit_stats));
+
+	ctx->submission_count = 0;
+	ctx->submit_instance_count = 0;
+	ctx->submit_instance_qw_count = 0;
+	ctx->submit_filled_vertex_count = 0;
+	ctx->submit_wire_vertex_count = 0;
+}
+
+void imdd_gl3_submit_stores(
+	imdd_gl3_context_t *ctx,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count)
+{
+	if (ctx->submission_count == IMDD_GL3_MAX_SUBMISSION_COUNT) {
+		imdd_emit_count_dropped(&ctx->submit_stats, stores, store_count);
+		return;
+	}
+	imdd_gl3_submission_t *const submission = &ctx->submissions[ctx->submission_count++];
+	submission->instance_offset = ctx->submit_instance_count;
+	submission->instance_qw_offset = ctx->submit_instance_qw_count;
+	submission->filled_vertex_offset = ctx->submit_filled_vertex_count;
+	submission->wire_vertex_offset = ctx->submit_wire_vertex_count;
+
+	// transforms use at most IMDD_INSTANCE_TRANSFORM_QW_SIZE per instance, so fit whenever the colors do
+	imdd_emit_options_t emit_options = ctx->submit_options;
+	imdd_emit_stats_t stats;
+	emit_options.stats = &stats;
+	uint32_t instance_count = 0;
+	uint32_t filled_vertex_count = 0;
+	uint32_t wire_vertex_count = 0;
+	imdd_emit_shapes(
+		stores,
+		store_count,
+		(imdd_instance_transform_t *)((imdd_v4 *)ctx->instance_transform_staging + submission->instance_qw_offset),
+		ctx->instance_color_staging + submission->instance_offset,
+		ctx->instance_capacity - submission->instance_offset,
+		submission->instance_batches,
+		&instance_count,
+		(imdd_array_filled_vertex_t *)(ctx->filled_vertex_staging + submission->filled_vertex_offset),
+		ctx->filled_vertex_capacity - submission->filled_vertex_offset,
+		submission->filled_array_batches,
+		&filled_vertex_count,
+		ctx->wire_vertex_staging + submission->wire_vertex_offset,
+		ctx->wire_vertex_capacity - submission->wire_vertex_offset,
+		submission->wire_array_batches,
+		&wire_vertex_count,
+		&emit_options);
+	ctx->submit_instance_count += instance_count;
+	ctx->submit_instance_qw_count += imdd_instance_qw_count(submission->instance_batches, instance_count);
+	ctx->submit_filled_vertex_count += filled_vertex_count;
+	ctx->submit_wire_vertex_count += wire_vertex_count;
+
+	// submissions share staging memory, so the space they need adds up
+	for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+		ctx->submit_stats.culled_counts[shape] += stats.culled_counts[shape];
+		ctx->submit_stats.small_counts[shape] += stats.small_counts[shape];
+		ctx->submit_stats.duplicate_counts[shape] += stats.duplicate_counts[shape];
+	}
+	ctx->submit_stats.required_instance_count += stats.required_instance_count;
+	ctx->submit_stats.required_filled_vertex_count += stats.required_filled_vertex_count;
+	ctx->submit_stats.required_wire_vertex_count += stats.required_wire_vertex_count;
+}
+
+// sets each batch to cover the same batch of every submission in turn
+static
+void imdd_gl3_join_batches(
+	imdd_gl3_submission_t const *submissions,
+	uint32_t submission_count,
+	size_t batches_offset,
+	uint32_t batch_count,
+	imdd_batch_t *batches)
+{
+	uint32_t end_offset = 0;
+	for (uint32_t batch_index = 0; batch_index < batch_count; ++batch_index) {
+		batches[batch_index].offset = end_offset;
+		for (uint32_t submission_index = 0; submission_index < submission_count; ++submission_index) {
+			uint8_t const *const submission = (uint8_t const *)&submissions[submission_index];
+			end_offset += ((imdd_batch_t const *)(submission + batches_offset))[batch_index].count;
+		}
+		batches[batch_index].count = end_offset - batches[batch_index].offset;
+	}
+}
+
+// uploads the elements of every submission to their place in the joined batches
+static
+void imdd_gl3_upload_joined(
+	GLuint buf,
+	uint32_t element_count,
+	uint32_t element_size,
+	void const *staging,
+	imdd_gl3_submission_t const *submissions,
+	uint32_t submission_count,
+	size_t element_offset_offset,
+	size_t batches_offset,
+	uint32_t batch_count,
+	imdd_batch_t const *batches)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buf);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)element_count*element_size, NULL, GL_STREAM_DRAW);
+	for (uint32_t batch_index = 0; batch_index < batch_count; ++batch_index) {
+		uint32_t dst_offset = batches[batch_index].offset;
+		for (uint32_t submission_index = 0; submission_index < submission_count; ++submission_index) {
+			uint8_t const *const submission = (uint8_t const *)&submissions[submission_index];
+			imdd_batch_t const src = ((imdd_batch_t const *)(submission + batches_offset))[batch_index];
+			if (src.count == 0) {
+				continue;
+			}
+			uint32_t const src_offset = *(uint32_t const *)(submission + element_offset_offset) + src.offset;
+			glBufferSubData(
+				GL_ARRAY_BUFFER,
+				(GLintptr)dst_offset*element_size,
+				(GLsizeiptr)src.count*element_size,
+				(uint8_t const *)staging + (size_t)src_offset*element_size);
+			dst_offset += src.count;
+		}
+	}
+}
+
+// joins the batches of every submission into the output and uploads each part to where it belongs
+static
+void imdd_gl3_upload_submissions(imdd_gl3_context_t *ctx, imdd_gl3_output_t *output)
+{
+	imdd_gl3_submission_t const *const submissions = ctx->submissions;
+	uint32_t const submission_count = ctx->submission_count;
+	imdd_gl3_join_batches(submissions, submission_count, offsetof(imdd_gl3_submission_t, instance_batches), IMDD_INSTANCE_BATCH_COUNT, output->instance_batches);
+	imdd_gl3_join_batches(submissions, submission_count, offsetof(imdd_gl3_submission_t, filled_array_batches), IMDD_ARRAY_BATCH_COUNT, output->filled_array_batches);
+	imdd_gl3_join_batches(submissions, submission_count, offsetof(imdd_gl3_submission_t, wire_array_batches), IMDD_ARRAY_BATCH_COUNT, output->wire_array_batches);
+
+	// transforms have a size and bias that depend on the format of each batch
+	glBindBuffer(GL_ARRAY_BUFFER, output->instance_transform_buf);
+	glBufferData(GL_ARRAY_BUFFER, imdd_instance_qw_count(output->instance_batches, ctx->submit_instance_count)*sizeof(imdd_v4), NULL, GL_STREAM_DRAW);
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		imdd_instance_format_enum_t const format = g_imdd_instance_groups[imdd_instance_group_from_batch_index(batch_index)].format;
+		uint32_t const qw_size = g_imdd_instance_format_qw_size[format];
+		uint32_t dst_qw_offset = imdd_instance_format_qw_bias(output->instance_batches, format) + output->instance_batches[batch_index].offset*qw_size;
+		for (uint32_t submission_index = 0; submission_index < submission_count; ++submission_index) {
+			imdd_gl3_submission_t const *const submission = &submissions[submission_index];
+			imdd_batch_t const src = submission->instance_batches[batch_index];
+			if (src.count == 0) {
+				continue;
+			}
+			uint32_t const src_qw_offset = submission->instance_qw_offset
+				+ imdd_instance_format_qw_bias(submission->instance_batches, format)
+				+ src.offset*qw_size;
+			glBufferSubData(
+				GL_ARRAY_BUFFER,
+				(GLintptr)dst_qw_offset*sizeof(imdd_v4),
+				(GLsizeiptr)src.count*qw_size*sizeof(imdd_v4),
+				(imdd_v4 const *)ctx->instance_transform_staging + src_qw_offset);
+			dst_qw_offset += src.count*qw_size;
+		}
+	}
+	imdd_gl3_upload_joined(
+		output->instance_color_buf,
+		ctx->submit_instance_count,
+		sizeof(imdd_instance_color_t),
+		ctx->instance_color_staging,
+		submissions,
+		submission_count,
+		offsetof(imdd_gl3_submission_t, instance_offset),
+		offsetof(imdd_gl3_submission_t, instance_batches),
+		IMDD_INSTANCE_BATCH_COUNT,
+		output->instance_batches);
+	imdd_gl3_upload_joined(
+		output->filled_vertex_buf,
+		ctx->submit_filled_vertex_count,
+		sizeof(imdd_array_flat_vertex_t),
+		ctx->filled_vertex_staging,
+		submissions,
+		submission_count,
+		offsetof(imdd_gl3_submission_t, filled_vertex_offset),
+		offsetof(imdd_gl3_submission_t, filled_array_batches),
+		IMDD_ARRAY_BATCH_COUNT,
+		output->filled_array_batches);
+	imdd_gl3_upload_joined(
+		output->wire_vertex_buf,
+		ctx->submit_wire_vertex_count,
+		sizeof(imdd_array_wire_vertex_t),
+		ctx->wire_vertex_staging,
+		submissions,
+		submission_count,
+		offsetof(imdd_gl3_submission_t, wire_vertex_offset),
+		offsetof(imdd_gl3_submission_t, wire_array_batches),
+		IMDD_ARRAY_BATCH_COUNT,
+		output->wire_array_batches);
+	imdd_gl3_set_compact_data_pointers(output);
+}
+
+void imdd_gl3_end_update(imdd_gl3_context_t *ctx)
+{
+	imdd_gl3_output_t *const output = &ctx->frame_output;
+	if (ctx->submission_count == 1) {
+		// a single submission starts at the beginning of staging memory, so is uploaded as it is
+		imdd_gl3_submission_t const *const submission = &ctx->submissions[0];
+		memcpy(output->instance_batches, submission->instance_batches, sizeof(output->instance_batches));
+		memcpy(output->filled_array_batches, submission->filled_array_batches, sizeof(output->filled_array_batches));
+		memcpy(output->wire_array_batches, submission->wire_array_batches, sizeof(output->wire_array_batches));
+		imdd_gl3_upload(ctx, output, ctx->submit_instance_count, ctx->submit_filled_vertex_count, ctx->submit_wire_vertex_count, GL_STREAM_DRAW);
+	} else {
+		imdd_gl3_upload_submissions(ctx, output);
+	}
+
+	if (ctx->submit_options.stats) {
+		*ctx->submit_options.stats = ctx->submit_stats;
+	}
+	if (ctx->flags & IMDD_GL3_FLAG_GROW) {
+		imdd_gl3_resize_staging(ctx, &ctx->submit_stats);
+	}
+}
+
+// converts the stores of the last update on a thread of the async scheduler
+static
+void imdd_gl3_async_task(void *task_ctx, uint32_t index)
+{
+	imdd_gl3_context_t *const ctx = (imdd_gl3_context_t *)task_ctx;
+	(void)index;
+	imdd_gl3_submit_stores(ctx, ctx->async_stores, ctx->async_store_count);
+}
+
+// waits for the conversion started by the last update (if any), then uploads it for drawing
+static
+void imdd_gl3_finish_async(imdd_gl3_context_t *ctx)
+{
+	if (ctx->async_pending) {
+		ctx->async_scheduler->wait(ctx->async_scheduler->user_data);
+		ctx->async_pending = 0;
+		imdd_gl3_end_update(ctx);
+	}
+}
+
+/*
+	With an async scheduler, imdd_gl3_update only starts converting the
+	stores as a single task on the scheduler, and instead uploads the shapes
+	converted by the previous update, so shapes are drawn one frame late.
+	The stores (and the array of them, and anything the options point to)
+	belong to the context until the next update, so the caller should
+	alternate between two sets of stores.  The task converts on one thread,
+	so the scheduler of the options is not used, and stats are written by
+	the next update.  Waits for the last conversion if the scheduler is
+	changed, and NULL goes back to converting during imdd_gl3_update.
+*/
+void imdd_gl3_set_async_scheduler(imdd_gl3_context_t *ctx, imdd_scheduler_t const *scheduler)
+{
+	imdd_gl3_finish_async(ctx);
+	ctx->async_scheduler = scheduler;
+}
+
+void imdd_gl3_update(
+	imdd_gl3_context_t *ctx,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+	imdd_emit_options_t const *options)
+{
+	if (ctx->async_scheduler) {
+		imdd_gl3_finish_async(ctx);
+		imdd_gl3_begin_update(ctx, options);
+		ctx->submit_options.scheduler = NULL;
+		ctx->async_stores = stores;
+		ctx->async_store_count = store_count;
+		ctx->async_pending = 1;
+		ctx->async_scheduler->parallel_for(ctx->async_scheduler->user_data, 1, &imdd_gl3_async_task, ctx);
+		return;
+	}
+
+	uint32_t instance_count = 0;
+	uint32_t filled_vertex_count = 0;
+	uint32_t wire_vertex_count = 0;
+	imdd_gl3_emit(ctx, stores, store_count, options, NULL, &instance_count, &filled_vertex_count, &wire_vertex_count);
+}
+
+/*
+	Stores with content that rarely changes (such as level geometry) can be
+	converted into buffers of their own, which are drawn after the shapes of
+	the frame in each pass by imdd_gl3_draw and imdd_gl3_draw_view.  Call
+	this every frame: conversion and upload are skipped while the store has
+	not been reset and has had no shapes added since the last conversion.
+	Shapes are not culled or given LODs, since the result must not depend
+	on the camera, and only the flags, scheduler and scratch of the options are used.
+*/
+void imdd_gl3_update_cached(
+	imdd_gl3_context_t *ctx,
+	uint32_t slot,
+	imdd_shape_store_t const *store,
+	imdd_emit_options_t const *options)
+{
+	imdd_gl3_cached_store_t *const cached = &ctx->cached_stores[slot];
+	uint32_t const header_count = imdd_atomic_load(&store->header_count);
+	uint32_t const data_qw_count = imdd_atomic_load(&store->data_qw_count);
+	if (cached->store == store
+		&& cached->generation == store->generation
+		&& cached->header_count == header_count
+		&& cached->data_qw_count == data_qw_count) {
+		return;
+	}
+	imdd_gl3_finish_async(ctx);
+	if (!cached->has_output) {
+		imdd_gl3_init_output(ctx, &cached->output);
+		cached->has_output = 1;
+	}
+
+	imdd_emit_options_t emit_options;
+	imdd_emit_stats_t stats;
+	memset(&emit_options, 0, sizeof(emit_options));
+	if (options) {
+		emit_options.flags = options->flags;
+		emit_options.scheduler = options->scheduler;
+		emit_options.scratch = options->scratch;
+	}
+	if (!emit_options.scratch) {
+		emit_options.scratch = &ctx->emit_scratch;
+	}
+	emit_options.flags |= IMDD_EMIT_FLAG_COMPACT_INSTANCES | IMDD_EMIT_FLAG_FLAT_TRIANGLES | IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES;
+	emit_options.stats = &stats;
+
+	// convert into staging memory, growing it once if the store does not fit
+	uint32_t instance_count = 0;
+	uint32_t filled_vertex_count = 0;
+	uint32_t wire_vertex_count = 0;
+	for (;;) {
+		imdd_emit_shapes(
+			&store,
+			1,
+			ctx->instance_transform_staging,
+			ctx->instance_color_staging,
+			ctx->instance_capacity,
+			cached->output.instance_batches,
+			&instance_count,
+			(imdd_array_filled_vertex_t *)ctx->filled_vertex_staging,
+			ctx->filled_vertex_capacity,
+			cached->output.filled_array_batches,
+			&filled_vertex_count,
+			ctx->wire_vertex_staging,
+			ctx->wire_vertex_capacity,
+			cached->output.wire_array_batches,
+			&wire_vertex_count,
+			&emit_options);
+		if (stats.required_instance_count <= ctx->instance_capacity
+			&& stats.required_filled_vertex_count <= ctx->filled_vertex_capacity
+			&& stats.required_wire_vertex_count <= ctx->wire_vertex_capacity) {
+			break;
+		}
+		imdd_gl3_reserve_staging(ctx, &stats);
+	}
+	imdd_gl3_upload(ctx, &cached->output, instance_count, filled_vertex_count, wire_vertex_count, GL_STATIC_DRAW);
+
+	cached->store = store;
+	cached->generation = store->generation;
+	cached->header_count = header_count;
+	cached->data_qw_count = data_qw_count;
+}
+
+// stops drawing a cached store, its buffers are kept for the next store in this slot
+void imdd_gl3_clear_cached(imdd_gl3_context_t *ctx, uint32_t slot)
+{
+	ctx->cached_stores[slot].store = NULL;
 }
 
 static
 void imdd_gl3_draw_instances(
 	imdd_gl3_context_t *ctx,
+	imdd_gl3_output_t const *output,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
 	imdd_style_enum_t style,
 	imdd_blend_enum_t blend,
 	imdd_zmode_enum_t zmode)
 {
-	GLuint const *const vertex_array = &ctx->instance_vertex_array[style];
-	glBindVertexArray(*vertex_array);
-
-	for (imdd_mesh_enum_t mesh = (imdd_mesh_enum_t)0; mesh < IMDD_MESH_COUNT; mesh = (imdd_mesh_enum_t)(mesh + 1)) {
-		uint32_t const batch_index = imdd_instance_batch_index(mesh, style, blend, zmode);
-		imdd_batch_t const *const batch = &ctx->instance_batches[batch_index];
-		if (batch->count) {
+	// groups are sorted by format, so switch program and vertex array when the format changes
+	imdd_instance_format_enum_t bound_format = IMDD_INSTANCE_FORMAT_COUNT;
+	for (uint32_t group = 0; group < IMDD_INSTANCE_GROUP_COUNT; ++group) {
+		imdd_instance_format_enum_t const format = g_imdd_instance_groups[group].format;
+		imdd_mesh_enum_t const mesh = g_imdd_instance_groups[group].mesh;
+		uint32_t const batch_index = imdd_instance_group_batch_index(group, layer, style, blend, zmode);
+		imdd_batch_t const *ranges = &output->instance_batches[batch_index];
+		uint32_t range_count = 1;
+		if (view) {
+			ranges = view->ranges + view->instance_range_lists[batch_index].offset;
+			range_count = view->instance_range_lists[batch_index].count;
+		}
+		if (range_count && ranges->count) {
+			if (format != bound_format) {
+				glUseProgram(ctx->instance_program[format][style].prog);
+				glBindVertexArray(output->instance_vertex_array[format][style]);
+				bound_format = format;
+			}
 			imdd_gl3_mesh_buffer_t const *const mesh_buffer = &ctx->mesh_buffer[style];
 			imdd_mesh_desc_t const *const mesh_desc = &mesh_buffer->layout.mesh_desc[mesh];
 			imdd_mesh_offsets_t const *const mesh_offsets = &mesh_buffer->layout.mesh_offsets[mesh];
 
-			glDrawElementsInstancedBaseInstance(
-				mesh_buffer->draw_mode,
-				mesh_desc->index_count,
-				GL_UNSIGNED_SHORT,
-				(void *)(sizeof(uint16_t)*mesh_offsets->index_offset),
-				batch->count,
-				batch->offset);
+			for (uint32_t range_index = 0; range_index < range_count; ++range_index) {
+				glDrawElementsInstancedBaseInstance(
+					mesh_buffer->draw_mode,
+					mesh_desc->index_count,
+					GL_UNSIGNED_SHORT,
+					(void *)(sizeof(uint16_t)*mesh_offsets->index_offset),
+					ranges[range_index].count,
+					ranges[range_index].offset);
+			}
 		}
 	}
 }
 
 static
 void imdd_gl3_draw_filled_arrays(
-	imdd_gl3_context_t *ctx,
+	imdd_gl3_output_t const *output,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
 	imdd_blend_enum_t blend,
 	imdd_zmode_enum_t zmode)
 {
-	uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-	imdd_batch_t const *const batch = &ctx->filled_array_batches[batch_index];
-	if (batch->count) {
-		glBindVertexArray(ctx->filled_vertex_array);
-		glDrawArrays(GL_TRIANGLES, batch->offset, batch->count);
+	uint32_t const batch_index = imdd_array_batch_index(layer, blend, zmode);
+	imdd_batch_t const *ranges = &output->filled_array_batches[batch_index];
+	uint32_t range_count = 1;
+	if (view) {
+		ranges = view->ranges + view->filled_range_lists[batch_index].offset;
+		range_count = view->filled_range_lists[batch_index].count;
+	}
+	glBindVertexArray(output->filled_vertex_array);
+	for (uint32_t range_index = 0; range_index < range_count; ++range_index) {
+		if (ranges[range_index].count) {
+			glDrawArrays(GL_TRIANGLES, ranges[range_index].offset, ranges[range_index].count);
+		}
 	}
 }
 
 static
 void imdd_gl3_draw_wire_arrays(
-	imdd_gl3_context_t *ctx,
+	imdd_gl3_output_t const *output,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
 	imdd_blend_enum_t blend,
 	imdd_zmode_enum_t zmode)
 {
-	uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-	imdd_batch_t const *const batch = &ctx->wire_array_batches[batch_index];
-	if (batch->count) {
-		glBindVertexArray(ctx->wire_vertex_array);
-		glDrawArrays(GL_LINES, batch->offset, batch->count);
+	glBindVertexArray(output->wire_vertex_array);
+
+	uint32_t const batch_index = imdd_array_batch_index(layer, blend, zmode);
+	imdd_batch_t const *ranges = &output->wire_array_batches[batch_index];
+	uint32_t range_count = 1;
+	if (view) {
+		ranges = view->ranges + view->wire_range_lists[batch_index].offset;
+		range_count = view->wire_range_lists[batch_index].count;
+	}
+	for (uint32_t range_index = 0; range_index < range_count; ++range_index) {
+		if (ranges[range_index].count) {
+			glDrawArrays(GL_LINES, ranges[range_index].offset, ranges[range_index].count);
+		}
+	}
+
+	// draw triangles as lines using the index pattern, one block at a time
+	uint32_t const triangle_batch_index = imdd_array_wire_triangle_batch_index(layer, blend, zmode);
+	imdd_batch_t const *triangle_ranges = &output->wire_array_batches[triangle_batch_index];
+	uint32_t triangle_range_count = 1;
+	if (view) {
+		triangle_ranges = view->ranges + view->wire_range_lists[triangle_batch_index].offset;
+		triangle_range_count = view->wire_range_lists[triangle_batch_index].count;
+	}
+	for (uint32_t range_index = 0; range_index < triangle_range_count; ++range_index) {
+		imdd_batch_t const *const range = &triangle_ranges[range_index];
+		uint32_t const triangle_count = range->count/3;
+		for (uint32_t first = 0; first < triangle_count; first += IMDD_WIRE_TRIANGLE_BLOCK_SIZE) {
+			uint32_t const remaining_count = triangle_count - first;
+			uint32_t const block_count = (remaining_count < IMDD_WIRE_TRIANGLE_BLOCK_SIZE) ? remaining_count : IMDD_WIRE_TRIANGLE_BLOCK_SIZE;
+			glDrawElementsBaseVertex(GL_LINES, 6*block_count, GL_UNSIGNED_SHORT, NULL, range->offset + 3*first);
+		}
 	}
 }
 
-void imdd_gl3_draw(
-	imdd_gl3_context_t *ctx,
-	float const *proj_from_world)
+static
+void imdd_gl3_set_proj_from_world(imdd_gl3_context_t *ctx, float const *proj_from_world)
 {
-	// set shader constants
 	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
 		glUseProgram(ctx->array_program[style].prog);
 		glUniformMatrix4fv(ctx->array_program[style].proj_from_world_loc, 1, GL_FALSE, proj_from_world);
-		glUseProgram(ctx->instance_program[style].prog);
-		glUniformMatrix4fv(ctx->instance_program[style].proj_from_world_loc, 1, GL_FALSE, proj_from_world);
+		for (imdd_instance_format_enum_t format = (imdd_instance_format_enum_t)0; format < IMDD_INSTANCE_FORMAT_COUNT; format = (imdd_instance_format_enum_t)(format + 1)) {
+			imdd_gl3_program_t const *const program = &ctx->instance_program[format][style];
+			glUseProgram(program->prog);
+			glUniformMatrix4fv(program->proj_from_world_loc, 1, GL_FALSE, proj_from_world);
+		}
 	}
+}
 
-	// emit all draw calls
-	for (imdd_zmode_enum_t zmode = (imdd_zmode_enum_t)0; zmode < IMDD_ZMODE_COUNT; zmode = (imdd_zmode_enum_t)(zmode + 1)) {
-		if (zmode == IMDD_ZMODE_TEST) {
-			glEnable(GL_DEPTH_TEST);
+// draws the batches of one output for this layer, zmode and blend mode
+static
+void imdd_gl3_draw_output(
+	imdd_gl3_context_t *ctx,
+	imdd_gl3_output_t const *output,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
+	imdd_zmode_enum_t zmode,
+	imdd_blend_enum_t blend)
+{
+	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
+		glEnable(GL_CULL_FACE);
+		imdd_gl3_draw_instances(ctx, output, view, layer, style, blend, zmode);
+		glDisable(GL_CULL_FACE);
+		glUseProgram(ctx->array_program[style].prog);
+		if (style == IMDD_STYLE_FILLED) {
+			imdd_gl3_draw_filled_arrays(output, view, layer, blend, zmode);
 		} else {
-			glDisable(GL_DEPTH_TEST);
+			imdd_gl3_draw_wire_arrays(output, view, layer, blend, zmode);
 		}
-		for (imdd_blend_enum_t blend = (imdd_blend_enum_t)0; blend < IMDD_BLEND_COUNT; blend = (imdd_blend_enum_t)(blend + 1)) {
-			if (blend == IMDD_BLEND_OPAQUE) {
-				glDepthMask(GL_TRUE);
-				glDisable(GL_BLEND);
-			} else {
-				glDepthMask(GL_FALSE);
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			}
-			for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
-				glEnable(GL_CULL_FACE);
-				glUseProgram(ctx->instance_program[style].prog);
-				imdd_gl3_draw_instances(ctx, style, blend, zmode);
-				glDisable(GL_CULL_FACE);
-				glUseProgram(ctx->array_program[style].prog);
-				if (style == IMDD_STYLE_FILLED) {
-					imdd_gl3_draw_filled_arrays(ctx, blend, zmode);
-				} else {
-					imdd_gl3_draw_wire_arrays(ctx, blend, zmode);
-				}
+	}
+}
+
+// sets render state for this layer, zmode and blend mode, before drawing its batches
+static
+void imdd_gl3_set_pass_state(
+	imdd_gl3_context_t *ctx,
+	uint32_t layer,
+	imdd_zmode_enum_t zmode,
+	imdd_blend_enum_t blend)
+{
+	imdd_gl3_layer_t const *const layer_state = &ctx->layers[layer];
+	if (zmode == IMDD_ZMODE_TEST) {
+		glEnable(GL_DEPTH_TEST);
+	} else {
+		glDisable(GL_DEPTH_TEST);
+	}
+	if (blend == IMDD_BLEND_OPAQUE) {
+		glDepthMask(GL_TRUE);
+		glDisable(GL_BLEND);
+	} else {
+		glDepthMask(GL_FALSE);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, layer_state->additive ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+	}
+	if (layer_state->depth_bias_factor != 0.f || layer_state->depth_bias_units != 0.f) {
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(layer_state->depth_bias_factor, layer_state->depth_bias_units);
+	} else {
+		glDisable(GL_POLYGON_OFFSET_FILL);
+	}
+	glLineWidth(layer_state->line_width);
+}
+
+static
+void imdd_gl3_draw_batches(
+	imdd_gl3_context_t *ctx,
+	float const *proj_from_world,
+	imdd_emit_view_t const *view)
+{
+	// set shader constants
+	imdd_gl3_set_proj_from_world(ctx, proj_from_world);
+
+	// emit all draw calls, with cached stores after the shapes of this frame in each pass
+	for (uint32_t layer = 0; layer < IMDD_LAYER_COUNT; ++layer)
+	for (imdd_zmode_enum_t zmode = (imdd_zmode_enum_t)0; zmode < IMDD_ZMODE_COUNT; zmode = (imdd_zmode_enum_t)(zmode + 1))
+	for (imdd_blend_enum_t blend = (imdd_blend_enum_t)0; blend < IMDD_BLEND_COUNT; blend = (imdd_blend_enum_t)(blend + 1)) {
+		imdd_gl3_set_pass_state(ctx, layer, zmode, blend);
+		imdd_gl3_draw_output(ctx, &ctx->frame_output, view, layer, zmode, blend);
+		for (uint32_t slot = 0; slot < IMDD_GL3_CACHED_STORE_COUNT; ++slot) {
+			imdd_gl3_cached_store_t const *const cached = &ctx->cached_stores[slot];
+			if (cached->store) {
+				imdd_gl3_draw_output(ctx, &cached->output, NULL, layer, zmode, blend);
 			}
 		}
 	}
@@ -524,6 +1307,91 @@ void imdd_gl3_draw(
 	// clean up
 	glBindVertexArray(0);
 	glUseProgram(0);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glLineWidth(1.f);
+}
+
+void imdd_gl3_draw(
+	imdd_gl3_context_t *ctx,
+	float const *proj_from_world)
+{
+	imdd_gl3_draw_batches(ctx, proj_from_world, NULL);
+}
+
+// draws only the ranges visible in a view, written by the last update using imdd_emit_options_t::views
+void imdd_gl3_draw_view(
+	imdd_gl3_context_t *ctx,
+	float const *proj_from_world,
+	imdd_emit_view_t const *view)
+{
+	imdd_gl3_draw_batches(ctx, proj_from_world, view);
+}
+
+typedef struct {
+	imdd_gl3_context_t *ctx;
+	uint32_t instance_count;
+	uint32_t filled_vertex_count;
+	uint32_t wire_vertex_count;
+} imdd_gl3_stream_state_t;
+
+static
+void imdd_gl3_flush_window(void *user_data, uint32_t layer, imdd_zmode_enum_t zmode, imdd_blend_enum_t blend)
+{
+	imdd_gl3_stream_state_t *const stream_state = (imdd_gl3_stream_state_t *)user_data;
+	imdd_gl3_context_t *const ctx = stream_state->ctx;
+	imdd_gl3_upload(ctx, &ctx->frame_output, stream_state->instance_count, stream_state->filled_vertex_count, stream_state->wire_vertex_count, GL_STREAM_DRAW);
+	imdd_gl3_set_pass_state(ctx, layer, zmode, blend);
+	imdd_gl3_draw_output(ctx, &ctx->frame_output, NULL, layer, zmode, blend);
+}
+
+// updates and draws in one go, converting window_shape_count shapes at a time so that staging memory only needs
+// to fit one window (see imdd_emit_stream_t), views and bounds are not supported and cached stores are not drawn
+void imdd_gl3_update_and_draw_streamed(
+	imdd_gl3_context_t *ctx,
+	float const *proj_from_world,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+	uint32_t window_shape_count,
+	imdd_emit_options_t const *options)
+{
+	imdd_gl3_finish_async(ctx);
+
+	imdd_gl3_stream_state_t stream_state;
+	stream_state.ctx = ctx;
+	stream_state.instance_count = 0;
+	stream_state.filled_vertex_count = 0;
+	stream_state.wire_vertex_count = 0;
+
+	imdd_emit_stream_t stream;
+	stream.window_shape_count = window_shape_count;
+	stream.flush = &imdd_gl3_flush_window;
+	stream.user_data = &stream_state;
+
+	imdd_emit_options_t emit_options;
+	if (options) {
+		emit_options = *options;
+	} else {
+		memset(&emit_options, 0, sizeof(emit_options));
+	}
+	emit_options.views = NULL;
+	emit_options.bounds = NULL;
+
+	imdd_gl3_set_proj_from_world(ctx, proj_from_world);
+	imdd_gl3_emit(
+		ctx,
+		stores,
+		store_count,
+		&emit_options,
+		&stream,
+		&stream_state.instance_count,
+		&stream_state.filled_vertex_count,
+		&stream_state.wire_vertex_count);
+
+	// clean up
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glLineWidth(1.f);
 }
 
 #ifdef __cplusplus
@@ -3,29 +3,62 @@
 #include "imdd.h"
 #include "imdd_store.h"
 #include <math.h>
+#include <stddef.h> // for offsetof
 #include <string.h> // for memcpy
+#include <float.h> // for FLT_MAX
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// curved meshes have lower detail versions for shapes that are small on screen
 typedef enum {
 	IMDD_MESH_BOX,
 	IMDD_MESH_SPHERE,
 	IMDD_MESH_CONE,
 	IMDD_MESH_CYLINDER,
+	IMDD_MESH_SPHERE_LOD1,
+	IMDD_MESH_CONE_LOD1,
+	IMDD_MESH_CYLINDER_LOD1,
+	IMDD_MESH_SPHERE_LOD2,
+	IMDD_MESH_CONE_LOD2,
+	IMDD_MESH_CYLINDER_LOD2,
 	IMDD_MESH_COUNT
 } imdd_mesh_enum_t;
 
-static imdd_mesh_enum_t const g_imdd_mesh_from_shape[IMDD_SHAPE_COUNT] = {
-	IMDD_MESH_COUNT,	// IMDD_SHAPE_LINE
-	IMDD_MESH_COUNT,	// IMDD_SHAPE_TRIANGLE
-	IMDD_MESH_BOX,		// IMDD_SHAPE_AABB
-	IMDD_MESH_BOX,		// IMDD_SHAPE_OBB
-	IMDD_MESH_SPHERE,	// IMDD_SHAPE_SPHERE
-	IMDD_MESH_SPHERE,	// IMDD_SHAPE_ELLIPSOID
-	IMDD_MESH_CONE,		// IMDD_SHAPE_CONE
-	IMDD_MESH_CYLINDER	// IMDD_SHAPE_CYLINDER
+#define IMDD_MESH_LOD_COUNT		3
+
+static imdd_mesh_enum_t const g_imdd_mesh_from_shape[IMDD_MESH_LOD_COUNT][IMDD_SHAPE_COUNT] = {
+	{
+		IMDD_MESH_COUNT,		// IMDD_SHAPE_LINE
+		IMDD_MESH_COUNT,		// IMDD_SHAPE_TRIANGLE
+		IMDD_MESH_BOX,			// IMDD_SHAPE_AABB
+		IMDD_MESH_BOX,			// IMDD_SHAPE_OBB
+		IMDD_MESH_SPHERE,		// IMDD_SHAPE_SPHERE
+		IMDD_MESH_SPHERE,		// IMDD_SHAPE_ELLIPSOID
+		IMDD_MESH_CONE,			// IMDD_SHAPE_CONE
+		IMDD_MESH_CYLINDER		// IMDD_SHAPE_CYLINDER
+	},
+	{
+		IMDD_MESH_COUNT,		// IMDD_SHAPE_LINE
+		IMDD_MESH_COUNT,		// IMDD_SHAPE_TRIANGLE
+		IMDD_MESH_BOX,			// IMDD_SHAPE_AABB
+		IMDD_MESH_BOX,			// IMDD_SHAPE_OBB
+		IMDD_MESH_SPHERE_LOD1,	// IMDD_SHAPE_SPHERE
+		IMDD_MESH_SPHERE_LOD1,	// IMDD_SHAPE_ELLIPSOID
+		IMDD_MESH_CONE_LOD1,	// IMDD_SHAPE_CONE
+		IMDD_MESH_CYLINDER_LOD1	// IMDD_SHAPE_CYLINDER
+	},
+	{
+		IMDD_MESH_COUNT,		// IMDD_SHAPE_LINE
+		IMDD_MESH_COUNT,		// IMDD_SHAPE_TRIANGLE
+		IMDD_MESH_BOX,			// IMDD_SHAPE_AABB
+		IMDD_MESH_BOX,			// IMDD_SHAPE_OBB
+		IMDD_MESH_SPHERE_LOD2,	// IMDD_SHAPE_SPHERE
+		IMDD_MESH_SPHERE_LOD2,	// IMDD_SHAPE_ELLIPSOID
+		IMDD_MESH_CONE_LOD2,	// IMDD_SHAPE_CONE
+		IMDD_MESH_CYLINDER_LOD2	// IMDD_SHAPE_CYLINDER
+	}
 };
 
 typedef struct {
@@ -39,39 +72,53 @@ typedef struct {
 
 #define IMDD_PI								3.1415926535f
 
-#define IMDD_FILLED_BOX_VERTEX_COUNT		(4*6)
-#define IMDD_FILLED_BOX_INDEX_COUNT			(6*6)
+#define IMDD_FILLED_BOX_VERTEX_COUNT					(4*6)
+#define IMDD_FILLED_BOX_INDEX_COUNT						(6*6)
 
-#define IMDD_FILLED_SPHERE_SUB				6
-#define IMDD_FILLED_SPHERE_VERTEX_COUNT		(6*(1 + IMDD_FILLED_SPHERE_SUB)*(1 + IMDD_FILLED_SPHERE_SUB))
-#define IMDD_FILLED_SPHERE_INDEX_COUNT		(6*6*IMDD_FILLED_SPHERE_SUB*IMDD_FILLED_SPHERE_SUB)
+#define IMDD_FILLED_SPHERE_SUB							6
+#define IMDD_FILLED_SPHERE_LOD1_SUB						3
+#define IMDD_FILLED_SPHERE_LOD2_SUB						2
+#define IMDD_FILLED_SPHERE_VERTEX_COUNT_FOR_SUB(SUB)	(6*(1 + (SUB))*(1 + (SUB)))
+#define IMDD_FILLED_SPHERE_INDEX_COUNT_FOR_SUB(SUB)		(6*6*(SUB)*(SUB))
 
-#define IMDD_FILLED_CONE_SEGMENT_COUNT		18
-#define IMDD_FILLED_CONE_VERTEX_COUNT		(3*IMDD_FILLED_CONE_SEGMENT_COUNT + 1)
-#define IMDD_FILLED_CONE_INDEX_COUNT		(9*IMDD_FILLED_CONE_SEGMENT_COUNT)
+#define IMDD_FILLED_CONE_SEGMENT_COUNT					18
+#define IMDD_FILLED_CONE_LOD1_SEGMENT_COUNT				10
+#define IMDD_FILLED_CONE_LOD2_SEGMENT_COUNT				6
+#define IMDD_FILLED_CONE_VERTEX_COUNT_FOR_SEGMENTS(N)	(3*(N) + 1)
+#define IMDD_FILLED_CONE_INDEX_COUNT_FOR_SEGMENTS(N)	(9*(N))
 
-#define IMDD_FILLED_CYLINDER_SEGMENT_COUNT	18
-#define IMDD_FILLED_CYLINDER_VERTEX_COUNT	(4*IMDD_FILLED_CYLINDER_SEGMENT_COUNT + 2)
-#define IMDD_FILLED_CYLINDER_INDEX_COUNT	(12*IMDD_FILLED_CYLINDER_SEGMENT_COUNT)
+#define IMDD_FILLED_CYLINDER_SEGMENT_COUNT				18
+#define IMDD_FILLED_CYLINDER_LOD1_SEGMENT_COUNT			10
+#define IMDD_FILLED_CYLINDER_LOD2_SEGMENT_COUNT			6
+#define IMDD_FILLED_CYLINDER_VERTEX_COUNT_FOR_SEGMENTS(N)	(4*(N) + 2)
+#define IMDD_FILLED_CYLINDER_INDEX_COUNT_FOR_SEGMENTS(N)	(12*(N))
 
-#define IMDD_WIRE_BOX_VERTEX_COUNT			(8)
-#define IMDD_WIRE_BOX_INDEX_COUNT			(2*12)
+#define IMDD_WIRE_BOX_VERTEX_COUNT						(8)
+#define IMDD_WIRE_BOX_INDEX_COUNT						(2*12)
 
-#define IMDD_WIRE_SPHERE_SUB				6
-#define IMDD_WIRE_SPHERE_VERTEX_COUNT		(6*(1 + IMDD_WIRE_SPHERE_SUB)*(1 + IMDD_WIRE_SPHERE_SUB))
-#define IMDD_WIRE_SPHERE_INDEX_COUNT		(6*4*(1 + IMDD_WIRE_SPHERE_SUB)*IMDD_WIRE_SPHERE_SUB)
+#define IMDD_WIRE_SPHERE_SUB							6
+#define IMDD_WIRE_SPHERE_LOD1_SUB						3
+#define IMDD_WIRE_SPHERE_LOD2_SUB						2
+#define IMDD_WIRE_SPHERE_VERTEX_COUNT_FOR_SUB(SUB)		(6*(1 + (SUB))*(1 + (SUB)))
+#define IMDD_WIRE_SPHERE_INDEX_COUNT_FOR_SUB(SUB)		(6*4*(1 + (SUB))*(SUB))
 
-#define IMDD_WIRE_CONE_SEGMENT_COUNT		18
-#define IMDD_WIRE_CONE_VERTEX_COUNT			(IMDD_WIRE_CONE_SEGMENT_COUNT + 1)
-#define IMDD_WIRE_CONE_INDEX_COUNT			(4*IMDD_WIRE_CONE_SEGMENT_COUNT)
+#define IMDD_WIRE_CONE_SEGMENT_COUNT					18
+#define IMDD_WIRE_CONE_LOD1_SEGMENT_COUNT				10
+#define IMDD_WIRE_CONE_LOD2_SEGMENT_COUNT				6
+#define IMDD_WIRE_CONE_VERTEX_COUNT_FOR_SEGMENTS(N)		((N) + 1)
+#define IMDD_WIRE_CONE_INDEX_COUNT_FOR_SEGMENTS(N)		(4*(N))
 
-#define IMDD_WIRE_CYLINDER_SEGMENT_COUNT	18
-#define IMDD_WIRE_CYLINDER_VERTEX_COUNT		(2*IMDD_WIRE_CYLINDER_SEGMENT_COUNT)
-#define IMDD_WIRE_CYLINDER_INDEX_COUNT		(6*IMDD_WIRE_CYLINDER_SEGMENT_COUNT)
+#define IMDD_WIRE_CYLINDER_SEGMENT_COUNT				18
+#define IMDD_WIRE_CYLINDER_LOD1_SEGMENT_COUNT			10
+#define IMDD_WIRE_CYLINDER_LOD2_SEGMENT_COUNT			6
+#define IMDD_WIRE_CYLINDER_VERTEX_COUNT_FOR_SEGMENTS(N)	(2*(N))
+#define IMDD_WIRE_CYLINDER_INDEX_COUNT_FOR_SEGMENTS(N)	(6*(N))
 
 static
-void imdd_write_filled_box(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_filled_box(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t tessellation)
 {
+	(void)tessellation;
+
 	imdd_mesh_filled_vertex_t *vertices = (imdd_mesh_filled_vertex_t *)vertex_base + vertex_offset;
 	for (uint32_t face = 0; face < 6; ++face) {
 		// make normal and tangent
@@ -109,7 +156,7 @@ void imdd_write_filled_box(void *vertex_base, uint32_t vertex_offset, uint16_t *
 }
 
 static
-void imdd_write_filled_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_filled_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t sub)
 {
 	imdd_mesh_filled_vertex_t *vertices = (imdd_mesh_filled_vertex_t *)vertex_base + vertex_offset;
 	for (uint32_t face = 0; face < 6; ++face) {
@@ -125,10 +172,10 @@ void imdd_write_filled_sphere(void *vertex_base, uint32_t vertex_offset, uint16_
 		imdd_v4 const bitangent = imdd_v4_cross(normal, tangent);
 
 		// tessellate the quad
-		for (uint32_t y = 0; y <= IMDD_FILLED_SPHERE_SUB; ++y)
-		for (uint32_t x = 0; x <= IMDD_FILLED_SPHERE_SUB; ++x) {
-			float const tx = 2.f*(float)x/(float)IMDD_FILLED_SPHERE_SUB - 1.f;
-			float const ty = 2.f*(float)y/(float)IMDD_FILLED_SPHERE_SUB - 1.f;
+		for (uint32_t y = 0; y <= sub; ++y)
+		for (uint32_t x = 0; x <= sub; ++x) {
+			float const tx = 2.f*(float)x/(float)sub - 1.f;
+			float const ty = 2.f*(float)y/(float)sub - 1.f;
 
 			imdd_v4 const offset = imdd_v4_add(
 				imdd_v4_mul(tangent, imdd_v4_init_1f(tx)),
@@ -141,12 +188,12 @@ void imdd_write_filled_sphere(void *vertex_base, uint32_t vertex_offset, uint16_
 		}
 
 		// write triangles
-		uint32_t const face_vertex_offset = vertex_offset + face*((1 + IMDD_FILLED_SPHERE_SUB)*(1 + IMDD_FILLED_SPHERE_SUB));
-		for (uint32_t y = 0; y < IMDD_FILLED_SPHERE_SUB; ++y)
-		for (uint32_t x = 0; x < IMDD_FILLED_SPHERE_SUB; ++x) {
-			uint32_t const i0 = face_vertex_offset + y*(1 + IMDD_FILLED_SPHERE_SUB) + x;
+		uint32_t const face_vertex_offset = vertex_offset + face*((1 + sub)*(1 + sub));
+		for (uint32_t y = 0; y < sub; ++y)
+		for (uint32_t x = 0; x < sub; ++x) {
+			uint32_t const i0 = face_vertex_offset + y*(1 + sub) + x;
 			uint32_t const i1 = i0 + 1;
-			uint32_t const i2 = i0 + (1 + IMDD_FILLED_SPHERE_SUB);
+			uint32_t const i2 = i0 + (1 + sub);
 			uint32_t const i3 = i2 + 1;
 			indices[0] = (uint16_t)i0;
 			indices[1] = (uint16_t)i1;
@@ -160,14 +207,14 @@ void imdd_write_filled_sphere(void *vertex_base, uint32_t vertex_offset, uint16_
 }
 
 static
-void imdd_write_filled_cone(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_filled_cone(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t segment_count)
 {
 	imdd_mesh_filled_vertex_t *vertices = (imdd_mesh_filled_vertex_t *)vertex_base + vertex_offset;
 	float const sqrt_half = sqrtf(1.f/2.f);
 
 	// quads around apex
-	for (uint32_t i = 0; i < IMDD_FILLED_CONE_SEGMENT_COUNT; ++i) {
-		float const phi = 2.f*IMDD_PI*(float)i/(float)IMDD_FILLED_CONE_SEGMENT_COUNT;
+	for (uint32_t i = 0; i < segment_count; ++i) {
+		float const phi = 2.f*IMDD_PI*(float)i/(float)segment_count;
 		float const cos_phi = cosf(phi);
 		float const sin_phi = sinf(phi);
 		vertices[0].pos[0] = cos_phi;
@@ -184,10 +231,10 @@ void imdd_write_filled_cone(void *vertex_base, uint32_t vertex_offset, uint16_t
 		vertices[1].normal[2] = -sqrt_half;
 		vertices += 2;
 	}
-	for (uint32_t i = 0; i < IMDD_FILLED_CONE_SEGMENT_COUNT; ++i) {
+	for (uint32_t i = 0; i < segment_count; ++i) {
 		uint32_t const i0 = vertex_offset + 2*i;
 		uint32_t const i1 = i0 + 1;
-		uint32_t const i2 = vertex_offset + 2*((i + 1) % IMDD_FILLED_CONE_SEGMENT_COUNT);
+		uint32_t const i2 = vertex_offset + 2*((i + 1) % segment_count);
 		uint32_t const i3 = i2 + 1;
 		indices[0] = (uint16_t)i0;
 		indices[1] = (uint16_t)i1;
@@ -197,11 +244,11 @@ void imdd_write_filled_cone(void *vertex_base, uint32_t vertex_offset, uint16_t
 		indices[5] = (uint16_t)i1;
 		indices += 6;
 	}
-	vertex_offset += 2*IMDD_FILLED_CONE_SEGMENT_COUNT;
+	vertex_offset += 2*segment_count;
 
 	// end cap
-	for (uint32_t i = 0; i < IMDD_FILLED_CONE_SEGMENT_COUNT; ++i) {
-		float const phi = 2.f*IMDD_PI*(float)i/(float)IMDD_FILLED_CONE_SEGMENT_COUNT;
+	for (uint32_t i = 0; i < segment_count; ++i) {
+		float const phi = 2.f*IMDD_PI*(float)i/(float)segment_count;
 		float const cos_phi = cosf(phi);
 		float const sin_phi = sinf(phi);
 		vertices[0].pos[0] = cos_phi;
@@ -219,10 +266,10 @@ void imdd_write_filled_cone(void *vertex_base, uint32_t vertex_offset, uint16_t
 	vertices[0].normal[1] = 0.f;
 	vertices[0].normal[2] = 1.f;
 	++vertices;
-	for (uint32_t i = 0; i < IMDD_FILLED_CONE_SEGMENT_COUNT; ++i) {
+	for (uint32_t i = 0; i < segment_count; ++i) {
 		uint32_t const i0 = vertex_offset + i;
-		uint32_t const i1 = vertex_offset + ((i + 1) % IMDD_FILLED_CONE_SEGMENT_COUNT);
-		uint32_t const i2 = vertex_offset + IMDD_FILLED_CONE_SEGMENT_COUNT;
+		uint32_t const i1 = vertex_offset + ((i + 1) % segment_count);
+		uint32_t const i2 = vertex_offset + segment_count;
 		indices[0] = (uint16_t)i0;
 		indices[1] = (uint16_t)i1;
 		indices[2] = (uint16_t)i2;
@@ -231,13 +278,13 @@ void imdd_write_filled_cone(void *vertex_base, uint32_t vertex_offset, uint16_t
 }
 
 static
-void imdd_write_filled_cylinder(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_filled_cylinder(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t segment_count)
 {
 	imdd_mesh_filled_vertex_t *vertices = (imdd_mesh_filled_vertex_t *)vertex_base + vertex_offset;
 
 	// quads around
-	for (uint32_t i = 0; i < IMDD_FILLED_CYLINDER_SEGMENT_COUNT; ++i) {
-		float const phi = 2.f*IMDD_PI*(float)i/(float)IMDD_FILLED_CYLINDER_SEGMENT_COUNT;
+	for (uint32_t i = 0; i < segment_count; ++i) {
+		float const phi = 2.f*IMDD_PI*(float)i/(float)segment_count;
 		float const cos_phi = cosf(phi);
 		float const sin_phi = sinf(phi);
 		vertices[0].pos[0] = cos_phi;
@@ -254,10 +301,10 @@ void imdd_write_filled_cylinder(void *vertex_base, uint32_t vertex_offset, uint1
 		vertices[1].normal[2] = 0.f;
 		vertices += 2;
 	}
-	for (uint32_t i = 0; i < IMDD_FILLED_CYLINDER_SEGMENT_COUNT; ++i) {
+	for (uint32_t i = 0; i < segment_count; ++i) {
 		uint32_t const i0 = vertex_offset + 2*i;
 		uint32_t const i1 = i0 + 1;
-		uint32_t const i2 = vertex_offset + 2*((i + 1) % IMDD_FILLED_CYLINDER_SEGMENT_COUNT);
+		uint32_t const i2 = vertex_offset + 2*((i + 1) % segment_count);
 		uint32_t const i3 = i2 + 1;
 		indices[0] = (uint16_t)i0;
 		indices[1] = (uint16_t)i2;
@@ -267,13 +314,13 @@ void imdd_write_filled_cylinder(void *vertex_base, uint32_t vertex_offset, uint1
 		indices[5] = (uint16_t)i3;
 		indices += 6;
 	}
-	vertex_offset += 2*IMDD_FILLED_CYLINDER_SEGMENT_COUNT;
+	vertex_offset += 2*segment_count;
 
 	// end caps
 	for (uint32_t k = 0; k < 2; ++k) {
 		float const nz = (k != 0) ? 1.f : -1.f;
-		for (uint32_t i = 0; i < IMDD_FILLED_CYLINDER_SEGMENT_COUNT; ++i) {
-			float const phi = 2.f*IMDD_PI*(float)i/(float)IMDD_FILLED_CYLINDER_SEGMENT_COUNT;
+		for (uint32_t i = 0; i < segment_count; ++i) {
+			float const phi = 2.f*IMDD_PI*(float)i/(float)segment_count;
 			float const cos_phi = cosf(phi);
 			float const sin_phi = sinf(phi);
 			vertices[0].pos[0] = cos_phi;
@@ -292,22 +339,24 @@ void imdd_write_filled_cylinder(void *vertex_base, uint32_t vertex_offset, uint1
 		vertices[0].normal[2] = nz;
 		++vertices;
 
-		for (uint32_t i = 0; i < IMDD_FILLED_CYLINDER_SEGMENT_COUNT; ++i) {
+		for (uint32_t i = 0; i < segment_count; ++i) {
 			uint32_t const i0 = vertex_offset + i;
-			uint32_t const i1 = vertex_offset + ((i + 1) % IMDD_FILLED_CYLINDER_SEGMENT_COUNT);
-			uint32_t const i2 = vertex_offset + IMDD_FILLED_CYLINDER_SEGMENT_COUNT;
+			uint32_t const i1 = vertex_offset + ((i + 1) % segment_count);
+			uint32_t const i2 = vertex_offset + segment_count;
 			indices[0] = (uint16_t)((k != 0) ? i0 : i1);
 			indices[1] = (uint16_t)((k != 0) ? i1 : i0);
 			indices[2] = (uint16_t)i2;
 			indices += 3;
 		}
-		vertex_offset += IMDD_FILLED_CYLINDER_SEGMENT_COUNT + 1;
+		vertex_offset += segment_count + 1;
 	}
 }
 
 static
-void imdd_write_wire_box(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_wire_box(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t tessellation)
 {
+	(void)tessellation;
+
 	imdd_mesh_wire_vertex_t *const vertices = (imdd_mesh_wire_vertex_t *)vertex_base + vertex_offset;
 	for (uint32_t i = 0; i < IMDD_WIRE_BOX_VERTEX_COUNT; ++i) {
 		vertices[i].pos[0] = (i & 1) ? 1.f : -1.f;
@@ -338,7 +387,7 @@ void imdd_write_wire_box(void *vertex_base, uint32_t vertex_offset, uint16_t *in
 }
 
 static
-void imdd_write_wire_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_wire_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t sub)
 {
 	imdd_mesh_wire_vertex_t *vertices = (imdd_mesh_wire_vertex_t *)vertex_base + vertex_offset;
 	for (uint32_t face = 0; face < 6; ++face) {
@@ -354,10 +403,10 @@ void imdd_write_wire_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t
 		imdd_v4 const bitangent = imdd_v4_cross(normal, tangent);
 
 		// tessellate the quad
-		for (uint32_t y = 0; y <= IMDD_WIRE_SPHERE_SUB; ++y)
-		for (uint32_t x = 0; x <= IMDD_WIRE_SPHERE_SUB; ++x) {
-			float const tx = 2.f*(float)x/(float)IMDD_WIRE_SPHERE_SUB - 1.f;
-			float const ty = 2.f*(float)y/(float)IMDD_WIRE_SPHERE_SUB - 1.f;
+		for (uint32_t y = 0; y <= sub; ++y)
+		for (uint32_t x = 0; x <= sub; ++x) {
+			float const tx = 2.f*(float)x/(float)sub - 1.f;
+			float const ty = 2.f*(float)y/(float)sub - 1.f;
 
 			imdd_v4 const offset = imdd_v4_add(
 				imdd_v4_mul(tangent, imdd_v4_init_1f(tx)),
@@ -369,18 +418,18 @@ void imdd_write_wire_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t
 		}
 
 		// write lines
-		uint32_t const face_vertex_offset = vertex_offset + face*((1 + IMDD_WIRE_SPHERE_SUB)*(1 + IMDD_WIRE_SPHERE_SUB));
-		for (uint32_t y = 0; y <= IMDD_WIRE_SPHERE_SUB; ++y)
-		for (uint32_t x = 0; x <= IMDD_WIRE_SPHERE_SUB; ++x) {
-			uint32_t const i0 = face_vertex_offset + y*(1 + IMDD_WIRE_SPHERE_SUB) + x;
-			if (x < IMDD_WIRE_SPHERE_SUB) {
+		uint32_t const face_vertex_offset = vertex_offset + face*((1 + sub)*(1 + sub));
+		for (uint32_t y = 0; y <= sub; ++y)
+		for (uint32_t x = 0; x <= sub; ++x) {
+			uint32_t const i0 = face_vertex_offset + y*(1 + sub) + x;
+			if (x < sub) {
 				uint32_t const i1 = i0 + 1;
 				indices[0] = (uint16_t)i0;
 				indices[1] = (uint16_t)i1;
 				indices += 2;
 			}
-			if (y < IMDD_WIRE_SPHERE_SUB) {
-				uint32_t const i1 = i0 + (1 + IMDD_WIRE_SPHERE_SUB);
+			if (y < sub) {
+				uint32_t const i1 = i0 + (1 + sub);
 				indices[0] = (uint16_t)i0;
 				indices[1] = (uint16_t)i1;
 				indices += 2;
@@ -390,11 +439,11 @@ void imdd_write_wire_sphere(void *vertex_base, uint32_t vertex_offset, uint16_t
 }
 
 static
-void imdd_write_wire_cone(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_wire_cone(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t segment_count)
 {
 	imdd_mesh_wire_vertex_t *vertices = (imdd_mesh_wire_vertex_t *)vertex_base + vertex_offset;
-	for (uint32_t i = 0; i < IMDD_WIRE_CONE_SEGMENT_COUNT; ++i) {
-		float const phi = 2.f*IMDD_PI*(float)i/(float)IMDD_WIRE_CONE_SEGMENT_COUNT;
+	for (uint32_t i = 0; i < segment_count; ++i) {
+		float const phi = 2.f*IMDD_PI*(float)i/(float)segment_count;
 		float const cos_phi = cosf(phi);
 		float const sin_phi = sinf(phi);
 		vertices[0].pos[0] = cos_phi;
@@ -407,10 +456,10 @@ void imdd_write_wire_cone(void *vertex_base, uint32_t vertex_offset, uint16_t *i
 	vertices[0].pos[2] = 0.f;
 	++vertices;
 
-	for (uint32_t i = 0; i < IMDD_WIRE_CONE_SEGMENT_COUNT; ++i) {
+	for (uint32_t i = 0; i < segment_count; ++i) {
 		uint32_t const i0 = vertex_offset + i;
-		uint32_t const i1 = vertex_offset + ((i + 1) % IMDD_WIRE_CONE_SEGMENT_COUNT);
-		uint32_t const i2 = vertex_offset + IMDD_WIRE_CONE_SEGMENT_COUNT;
+		uint32_t const i1 = vertex_offset + ((i + 1) % segment_count);
+		uint32_t const i2 = vertex_offset + segment_count;
 		indices[0] = (uint16_t)i0;
 		indices[1] = (uint16_t)i1;
 		indices[2] = (uint16_t)i0;
@@ -420,11 +469,11 @@ void imdd_write_wire_cone(void *vertex_base, uint32_t vertex_offset, uint16_t *i
 }
 
 static
-void imdd_write_wire_cylinder(void *vertex_base, uint32_t vertex_offset, uint16_t *indices)
+void imdd_write_wire_cylinder(void *vertex_base, uint32_t vertex_offset, uint16_t *indices, uint32_t segment_count)
 {
 	imdd_mesh_wire_vertex_t *vertices = (imdd_mesh_wire_vertex_t *)vertex_base + vertex_offset;
-	for (uint32_t i = 0; i < IMDD_WIRE_CYLINDER_SEGMENT_COUNT; ++i) {
-		float const phi = 2.f*IMDD_PI*(float)i/(float)IMDD_WIRE_CYLINDER_SEGMENT_COUNT;
+	for (uint32_t i = 0; i < segment_count; ++i) {
+		float const phi = 2.f*IMDD_PI*(float)i/(float)segment_count;
 		float const cos_phi = cosf(phi);
 		float const sin_phi = sinf(phi);
 		vertices[0].pos[0] = cos_phi;
@@ -436,10 +485,10 @@ void imdd_write_wire_cylinder(void *vertex_base, uint32_t vertex_offset, uint16_
 		vertices += 2;
 	}
 
-	for (uint32_t i = 0; i < IMDD_WIRE_CYLINDER_SEGMENT_COUNT; ++i) {
+	for (uint32_t i = 0; i < segment_count; ++i) {
 		uint32_t const i0 = vertex_offset + 2*i;
 		uint32_t const i1 = i0 + 1;
-		uint32_t const i2 = vertex_offset + 2*((i + 1) % IMDD_WIRE_CYLINDER_SEGMENT_COUNT);
+		uint32_t const i2 = vertex_offset + 2*((i + 1) % segment_count);
 		uint32_t const i3 = i2 + 1;
 		indices[1] = (uint16_t)i2;
 		indices[0] = (uint16_t)i0;
@@ -451,28 +500,54 @@ void imdd_write_wire_cylinder(void *vertex_base, uint32_t vertex_offset, uint16_
 	}
 }
 
-typedef void (* imdd_write_mesh_func_t)(void *, uint32_t, uint16_t *);
+typedef void (* imdd_write_mesh_func_t)(void *, uint32_t, uint16_t *, uint32_t);
 
 typedef struct {
 	imdd_write_mesh_func_t write_mesh_func;
+	uint32_t tessellation;
 	uint32_t vertex_count;
 	uint32_t index_count;
 } imdd_mesh_desc_t;
 
+#define IMDD_FILLED_SPHERE_DESC(SUB)		\
+	{ &imdd_write_filled_sphere, (SUB), IMDD_FILLED_SPHERE_VERTEX_COUNT_FOR_SUB(SUB), IMDD_FILLED_SPHERE_INDEX_COUNT_FOR_SUB(SUB) }
+#define IMDD_FILLED_CONE_DESC(N)			\
+	{ &imdd_write_filled_cone, (N), IMDD_FILLED_CONE_VERTEX_COUNT_FOR_SEGMENTS(N), IMDD_FILLED_CONE_INDEX_COUNT_FOR_SEGMENTS(N) }
+#define IMDD_FILLED_CYLINDER_DESC(N)		\
+	{ &imdd_write_filled_cylinder, (N), IMDD_FILLED_CYLINDER_VERTEX_COUNT_FOR_SEGMENTS(N), IMDD_FILLED_CYLINDER_INDEX_COUNT_FOR_SEGMENTS(N) }
+#define IMDD_WIRE_SPHERE_DESC(SUB)			\
+	{ &imdd_write_wire_sphere, (SUB), IMDD_WIRE_SPHERE_VERTEX_COUNT_FOR_SUB(SUB), IMDD_WIRE_SPHERE_INDEX_COUNT_FOR_SUB(SUB) }
+#define IMDD_WIRE_CONE_DESC(N)				\
+	{ &imdd_write_wire_cone, (N), IMDD_WIRE_CONE_VERTEX_COUNT_FOR_SEGMENTS(N), IMDD_WIRE_CONE_INDEX_COUNT_FOR_SEGMENTS(N) }
+#define IMDD_WIRE_CYLINDER_DESC(N)			\
+	{ &imdd_write_wire_cylinder, (N), IMDD_WIRE_CYLINDER_VERTEX_COUNT_FOR_SEGMENTS(N), IMDD_WIRE_CYLINDER_INDEX_COUNT_FOR_SEGMENTS(N) }
+
 static imdd_mesh_desc_t const g_imdd_mesh_desc[IMDD_STYLE_COUNT][IMDD_MESH_COUNT] = {
 	// IMDD_STYLE_FILLED
 	{
-		{ &imdd_write_filled_box,		IMDD_FILLED_BOX_VERTEX_COUNT,		IMDD_FILLED_BOX_INDEX_COUNT },
-		{ &imdd_write_filled_sphere,	IMDD_FILLED_SPHERE_VERTEX_COUNT,	IMDD_FILLED_SPHERE_INDEX_COUNT },
-		{ &imdd_write_filled_cone,		IMDD_FILLED_CONE_VERTEX_COUNT,		IMDD_FILLED_CONE_INDEX_COUNT },
-		{ &imdd_write_filled_cylinder,	IMDD_FILLED_CYLINDER_VERTEX_COUNT,	IMDD_FILLED_CYLINDER_INDEX_COUNT }
+		{ &imdd_write_filled_box, 0, IMDD_FILLED_BOX_VERTEX_COUNT, IMDD_FILLED_BOX_INDEX_COUNT },
+		IMDD_FILLED_SPHERE_DESC(IMDD_FILLED_SPHERE_SUB),
+		IMDD_FILLED_CONE_DESC(IMDD_FILLED_CONE_SEGMENT_COUNT),
+		IMDD_FILLED_CYLINDER_DESC(IMDD_FILLED_CYLINDER_SEGMENT_COUNT),
+		IMDD_FILLED_SPHERE_DESC(IMDD_FILLED_SPHERE_LOD1_SUB),
+		IMDD_FILLED_CONE_DESC(IMDD_FILLED_CONE_LOD1_SEGMENT_COUNT),
+		IMDD_FILLED_CYLINDER_DESC(IMDD_FILLED_CYLINDER_LOD1_SEGMENT_COUNT),
+		IMDD_FILLED_SPHERE_DESC(IMDD_FILLED_SPHERE_LOD2_SUB),
+		IMDD_FILLED_CONE_DESC(IMDD_FILLED_CONE_LOD2_SEGMENT_COUNT),
+		IMDD_FILLED_CYLINDER_DESC(IMDD_FILLED_CYLINDER_LOD2_SEGMENT_COUNT)
 	},
 	// IMDD_STYLE_WIRE
 	{
-		{ &imdd_write_wire_box,			IMDD_WIRE_BOX_VERTEX_COUNT,			IMDD_WIRE_BOX_INDEX_COUNT },
-		{ &imdd_write_wire_sphere,		IMDD_WIRE_SPHERE_VERTEX_COUNT,		IMDD_WIRE_SPHERE_INDEX_COUNT },
-		{ &imdd_write_wire_cone,		IMDD_WIRE_CONE_VERTEX_COUNT,		IMDD_WIRE_CONE_INDEX_COUNT },
-		{ &imdd_write_wire_cylinder,	IMDD_WIRE_CYLINDER_VERTEX_COUNT,	IMDD_WIRE_CYLINDER_INDEX_COUNT }
+		{ &imdd_write_wire_box, 0, IMDD_WIRE_BOX_VERTEX_COUNT, IMDD_WIRE_BOX_INDEX_COUNT },
+		IMDD_WIRE_SPHERE_DESC(IMDD_WIRE_SPHERE_SUB),
+		IMDD_WIRE_CONE_DESC(IMDD_WIRE_CONE_SEGMENT_COUNT),
+		IMDD_WIRE_CYLINDER_DESC(IMDD_WIRE_CYLINDER_SEGMENT_COUNT),
+		IMDD_WIRE_SPHERE_DESC(IMDD_WIRE_SPHERE_LOD1_SUB),
+		IMDD_WIRE_CONE_DESC(IMDD_WIRE_CONE_LOD1_SEGMENT_COUNT),
+		IMDD_WIRE_CYLINDER_DESC(IMDD_WIRE_CYLINDER_LOD1_SEGMENT_COUNT),
+		IMDD_WIRE_SPHERE_DESC(IMDD_WIRE_SPHERE_LOD2_SUB),
+		IMDD_WIRE_CONE_DESC(IMDD_WIRE_CONE_LOD2_SEGMENT_COUNT),
+		IMDD_WIRE_CYLINDER_DESC(IMDD_WIRE_CYLINDER_LOD2_SEGMENT_COUNT)
 	}
 };
 
@@ -524,7 +599,8 @@ void imdd_mesh_layout_write(
 			mesh_desc->write_mesh_func(
 				vertices,
 				mesh_offsets->vertex_offset,
-				indices + mesh_offsets->index_offset);
+				indices + mesh_offsets->index_offset,
+				mesh_desc->tessellation);
 		}
 	}
 }
@@ -533,21 +609,31 @@ void imdd_mesh_layout_write(
 	Internal API for generating transforms and vertices for shapes.
    ------------------------------------------------------------------------- */
 
-#define IMDD_SHAPE_BUCKET_COUNT		(IMDD_SHAPE_COUNT << 3)
+// shapes reserved once the store is full are counted but have no header
+static inline
+uint32_t imdd_store_header_count(imdd_shape_store_t const *store)
+{
+	uint32_t const header_count = imdd_atomic_load(&store->header_count);
+	return (header_count < store->header_capacity) ? header_count : store->header_capacity;
+}
+
+// buckets of each layer follow the buckets of the previous one, so that layers are batched and drawn in order
+#define IMDD_LAYER_BUCKET_COUNT		(IMDD_SHAPE_COUNT << 3)
+#define IMDD_SHAPE_BUCKET_COUNT		(IMDD_LAYER_COUNT*IMDD_LAYER_BUCKET_COUNT)
 
 static inline
 uint32_t imdd_bucket_index_from_shape_header(imdd_shape_header_t header)
 {
 	union { imdd_shape_header_t header; uint32_t bits[2]; } u;
 	u.header = header;
-	return u.bits[0] & 0xffU;
+	return (u.bits[0] & 0x7fU) + ((u.bits[0] >> 7) & 0x3U)*IMDD_LAYER_BUCKET_COUNT;
 }
 
 static inline
 imdd_shape_header_t imdd_shape_header_from_bucket_index(uint32_t index)
 {
 	union { imdd_shape_header_t header; uint32_t bits[2]; } u;
-	u.bits[0] = index;
+	u.bits[0] = (index % IMDD_LAYER_BUCKET_COUNT) | ((index / IMDD_LAYER_BUCKET_COUNT) << 7);
 	u.bits[1] = 0;
 	return u.header;
 }
@@ -562,11 +648,35 @@ typedef struct {
 	uint32_t col;
 } imdd_instance_color_t;
 
+// compact formats for boxes and spheres, the w components of the box are unused
+typedef struct {
+	imdd_v4 centre;
+	imdd_v4 half_extent;
+} imdd_instance_box_t;
+
+typedef struct {
+	imdd_v4 centre_radius;
+} imdd_instance_sphere_t;
+
+// size of each format in imdd_v4
+#define IMDD_INSTANCE_TRANSFORM_QW_SIZE		3
+#define IMDD_INSTANCE_BOX_QW_SIZE			2
+#define IMDD_INSTANCE_SPHERE_QW_SIZE		1
+
 typedef struct {
 	imdd_v4 pos_col;
 	imdd_v4 normal_pad;
 } imdd_array_filled_vertex_t;
 
+// filled vertex without a normal, for renderers that compute normals from screen-space derivatives
+typedef struct {
+	imdd_v4 pos_col;
+} imdd_array_flat_vertex_t;
+
+// size of each filled vertex format in imdd_v4
+#define IMDD_ARRAY_FILLED_VERTEX_QW_SIZE	2
+#define IMDD_ARRAY_FLAT_VERTEX_QW_SIZE		1
+
 typedef struct {
 	imdd_v4 pos_col;
 } imdd_array_wire_vertex_t;
@@ -576,23 +686,77 @@ typedef struct {
 	uint32_t count;
 } imdd_batch_t;
 
+/*
+	Layout of the caller's own vertex buffers, so that conversion writes
+	each attribute directly to where the renderer reads it, instead of into
+	the buffers of imdd_emit_shapes.  Each attribute is at base + i*stride
+	for element i, so attributes can be interleaved or in separate buffers.
+	Batch offsets and counts are element indices in these buffers.
+
+	Each shape is converted by the usual kernel into a single element on the
+	stack, then each attribute of that element is stored to the layout, so
+	nothing is staged or copied again.  Instances are always written as
+	transforms, non-temporal stores are not used, and views and bounds are
+	not supported.
+*/
+typedef enum {
+	IMDD_ATTRIB_FORMAT_NONE,		// not written
+	IMDD_ATTRIB_FORMAT_FLOAT3,
+	IMDD_ATTRIB_FORMAT_FLOAT4,		// w is 1 for vertex positions
+	IMDD_ATTRIB_FORMAT_SNORM8X4,	// for normals, w is 0
+	IMDD_ATTRIB_FORMAT_UNORM8X4		// for colors, in the same byte order as the color of each shape
+} imdd_attrib_format_enum_t;
+
+typedef struct {
+	void *base;
+	uint32_t stride;
+	imdd_attrib_format_enum_t format;
+} imdd_emit_attrib_t;
+
 typedef struct {
-	imdd_instance_transform_t *begin;
-	imdd_instance_transform_t *current;
-	imdd_instance_transform_t *end;
+	imdd_emit_attrib_t instance_rows[3];		// rows of the transform, with the translation in w
+	imdd_emit_attrib_t instance_color;
+	imdd_emit_attrib_t filled_vertex_pos;
+	imdd_emit_attrib_t filled_vertex_normal;	// normals are not computed if this is not written
+	imdd_emit_attrib_t filled_vertex_color;
+	imdd_emit_attrib_t wire_vertex_pos;
+	imdd_emit_attrib_t wire_vertex_color;
+} imdd_emit_layout_t;
+
+// instances of any format, each instance is qw_size consecutive imdd_v4
+typedef struct {
+	imdd_v4 *begin;
+	imdd_v4 *current;
+	imdd_v4 *end;
 	imdd_instance_color_t *color;
+	uint32_t qw_size;
+
+	// when writing a layout, elements are stored to it from index instead of through the pointers above
+	imdd_emit_layout_t const *layout;
+	uint32_t index;
+	uint32_t index_end;
 } imdd_instance_stream_t;
 
+// filled vertices of either format, each vertex is qw_size consecutive imdd_v4
 typedef struct {
-	imdd_array_filled_vertex_t *begin;
-	imdd_array_filled_vertex_t *current;
-	imdd_array_filled_vertex_t *end;
+	imdd_v4 *begin;
+	imdd_v4 *current;
+	imdd_v4 *end;
+	uint32_t qw_size;
+
+	imdd_emit_layout_t const *layout;
+	uint32_t index;
+	uint32_t index_end;
 } imdd_filled_vertex_stream_t;
 
 typedef struct {
 	imdd_array_wire_vertex_t *begin;
 	imdd_array_wire_vertex_t *current;
 	imdd_array_wire_vertex_t *end;
+
+	imdd_emit_layout_t const *layout;
+	uint32_t index;
+	uint32_t index_end;
 } imdd_wire_vertex_stream_t;
 
 static
@@ -641,10 +805,27 @@ void imdd_emit_wire_triangle(imdd_wire_vertex_stream_t *stream, uint32_t col, im
 	stream->current = next;
 }
 
+static
+void imdd_emit_indexed_wire_triangle(imdd_wire_vertex_stream_t *stream, uint32_t col, imdd_v4 const *data)
+{
+	imdd_array_wire_vertex_t *const next = stream->current + 3;
+	if (next > stream->end) {
+		return;
+	}
+
+	imdd_v4 const tmp = imdd_v4_init_1f(imdd_asfloat(col));
+
+	imdd_array_wire_vertex_t *const vertices = stream->current;
+	vertices[0].pos_col = imdd_v4_set_w(data[0], tmp);
+	vertices[1].pos_col = imdd_v4_set_w(data[1], tmp);
+	vertices[2].pos_col = imdd_v4_set_w(data[2], tmp);
+	stream->current = next;
+}
+
 static
 void imdd_emit_filled_triangle(imdd_filled_vertex_stream_t *stream, uint32_t col, imdd_v4 const *data)
 {
-	imdd_array_filled_vertex_t *const next = stream->current + 3;
+	imdd_v4 *const next = stream->current + 3*IMDD_ARRAY_FILLED_VERTEX_QW_SIZE;
 	if (next > stream->end) {
 		return;
 	}
@@ -659,7 +840,7 @@ void imdd_emit_filled_triangle(imdd_filled_vertex_stream_t *stream, uint32_t col
 
 	imdd_v4 const tmp = imdd_v4_init_1f(imdd_asfloat(col));
 
-	imdd_array_filled_vertex_t *const vertices = stream->current;
+	imdd_array_filled_vertex_t *const vertices = (imdd_array_filled_vertex_t *)stream->current;
 	vertices[0].pos_col = imdd_v4_set_w(pos_a, tmp);
 	vertices[0].normal_pad = normal;
 	vertices[1].pos_col = imdd_v4_set_w(pos_b, tmp);
@@ -669,6 +850,23 @@ void imdd_emit_filled_triangle(imdd_filled_vertex_stream_t *stream, uint32_t col
 	stream->current = next;
 }
 
+static
+void imdd_emit_flat_triangle(imdd_filled_vertex_stream_t *stream, uint32_t col, imdd_v4 const *data)
+{
+	imdd_v4 *const next = stream->current + 3*IMDD_ARRAY_FLAT_VERTEX_QW_SIZE;
+	if (next > stream->end) {
+		return;
+	}
+
+	imdd_v4 const tmp = imdd_v4_init_1f(imdd_asfloat(col));
+
+	imdd_array_flat_vertex_t *const vertices = (imdd_array_flat_vertex_t *)stream->current;
+	vertices[0].pos_col = imdd_v4_set_w(data[0], tmp);
+	vertices[1].pos_col = imdd_v4_set_w(data[1], tmp);
+	vertices[2].pos_col = imdd_v4_set_w(data[2], tmp);
+	stream->current = next;
+}
+
 static
 void imdd_emit_aabb(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 const *data)
 {
@@ -691,8 +889,9 @@ void imdd_emit_aabb(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 const
 
 	imdd_v4_transpose_inplace(r0, r1, r2, r3);
 
-	imdd_instance_transform_t *transform = stream->current++;
+	imdd_instance_transform_t *transform = (imdd_instance_transform_t *)stream->current;
 	imdd_instance_color_t *color = stream->color++;
+	stream->current += IMDD_INSTANCE_TRANSFORM_QW_SIZE;
 
 	transform->row0 = r0;
 	transform->row1 = r1;
@@ -707,8 +906,9 @@ void imdd_emit_transform(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 c
 		return;
 	}
 
-	imdd_instance_transform_t *transform = stream->current++;
+	imdd_instance_transform_t *transform = (imdd_instance_transform_t *)stream->current;
 	imdd_instance_color_t *color = stream->color++;
+	stream->current += IMDD_INSTANCE_TRANSFORM_QW_SIZE;
 
 	transform->row0 = data[0];
 	transform->row1 = data[1];
@@ -723,8 +923,9 @@ void imdd_emit_sphere(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 cons
 		return;
 	}
 
-	imdd_instance_transform_t *transform = stream->current++;
+	imdd_instance_transform_t *transform = (imdd_instance_transform_t *)stream->current;
 	imdd_instance_color_t *color = stream->color++;
+	stream->current += IMDD_INSTANCE_TRANSFORM_QW_SIZE;
 
 	imdd_v4 const centre_radius = data[0];
 
@@ -743,27 +944,411 @@ void imdd_emit_sphere(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 cons
 	color->col = col;
 }
 
+static
+void imdd_emit_aabb_compact(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 const *data)
+{
+	if (stream->current == stream->end) {
+		return;
+	}
+
+	imdd_v4 const min = data[0];
+	imdd_v4 const max = data[1];
+
+	imdd_v4 const half = imdd_v4_const_0_5f();
+
+	imdd_instance_box_t *box = (imdd_instance_box_t *)stream->current;
+	imdd_instance_color_t *color = stream->color++;
+	stream->current += IMDD_INSTANCE_BOX_QW_SIZE;
+
+	box->centre = imdd_v4_mul(imdd_v4_add(max, min), half);
+	box->half_extent = imdd_v4_mul(imdd_v4_sub(max, min), half);
+	color->col = col;
+}
+
+static
+void imdd_emit_sphere_compact(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 const *data)
+{
+	if (stream->current == stream->end) {
+		return;
+	}
+
+	imdd_instance_sphere_t *sphere = (imdd_instance_sphere_t *)stream->current;
+	imdd_instance_color_t *color = stream->color++;
+	stream->current += IMDD_INSTANCE_SPHERE_QW_SIZE;
+
+	sphere->centre_radius = data[0];
+	color->col = col;
+}
+
+#ifdef IMDD_SIMD_V8
+
+static IMDD_AVX_TARGET
+void imdd_emit_line_avx(imdd_wire_vertex_stream_t *stream, uint32_t col, imdd_v4 const *data)
+{
+	imdd_array_wire_vertex_t *const next = stream->current + 2;
+	if (next > stream->end) {
+		return;
+	}
+
+	// start and end are adjacent so write both vertices at once
+	imdd_v8 const start_end = imdd_v8_loadu(data);
+	imdd_v8 const tmp = imdd_v8_init_1f(imdd_asfloat(col));
+
+	imdd_v8_storeu(stream->current, imdd_v8_set_w(start_end, tmp));
+	stream->current = next;
+}
+
+static IMDD_AVX_TARGET
+void imdd_emit_aabb_x2(imdd_instance_stream_t *stream, uint32_t col0, imdd_v4 const *data0, uint32_t col1, imdd_v4 const *data1)
+{
+	if (stream->end - stream->current < 2*IMDD_INSTANCE_TRANSFORM_QW_SIZE) {
+		imdd_emit_aabb(stream, col0, data0);
+		imdd_emit_aabb(stream, col1, data1);
+		return;
+	}
+
+	imdd_v8 const min = imdd_v8_init_2v4(data0[0], data1[0]);
+	imdd_v8 const max = imdd_v8_init_2v4(data0[1], data1[1]);
+
+	imdd_v8 const half = imdd_v8_const_0_5f();
+	imdd_v8 const centre = imdd_v8_mul(imdd_v8_add(max, min), half);
+	imdd_v8 const half_extent = imdd_v8_mul(imdd_v8_sub(max, min), half);
+
+	imdd_v8 const zero = imdd_v8_const_zero();
+	imdd_v8 r0 = imdd_v8_set_x(zero, half_extent);
+	imdd_v8 r1 = imdd_v8_set_y(zero, half_extent);
+	imdd_v8 r2 = imdd_v8_set_z(zero, half_extent);
+	imdd_v8 r3 = centre;
+
+	imdd_v8_transpose_inplace(r0, r1, r2, r3);
+
+	imdd_v8_store_rows_2x3(stream->current, r0, r1, r2);
+	stream->color[0].col = col0;
+	stream->color[1].col = col1;
+	stream->current += 2*IMDD_INSTANCE_TRANSFORM_QW_SIZE;
+	stream->color += 2;
+}
+
+static IMDD_AVX_TARGET
+void imdd_emit_sphere_x2(imdd_instance_stream_t *stream, uint32_t col0, imdd_v4 const *data0, uint32_t col1, imdd_v4 const *data1)
+{
+	if (stream->end - stream->current < 2*IMDD_INSTANCE_TRANSFORM_QW_SIZE) {
+		imdd_emit_sphere(stream, col0, data0);
+		imdd_emit_sphere(stream, col1, data1);
+		return;
+	}
+
+	imdd_v8 const centre_radius = imdd_v8_init_2v4(data0[0], data1[0]);
+
+	imdd_v8 const radius = imdd_v8_swiz_wwww(centre_radius);
+	imdd_v8 const zero = imdd_v8_const_zero();
+	imdd_v8 r0 = imdd_v8_set_x(zero, radius);
+	imdd_v8 r1 = imdd_v8_set_y(zero, radius);
+	imdd_v8 r2 = imdd_v8_set_z(zero, radius);
+	imdd_v8 r3 = centre_radius;
+
+	imdd_v8_transpose_inplace(r0, r1, r2, r3);
+
+	imdd_v8_store_rows_2x3(stream->current, r0, r1, r2);
+	stream->color[0].col = col0;
+	stream->color[1].col = col1;
+	stream->current += 2*IMDD_INSTANCE_TRANSFORM_QW_SIZE;
+	stream->color += 2;
+}
+
+static IMDD_AVX_TARGET
+void imdd_emit_aabb_compact_x2(imdd_instance_stream_t *stream, uint32_t col0, imdd_v4 const *data0, uint32_t col1, imdd_v4 const *data1)
+{
+	if (stream->end - stream->current < 2*IMDD_INSTANCE_BOX_QW_SIZE) {
+		imdd_emit_aabb_compact(stream, col0, data0);
+		imdd_emit_aabb_compact(stream, col1, data1);
+		return;
+	}
+
+	imdd_v8 const min = imdd_v8_init_2v4(data0[0], data1[0]);
+	imdd_v8 const max = imdd_v8_init_2v4(data0[1], data1[1]);
+
+	imdd_v8 const half = imdd_v8_const_0_5f();
+	imdd_v8 const centre = imdd_v8_mul(imdd_v8_add(max, min), half);
+	imdd_v8 const half_extent = imdd_v8_mul(imdd_v8_sub(max, min), half);
+
+	imdd_v8_store_rows_2x2(stream->current, centre, half_extent);
+	stream->color[0].col = col0;
+	stream->color[1].col = col1;
+	stream->current += 2*IMDD_INSTANCE_BOX_QW_SIZE;
+	stream->color += 2;
+}
+
+#endif // def IMDD_SIMD_V8
+
+// stores one attribute of element index, src is in memory so that it is forwarded from the kernel
+static inline
+void imdd_emit_attrib_store(imdd_emit_attrib_t const *attrib, uint32_t index, imdd_v4 const *src)
+{
+	uint8_t *const dst = (uint8_t *)attrib->base + (size_t)index*attrib->stride;
+	switch (attrib->format) {
+		case IMDD_ATTRIB_FORMAT_FLOAT3:
+			memcpy(dst, src, 3*sizeof(float));
+			break;
+
+		case IMDD_ATTRIB_FORMAT_FLOAT4:
+			memcpy(dst, src, 4*sizeof(float));
+			break;
+
+		case IMDD_ATTRIB_FORMAT_SNORM8X4: {
+			float f[4];
+			int8_t packed[4];
+			memcpy(f, src, sizeof(f));
+			for (uint32_t c = 0; c < 3; ++c) {
+				float const x = (f[c] < -1.f) ? -1.f : (f[c] > 1.f) ? 1.f : f[c];
+				packed[c] = (int8_t)(x*127.f + ((x < 0.f) ? -.5f : .5f));
+			}
+			packed[3] = 0;
+			memcpy(dst, packed, sizeof(packed));
+		} break;
+
+		default:
+			break;
+	}
+}
+
+static inline
+void imdd_emit_attrib_store_color(imdd_emit_attrib_t const *attrib, uint32_t index, uint32_t col)
+{
+	if (attrib->format == IMDD_ATTRIB_FORMAT_UNORM8X4) {
+		memcpy((uint8_t *)attrib->base + (size_t)index*attrib->stride, &col, sizeof(col));
+	}
+}
+
+// vertex positions are stored with w set to 1, the kernels keep the color of the vertex in w
+static inline
+void imdd_emit_layout_store_vertex(imdd_emit_attrib_t const *pos, imdd_emit_attrib_t const *color, uint32_t index, imdd_v4 *pos_col)
+{
+	uint32_t col;
+	memcpy(&col, (float const *)pos_col + 3, sizeof(col));
+	imdd_emit_attrib_store_color(color, index, col);
+	*pos_col = imdd_v4_set_w(*pos_col, imdd_v4_init_1f(1.f));
+	imdd_emit_attrib_store(pos, index, pos_col);
+}
+
+/*
+	Kernels that store to a layout run the kernel above into a single
+	element on the stack, then store each attribute of that element.  This
+	keeps each shape in one place, at the cost of one extra store and load
+	per vector that stays in L1.
+*/
+#define IMDD_EMIT_LAYOUT_INSTANCE(NAME, FUNC)														\
+	static																							\
+	void NAME(imdd_instance_stream_t *stream, uint32_t col, imdd_v4 const *data)					\
+	{																								\
+		if (stream->index == stream->index_end) {													\
+			return;																					\
+		}																							\
+		imdd_v4 rows[IMDD_INSTANCE_TRANSFORM_QW_SIZE];												\
+		imdd_instance_color_t color;																\
+		imdd_instance_stream_t tmp;																	\
+		tmp.begin = tmp.current = rows;																\
+		tmp.end = rows + IMDD_INSTANCE_TRANSFORM_QW_SIZE;											\
+		tmp.color = &color;																			\
+		tmp.qw_size = IMDD_INSTANCE_TRANSFORM_QW_SIZE;												\
+		FUNC(&tmp, col, data);																		\
+		imdd_emit_layout_t const *const layout = stream->layout;									\
+		uint32_t const index = stream->index++;														\
+		imdd_emit_attrib_store(&layout->instance_rows[0], index, &rows[0]);							\
+		imdd_emit_attrib_store(&layout->instance_rows[1], index, &rows[1]);							\
+		imdd_emit_attrib_store(&layout->instance_rows[2], index, &rows[2]);							\
+		imdd_emit_attrib_store_color(&layout->instance_color, index, color.col);					\
+	}
+
+#define IMDD_EMIT_LAYOUT_FILLED_VERTICES(NAME, FUNC, QW_SIZE)										\
+	static																							\
+	void NAME(imdd_filled_vertex_stream_t *stream, uint32_t col, imdd_v4 const *data)				\
+	{																								\
+		if (stream->index + 3 > stream->index_end) {												\
+			return;																					\
+		}																							\
+		imdd_v4 vertices[3*(QW_SIZE)];																\
+		imdd_filled_vertex_stream_t tmp;															\
+		tmp.begin = tmp.current = vertices;															\
+		tmp.end = vertices + 3*(QW_SIZE);															\
+		tmp.qw_size = (QW_SIZE);																	\
+		FUNC(&tmp, col, data);																		\
+		imdd_emit_layout_t const *const layout = stream->layout;									\
+		for (uint32_t i = 0; i < 3; ++i) {															\
+			uint32_t const index = stream->index++;													\
+			if ((QW_SIZE) > 1) {																	\
+				imdd_emit_attrib_store(                                                                     \
+					&layout->filled_vertex_normal, index, &vertices[i*(QW_SIZE) + 1]);                         \
+			}																						\
+			imdd_emit_layout_store_vertex(                                                               \
+				&layout->filled_vertex_pos, &layout->filled_vertex_color, index, &vertices[i*(QW_SIZE)]);   \
+		}																							\
+	}
+
+#define IMDD_EMIT_LAYOUT_WIRE_VERTICES(NAME, FUNC, VERTEX_COUNT)									\
+	static																							\
+	void NAME(imdd_wire_vertex_stream_t *stream, uint32_t col, imdd_v4 const *data)				\
+	{																								\
+		if (stream->index + (VERTEX_COUNT) > stream->index_end) {									\
+			return;																					\
+		}																							\
+		imdd_array_wire_vertex_t vertices[VERTEX_COUNT];											\
+		imdd_wire_vertex_stream_t tmp;																\
+		tmp.begin = tmp.current = vertices;															\
+		tmp.end = vertices + (VERTEX_COUNT);														\
+		FUNC(&tmp, col, data);																		\
+		imdd_emit_layout_t const *const layout = stream->layout;									\
+		for (uint32_t i = 0; i < (VERTEX_COUNT); ++i) {												\
+			imdd_emit_layout_store_vertex(                                                               \
+				&layout->wire_vertex_pos, &layout->wire_vertex_color, stream->index++, &vertices[i].pos_col);\
+		}																							\
+	}
+
+IMDD_EMIT_LAYOUT_INSTANCE(imdd_emit_aabb_layout, imdd_emit_aabb)
+IMDD_EMIT_LAYOUT_INSTANCE(imdd_emit_transform_layout, imdd_emit_transform)
+IMDD_EMIT_LAYOUT_INSTANCE(imdd_emit_sphere_layout, imdd_emit_sphere)
+IMDD_EMIT_LAYOUT_FILLED_VERTICES(imdd_emit_filled_triangle_layout, imdd_emit_filled_triangle, IMDD_ARRAY_FILLED_VERTEX_QW_SIZE)
+IMDD_EMIT_LAYOUT_FILLED_VERTICES(imdd_emit_flat_triangle_layout, imdd_emit_flat_triangle, IMDD_ARRAY_FLAT_VERTEX_QW_SIZE)
+IMDD_EMIT_LAYOUT_WIRE_VERTICES(imdd_emit_line_layout, imdd_emit_line, 2)
+IMDD_EMIT_LAYOUT_WIRE_VERTICES(imdd_emit_wire_triangle_layout, imdd_emit_wire_triangle, 6)
+IMDD_EMIT_LAYOUT_WIRE_VERTICES(imdd_emit_indexed_wire_triangle_layout, imdd_emit_indexed_wire_triangle, 3)
+
+// array batches of each layer follow the batches of the previous one
+static inline
+uint32_t imdd_array_batch_index(uint32_t layer, imdd_blend_enum_t blend, imdd_zmode_enum_t zmode)
+{
+	return (layer << 3) | (blend << 1) | zmode;
+}
+
+// wire triangles written with IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES use the upper half of the wire array batches of a layer, filled arrays only use the lower half
+static inline
+uint32_t imdd_array_wire_triangle_batch_index(uint32_t layer, imdd_blend_enum_t blend, imdd_zmode_enum_t zmode)
+{
+	return (layer << 3) | (1 << 2) | (blend << 1) | zmode;
+}
+
+#define IMDD_ARRAY_BATCH_COUNT			(IMDD_LAYER_COUNT << 3)
+
+/*
+	Indexed wire triangles are 3 vertices each, drawn as lines using a
+	fixed pattern of indices.  The pattern covers a block of triangles
+	with 16-bit indices, so larger batches are drawn as several blocks
+	with a base vertex of 3*IMDD_WIRE_TRIANGLE_BLOCK_SIZE apart.
+*/
+#define IMDD_WIRE_TRIANGLE_BLOCK_SIZE		4096
+#define IMDD_WIRE_TRIANGLE_INDEX_COUNT		(6*IMDD_WIRE_TRIANGLE_BLOCK_SIZE)
+
+static inline
+void imdd_wire_triangle_indices_write(uint16_t *indices)
+{
+	for (uint32_t i = 0; i < IMDD_WIRE_TRIANGLE_BLOCK_SIZE; ++i) {
+		uint16_t const base = (uint16_t)(3*i);
+		indices[0] = base;
+		indices[1] = base + 1;
+		indices[2] = base + 1;
+		indices[3] = base + 2;
+		indices[4] = base + 2;
+		indices[5] = base;
+		indices += 6;
+	}
+}
+
+/*
+	Instance batches are grouped by format.  Every mesh has a group of
+	batches for transforms, then boxes have a group for the compact box
+	format, then each sphere LOD has a group for the compact sphere format.
+	Compact formats are only written with IMDD_EMIT_FLAG_COMPACT_INSTANCES.
+
+	Instances of all formats share the transform buffer, packed one group
+	after another.  Instance i of a format is at imdd_v4 offset
+	imdd_instance_format_qw_bias() + i*qw_size of the transform buffer, so
+	the same instance index can be used for both transforms and colors.
+*/
+typedef enum {
+	IMDD_INSTANCE_FORMAT_TRANSFORM,		// imdd_instance_transform_t
+	IMDD_INSTANCE_FORMAT_BOX,			// imdd_instance_box_t
+	IMDD_INSTANCE_FORMAT_SPHERE,		// imdd_instance_sphere_t
+	IMDD_INSTANCE_FORMAT_COUNT
+} imdd_instance_format_enum_t;
+
+typedef struct {
+	imdd_instance_format_enum_t format;
+	imdd_mesh_enum_t mesh;
+} imdd_instance_group_t;
+
+#define IMDD_INSTANCE_GROUP_BOX			IMDD_MESH_COUNT
+#define IMDD_INSTANCE_GROUP_SPHERE		(IMDD_INSTANCE_GROUP_BOX + 1)		// then one group per LOD
+#define IMDD_INSTANCE_GROUP_COUNT		(IMDD_INSTANCE_GROUP_SPHERE + IMDD_MESH_LOD_COUNT)
+
+static imdd_instance_group_t const g_imdd_instance_groups[IMDD_INSTANCE_GROUP_COUNT] = {
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_BOX },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_SPHERE },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_CONE },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_CYLINDER },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_SPHERE_LOD1 },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_CONE_LOD1 },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_CYLINDER_LOD1 },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_SPHERE_LOD2 },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_CONE_LOD2 },
+	{ IMDD_INSTANCE_FORMAT_TRANSFORM, IMDD_MESH_CYLINDER_LOD2 },
+	{ IMDD_INSTANCE_FORMAT_BOX, IMDD_MESH_BOX },
+	{ IMDD_INSTANCE_FORMAT_SPHERE, IMDD_MESH_SPHERE },
+	{ IMDD_INSTANCE_FORMAT_SPHERE, IMDD_MESH_SPHERE_LOD1 },
+	{ IMDD_INSTANCE_FORMAT_SPHERE, IMDD_MESH_SPHERE_LOD2 }
+};
+
+static uint32_t const g_imdd_instance_format_qw_size[IMDD_INSTANCE_FORMAT_COUNT] = {
+	IMDD_INSTANCE_TRANSFORM_QW_SIZE,
+	IMDD_INSTANCE_BOX_QW_SIZE,
+	IMDD_INSTANCE_SPHERE_QW_SIZE
+};
+
+// each group has batches for every layer, so that formats stay packed one after another
+#define IMDD_INSTANCE_BATCH_COUNT		((IMDD_INSTANCE_GROUP_COUNT*IMDD_LAYER_COUNT) << 3)
+
+static inline
+uint32_t imdd_instance_group_batch_index(uint32_t group, uint32_t layer, imdd_style_enum_t style, imdd_blend_enum_t blend, imdd_zmode_enum_t zmode)
+{
+	return ((group*IMDD_LAYER_COUNT + layer) << 3) | (style << 2) | (blend << 1) | zmode;
+}
+
 static inline
-uint32_t imdd_instance_batch_index(imdd_mesh_enum_t mesh, imdd_style_enum_t style, imdd_blend_enum_t blend, imdd_zmode_enum_t zmode)
+uint32_t imdd_instance_group_from_batch_index(uint32_t batch_index)
 {
-	return (mesh << 3) | (style << 2) | (blend << 1) | zmode;
+	return (batch_index >> 3)/IMDD_LAYER_COUNT;
 }
 
+// offset in imdd_v4 of instance 0 of a format, from the batch offsets written by conversion
 static inline
-uint32_t imdd_array_batch_index(imdd_blend_enum_t blend, imdd_zmode_enum_t zmode)
+uint32_t imdd_instance_format_qw_bias(imdd_batch_t const *instance_batches, imdd_instance_format_enum_t format)
 {
-	return (blend << 1) | zmode;
+	// each format starts where the previous one ends, formats get smaller so this is never negative
+	uint32_t const box_begin = instance_batches[(IMDD_INSTANCE_GROUP_BOX*IMDD_LAYER_COUNT) << 3].offset;
+	uint32_t const sphere_begin = instance_batches[(IMDD_INSTANCE_GROUP_SPHERE*IMDD_LAYER_COUNT) << 3].offset;
+	uint32_t const box_bias = box_begin*(IMDD_INSTANCE_TRANSFORM_QW_SIZE - IMDD_INSTANCE_BOX_QW_SIZE);
+	uint32_t const sphere_bias = box_bias + sphere_begin*(IMDD_INSTANCE_BOX_QW_SIZE - IMDD_INSTANCE_SPHERE_QW_SIZE);
+	switch (format) {
+		case IMDD_INSTANCE_FORMAT_BOX:		return box_bias;
+		case IMDD_INSTANCE_FORMAT_SPHERE:	return sphere_bias;
+		default:							return 0;
+	}
 }
 
-#define IMDD_INSTANCE_BATCH_COUNT		(IMDD_MESH_COUNT << 3)
-#define IMDD_ARRAY_BATCH_COUNT			4
+// imdd_v4 used in the transform buffer, at most IMDD_INSTANCE_TRANSFORM_QW_SIZE per instance
+static inline
+uint32_t imdd_instance_qw_count(imdd_batch_t const *instance_batches, uint32_t instance_count)
+{
+	return imdd_instance_format_qw_bias(instance_batches, IMDD_INSTANCE_FORMAT_SPHERE) + instance_count*IMDD_INSTANCE_SPHERE_QW_SIZE;
+}
 
 typedef void (* imdd_emit_instance_func_t)(imdd_instance_stream_t *, uint32_t color, imdd_v4 const *);
+typedef void (* imdd_emit_instance_x2_func_t)(imdd_instance_stream_t *, uint32_t color0, imdd_v4 const *, uint32_t color1, imdd_v4 const *);
 typedef void (* imdd_emit_filled_vertex_func_t)(imdd_filled_vertex_stream_t *, uint32_t color, imdd_v4 const *);
 typedef void (* imdd_emit_wire_vertex_func_t)(imdd_wire_vertex_stream_t *, uint32_t color, imdd_v4 const *);
 
 typedef struct {
 	imdd_emit_instance_func_t instance_func;
+	imdd_emit_instance_x2_func_t instance_x2_func;	// optional, emits 2 shapes from the same bucket
 	imdd_emit_filled_vertex_func_t filled_vertex_func;
 	imdd_emit_wire_vertex_func_t wire_vertex_func;
 	uint32_t filled_vertex_count;
@@ -771,181 +1356,3235 @@ typedef struct {
 } imdd_emit_desc_t;
 
 static imdd_emit_desc_t const g_imdd_emit_instance_desc[IMDD_SHAPE_COUNT] = {
-	{ NULL, NULL, &imdd_emit_line, 0, 2 },									// IMDD_SHAPE_LINE
-	{ NULL, &imdd_emit_filled_triangle, &imdd_emit_wire_triangle, 3, 6 },	// IMDD_SHAPE_TRIANGLE
-	{ &imdd_emit_aabb, NULL, NULL, 0, 0 },									// IMDD_SHAPE_AABB
-	{ &imdd_emit_transform, NULL, NULL, 0, 0 },								// IMDD_SHAPE_OBB
-	{ &imdd_emit_sphere, NULL, NULL, 0, 0 },								// IMDD_SHAPE_SPHERE
-	{ &imdd_emit_transform, NULL, NULL, 0, 0 },								// IMDD_SHAPE_ELLIPSOID
-	{ &imdd_emit_transform, NULL, NULL, 0, 0 },								// IMDD_SHAPE_CONE
-	{ &imdd_emit_transform, NULL, NULL, 0, 0 }								// IMDD_SHAPE_CYLINDER
+	{ NULL, NULL, NULL, &imdd_emit_line, 0, 2 },									// IMDD_SHAPE_LINE
+	{ NULL, NULL, &imdd_emit_filled_triangle, &imdd_emit_wire_triangle, 3, 6 },	// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb, NULL, NULL, NULL, 0, 0 },									// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere, NULL, NULL, NULL, 0, 0 },									// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 }								// IMDD_SHAPE_CYLINDER
 };
 
-static
-void imdd_emit_shapes(
-	imdd_shape_store_t const *const *stores,
-	uint32_t store_count,
+static imdd_emit_desc_t const g_imdd_emit_compact_instance_desc[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, NULL, &imdd_emit_line, 0, 2 },									// IMDD_SHAPE_LINE
+	{ NULL, NULL, &imdd_emit_filled_triangle, &imdd_emit_wire_triangle, 3, 6 },	// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_compact, NULL, NULL, NULL, 0, 0 },							// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_compact, NULL, NULL, NULL, 0, 0 },							// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 }								// IMDD_SHAPE_CYLINDER
+};
 
-	imdd_instance_transform_t *instance_transform_buf,
-	imdd_instance_color_t *instance_color_buf,
-	uint32_t instance_capacity,
-	imdd_batch_t *instance_batches,
-	uint32_t *instance_count,
+#ifdef IMDD_SIMD_V8
+static imdd_emit_desc_t const g_imdd_emit_instance_desc_avx[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, NULL, &imdd_emit_line_avx, 0, 2 },								// IMDD_SHAPE_LINE
+	{ NULL, NULL, &imdd_emit_filled_triangle, &imdd_emit_wire_triangle, 3, 6 },	// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb, &imdd_emit_aabb_x2, NULL, NULL, 0, 0 },						// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere, &imdd_emit_sphere_x2, NULL, NULL, 0, 0 },					// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 }								// IMDD_SHAPE_CYLINDER
+};
 
-	imdd_array_filled_vertex_t *filled_vertex_buf,
-	uint32_t filled_vertex_capacity,
-	imdd_batch_t *filled_array_batches,
-	uint32_t *filled_vertex_count,
+static imdd_emit_desc_t const g_imdd_emit_compact_instance_desc_avx[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, NULL, &imdd_emit_line_avx, 0, 2 },								// IMDD_SHAPE_LINE
+	{ NULL, NULL, &imdd_emit_filled_triangle, &imdd_emit_wire_triangle, 3, 6 },	// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_compact, &imdd_emit_aabb_compact_x2, NULL, NULL, 0, 0 },		// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_compact, NULL, NULL, NULL, 0, 0 },							// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 },								// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform, NULL, NULL, NULL, 0, 0 }								// IMDD_SHAPE_CYLINDER
+};
+#endif
 
-	imdd_array_wire_vertex_t *wire_vertex_buf,
-	uint32_t wire_vertex_capacity,
-	imdd_batch_t *wire_array_batches,
-	uint32_t *wire_vertex_count)
+// the layout kernels store transforms, and replace the triangle kernels when the flags do
+static imdd_emit_desc_t const g_imdd_emit_layout_desc[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, NULL, &imdd_emit_line_layout, 0, 2 },											// IMDD_SHAPE_LINE
+	{ NULL, NULL, &imdd_emit_filled_triangle_layout, &imdd_emit_wire_triangle_layout, 3, 6 },	// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_layout, NULL, NULL, NULL, 0, 0 },										// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform_layout, NULL, NULL, NULL, 0, 0 },									// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_layout, NULL, NULL, NULL, 0, 0 },										// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform_layout, NULL, NULL, NULL, 0, 0 },									// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform_layout, NULL, NULL, NULL, 0, 0 },									// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform_layout, NULL, NULL, NULL, 0, 0 }									// IMDD_SHAPE_CYLINDER
+};
+
+/*
+	The conversion kernels are chosen at runtime based on the CPU, so a
+	single binary can use wider SIMD where available.  The CPU is checked
+	each time conversion starts, which costs a cpuid or two per call, so
+	no state is shared between threads or translation units.  Only ISAs
+	with distinct kernels are listed: SSE4.1 machines use the SSE2 kernels
+	and AVX2/AVX-512 machines use the AVX kernels, since tables for these
+	would only repeat an existing one.  IMDD_EMIT_FLAG_DEFAULT_SIMD forces
+	the imdd_v4 kernels, for example to compare the levels.
+*/
+typedef enum {
+	IMDD_SIMD_LEVEL_DEFAULT,	// imdd_v4 kernels only
+	IMDD_SIMD_LEVEL_AVX,		// imdd_v8 kernels for boxes, spheres and lines
+	IMDD_SIMD_LEVEL_COUNT		// keep last
+} imdd_simd_level_enum_t;
+
+static inline
+imdd_simd_level_enum_t imdd_emit_detect_simd_level(void)
 {
-	// partition the shapes into buckets and count them
-	uint32_t bucket_sizes[IMDD_SHAPE_BUCKET_COUNT];
-	memset(bucket_sizes, 0, IMDD_SHAPE_BUCKET_COUNT*sizeof(uint32_t));
-	for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
-		imdd_shape_store_t const *const store = stores[store_index];
-		uint32_t header_count = imdd_atomic_load(&store->header_count);
-		for (uint32_t header_offset = 0; header_offset < header_count; ++header_offset) {
-			imdd_shape_header_t const header = store->header_store[header_offset];
-			if (header.shape >= IMDD_SHAPE_COUNT) {
-				continue;
-			}
-			uint32_t const bucket_index = imdd_bucket_index_from_shape_header(header);
-			++bucket_sizes[bucket_index];
-		}
+#ifdef IMDD_SIMD_V8
+	if (imdd_simd_has_avx()) {
+		return IMDD_SIMD_LEVEL_AVX;
 	}
+#endif
+	return IMDD_SIMD_LEVEL_DEFAULT;
+}
 
-	// count vertices and instances
-	uint32_t instance_counts[IMDD_INSTANCE_BATCH_COUNT];
-	uint32_t filled_vertex_counts[IMDD_ARRAY_BATCH_COUNT];
-	uint32_t wire_vertex_counts[IMDD_ARRAY_BATCH_COUNT];
-	memset(instance_counts, 0, IMDD_INSTANCE_BATCH_COUNT*sizeof(uint32_t));
-	memset(filled_vertex_counts, 0, IMDD_ARRAY_BATCH_COUNT*sizeof(uint32_t));
-	memset(wire_vertex_counts, 0, IMDD_ARRAY_BATCH_COUNT*sizeof(uint32_t));
-	for (uint32_t bucket_index = 0; bucket_index < IMDD_SHAPE_BUCKET_COUNT; ++bucket_index) {
-		imdd_shape_header_t const header = imdd_shape_header_from_bucket_index(bucket_index);
-		if (header.shape >= IMDD_SHAPE_COUNT) {
-			continue;
-		}
+static inline
+imdd_emit_desc_t const *imdd_emit_get_desc_table(imdd_simd_level_enum_t simd_level, int compact)
+{
+#ifdef IMDD_SIMD_V8
+	if (simd_level == IMDD_SIMD_LEVEL_AVX) {
+		return compact ? g_imdd_emit_compact_instance_desc_avx : g_imdd_emit_instance_desc_avx;
+	}
+#else
+	(void)simd_level;
+#endif
+	return compact ? g_imdd_emit_compact_instance_desc : g_imdd_emit_instance_desc;
+}
 
-		imdd_emit_desc_t const *const desc = g_imdd_emit_instance_desc + header.shape;
-		imdd_style_enum_t const style = (imdd_style_enum_t)header.style;
-		imdd_blend_enum_t const blend = (imdd_blend_enum_t)header.blend;
-		imdd_zmode_enum_t const zmode = (imdd_zmode_enum_t)header.zmode;
-		uint32_t const bucket_size = bucket_sizes[bucket_index];
+/*
+	View frustum for culling during conversion, stored as 8 planes (the
+	last 2 never cull) with each component in a separate vector so that
+	4 planes are tested at once.  Points p with dot(normal, p) + offset
+	less than zero are outside.
+*/
+typedef struct {
+	imdd_v4 normal_x[2];
+	imdd_v4 normal_y[2];
+	imdd_v4 normal_z[2];
+	imdd_v4 offset[2];
+} imdd_frustum_t;
 
-		if (desc->instance_func) {
-			imdd_mesh_enum_t const mesh = g_imdd_mesh_from_shape[header.shape];
-			uint32_t const batch_index = imdd_instance_batch_index(mesh, style, blend, zmode);
-			instance_counts[batch_index] += bucket_size;
-		}
-		if (desc->filled_vertex_func && style == IMDD_STYLE_FILLED) {
-			uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-			filled_vertex_counts[batch_index] += bucket_size*desc->filled_vertex_count;
+/*
+	Extracts the planes from a column major projection matrix.  Clip space
+	depth is assumed to be in [-w, w], which is conservative for matrices
+	that use [0, w] (or reversed) depth.
+*/
+static inline
+void imdd_frustum_init(imdd_frustum_t *frustum, float const *proj_from_world)
+{
+	float planes[8][4];
+	for (uint32_t plane_index = 0; plane_index < 6; ++plane_index) {
+		uint32_t const row = plane_index >> 1;
+		float const sign = (plane_index & 1) ? -1.f : 1.f;
+		float *const plane = planes[plane_index];
+		for (uint32_t col = 0; col < 4; ++col) {
+			plane[col] = proj_from_world[4*col + 3] + sign*proj_from_world[4*col + row];
 		}
-		if (desc->wire_vertex_func && style == IMDD_STYLE_WIRE) {
-			uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-			wire_vertex_counts[batch_index] += bucket_size*desc->wire_vertex_count;
+
+		// normalize so that distances can be compared to sphere radii
+		float const len = sqrtf(plane[0]*plane[0] + plane[1]*plane[1] + plane[2]*plane[2]);
+		if (len > 0.f) {
+			plane[0] /= len;
+			plane[1] /= len;
+			plane[2] /= len;
+			plane[3] /= len;
+		} else {
+			plane[0] = plane[1] = plane[2] = 0.f;
+			plane[3] = 1.f;
 		}
 	}
+	for (uint32_t plane_index = 6; plane_index < 8; ++plane_index) {
+		planes[plane_index][0] = planes[plane_index][1] = planes[plane_index][2] = 0.f;
+		planes[plane_index][3] = 1.f;
+	}
+	for (uint32_t group = 0; group < 2; ++group) {
+		float const (*const p)[4] = planes + 4*group;
+		frustum->normal_x[group] = imdd_v4_init_4f(p[0][0], p[1][0], p[2][0], p[3][0]);
+		frustum->normal_y[group] = imdd_v4_init_4f(p[0][1], p[1][1], p[2][1], p[3][1]);
+		frustum->normal_z[group] = imdd_v4_init_4f(p[0][2], p[1][2], p[2][2], p[3][2]);
+		frustum->offset[group] = imdd_v4_init_4f(p[0][3], p[1][3], p[2][3], p[3][3]);
+	}
+}
 
-	// partition the buffers between draw calls
-	imdd_instance_stream_t instance_streams[IMDD_INSTANCE_BATCH_COUNT];
-	imdd_filled_vertex_stream_t filled_vertex_streams[IMDD_ARRAY_BATCH_COUNT];
-	imdd_wire_vertex_stream_t wire_vertex_streams[IMDD_ARRAY_BATCH_COUNT];
-	uint32_t end_offset;
+// dot(normal, v) for 4 planes of the frustum
+static inline
+imdd_v4 imdd_frustum_dot(imdd_frustum_t const *frustum, uint32_t group, imdd_v4 v)
+{
+	imdd_v4 d = imdd_v4_mul(frustum->normal_x[group], imdd_v4_swiz_xxxx(v));
+	d = imdd_v4_add(d, imdd_v4_mul(frustum->normal_y[group], imdd_v4_swiz_yyyy(v)));
+	d = imdd_v4_add(d, imdd_v4_mul(frustum->normal_z[group], imdd_v4_swiz_zzzz(v)));
+	return d;
+}
 
-	end_offset = 0;
-	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
-		uint32_t const start_offset = end_offset;
-		end_offset += instance_counts[batch_index];
-		if (end_offset > instance_capacity) {
-			end_offset = instance_capacity;
+// returns non-zero unless all the points are outside the same plane
+static
+int imdd_frustum_test_points(imdd_frustum_t const *frustum, imdd_v4 const *points, uint32_t point_count)
+{
+	for (uint32_t group = 0; group < 2; ++group) {
+		imdd_v4 dist = imdd_frustum_dot(frustum, group, points[0]);
+		for (uint32_t point_index = 1; point_index < point_count; ++point_index) {
+			dist = imdd_v4_max(dist, imdd_frustum_dot(frustum, group, points[point_index]));
 		}
-		instance_streams[batch_index].begin = instance_transform_buf + start_offset;
-		instance_streams[batch_index].current = instance_transform_buf + start_offset;
-		instance_streams[batch_index].end = instance_transform_buf + end_offset;
-		instance_streams[batch_index].color = instance_color_buf + start_offset;
-	}
-	*instance_count = end_offset;
-
-	end_offset = 0;
-	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
-		uint32_t const start_offset = end_offset;
-		end_offset += filled_vertex_counts[batch_index];
-		if (end_offset > filled_vertex_capacity) {
-			end_offset = filled_vertex_capacity;
+		if (imdd_v4_signmask(imdd_v4_add(dist, frustum->offset[group])) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// returns non-zero unless the box (centre plus or minus each half axis) is outside a plane
+static
+int imdd_frustum_test_box(imdd_frustum_t const *frustum, imdd_v4 centre, imdd_v4 half_axis0, imdd_v4 half_axis1, imdd_v4 half_axis2)
+{
+	for (uint32_t group = 0; group < 2; ++group) {
+		imdd_v4 dist = imdd_v4_add(imdd_frustum_dot(frustum, group, centre), frustum->offset[group]);
+		dist = imdd_v4_add(dist, imdd_v4_abs(imdd_frustum_dot(frustum, group, half_axis0)));
+		dist = imdd_v4_add(dist, imdd_v4_abs(imdd_frustum_dot(frustum, group, half_axis1)));
+		dist = imdd_v4_add(dist, imdd_v4_abs(imdd_frustum_dot(frustum, group, half_axis2)));
+		if (imdd_v4_signmask(dist) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// returns non-zero unless the sphere (radius in w) is outside a plane
+static
+int imdd_frustum_test_sphere(imdd_frustum_t const *frustum, imdd_v4 centre_radius)
+{
+	imdd_v4 const radius = imdd_v4_swiz_wwww(centre_radius);
+	for (uint32_t group = 0; group < 2; ++group) {
+		imdd_v4 dist = imdd_v4_add(imdd_frustum_dot(frustum, group, centre_radius), frustum->offset[group]);
+		dist = imdd_v4_add(dist, radius);
+		if (imdd_v4_signmask(dist) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// returns non-zero if the shape could be visible in any of the frustums, using the bounds of its mesh
+static
+int imdd_frustum_test_shape(imdd_frustum_t const *frustums, uint32_t frustum_count, imdd_shape_enum_t shape, imdd_v4 const *data)
+{
+	for (uint32_t frustum_index = 0; frustum_index < frustum_count; ++frustum_index) {
+		imdd_frustum_t const *const frustum = &frustums[frustum_index];
+		int visible;
+		switch (shape) {
+			case IMDD_SHAPE_LINE:
+				visible = imdd_frustum_test_points(frustum, data, 2);
+				break;
+
+			case IMDD_SHAPE_TRIANGLE:
+				visible = imdd_frustum_test_points(frustum, data, 3);
+				break;
+
+			case IMDD_SHAPE_AABB: {
+				imdd_v4 const half = imdd_v4_const_0_5f();
+				imdd_v4 const centre = imdd_v4_mul(imdd_v4_add(data[1], data[0]), half);
+				imdd_v4 const half_extent = imdd_v4_mul(imdd_v4_sub(data[1], data[0]), half);
+				imdd_v4 const zero = imdd_v4_const_zero();
+				visible = imdd_frustum_test_box(
+					frustum,
+					centre,
+					imdd_v4_set_x(zero, half_extent),
+					imdd_v4_set_y(zero, half_extent),
+					imdd_v4_set_z(zero, half_extent));
+			} break;
+
+			case IMDD_SHAPE_SPHERE:
+				visible = imdd_frustum_test_sphere(frustum, data[0]);
+				break;
+
+			default: {
+				// all meshes fit within [-1, 1] on each axis of the transform
+				imdd_v4 x_axis = data[0];
+				imdd_v4 y_axis = data[1];
+				imdd_v4 z_axis = data[2];
+				imdd_v4 centre = imdd_v4_const_zero();
+				imdd_v4_transpose_inplace(x_axis, y_axis, z_axis, centre);
+				visible = imdd_frustum_test_box(frustum, centre, x_axis, y_axis, z_axis);
+			} break;
+		}
+		if (visible) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// returns non-zero if a converted instance could be visible in the frustum
+static
+int imdd_frustum_test_instance(imdd_frustum_t const *frustum, imdd_instance_format_enum_t format, imdd_v4 const *data)
+{
+	switch (format) {
+		case IMDD_INSTANCE_FORMAT_BOX: {
+			imdd_v4 const zero = imdd_v4_const_zero();
+			return imdd_frustum_test_box(
+				frustum,
+				data[0],
+				imdd_v4_set_x(zero, data[1]),
+				imdd_v4_set_y(zero, data[1]),
+				imdd_v4_set_z(zero, data[1]));
+		}
+
+		case IMDD_INSTANCE_FORMAT_SPHERE:
+			return imdd_frustum_test_sphere(frustum, data[0]);
+
+		default: {
+			imdd_v4 x_axis = data[0];
+			imdd_v4 y_axis = data[1];
+			imdd_v4 z_axis = data[2];
+			imdd_v4 centre = imdd_v4_const_zero();
+			imdd_v4_transpose_inplace(x_axis, y_axis, z_axis, centre);
+			return imdd_frustum_test_box(frustum, centre, x_axis, y_axis, z_axis);
+		}
+	}
+}
+
+/*
+	Camera for picking lower detail meshes for curved shapes that are small
+	on screen.  pixels_per_unit is the projected size in pixels of a unit
+	length at unit distance, which is viewport_height/(2*tan(fov_y/2)) for a
+	perspective projection.  The default thresholds keep the error from the
+	coarser tessellation to around a pixel.
+
+	Instanced shapes with a projected radius below min_pixel_radius are not
+	drawn as meshes at all.  They are skipped, or drawn as a line about a
+	pixel long using IMDD_EMIT_FLAG_SMALL_AS_POINTS.
+*/
+typedef struct {
+	float eye_pos[3];
+	float pixels_per_unit;
+	float min_pixel_radius;		// zero to draw all shapes as meshes
+} imdd_emit_lod_t;
+
+#ifndef IMDD_EMIT_LOD1_PIXEL_RADIUS
+#define IMDD_EMIT_LOD1_PIXEL_RADIUS		24.f
+#endif
+#ifndef IMDD_EMIT_LOD2_PIXEL_RADIUS
+#define IMDD_EMIT_LOD2_PIXEL_RADIUS		8.f
+#endif
+
+// write with non-temporal stores, for output buffers in write-combined or uncached memory
+#define IMDD_EMIT_FLAG_NON_TEMPORAL		(1 << 0)
+
+// sort shapes by type in blocks before converting, the order of shapes within a batch can change
+#define IMDD_EMIT_FLAG_SORTED			(1 << 1)
+
+// draw shapes below the minimum size of the LOD camera as points in the wire vertex array, instead of skipping them
+#define IMDD_EMIT_FLAG_SMALL_AS_POINTS	(1 << 2)
+
+// write boxes and spheres in the compact instance formats, which the renderer must support
+#define IMDD_EMIT_FLAG_COMPACT_INSTANCES	(1 << 3)
+
+// write filled triangles as imdd_array_flat_vertex_t without normals, the filled vertex buffer, capacity and counts are then in flat vertices
+// (the renderer must compute normals from derivatives, which only the GL3 renderer does, the Vulkan renderer clears this flag)
+#define IMDD_EMIT_FLAG_FLAT_TRIANGLES	(1 << 4)
+
+// write wire triangles as 3 vertices each into separate batches (see imdd_array_wire_triangle_batch_index), to be drawn with imdd_wire_triangle_indices_write
+#define IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES	(1 << 5)
+
+// use the imdd_v4 kernels even if the CPU supports wider SIMD, for example to compare against them
+#define IMDD_EMIT_FLAG_DEFAULT_SIMD		(1 << 6)
+
+/*
+	Interface to an external job system for running conversion on several
+	threads.  parallel_for must call fn(ctx, index) once for each index in
+	[0, count), in any order and on any thread, and may return before these
+	calls complete.  wait must block until all calls from previous
+	parallel_for calls have completed.
+*/
+typedef void (* imdd_task_func_t)(void *ctx, uint32_t index);
+
+typedef struct {
+	void (* parallel_for)(void *user_data, uint32_t count, imdd_task_func_t fn, void *ctx);
+	void (* wait)(void *user_data);
+	void *user_data;
+} imdd_scheduler_t;
+
+/*
+	Camera and scratch memory for drawing alpha blended shapes from back to
+	front.  Each alpha blended shape is given a key from the distance of its
+	centre to eye_pos, and these keys are radix sorted so that each alpha
+	blended batch is written from the furthest shape to the nearest.  Batches
+	are still drawn one after another, so shapes are only in order within
+	each batch.  When streaming, each window is sorted on its own, so the
+	order is also only kept within each window (see imdd_emit_stream_t).
+
+	items must have room for two items per shape in the stores, at most
+	IMDD_EMIT_SORT_MAX_STORE_COUNT stores are supported, and each store can
+	have at most IMDD_EMIT_SORT_MAX_HEADER_COUNT shapes.  Otherwise alpha
+	blended shapes are left in store order, and the reason is written to
+	imdd_emit_stats_t.
+*/
+typedef struct {
+	uint32_t key;		// quantised distance in the top 22 bits, inverted so that the furthest shape is lowest, then the bucket and LOD
+	uint32_t ref;		// store index in the top 8 bits, header offset in the rest
+} imdd_emit_sort_item_t;
+
+typedef struct {
+	float eye_pos[3];
+	imdd_emit_sort_item_t *items;
+	uint32_t item_capacity;
+} imdd_emit_alpha_sort_t;
+
+#define IMDD_EMIT_SORT_MAX_STORE_COUNT	256
+#define IMDD_EMIT_SORT_MAX_HEADER_COUNT	((1U << 24) - 1U)
+
+// reasons for leaving alpha blended shapes in store order, written to imdd_emit_stats_t
+#define IMDD_EMIT_UNSORTED_STORE_COUNT		(1 << 0)	// more than IMDD_EMIT_SORT_MAX_STORE_COUNT stores
+#define IMDD_EMIT_UNSORTED_ITEM_CAPACITY	(1 << 1)	// fewer than two items per shape
+#define IMDD_EMIT_UNSORTED_CHUNK_CAPACITY	(1 << 2)	// fewer than two chunks, from scratch that is too small
+#define IMDD_EMIT_UNSORTED_HEADER_COUNT		(1 << 3)	// a store with more than IMDD_EMIT_SORT_MAX_HEADER_COUNT shapes
+
+/*
+	Scratch memory for skipping shapes that are exact copies of an earlier
+	shape, such as the same box emitted by several systems.  Each shape is
+	hashed from its header and parameters into a table of slots, shared by
+	all the chunks and filled without locks, which keeps the first copy of
+	each shape in store order and marks the others.  Marked shapes are then
+	skipped when counting and writing, with the number of copies of each
+	shape type written to imdd_emit_stats_t.  When streaming, only copies
+	within the same window are found.
+
+	slots must have room for four slots per shape, at most
+	IMDD_EMIT_SORT_MAX_STORE_COUNT stores are supported, and each store can
+	have at most IMDD_EMIT_SORT_MAX_HEADER_COUNT shapes.  Otherwise every
+	shape is converted.
+*/
+typedef struct {
+	imdd_atomic_uint *slots;
+	uint32_t slot_capacity;
+} imdd_emit_dedupe_t;
+
+/*
+	Scratch memory for the chunks that conversion is split into to run on
+	several threads, which are a few KB each, and for the pool of staging
+	windows that each chunk uses with IMDD_EMIT_FLAG_NON_TEMPORAL.  These
+	are kept off the stack so that conversion can run on threads or fibers
+	with small stacks.  Use imdd_emit_scratch_size to size it.
+
+	If there is only room for fewer chunks than the scheduler could use,
+	fewer chunks are used, dropping the staging windows first if there is
+	not room for even one chunk with them.  Without scratch, shapes are
+	converted on the calling thread with IMDD_EMIT_STACK_CHUNK_COUNT chunks
+	on the stack, and non-temporal stores are not used.
+*/
+typedef struct {
+	void *memory;
+	uint32_t size;
+} imdd_emit_scratch_t;
+
+/*
+	Visibility of the converted shapes in each of several views, so that
+	shapes are converted once and each view draws only what it can see.
+	Shapes are converted if they could be visible in any of the frustums,
+	then one pass over the converted instances and vertices writes the
+	ranges of each batch that could be visible in each frustum.  This
+	reads back the output buffers, so these should be in cached memory.
+
+	Ranges are in the same units as the batch and within it, so can be
+	drawn in place of the whole batch.  Gaps of up to
+	IMDD_EMIT_VIEW_MERGE_GAP shapes are drawn rather than splitting a range,
+	and once ranges run out the last range of a batch is extended instead,
+	so some shapes outside the view are drawn to keep the draw count low.
+*/
+#define IMDD_EMIT_MAX_VIEW_COUNT		8
+#ifndef IMDD_EMIT_VIEW_MERGE_GAP
+#define IMDD_EMIT_VIEW_MERGE_GAP		8
+#endif
+#define IMDD_EMIT_VIEW_BATCH_COUNT		(IMDD_INSTANCE_BATCH_COUNT + 2*IMDD_ARRAY_BATCH_COUNT)
+
+typedef struct {
+	imdd_batch_t *ranges;
+	uint32_t range_capacity;		// must be at least IMDD_EMIT_VIEW_BATCH_COUNT
+	uint32_t range_count;
+
+	// for each batch, the offset and count of its visible ranges in ranges
+	imdd_batch_t instance_range_lists[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_batch_t filled_range_lists[IMDD_ARRAY_BATCH_COUNT];
+	imdd_batch_t wire_range_lists[IMDD_ARRAY_BATCH_COUNT];
+} imdd_emit_view_t;
+
+/*
+	World space bounds of the converted shapes, for renderers that skip
+	whole batches or parts of batches that are off screen, such as when
+	culling on the GPU.  After conversion, one pass over the converted
+	instances and vertices writes the bounds of each batch, and of each
+	cluster of IMDD_EMIT_BOUNDS_CLUSTER_SIZE instances, triangles or lines
+	from the start of each batch.  Like views, this reads back the output
+	buffers, so these should be in cached memory, and layouts are not
+	supported.  When streaming, the bounds are for the current window.
+
+	Instances are bounded using the box of their format, vertex arrays by
+	their vertices.  The w components are zero, and batches with nothing to
+	draw have min above max.  Once clusters run out, later batches have no
+	clusters, only the bounds of the whole batch.
+*/
+#ifndef IMDD_EMIT_BOUNDS_CLUSTER_SIZE
+#define IMDD_EMIT_BOUNDS_CLUSTER_SIZE	64
+#endif
+
+typedef struct {
+	imdd_v4 min;
+	imdd_v4 max;
+} imdd_emit_bound_t;
+
+typedef struct {
+	imdd_emit_bound_t *clusters;	// optional, only batch bounds are written if NULL
+	uint32_t cluster_capacity;
+	uint32_t cluster_count;
+
+	imdd_emit_bound_t instance_bounds[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_emit_bound_t filled_bounds[IMDD_ARRAY_BATCH_COUNT];
+	imdd_emit_bound_t wire_bounds[IMDD_ARRAY_BATCH_COUNT];
+
+	// for each batch, the offset and count of its clusters in clusters
+	imdd_batch_t instance_cluster_lists[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_batch_t filled_cluster_lists[IMDD_ARRAY_BATCH_COUNT];
+	imdd_batch_t wire_cluster_lists[IMDD_ARRAY_BATCH_COUNT];
+} imdd_emit_bounds_t;
+
+/*
+	Streaming conversion, so that output buffers only need to fit a window
+	of shapes rather than the whole frame.  The stores are walked in windows
+	of window_shape_count shapes, each window is converted into the same
+	output buffers, then flush is called to upload and draw the batches
+	before the buffers are reused.
+
+	Renderers draw each layer, zmode and blend mode in turn, so that order
+	is kept by walking the stores once for each of these passes that has
+	shapes, in the order of imdd_emit_pass_index, and only converting shapes
+	of the current pass.  Flush is only called for windows with something
+	to draw, and the output counts and batches are only valid during flush.
+	Views apply to each window on its own, and so does alpha sorting: the
+	alpha blended shapes of each window are back to front, but a later
+	window is drawn over an earlier one whatever their distance, so the
+	order is only kept across the frame if every alpha blended shape of a
+	pass fits in one window.
+
+	Stats are summed over all windows, except for the required counts which
+	are the most needed by any window.
+*/
+#define IMDD_EMIT_PASS_COUNT	(IMDD_LAYER_COUNT*IMDD_ZMODE_COUNT*IMDD_BLEND_COUNT)
+
+static inline
+uint32_t imdd_emit_pass_index(uint32_t layer, imdd_zmode_enum_t zmode, imdd_blend_enum_t blend)
+{
+	return (layer*IMDD_ZMODE_COUNT + zmode)*IMDD_BLEND_COUNT + blend;
+}
+
+typedef void (* imdd_emit_flush_func_t)(void *user_data, uint32_t layer, imdd_zmode_enum_t zmode, imdd_blend_enum_t blend);
+
+// alpha sorting is only within each window, see above
+typedef struct {
+	uint32_t window_shape_count;
+	imdd_emit_flush_func_t flush;
+	void *user_data;
+} imdd_emit_stream_t;
+
+typedef struct {
+	uint32_t culled_counts[IMDD_SHAPE_COUNT];	// shapes of each type outside all the frustums
+	uint32_t small_counts[IMDD_SHAPE_COUNT];	// shapes of each type below the minimum size, skipped or drawn as points
+	uint32_t duplicate_counts[IMDD_SHAPE_COUNT];	// shapes of each type skipped as a copy of an earlier shape
+	uint32_t dropped_counts[IMDD_SHAPE_COUNT];	// shapes of each type not converted, by renderers that ran out of submissions
+	uint32_t unsorted_alpha_flags;				// IMDD_EMIT_UNSORTED_* if alpha_sort was set but not used
+
+	// space needed to convert every shape, shapes were dropped if this is more than the capacity
+	uint32_t required_instance_count;
+	uint32_t required_filled_vertex_count;
+	uint32_t required_wire_vertex_count;
+} imdd_emit_stats_t;
+
+typedef struct {
+	uint32_t flags;
+	imdd_scheduler_t const *scheduler;		// optional, converts on the calling thread if NULL
+	imdd_frustum_t const *frustums;			// optional, shapes outside all of these are skipped
+	uint32_t frustum_count;
+	imdd_emit_stats_t *stats;				// optional, written after conversion
+	imdd_emit_lod_t const *lod;				// optional, always uses the most detailed meshes if NULL
+	imdd_emit_alpha_sort_t const *alpha_sort;	// optional, alpha blended shapes are drawn in store order if NULL
+	imdd_emit_view_t *views;				// optional, one per frustum (up to IMDD_EMIT_MAX_VIEW_COUNT) to write visible ranges for
+	imdd_emit_layout_t const *layout;		// optional, the output buffers are not used if set
+	imdd_emit_stream_t const *stream;		// optional, converts all shapes at once if NULL
+	imdd_emit_dedupe_t const *dedupe;		// optional, copies of shapes are converted again if NULL
+	imdd_emit_bounds_t *bounds;				// optional, written after conversion
+	imdd_emit_scratch_t const *scratch;		// optional, converts on the calling thread without non-temporal stores if NULL
+} imdd_emit_options_t;
+
+/*
+	Capacity tracking for renderers that resize their buffers to fit the
+	required counts in imdd_emit_stats_t.  Capacity grows as soon as more is
+	required, with some headroom, but only shrinks once much less has been
+	required for IMDD_CAPACITY_SHRINK_FRAME_COUNT frames in a row, so that
+	buffers are not reallocated every time the number of shapes changes.
+	Capacity never shrinks below the initial capacity.
+*/
+#ifndef IMDD_CAPACITY_SHRINK_FRAME_COUNT
+#define IMDD_CAPACITY_SHRINK_FRAME_COUNT	60
+#endif
+
+typedef struct {
+	uint32_t min_capacity;
+	uint32_t oversized_frame_count;
+} imdd_capacity_tracker_t;
+
+static inline
+void imdd_capacity_tracker_init(imdd_capacity_tracker_t *tracker, uint32_t initial_capacity)
+{
+	tracker->min_capacity = initial_capacity;
+	tracker->oversized_frame_count = 0;
+}
+
+// returns the capacity to use for the next frame
+static inline
+uint32_t imdd_capacity_tracker_update(imdd_capacity_tracker_t *tracker, uint32_t capacity, uint32_t required)
+{
+	// grow by half again, so that slow growth does not reallocate every frame, saturating rather than wrapping
+	if (required > capacity) {
+		tracker->oversized_frame_count = 0;
+		return (required/2 < UINT32_MAX - required) ? (required + required/2) : UINT32_MAX;
+	}
+
+	// shrink to twice what is required after being more than 4x larger for long enough
+	if (required < capacity/4 && capacity > tracker->min_capacity) {
+		if (++tracker->oversized_frame_count >= IMDD_CAPACITY_SHRINK_FRAME_COUNT) {
+			tracker->oversized_frame_count = 0;
+			return (2*required > tracker->min_capacity) ? 2*required : tracker->min_capacity;
+		}
+	} else {
+		tracker->oversized_frame_count = 0;
+	}
+	return capacity;
+}
+
+/*
+	For non-temporal output, each stream writes into a small staging window
+	in cached memory instead of the destination.  The window has the same
+	alignment within a cache line as the destination, so when it fills up
+	the complete lines are copied out with non-temporal stores.  The
+	destination then only receives whole lines (apart from where batches
+	meet), however shapes are interleaved between streams.
+
+	Each chunk has a pool of IMDD_EMIT_NT_WINDOW_COUNT windows, which are
+	given to the batches that the chunk writes to in batch order.  Any
+	batches left over write directly to the destination.
+*/
+#define IMDD_EMIT_NT_LINE_SIZE			64
+#define IMDD_EMIT_NT_WINDOW_SIZE		256
+#define IMDD_EMIT_NT_COLOR_WINDOW_SIZE	128		// must fit the colors for a full window of instances
+#ifndef IMDD_EMIT_NT_WINDOW_COUNT
+#define IMDD_EMIT_NT_WINDOW_COUNT		32
+#endif
+#define IMDD_EMIT_NT_NO_WINDOW			0xffU
+
+typedef struct {
+	uint8_t *window;		// staging in cached memory, aligned to a line
+	uint8_t *dst_begin;		// destination of the first element
+	uint8_t *dst_line;		// destination of window[0], aligned to a line
+	uint8_t *dst_end;		// end of the destination range
+	uint32_t head;			// window offset of the first byte not yet copied out
+	uint32_t size;
+} imdd_emit_nt_window_t;
+
+typedef struct {
+	// index of the window for each batch or IMDD_EMIT_NT_NO_WINDOW, instances use the next window for colors
+	uint8_t instance_windows[IMDD_INSTANCE_BATCH_COUNT];
+	uint8_t filled_vertex_windows[IMDD_ARRAY_BATCH_COUNT];
+	uint8_t wire_vertex_windows[IMDD_ARRAY_BATCH_COUNT];
+	imdd_emit_nt_window_t windows[IMDD_EMIT_NT_WINDOW_COUNT];
+	uint8_t storage[IMDD_EMIT_NT_WINDOW_COUNT*IMDD_EMIT_NT_WINDOW_SIZE + IMDD_EMIT_NT_LINE_SIZE];
+} imdd_emit_nt_state_t;
+
+static
+void imdd_emit_nt_copy(uint8_t *dst, uint8_t const *src, uint32_t size)
+{
+	// only colors have a head or tail that is not 16-byte aligned
+	while (size > 0 && ((uintptr_t)dst & 15) != 0) {
+		imdd_u32_store_nt((uint32_t *)dst, *(uint32_t const *)src);
+		dst += 4;
+		src += 4;
+		size -= 4;
+	}
+	while (size >= 16) {
+		imdd_v4_store_nt((imdd_v4 *)dst, *(imdd_v4 const *)src);
+		dst += 16;
+		src += 16;
+		size -= 16;
+	}
+	while (size > 0) {
+		imdd_u32_store_nt((uint32_t *)dst, *(uint32_t const *)src);
+		dst += 4;
+		src += 4;
+		size -= 4;
+	}
+}
+
+// returns where the stream should start writing in the window
+static
+uint8_t *imdd_emit_nt_window_init(
+	imdd_emit_nt_window_t *win,
+	uint8_t **storage,
+	uint32_t size,
+	void *dst_begin,
+	void *dst_end)
+{
+	uint32_t const head = (uint32_t)((uintptr_t)dst_begin & (IMDD_EMIT_NT_LINE_SIZE - 1));
+	win->window = *storage;
+	win->dst_begin = (uint8_t *)dst_begin;
+	win->dst_line = (uint8_t *)dst_begin - head;
+	win->dst_end = (uint8_t *)dst_end;
+	win->head = head;
+	win->size = size;
+	*storage += size;
+	return win->window + head;
+}
+
+// the window is full up to here, or to the end of the destination if that comes first
+static
+uint8_t *imdd_emit_nt_window_limit(imdd_emit_nt_window_t const *win)
+{
+	uintptr_t const dst_size = (uintptr_t)(win->dst_end - win->dst_line);
+	return win->window + ((dst_size < win->size) ? dst_size : win->size);
+}
+
+// copies out whole lines written so far, returns how far the remaining bytes moved down the window
+static
+uint32_t imdd_emit_nt_window_flush(imdd_emit_nt_window_t *win, uint8_t const *current)
+{
+	uint32_t const used = (uint32_t)(current - win->window);
+	uint32_t const copy_end = used & ~(uint32_t)(IMDD_EMIT_NT_LINE_SIZE - 1);
+	if (copy_end <= win->head) {
+		return 0;
+	}
+	imdd_emit_nt_copy(win->dst_line + win->head, win->window + win->head, copy_end - win->head);
+	memmove(win->window, win->window + copy_end, used - copy_end);
+	win->dst_line += copy_end;
+	win->head = 0;
+	return copy_end;
+}
+
+// copies out everything written so far, returns the destination address for current
+static
+uint8_t *imdd_emit_nt_window_finish(imdd_emit_nt_window_t *win, uint8_t const *current)
+{
+	uint32_t const used = (uint32_t)(current - win->window);
+	if (used > win->head) {
+		imdd_emit_nt_copy(win->dst_line + win->head, win->window + win->head, used - win->head);
+	}
+	return win->dst_line + used;
+}
+
+// the end of the whole instances that fit in the window
+static
+imdd_v4 *imdd_emit_nt_instance_limit(imdd_emit_nt_window_t const *win, imdd_instance_stream_t const *stream)
+{
+	uint32_t const instance_size = stream->qw_size*sizeof(imdd_v4);
+	return stream->current + stream->qw_size*((imdd_emit_nt_window_limit(win) - (uint8_t *)stream->current)/instance_size);
+}
+
+static
+imdd_v4 *imdd_emit_nt_filled_vertex_limit(imdd_emit_nt_window_t const *win, imdd_filled_vertex_stream_t const *stream)
+{
+	uint32_t const vertex_size = stream->qw_size*sizeof(imdd_v4);
+	return stream->current + stream->qw_size*((imdd_emit_nt_window_limit(win) - (uint8_t *)stream->current)/vertex_size);
+}
+
+// gives windows to the batches that have a range in the destination, while there are windows left
+static
+void imdd_emit_nt_begin(
+	imdd_emit_nt_state_t *state,
+	imdd_instance_stream_t *instance_streams,
+	imdd_filled_vertex_stream_t *filled_vertex_streams,
+	imdd_wire_vertex_stream_t *wire_vertex_streams)
+{
+	uint8_t *storage = (uint8_t *)(((uintptr_t)state->storage + IMDD_EMIT_NT_LINE_SIZE - 1) & ~(uintptr_t)(IMDD_EMIT_NT_LINE_SIZE - 1));
+	uint32_t window_count = 0;
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		imdd_instance_stream_t *const stream = &instance_streams[batch_index];
+		if (stream->begin == stream->end || window_count + 2 > IMDD_EMIT_NT_WINDOW_COUNT) {
+			state->instance_windows[batch_index] = IMDD_EMIT_NT_NO_WINDOW;
+			continue;
+		}
+		state->instance_windows[batch_index] = (uint8_t)window_count;
+		imdd_emit_nt_window_t *const win = &state->windows[window_count++];
+		imdd_emit_nt_window_t *const color_win = &state->windows[window_count++];
+		imdd_instance_color_t *const color_end = stream->color + (stream->end - stream->begin)/stream->qw_size;
+		stream->color = (imdd_instance_color_t *)imdd_emit_nt_window_init(
+			color_win, &storage, IMDD_EMIT_NT_COLOR_WINDOW_SIZE, stream->color, color_end);
+		stream->begin = stream->current = (imdd_v4 *)imdd_emit_nt_window_init(
+			win, &storage, IMDD_EMIT_NT_WINDOW_SIZE, stream->begin, stream->end);
+		stream->end = imdd_emit_nt_instance_limit(win, stream);
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_filled_vertex_stream_t *const stream = &filled_vertex_streams[batch_index];
+		if (stream->begin == stream->end || window_count == IMDD_EMIT_NT_WINDOW_COUNT) {
+			state->filled_vertex_windows[batch_index] = IMDD_EMIT_NT_NO_WINDOW;
+			continue;
+		}
+		state->filled_vertex_windows[batch_index] = (uint8_t)window_count;
+		imdd_emit_nt_window_t *const win = &state->windows[window_count++];
+		stream->begin = stream->current = (imdd_v4 *)imdd_emit_nt_window_init(
+			win, &storage, IMDD_EMIT_NT_WINDOW_SIZE, stream->begin, stream->end);
+		stream->end = imdd_emit_nt_filled_vertex_limit(win, stream);
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_wire_vertex_stream_t *const stream = &wire_vertex_streams[batch_index];
+		if (stream->begin == stream->end || window_count == IMDD_EMIT_NT_WINDOW_COUNT) {
+			state->wire_vertex_windows[batch_index] = IMDD_EMIT_NT_NO_WINDOW;
+			continue;
+		}
+		state->wire_vertex_windows[batch_index] = (uint8_t)window_count;
+		imdd_emit_nt_window_t *const win = &state->windows[window_count++];
+		stream->begin = stream->current = (imdd_array_wire_vertex_t *)imdd_emit_nt_window_init(
+			win, &storage, IMDD_EMIT_NT_WINDOW_SIZE, stream->begin, stream->end);
+		stream->end = stream->current + (imdd_emit_nt_window_limit(win) - (uint8_t *)stream->current)/sizeof(imdd_array_wire_vertex_t);
+	}
+}
+
+// makes room in the window for at least count more instances, unless the destination is full or written directly
+static
+void imdd_emit_nt_reserve_instances(imdd_emit_nt_state_t *state, uint32_t batch_index, imdd_instance_stream_t *stream, uint32_t count)
+{
+	if (stream->current + count*stream->qw_size <= stream->end) {
+		return;
+	}
+	uint32_t const window_index = state->instance_windows[batch_index];
+	if (window_index == IMDD_EMIT_NT_NO_WINDOW) {
+		return;
+	}
+	imdd_emit_nt_window_t *const win = &state->windows[window_index];
+	uint32_t const shift = imdd_emit_nt_window_flush(win, (uint8_t *)stream->current);
+	uint32_t const color_shift = imdd_emit_nt_window_flush(&state->windows[window_index + 1], (uint8_t *)stream->color);
+	stream->current = (imdd_v4 *)((uint8_t *)stream->current - shift);
+	stream->color = (imdd_instance_color_t *)((uint8_t *)stream->color - color_shift);
+	stream->end = imdd_emit_nt_instance_limit(win, stream);
+}
+
+static
+void imdd_emit_nt_reserve_filled_vertices(imdd_emit_nt_state_t *state, uint32_t batch_index, imdd_filled_vertex_stream_t *stream, uint32_t count)
+{
+	if (stream->current + count*stream->qw_size <= stream->end) {
+		return;
+	}
+	uint32_t const window_index = state->filled_vertex_windows[batch_index];
+	if (window_index == IMDD_EMIT_NT_NO_WINDOW) {
+		return;
+	}
+	imdd_emit_nt_window_t *const win = &state->windows[window_index];
+	uint32_t const shift = imdd_emit_nt_window_flush(win, (uint8_t *)stream->current);
+	stream->current = (imdd_v4 *)((uint8_t *)stream->current - shift);
+	stream->end = imdd_emit_nt_filled_vertex_limit(win, stream);
+}
+
+static
+void imdd_emit_nt_reserve_wire_vertices(imdd_emit_nt_state_t *state, uint32_t batch_index, imdd_wire_vertex_stream_t *stream, uint32_t count)
+{
+	if (stream->current + count <= stream->end) {
+		return;
+	}
+	uint32_t const window_index = state->wire_vertex_windows[batch_index];
+	if (window_index == IMDD_EMIT_NT_NO_WINDOW) {
+		return;
+	}
+	imdd_emit_nt_window_t *const win = &state->windows[window_index];
+	uint32_t const shift = imdd_emit_nt_window_flush(win, (uint8_t *)stream->current);
+	stream->current = (imdd_array_wire_vertex_t *)((uint8_t *)stream->current - shift);
+	stream->end = stream->current + (imdd_emit_nt_window_limit(win) - (uint8_t *)stream->current)/sizeof(imdd_array_wire_vertex_t);
+}
+
+// copies out the remaining data and points the streams back at the destination
+static
+void imdd_emit_nt_end(
+	imdd_emit_nt_state_t *state,
+	imdd_instance_stream_t *instance_streams,
+	imdd_filled_vertex_stream_t *filled_vertex_streams,
+	imdd_wire_vertex_stream_t *wire_vertex_streams)
+{
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		uint32_t const window_index = state->instance_windows[batch_index];
+		if (window_index == IMDD_EMIT_NT_NO_WINDOW) {
+			continue;
+		}
+		imdd_instance_stream_t *const stream = &instance_streams[batch_index];
+		imdd_emit_nt_window_t *const win = &state->windows[window_index];
+		imdd_emit_nt_window_t *const color_win = &state->windows[window_index + 1];
+		stream->color = (imdd_instance_color_t *)imdd_emit_nt_window_finish(color_win, (uint8_t *)stream->color);
+		stream->current = (imdd_v4 *)imdd_emit_nt_window_finish(win, (uint8_t *)stream->current);
+		stream->begin = (imdd_v4 *)win->dst_begin;
+		stream->end = (imdd_v4 *)win->dst_end;
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		uint32_t const window_index = state->filled_vertex_windows[batch_index];
+		if (window_index == IMDD_EMIT_NT_NO_WINDOW) {
+			continue;
+		}
+		imdd_filled_vertex_stream_t *const stream = &filled_vertex_streams[batch_index];
+		imdd_emit_nt_window_t *const win = &state->windows[window_index];
+		stream->current = (imdd_v4 *)imdd_emit_nt_window_finish(win, (uint8_t *)stream->current);
+		stream->begin = (imdd_v4 *)win->dst_begin;
+		stream->end = (imdd_v4 *)win->dst_end;
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		uint32_t const window_index = state->wire_vertex_windows[batch_index];
+		if (window_index == IMDD_EMIT_NT_NO_WINDOW) {
+			continue;
+		}
+		imdd_wire_vertex_stream_t *const stream = &wire_vertex_streams[batch_index];
+		imdd_emit_nt_window_t *const win = &state->windows[window_index];
+		stream->current = (imdd_array_wire_vertex_t *)imdd_emit_nt_window_finish(win, (uint8_t *)stream->current);
+		stream->begin = (imdd_array_wire_vertex_t *)win->dst_begin;
+		stream->end = (imdd_array_wire_vertex_t *)win->dst_end;
+	}
+
+	// make the stores visible before the caller flushes or submits
+	imdd_store_nt_fence();
+}
+
+/*
+	For sorted conversion, the headers of each block are sorted by bucket
+	and each bucket is converted by a loop specialised for its shape, so
+	the kernels are inlined and each output stream is written sequentially.
+	Each loop converts a list of shapes from a single store that all use
+	the same stream.
+*/
+typedef void (* imdd_emit_instance_loop_func_t)(
+	imdd_emit_nt_state_t *nt_state,
+	uint32_t batch_index,
+	imdd_instance_stream_t *stream,
+	imdd_shape_store_t const *store,
+	uint32_t const *header_offsets,
+	uint32_t count);
+typedef void (* imdd_emit_filled_vertex_loop_func_t)(
+	imdd_emit_nt_state_t *nt_state,
+	uint32_t batch_index,
+	imdd_filled_vertex_stream_t *stream,
+	imdd_shape_store_t const *store,
+	uint32_t const *header_offsets,
+	uint32_t count);
+typedef void (* imdd_emit_wire_vertex_loop_func_t)(
+	imdd_emit_nt_state_t *nt_state,
+	uint32_t batch_index,
+	imdd_wire_vertex_stream_t *stream,
+	imdd_shape_store_t const *store,
+	uint32_t const *header_offsets,
+	uint32_t count);
+
+#define IMDD_EMIT_INSTANCE_LOOP(NAME, TARGET, FUNC)													\
+	static TARGET																					\
+	void NAME(																						\
+		imdd_emit_nt_state_t *nt_state,																\
+		uint32_t batch_index,																		\
+		imdd_instance_stream_t *stream,																\
+		imdd_shape_store_t const *store,															\
+		uint32_t const *header_offsets,																\
+		uint32_t count)																				\
+	{																								\
+		for (uint32_t index = 0; index < count; ++index) {											\
+			imdd_shape_header_t const header = store->header_store[header_offsets[index]];			\
+			if (nt_state) {																			\
+				imdd_emit_nt_reserve_instances(nt_state, batch_index, stream, 1);					\
+			}																						\
+			FUNC(stream, header.color, store->data_qw_store + header.data_qw_offset);				\
+		}																							\
+	}
+
+#define IMDD_EMIT_INSTANCE_X2_LOOP(NAME, TARGET, FUNC, FUNC_X2)										\
+	static TARGET																					\
+	void NAME(																						\
+		imdd_emit_nt_state_t *nt_state,																\
+		uint32_t batch_index,																		\
+		imdd_instance_stream_t *stream,																\
+		imdd_shape_store_t const *store,															\
+		uint32_t const *header_offsets,																\
+		uint32_t count)																				\
+	{																								\
+		uint32_t index = 0;																			\
+		for (; index + 1 < count; index += 2) {														\
+			imdd_shape_header_t const header0 = store->header_store[header_offsets[index]];		\
+			imdd_shape_header_t const header1 = store->header_store[header_offsets[index + 1]];	\
+			if (nt_state) {																			\
+				imdd_emit_nt_reserve_instances(nt_state, batch_index, stream, 2);					\
+			}																						\
+			FUNC_X2(																				\
+				stream,																				\
+				header0.color, store->data_qw_store + header0.data_qw_offset,						\
+				header1.color, store->data_qw_store + header1.data_qw_offset);						\
+		}																							\
+		if (index < count) {																		\
+			imdd_shape_header_t const header = store->header_store[header_offsets[index]];			\
+			if (nt_state) {																			\
+				imdd_emit_nt_reserve_instances(nt_state, batch_index, stream, 1);					\
+			}																						\
+			FUNC(stream, header.color, store->data_qw_store + header.data_qw_offset);				\
+		}																							\
+	}
+
+#define IMDD_EMIT_VERTEX_LOOP(NAME, TARGET, STREAM_TYPE, RESERVE, FUNC, VERTEX_COUNT)				\
+	static TARGET																					\
+	void NAME(																						\
+		imdd_emit_nt_state_t *nt_state,																\
+		uint32_t batch_index,																		\
+		STREAM_TYPE *stream,																		\
+		imdd_shape_store_t const *store,															\
+		uint32_t const *header_offsets,																\
+		uint32_t count)																				\
+	{																								\
+		for (uint32_t index = 0; index < count; ++index) {											\
+			imdd_shape_header_t const header = store->header_store[header_offsets[index]];			\
+			if (nt_state) {																			\
+				RESERVE(nt_state, batch_index, stream, VERTEX_COUNT);								\
+			}																						\
+			FUNC(stream, header.color, store->data_qw_store + header.data_qw_offset);				\
+		}																							\
+	}
+
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_aabb_loop, , imdd_emit_aabb)
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_transform_loop, , imdd_emit_transform)
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_sphere_loop, , imdd_emit_sphere)
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_aabb_compact_loop, , imdd_emit_aabb_compact)
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_sphere_compact_loop, , imdd_emit_sphere_compact)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_line_loop, , imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_line, 2)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_filled_triangle_loop, , imdd_filled_vertex_stream_t, imdd_emit_nt_reserve_filled_vertices, imdd_emit_filled_triangle, 3)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_flat_triangle_loop, , imdd_filled_vertex_stream_t, imdd_emit_nt_reserve_filled_vertices, imdd_emit_flat_triangle, 3)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_wire_triangle_loop, , imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_wire_triangle, 6)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_indexed_wire_triangle_loop, , imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_indexed_wire_triangle, 3)
+
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_aabb_layout_loop, , imdd_emit_aabb_layout)
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_transform_layout_loop, , imdd_emit_transform_layout)
+IMDD_EMIT_INSTANCE_LOOP(imdd_emit_sphere_layout_loop, , imdd_emit_sphere_layout)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_line_layout_loop, , imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_line_layout, 2)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_filled_triangle_layout_loop, , imdd_filled_vertex_stream_t, imdd_emit_nt_reserve_filled_vertices, imdd_emit_filled_triangle_layout, 3)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_flat_triangle_layout_loop, , imdd_filled_vertex_stream_t, imdd_emit_nt_reserve_filled_vertices, imdd_emit_flat_triangle_layout, 3)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_wire_triangle_layout_loop, , imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_wire_triangle_layout, 6)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_indexed_wire_triangle_layout_loop, , imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_indexed_wire_triangle_layout, 3)
+
+#ifdef IMDD_SIMD_V8
+IMDD_EMIT_INSTANCE_X2_LOOP(imdd_emit_aabb_x2_loop, IMDD_AVX_TARGET, imdd_emit_aabb, imdd_emit_aabb_x2)
+IMDD_EMIT_INSTANCE_X2_LOOP(imdd_emit_sphere_x2_loop, IMDD_AVX_TARGET, imdd_emit_sphere, imdd_emit_sphere_x2)
+IMDD_EMIT_INSTANCE_X2_LOOP(imdd_emit_aabb_compact_x2_loop, IMDD_AVX_TARGET, imdd_emit_aabb_compact, imdd_emit_aabb_compact_x2)
+IMDD_EMIT_VERTEX_LOOP(imdd_emit_line_avx_loop, IMDD_AVX_TARGET, imdd_wire_vertex_stream_t, imdd_emit_nt_reserve_wire_vertices, imdd_emit_line_avx, 2)
+#endif
+
+typedef struct {
+	imdd_emit_instance_loop_func_t instance_loop_func;
+	imdd_emit_filled_vertex_loop_func_t filled_vertex_loop_func;
+	imdd_emit_wire_vertex_loop_func_t wire_vertex_loop_func;
+} imdd_emit_loop_desc_t;
+
+static imdd_emit_loop_desc_t const g_imdd_emit_loop_desc[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, &imdd_emit_line_loop },											// IMDD_SHAPE_LINE
+	{ NULL, &imdd_emit_filled_triangle_loop, &imdd_emit_wire_triangle_loop },		// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_loop, NULL, NULL },											// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_loop, NULL, NULL },											// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform_loop, NULL, NULL }										// IMDD_SHAPE_CYLINDER
+};
+
+static imdd_emit_loop_desc_t const g_imdd_emit_compact_loop_desc[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, &imdd_emit_line_loop },											// IMDD_SHAPE_LINE
+	{ NULL, &imdd_emit_filled_triangle_loop, &imdd_emit_wire_triangle_loop },		// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_compact_loop, NULL, NULL },									// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_compact_loop, NULL, NULL },									// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform_loop, NULL, NULL }										// IMDD_SHAPE_CYLINDER
+};
+
+#ifdef IMDD_SIMD_V8
+static imdd_emit_loop_desc_t const g_imdd_emit_loop_desc_avx[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, &imdd_emit_line_avx_loop },										// IMDD_SHAPE_LINE
+	{ NULL, &imdd_emit_filled_triangle_loop, &imdd_emit_wire_triangle_loop },		// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_x2_loop, NULL, NULL },										// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_x2_loop, NULL, NULL },										// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform_loop, NULL, NULL }										// IMDD_SHAPE_CYLINDER
+};
+
+static imdd_emit_loop_desc_t const g_imdd_emit_compact_loop_desc_avx[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, &imdd_emit_line_avx_loop },										// IMDD_SHAPE_LINE
+	{ NULL, &imdd_emit_filled_triangle_loop, &imdd_emit_wire_triangle_loop },		// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_compact_x2_loop, NULL, NULL },								// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_compact_loop, NULL, NULL },									// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform_loop, NULL, NULL },										// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform_loop, NULL, NULL }										// IMDD_SHAPE_CYLINDER
+};
+#endif
+
+static imdd_emit_loop_desc_t const g_imdd_emit_layout_loop_desc[IMDD_SHAPE_COUNT] = {
+	{ NULL, NULL, &imdd_emit_line_layout_loop },												// IMDD_SHAPE_LINE
+	{ NULL, &imdd_emit_filled_triangle_layout_loop, &imdd_emit_wire_triangle_layout_loop },	// IMDD_SHAPE_TRIANGLE
+	{ &imdd_emit_aabb_layout_loop, NULL, NULL },												// IMDD_SHAPE_AABB
+	{ &imdd_emit_transform_layout_loop, NULL, NULL },											// IMDD_SHAPE_OBB
+	{ &imdd_emit_sphere_layout_loop, NULL, NULL },												// IMDD_SHAPE_SPHERE
+	{ &imdd_emit_transform_layout_loop, NULL, NULL },											// IMDD_SHAPE_ELLIPSOID
+	{ &imdd_emit_transform_layout_loop, NULL, NULL },											// IMDD_SHAPE_CONE
+	{ &imdd_emit_transform_layout_loop, NULL, NULL }											// IMDD_SHAPE_CYLINDER
+};
+
+static inline
+imdd_emit_loop_desc_t const *imdd_emit_get_loop_desc_table(imdd_simd_level_enum_t simd_level, int compact)
+{
+#ifdef IMDD_SIMD_V8
+	if (simd_level == IMDD_SIMD_LEVEL_AVX) {
+		return compact ? g_imdd_emit_compact_loop_desc_avx : g_imdd_emit_loop_desc_avx;
+	}
+#else
+	(void)simd_level;
+#endif
+	return compact ? g_imdd_emit_compact_loop_desc : g_imdd_emit_loop_desc;
+}
+
+/*
+	Conversion can be split into chunks of shapes to run on several threads.
+	Each phase must complete for all chunks before the next phase starts:
+
+	- imdd_emit_begin splits the shapes into chunks (once), or when streaming
+	  imdd_emit_init then imdd_emit_begin_window splits one window of shapes
+	- imdd_emit_count_chunk counts the instances and vertices in each batch (per chunk, in parallel)
+	- when sorting alpha blended shapes (see below), each sort pass runs
+	  imdd_emit_sort_count (per task, in parallel), imdd_emit_sort_prefix
+	  (once) and imdd_emit_sort_scatter (per task, in parallel), until
+	  imdd_emit_sort_next_pass returns zero.  This adds chunks from
+	  sort_chunk_begin, which are then counted with imdd_emit_count_chunk
+	- imdd_emit_partition assigns each chunk a range within each batch (once)
+	- imdd_emit_write_chunk converts the shapes in a chunk (per chunk, in parallel)
+	- imdd_emit_end writes out the batches and totals (once)
+
+	Chunks take consecutive ranges of each batch in order, so the output
+	is identical to converting everything on one thread.  The exception is
+	when the buffers are too small: shapes are still dropped from the end
+	but the exact set of dropped shapes can depend on the chunking.  Stores
+	must not be modified until conversion is complete.  Non-temporal stores
+	are only used once nt_states of the state is pointed at one
+	imdd_emit_nt_state_t per chunk, after imdd_emit_begin or
+	imdd_emit_begin_window.
+
+	To sort alpha blended shapes, the chunks from imdd_emit_begin skip them
+	when converting, and instead collect a sort item for each one while
+	counting.  The items are sorted by an LSD radix sort of 8 bits per pass,
+	with the chunks from imdd_emit_begin as tasks.  The sort is stable and
+	the first pass reads the items of each chunk in order, so the result
+	does not depend on the chunking either.  The sorted items are then
+	split between extra chunks that convert them in order.
+*/
+#define IMDD_EMIT_SORT_RADIX_BITS		8
+#define IMDD_EMIT_SORT_RADIX_SIZE		(1U << IMDD_EMIT_SORT_RADIX_BITS)
+#define IMDD_EMIT_SORT_PASS_COUNT		3		// must be odd so that the result is in the back half of the items
+#define IMDD_EMIT_SORT_PREFETCH_DISTANCE	16
+#define IMDD_EMIT_SORT_BUCKET_BITS		10		// the low bits of each key are not sorted, and keep the bucket and LOD of the shape (less than IMDD_EMIT_LOD_BUCKET_COUNT)
+#define IMDD_EMIT_SORT_BUCKET_MASK		((1U << IMDD_EMIT_SORT_BUCKET_BITS) - 1U)
+#define IMDD_EMIT_SORT_STORE_SHIFT		24
+#define IMDD_EMIT_SORT_HEADER_MASK		((1U << IMDD_EMIT_SORT_STORE_SHIFT) - 1U)
+
+// sort items and dedupe slots pack the store index above the header offset, so every offset must fit below the shift
+// (one short of the mask, so that no reference is the empty dedupe slot)
+static
+int imdd_emit_refs_fit_header_counts(imdd_shape_store_t const *const *stores, uint32_t store_count)
+{
+	for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
+		if (imdd_store_header_count(stores[store_index]) > IMDD_EMIT_SORT_MAX_HEADER_COUNT) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+typedef struct {
+	// shapes from store_index_begin at header_offset_begin, to store_index_end at header_offset_end
+	uint32_t store_index_begin;
+	uint32_t header_offset_begin;
+	uint32_t store_index_end;
+	uint32_t header_offset_end;
+
+	// shapes skipped by culling, below the minimum size, or as a copy of an earlier shape
+	uint32_t culled_counts[IMDD_SHAPE_COUNT];
+	uint32_t small_counts[IMDD_SHAPE_COUNT];
+	uint32_t duplicate_counts[IMDD_SHAPE_COUNT];
+
+	// counts per batch, then offsets into each buffer after partitioning
+	uint32_t instance_counts[IMDD_INSTANCE_BATCH_COUNT];
+	uint32_t filled_vertex_counts[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t wire_vertex_counts[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t instance_offsets[IMDD_INSTANCE_BATCH_COUNT];
+	uint32_t filled_vertex_offsets[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t wire_vertex_offsets[IMDD_ARRAY_BATCH_COUNT];
+
+	// sort items collected by this chunk, or the range of sorted items converted by this chunk
+	int is_sorted_alpha;
+	uint32_t item_begin;
+	uint32_t item_end;
+
+	// digit counts then output offsets when this chunk is a sort task
+	uint32_t sort_offsets[IMDD_EMIT_SORT_RADIX_SIZE];
+} imdd_emit_chunk_t;
+
+typedef struct {
+	imdd_shape_store_t const *const *stores;
+	uint32_t store_count;
+	imdd_emit_chunk_t *chunks;
+	uint32_t chunk_count;
+	imdd_emit_desc_t desc_table[IMDD_SHAPE_COUNT];
+	imdd_emit_loop_desc_t loop_desc_table[IMDD_SHAPE_COUNT];
+	uint8_t instance_groups[IMDD_MESH_LOD_COUNT][IMDD_SHAPE_COUNT];
+	uint32_t flags;
+	uint32_t pass_mask;					// bit imdd_emit_pass_index set for each layer, zmode and blend mode to convert
+	imdd_frustum_t const *frustums;
+	uint32_t frustum_count;
+	imdd_emit_view_t *views;
+	imdd_emit_bounds_t *bounds;
+	imdd_emit_layout_t const *layout;
+	imdd_emit_stats_t *stats;
+	imdd_emit_lod_t const *lod;
+	imdd_v4 lod_eye_pos;
+	imdd_v4 lod_radius_sq_scale;		// squared radius per squared distance below LOD 1, LOD 2 and the minimum size
+	imdd_emit_alpha_sort_t const *alpha_sort;	// NULL unless sorting alpha blended shapes this frame
+	uint32_t unsorted_alpha_flags;
+	imdd_v4 sort_eye_pos;
+	imdd_emit_sort_item_t *sort_items_back;		// second half of the items, after one item per shape
+	uint32_t sort_task_count;
+	uint32_t sort_item_count;
+	uint32_t sort_pass;
+	uint32_t sort_chunk_begin;
+	imdd_emit_dedupe_t const *dedupe;
+	imdd_atomic_uint *dedupe_slots;		// NULL unless skipping copies of shapes this window
+	uint32_t dedupe_slot_mask;
+	uint8_t *dedupe_marks;				// one per shape of the window after the slots, set for copies
+	uint32_t dedupe_mark_count;
+	uint32_t dedupe_store_bases[IMDD_EMIT_SORT_MAX_STORE_COUNT];	// index in the window of the first shape of each store
+	imdd_emit_nt_state_t *nt_states;	// one per chunk, NULL unless writing with non-temporal stores
+
+	imdd_instance_transform_t *instance_transform_buf;
+	imdd_instance_color_t *instance_color_buf;
+	uint32_t instance_capacity;
+	imdd_batch_t *instance_batches;
+	uint32_t *instance_count;
+
+	imdd_array_filled_vertex_t *filled_vertex_buf;
+	uint32_t filled_vertex_capacity;
+	imdd_batch_t *filled_array_batches;
+	uint32_t *filled_vertex_count;
+
+	imdd_array_wire_vertex_t *wire_vertex_buf;
+	uint32_t wire_vertex_capacity;
+	imdd_batch_t *wire_array_batches;
+	uint32_t *wire_vertex_count;
+} imdd_emit_state_t;
+
+// sets up the state to convert shapes with these options, without splitting them into chunks
+static
+void imdd_emit_init(
+	imdd_emit_state_t *state,
+
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+
+	imdd_instance_transform_t *instance_transform_buf,
+	imdd_instance_color_t *instance_color_buf,
+	uint32_t instance_capacity,
+	imdd_batch_t *instance_batches,
+	uint32_t *instance_count,
+
+	imdd_array_filled_vertex_t *filled_vertex_buf,
+	uint32_t filled_vertex_capacity,
+	imdd_batch_t *filled_array_batches,
+	uint32_t *filled_vertex_count,
+
+	imdd_array_wire_vertex_t *wire_vertex_buf,
+	uint32_t wire_vertex_capacity,
+	imdd_batch_t *wire_array_batches,
+	uint32_t *wire_vertex_count,
+
+	imdd_emit_options_t const *options)
+{
+	state->stores = stores;
+	state->store_count = store_count;
+	state->chunks = NULL;
+	state->chunk_count = 0;
+	state->flags = options ? options->flags : 0;
+	state->pass_mask = (1U << IMDD_EMIT_PASS_COUNT) - 1U;
+	state->frustums = options ? options->frustums : NULL;
+	state->frustum_count = options ? options->frustum_count : 0;
+	state->views = options ? options->views : NULL;
+	state->bounds = options ? options->bounds : NULL;
+	state->nt_states = NULL;
+	state->layout = options ? options->layout : NULL;
+	if (state->layout) {
+		// layouts only describe transforms, are stored directly, and skip normals when they are not written
+		state->flags &= ~(uint32_t)(IMDD_EMIT_FLAG_COMPACT_INSTANCES | IMDD_EMIT_FLAG_NON_TEMPORAL);
+		if (state->layout->filled_vertex_normal.format == IMDD_ATTRIB_FORMAT_NONE) {
+			state->flags |= IMDD_EMIT_FLAG_FLAT_TRIANGLES;
+		}
+	}
+	state->stats = options ? options->stats : NULL;
+	state->lod = options ? options->lod : NULL;
+	if (state->lod) {
+		float const lod1_scale = IMDD_EMIT_LOD1_PIXEL_RADIUS/state->lod->pixels_per_unit;
+		float const lod2_scale = IMDD_EMIT_LOD2_PIXEL_RADIUS/state->lod->pixels_per_unit;
+		float const min_scale = state->lod->min_pixel_radius/state->lod->pixels_per_unit;
+		state->lod_eye_pos = imdd_v4_load_3f(state->lod->eye_pos);
+		state->lod_radius_sq_scale = imdd_v4_init_4f(
+			lod1_scale*lod1_scale,
+			lod2_scale*lod2_scale,
+			(state->lod->min_pixel_radius > 0.f) ? min_scale*min_scale : -1.f,
+			0.f);
+	}
+
+	// pick the conversion kernels for this CPU, and the instance format for each shape
+	imdd_simd_level_enum_t const simd_level = (state->flags & IMDD_EMIT_FLAG_DEFAULT_SIMD) ? IMDD_SIMD_LEVEL_DEFAULT : imdd_emit_detect_simd_level();
+	int const compact = (state->flags & IMDD_EMIT_FLAG_COMPACT_INSTANCES) != 0;
+	int const layout = state->layout != NULL;
+	memcpy(state->desc_table, layout ? g_imdd_emit_layout_desc : imdd_emit_get_desc_table(simd_level, compact), sizeof(state->desc_table));
+	memcpy(state->loop_desc_table, layout ? g_imdd_emit_layout_loop_desc : imdd_emit_get_loop_desc_table(simd_level, compact), sizeof(state->loop_desc_table));
+	if (state->flags & IMDD_EMIT_FLAG_FLAT_TRIANGLES) {
+		state->desc_table[IMDD_SHAPE_TRIANGLE].filled_vertex_func = layout ? &imdd_emit_flat_triangle_layout : &imdd_emit_flat_triangle;
+		state->loop_desc_table[IMDD_SHAPE_TRIANGLE].filled_vertex_loop_func = layout ? &imdd_emit_flat_triangle_layout_loop : &imdd_emit_flat_triangle_loop;
+	}
+	if (state->flags & IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES) {
+		state->desc_table[IMDD_SHAPE_TRIANGLE].wire_vertex_func = layout ? &imdd_emit_indexed_wire_triangle_layout : &imdd_emit_indexed_wire_triangle;
+		state->desc_table[IMDD_SHAPE_TRIANGLE].wire_vertex_count = 3;
+		state->loop_desc_table[IMDD_SHAPE_TRIANGLE].wire_vertex_loop_func = layout ? &imdd_emit_indexed_wire_triangle_layout_loop : &imdd_emit_indexed_wire_triangle_loop;
+	}
+	for (uint32_t lod_index = 0; lod_index < IMDD_MESH_LOD_COUNT; ++lod_index) {
+		for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+			uint32_t group = g_imdd_mesh_from_shape[lod_index][shape];
+			if (compact && shape == IMDD_SHAPE_AABB) {
+				group = IMDD_INSTANCE_GROUP_BOX;
+			}
+			if (compact && shape == IMDD_SHAPE_SPHERE) {
+				group = IMDD_INSTANCE_GROUP_SPHERE + lod_index;
+			}
+			state->instance_groups[lod_index][shape] = (uint8_t)group;
+		}
+	}
+
+	state->instance_transform_buf = instance_transform_buf;
+	state->instance_color_buf = instance_color_buf;
+	state->instance_capacity = instance_capacity;
+	state->instance_batches = instance_batches;
+	state->instance_count = instance_count;
+	state->filled_vertex_buf = filled_vertex_buf;
+	state->filled_vertex_capacity = filled_vertex_capacity;
+	state->filled_array_batches = filled_array_batches;
+	state->filled_vertex_count = filled_vertex_count;
+	state->wire_vertex_buf = wire_vertex_buf;
+	state->wire_vertex_capacity = wire_vertex_capacity;
+	state->wire_array_batches = wire_array_batches;
+	state->wire_vertex_count = wire_vertex_count;
+	state->alpha_sort = options ? options->alpha_sort : NULL;
+	state->dedupe = options ? options->dedupe : NULL;
+}
+
+// splits header_count shapes from header_begin (counting through the stores in order) into at most chunk_capacity
+// chunks of similar size, returns the chunk count
+// when sorting alpha blended shapes, only half of chunk_capacity is used so the rest can hold the sorted chunks
+static
+uint32_t imdd_emit_begin_window(
+	imdd_emit_state_t *state,
+	imdd_emit_chunk_t *chunks,
+	uint32_t chunk_capacity,
+	uint32_t header_begin,
+	uint32_t header_count)
+{
+	imdd_shape_store_t const *const *const stores = state->stores;
+	state->chunks = chunks;
+	state->chunk_count = 0;
+
+	// sorting needs room for the items and a chunk to convert sorted items for each chunk of shapes
+	state->sort_task_count = 0;
+	state->sort_item_count = 0;
+	state->sort_pass = 0;
+	state->sort_chunk_begin = 0;
+	state->unsorted_alpha_flags = 0;
+	if (state->alpha_sort) {
+		if (state->store_count > IMDD_EMIT_SORT_MAX_STORE_COUNT) {
+			state->unsorted_alpha_flags |= IMDD_EMIT_UNSORTED_STORE_COUNT;
+		}
+		if (!imdd_emit_refs_fit_header_counts(stores, state->store_count)) {
+			state->unsorted_alpha_flags |= IMDD_EMIT_UNSORTED_HEADER_COUNT;
+		}
+		if (header_count > state->alpha_sort->item_capacity/2) {
+			state->unsorted_alpha_flags |= IMDD_EMIT_UNSORTED_ITEM_CAPACITY;
+		}
+		if (chunk_capacity < 2) {
+			state->unsorted_alpha_flags |= IMDD_EMIT_UNSORTED_CHUNK_CAPACITY;
+		}
+		if (state->unsorted_alpha_flags == 0) {
+			state->sort_eye_pos = imdd_v4_load_3f(state->alpha_sort->eye_pos);
+			state->sort_items_back = state->alpha_sort->items + header_count;
+			chunk_capacity /= 2;
+		} else {
+			state->alpha_sort = NULL;
+		}
+	}
+
+	// the hash table is sized for the shapes in this window, to keep it at most two thirds full
+	state->dedupe_slots = NULL;
+	if (state->dedupe
+		&& state->store_count <= IMDD_EMIT_SORT_MAX_STORE_COUNT
+		&& imdd_emit_refs_fit_header_counts(stores, state->store_count)
+		&& header_count > 0
+		&& header_count <= state->dedupe->slot_capacity/4) {
+		uint32_t slot_count = 2;
+		while (2*slot_count < 3*header_count) {
+			slot_count *= 2;
+		}
+		state->dedupe_slots = state->dedupe->slots;
+		state->dedupe_slot_mask = slot_count - 1;
+		state->dedupe_marks = (uint8_t *)(state->dedupe->slots + slot_count);
+		state->dedupe_mark_count = header_count;
+		uint32_t store_base = 0U - header_begin;
+		for (uint32_t store_index = 0; store_index < state->store_count; ++store_index) {
+			state->dedupe_store_bases[store_index] = store_base;
+			store_base += imdd_store_header_count(stores[store_index]);
+		}
+	}
+
+	if (header_count == 0 || chunk_capacity == 0) {
+		return 0;
+	}
+	uint32_t const headers_per_chunk = (header_count + chunk_capacity - 1)/chunk_capacity;
+
+	// find the start of the window, then walk the stores in order, ending each chunk once it has enough headers
+	uint32_t store_index = 0;
+	uint32_t header_offset = header_begin;
+	for (;;) {
+		uint32_t const available = imdd_store_header_count(stores[store_index]);
+		if (header_offset <= available) {
+			break;
+		}
+		header_offset -= available;
+		++store_index;
+	}
+	uint32_t remaining_header_count = header_count;
+	while (remaining_header_count > 0) {
+		imdd_emit_chunk_t *const chunk = &chunks[state->chunk_count++];
+		chunk->store_index_begin = store_index;
+		chunk->header_offset_begin = header_offset;
+		chunk->is_sorted_alpha = 0;
+		chunk->item_begin = header_count - remaining_header_count;
+		chunk->item_end = chunk->item_begin;
+
+		uint32_t chunk_header_count = (remaining_header_count < headers_per_chunk) ? remaining_header_count : headers_per_chunk;
+		remaining_header_count -= chunk_header_count;
+		for (;;) {
+			uint32_t const available = imdd_store_header_count(stores[store_index]) - header_offset;
+			if (chunk_header_count <= available) {
+				header_offset += chunk_header_count;
+				break;
+			}
+			chunk_header_count -= available;
+			++store_index;
+			header_offset = 0;
+		}
+		chunk->store_index_end = store_index;
+		chunk->header_offset_end = header_offset;
+	}
+	if (state->alpha_sort) {
+		state->sort_task_count = state->chunk_count;
+	}
+	return state->chunk_count;
+}
+
+// splits all the shapes into at most chunk_capacity chunks of similar size, returns the chunk count
+static
+uint32_t imdd_emit_begin(
+	imdd_emit_state_t *state,
+	imdd_emit_chunk_t *chunks,
+	uint32_t chunk_capacity,
+
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+
+	imdd_instance_transform_t *instance_transform_buf,
+	imdd_instance_color_t *instance_color_buf,
+	uint32_t instance_capacity,
+	imdd_batch_t *instance_batches,
+	uint32_t *instance_count,
+
+	imdd_array_filled_vertex_t *filled_vertex_buf,
+	uint32_t filled_vertex_capacity,
+	imdd_batch_t *filled_array_batches,
+	uint32_t *filled_vertex_count,
+
+	imdd_array_wire_vertex_t *wire_vertex_buf,
+	uint32_t wire_vertex_capacity,
+	imdd_batch_t *wire_array_batches,
+	uint32_t *wire_vertex_count,
+
+	imdd_emit_options_t const *options)
+{
+	imdd_emit_init(
+		state,
+		stores,
+		store_count,
+		instance_transform_buf,
+		instance_color_buf,
+		instance_capacity,
+		instance_batches,
+		instance_count,
+		filled_vertex_buf,
+		filled_vertex_capacity,
+		filled_array_batches,
+		filled_vertex_count,
+		wire_vertex_buf,
+		wire_vertex_capacity,
+		wire_array_batches,
+		wire_vertex_count,
+		options);
+
+	uint32_t total_header_count = 0;
+	for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
+		total_header_count += imdd_store_header_count(stores[store_index]);
+	}
+	return imdd_emit_begin_window(state, chunks, chunk_capacity, 0, total_header_count);
+}
+
+// shapes of other passes are skipped when streaming
+static inline
+int imdd_emit_in_pass(imdd_emit_state_t const *state, imdd_shape_header_t header)
+{
+	return (state->pass_mask >> imdd_emit_pass_index(header.layer, (imdd_zmode_enum_t)header.zmode, (imdd_blend_enum_t)header.blend)) & 1U;
+}
+
+// culling is repeated when writing so that counts match without storing results
+static inline
+int imdd_emit_is_visible(imdd_frustum_t const *frustums, uint32_t frustum_count, imdd_shape_store_t const *store, imdd_shape_header_t header)
+{
+	return frustum_count == 0
+		|| imdd_frustum_test_shape(frustums, frustum_count, (imdd_shape_enum_t)header.shape, store->data_qw_store + header.data_qw_offset);
+}
+
+/*
+	Copies of shapes are found using a hash table of references to shapes,
+	in the same form as the reference of a sort item.  Each slot is claimed
+	with a compare and exchange, and when chunks race to insert copies of
+	the same shape the lowest reference is kept, so the first copy in store
+	order is converted however the chunks are scheduled.
+*/
+#define IMDD_EMIT_DEDUPE_EMPTY_SLOT		0xffffffffU
+#define IMDD_EMIT_DEDUPE_BLOCK_SIZE		32
+
+static uint32_t const g_imdd_emit_shape_data_qw_count[IMDD_SHAPE_COUNT] = {
+	2,		// IMDD_SHAPE_LINE
+	3,		// IMDD_SHAPE_TRIANGLE
+	2,		// IMDD_SHAPE_AABB
+	3,		// IMDD_SHAPE_OBB
+	1,		// IMDD_SHAPE_SPHERE
+	3,		// IMDD_SHAPE_ELLIPSOID
+	3,		// IMDD_SHAPE_CONE
+	3		// IMDD_SHAPE_CYLINDER
+};
+
+// hashes everything that is drawn, which is all of the header except where the parameters are stored
+static inline
+uint32_t imdd_emit_dedupe_hash(imdd_shape_header_t header, imdd_v4 const *data)
+{
+	// one multiply per 8 bytes moves each difference into the high bits
+	uint64_t hash = ((uint64_t)header.color << 32) | imdd_bucket_index_from_shape_header(header);
+	uint32_t const qw_count = g_imdd_emit_shape_data_qw_count[header.shape];
+	for (uint32_t qw_index = 0; qw_index < qw_count; ++qw_index) {
+		uint64_t words[2];
+		memcpy(words, data + qw_index, sizeof(words));
+		hash = (hash ^ words[0])*0x9e3779b97f4a7c15ULL;
+		hash = (hash ^ words[1])*0x9e3779b97f4a7c15ULL;
+	}
+
+	// then mix the high bits down, since the table only uses the low bits
+	hash ^= hash >> 32;
+	hash *= 0xd6e8feb86659fd93ULL;
+	hash ^= hash >> 32;
+	return (uint32_t)hash;
+}
+
+// compares the bits of the parameters, so that copies are exact even for negative zero or NaN
+static inline
+int imdd_emit_is_same_shape(imdd_emit_state_t const *state, uint32_t ref, imdd_shape_header_t header, imdd_v4 const *data)
+{
+	imdd_shape_store_t const *const store = state->stores[ref >> IMDD_EMIT_SORT_STORE_SHIFT];
+	imdd_shape_header_t const other_header = store->header_store[ref & IMDD_EMIT_SORT_HEADER_MASK];
+	if (imdd_bucket_index_from_shape_header(other_header) != imdd_bucket_index_from_shape_header(header)
+		|| other_header.color != header.color) {
+		return 0;
+	}
+	imdd_v4 const *const other_data = store->data_qw_store + other_header.data_qw_offset;
+	uint64_t diff = 0;
+	uint32_t const qw_count = g_imdd_emit_shape_data_qw_count[header.shape];
+	for (uint32_t qw_index = 0; qw_index < qw_count; ++qw_index) {
+		uint64_t words[2];
+		uint64_t other_words[2];
+		memcpy(words, data + qw_index, sizeof(words));
+		memcpy(other_words, other_data + qw_index, sizeof(other_words));
+		diff |= (words[0] ^ other_words[0]) | (words[1] ^ other_words[1]);
+	}
+	return diff == 0;
+}
+
+static inline
+uint32_t imdd_emit_dedupe_window_index(imdd_emit_state_t const *state, uint32_t store_index, uint32_t header_offset)
+{
+	return state->dedupe_store_bases[store_index] + header_offset;
+}
+
+/*
+	Each copy is marked exactly once, either by itself when it finds an
+	earlier copy in the table, or by the earlier copy that replaces it.
+	Marks are bytes, so chunks marking shapes of other chunks do not race.
+*/
+static
+void imdd_emit_dedupe_insert(
+	imdd_emit_state_t const *state,
+	uint32_t store_index,
+	uint32_t header_offset,
+	imdd_shape_header_t header,
+	imdd_v4 const *data,
+	uint32_t hash)
+{
+	imdd_atomic_uint *const slots = state->dedupe_slots;
+	uint32_t const slot_mask = state->dedupe_slot_mask;
+	uint32_t const ref = (store_index << IMDD_EMIT_SORT_STORE_SHIFT) | header_offset;
+	uint32_t slot_index = hash & slot_mask;
+	for (;;) {
+		uint32_t slot_ref = (uint32_t)imdd_atomic_load(&slots[slot_index]);
+		if (slot_ref == IMDD_EMIT_DEDUPE_EMPTY_SLOT) {
+			slot_ref = (uint32_t)imdd_atomic_compare_exchange(&slots[slot_index], IMDD_EMIT_DEDUPE_EMPTY_SLOT, ref);
+			if (slot_ref == IMDD_EMIT_DEDUPE_EMPTY_SLOT) {
+				return;
+			}
+		}
+		if (imdd_emit_is_same_shape(state, slot_ref, header, data)) {
+			// only copies of this shape are swapped into this slot, so retry until it holds a lower reference
+			while (ref < slot_ref) {
+				uint32_t const prev_ref = (uint32_t)imdd_atomic_compare_exchange(&slots[slot_index], slot_ref, ref);
+				if (prev_ref == slot_ref) {
+					state->dedupe_marks[imdd_emit_dedupe_window_index(state, slot_ref >> IMDD_EMIT_SORT_STORE_SHIFT, slot_ref & IMDD_EMIT_SORT_HEADER_MASK)] = 1;
+					return;
+				}
+				slot_ref = prev_ref;
+			}
+			state->dedupe_marks[imdd_emit_dedupe_window_index(state, store_index, header_offset)] = 1;
+			return;
+		}
+		slot_index = (slot_index + 1) & slot_mask;
+	}
+}
+
+// marks are checked again when writing, like culling, so that counts match without storing results
+static inline
+int imdd_emit_is_duplicate(imdd_emit_state_t const *state, uint32_t store_index, uint32_t header_offset)
+{
+	return state->dedupe_slots && state->dedupe_marks[imdd_emit_dedupe_window_index(state, store_index, header_offset)];
+}
+
+/*
+	Mesh LODs split each bucket further, so that shapes can be counted and
+	sorted by bucket and LOD together.  Shapes below the minimum size use
+	an extra level after the mesh LODs.
+*/
+#define IMDD_EMIT_LOD_SMALL				IMDD_MESH_LOD_COUNT
+#define IMDD_EMIT_LOD_BUCKET_COUNT		((IMDD_MESH_LOD_COUNT + 1)*IMDD_SHAPE_BUCKET_COUNT)
+
+// gets a centre and squared radius for the size of an instanced shape on screen, returns zero for other shapes
+static inline
+int imdd_emit_shape_size(imdd_shape_enum_t shape, imdd_v4 const *data, imdd_v4 *centre, imdd_v4 *radius_sq)
+{
+	switch (shape) {
+		case IMDD_SHAPE_AABB: {
+			imdd_v4 const half = imdd_v4_const_0_5f();
+			imdd_v4 const half_extent = imdd_v4_mul(imdd_v4_sub(data[1], data[0]), half);
+			*centre = imdd_v4_mul(imdd_v4_add(data[1], data[0]), half);
+			*radius_sq = imdd_v4_dot3(half_extent, half_extent);
+		} return 1;
+
+		case IMDD_SHAPE_SPHERE: {
+			imdd_v4 const radius = imdd_v4_swiz_wwww(data[0]);
+			*centre = data[0];
+			*radius_sq = imdd_v4_mul(radius, radius);
+		} return 1;
+
+		case IMDD_SHAPE_OBB:
+		case IMDD_SHAPE_ELLIPSOID:
+		case IMDD_SHAPE_CONE:
+		case IMDD_SHAPE_CYLINDER: {
+			imdd_v4 x_axis = data[0];
+			imdd_v4 y_axis = data[1];
+			imdd_v4 z_axis = data[2];
+			*centre = imdd_v4_const_zero();
+			imdd_v4_transpose_inplace(x_axis, y_axis, z_axis, *centre);
+			imdd_v4 const x_len_sq = imdd_v4_dot3(x_axis, x_axis);
+			imdd_v4 const y_len_sq = imdd_v4_dot3(y_axis, y_axis);
+			imdd_v4 const z_len_sq = imdd_v4_dot3(z_axis, z_axis);
+			if (shape == IMDD_SHAPE_OBB) {
+				// half diagonal of the box
+				*radius_sq = imdd_v4_add(imdd_v4_add(x_len_sq, y_len_sq), z_len_sq);
+			} else {
+				// longest axis from the transform origin
+				*radius_sq = imdd_v4_max(imdd_v4_max(x_len_sq, y_len_sq), z_len_sq);
+			}
+		} return 1;
+
+		default:
+			*centre = imdd_v4_const_zero();
+			*radius_sq = imdd_v4_const_zero();
+			return 0;
+	}
+}
+
+// picks the mesh LOD from the projected radius of the shape, like culling this is repeated when writing
+static
+uint32_t imdd_emit_lod_index(imdd_emit_state_t const *state, imdd_shape_store_t const *store, imdd_shape_header_t header)
+{
+	imdd_v4 centre;
+	imdd_v4 radius_sq;
+	if (!imdd_emit_shape_size((imdd_shape_enum_t)header.shape, store->data_qw_store + header.data_qw_offset, &centre, &radius_sq)) {
+		return 0;
+	}
+
+	// lanes x, y and z are negative while the shape is larger than LOD 1, LOD 2 and the minimum size
+	imdd_v4 const offset = imdd_v4_sub(centre, state->lod_eye_pos);
+	imdd_v4 const dist_sq = imdd_v4_dot3(offset, offset);
+	int const larger_mask = imdd_v4_signmask(imdd_v4_sub(imdd_v4_mul(state->lod_radius_sq_scale, dist_sq), radius_sq));
+	if ((larger_mask & 4) == 0) {
+		return IMDD_EMIT_LOD_SMALL;
+	}
+	if (header.shape == IMDD_SHAPE_AABB || header.shape == IMDD_SHAPE_OBB) {
+		return 0;
+	}
+	return 2U - (uint32_t)(larger_mask & 1) - (uint32_t)((larger_mask >> 1) & 1);
+}
+
+// draws a shape below the minimum size as a line through its centre that is about a pixel long
+static
+void imdd_emit_point(imdd_emit_state_t const *state, imdd_wire_vertex_stream_t *stream, uint32_t col, imdd_shape_enum_t shape, imdd_v4 const *data)
+{
+	imdd_v4 centre;
+	imdd_v4 radius_sq;
+	imdd_emit_shape_size(shape, data, &centre, &radius_sq);
+
+	// use the world axis closest to facing the camera, so that the line is at least 0.8 pixels long on screen
+	float offset[3];
+	imdd_v4_store_3f(offset, imdd_v4_sub(centre, state->lod_eye_pos));
+	float const x = fabsf(offset[0]);
+	float const y = fabsf(offset[1]);
+	float const z = fabsf(offset[2]);
+	float const half_length = .5f*sqrtf(offset[0]*offset[0] + offset[1]*offset[1] + offset[2]*offset[2])/state->lod->pixels_per_unit;
+	imdd_v4 const half_axis = (x <= y && x <= z) ? imdd_v4_init_3f(half_length, 0.f, 0.f)
+		: (y <= z) ? imdd_v4_init_3f(0.f, half_length, 0.f)
+		: imdd_v4_init_3f(0.f, 0.f, half_length);
+
+	// write it with the line kernel, which also handles full buffers and layouts
+	imdd_v4 line[2];
+	line[0] = imdd_v4_sub(centre, half_axis);
+	line[1] = imdd_v4_add(centre, half_axis);
+	state->desc_table[IMDD_SHAPE_LINE].wire_vertex_func(stream, col, line);
+}
+
+// quantises the squared distance to the centre of a shape, so that sorting keys in ascending order draws the furthest shape first
+static inline
+uint32_t imdd_emit_sort_key(imdd_emit_state_t const *state, imdd_shape_enum_t shape, imdd_v4 const *data)
+{
+	imdd_v4 centre;
+	imdd_v4 radius_sq;
+	switch (shape) {
+		case IMDD_SHAPE_LINE:
+			centre = imdd_v4_mul(imdd_v4_add(data[0], data[1]), imdd_v4_const_0_5f());
+			break;
+		case IMDD_SHAPE_TRIANGLE:
+			centre = imdd_v4_mul(imdd_v4_add(imdd_v4_add(data[0], data[1]), data[2]), imdd_v4_init_1f(1.f/3.f));
+			break;
+		default:
+			imdd_emit_shape_size(shape, data, &centre, &radius_sq);
+			break;
+	}
+	imdd_v4 const offset = imdd_v4_sub(centre, state->sort_eye_pos);
+	float dist_sq[3];
+	imdd_v4_store_3f(dist_sq, imdd_v4_dot3(offset, offset));
+
+	// the bits of a positive float sort in the same order as its value, keep the top 22
+	return ~imdd_asuint(dist_sq[0]) & ~IMDD_EMIT_SORT_BUCKET_MASK;
+}
+
+static
+uint32_t imdd_emit_instance_batch_index(imdd_emit_state_t const *state, uint32_t lod_index, imdd_shape_header_t header)
+{
+	return imdd_instance_group_batch_index(
+		state->instance_groups[lod_index][header.shape],
+		header.layer,
+		(imdd_style_enum_t)header.style,
+		(imdd_blend_enum_t)header.blend,
+		(imdd_zmode_enum_t)header.zmode);
+}
+
+static
+uint32_t imdd_emit_wire_batch_index(imdd_emit_state_t const *state, imdd_shape_header_t header)
+{
+	imdd_blend_enum_t const blend = (imdd_blend_enum_t)header.blend;
+	imdd_zmode_enum_t const zmode = (imdd_zmode_enum_t)header.zmode;
+	if (header.shape == IMDD_SHAPE_TRIANGLE && (state->flags & IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES)) {
+		return imdd_array_wire_triangle_batch_index(header.layer, blend, zmode);
+	}
+	return imdd_array_batch_index(header.layer, blend, zmode);
+}
+
+static
+void imdd_emit_dedupe_chunk(imdd_emit_state_t const *state, uint32_t chunk_index)
+{
+	imdd_emit_chunk_t const *const chunk = &state->chunks[chunk_index];
+	uint32_t const slot_mask = state->dedupe_slot_mask;
+	uint32_t hashes[IMDD_EMIT_DEDUPE_BLOCK_SIZE];
+	for (uint32_t store_index = chunk->store_index_begin; store_index <= chunk->store_index_end; ++store_index) {
+		imdd_shape_store_t const *const store = state->stores[store_index];
+		uint32_t const header_begin = (store_index == chunk->store_index_begin) ? chunk->header_offset_begin : 0;
+		uint32_t const header_end = (store_index == chunk->store_index_end) ? chunk->header_offset_end : imdd_store_header_count(store);
+		for (uint32_t block_begin = header_begin; block_begin < header_end; block_begin += IMDD_EMIT_DEDUPE_BLOCK_SIZE) {
+			uint32_t const block_end = (header_end - block_begin < IMDD_EMIT_DEDUPE_BLOCK_SIZE) ? header_end : (block_begin + IMDD_EMIT_DEDUPE_BLOCK_SIZE);
+
+			// slots are visited in a random order, so hash the whole block and fetch its slots ahead of time
+			for (uint32_t header_offset = block_begin; header_offset < block_end; ++header_offset) {
+				imdd_shape_header_t const header = store->header_store[header_offset];
+				if (header.shape >= IMDD_SHAPE_COUNT || !imdd_emit_in_pass(state, header)) {
+					continue;
+				}
+				uint32_t const hash = imdd_emit_dedupe_hash(header, store->data_qw_store + header.data_qw_offset);
+				hashes[header_offset - block_begin] = hash;
+				imdd_prefetch(state->dedupe_slots + (hash & slot_mask));
+			}
+			for (uint32_t header_offset = block_begin; header_offset < block_end; ++header_offset) {
+				imdd_shape_header_t const header = store->header_store[header_offset];
+				if (header.shape >= IMDD_SHAPE_COUNT || !imdd_emit_in_pass(state, header)) {
+					continue;
+				}
+				imdd_emit_dedupe_insert(
+					state,
+					store_index,
+					header_offset,
+					header,
+					store->data_qw_store + header.data_qw_offset,
+					hashes[header_offset - block_begin]);
+			}
+		}
+	}
+}
+
+static
+void imdd_emit_count_chunk(imdd_emit_state_t const *state, uint32_t chunk_index)
+{
+	imdd_emit_chunk_t *const chunk = &state->chunks[chunk_index];
+	imdd_frustum_t const *const frustums = state->frustums;
+	uint32_t const frustum_count = state->frustum_count;
+	int const use_lod = (state->lod != NULL);
+	int const small_as_points = (state->flags & IMDD_EMIT_FLAG_SMALL_AS_POINTS) != 0;
+
+	// partition the shapes into buckets and count them
+	uint32_t bucket_sizes[IMDD_EMIT_LOD_BUCKET_COUNT];
+	memset(bucket_sizes, 0, IMDD_EMIT_LOD_BUCKET_COUNT*sizeof(uint32_t));
+	memset(chunk->culled_counts, 0, IMDD_SHAPE_COUNT*sizeof(uint32_t));
+	memset(chunk->small_counts, 0, IMDD_SHAPE_COUNT*sizeof(uint32_t));
+	memset(chunk->duplicate_counts, 0, IMDD_SHAPE_COUNT*sizeof(uint32_t));
+	if (chunk->is_sorted_alpha) {
+		// each sorted item already has the bucket and LOD of its shape
+		imdd_emit_sort_item_t const *const items = state->sort_items_back;
+		for (uint32_t item_index = chunk->item_begin; item_index < chunk->item_end; ++item_index) {
+			++bucket_sizes[items[item_index].key & IMDD_EMIT_SORT_BUCKET_MASK];
+		}
+	} else {
+		// when sorting, collect alpha blended shapes as items instead of counting them
+		imdd_emit_sort_item_t *const items = state->alpha_sort ? state->alpha_sort->items : NULL;
+		uint32_t item_index = chunk->item_begin;
+		for (uint32_t store_index = chunk->store_index_begin; store_index <= chunk->store_index_end; ++store_index) {
+			imdd_shape_store_t const *const store = state->stores[store_index];
+			uint32_t const header_begin = (store_index == chunk->store_index_begin) ? chunk->header_offset_begin : 0;
+			uint32_t const header_end = (store_index == chunk->store_index_end) ? chunk->header_offset_end : imdd_store_header_count(store);
+			for (uint32_t header_offset = header_begin; header_offset < header_end; ++header_offset) {
+				imdd_shape_header_t const header = store->header_store[header_offset];
+				if (header.shape >= IMDD_SHAPE_COUNT || !imdd_emit_in_pass(state, header)) {
+					continue;
+				}
+				if (imdd_emit_is_duplicate(state, store_index, header_offset)) {
+					++chunk->duplicate_counts[header.shape];
+					continue;
+				}
+				if (!imdd_emit_is_visible(frustums, frustum_count, store, header)) {
+					++chunk->culled_counts[header.shape];
+					continue;
+				}
+				uint32_t bucket_index = imdd_bucket_index_from_shape_header(header);
+				if (use_lod) {
+					uint32_t const lod_index = imdd_emit_lod_index(state, store, header);
+					if (lod_index == IMDD_EMIT_LOD_SMALL) {
+						++chunk->small_counts[header.shape];
+						if (!small_as_points) {
+							continue;
+						}
+					}
+					bucket_index += lod_index*IMDD_SHAPE_BUCKET_COUNT;
+				}
+				if (items && header.blend == IMDD_BLEND_ALPHA) {
+					imdd_emit_sort_item_t *const item = &items[item_index++];
+					item->key = imdd_emit_sort_key(state, (imdd_shape_enum_t)header.shape, store->data_qw_store + header.data_qw_offset) | bucket_index;
+					item->ref = (store_index << IMDD_EMIT_SORT_STORE_SHIFT) | header_offset;
+					continue;
+				}
+				++bucket_sizes[bucket_index];
+			}
+		}
+		chunk->item_end = item_index;
+	}
+
+	// count vertices and instances
+	memset(chunk->instance_counts, 0, IMDD_INSTANCE_BATCH_COUNT*sizeof(uint32_t));
+	memset(chunk->filled_vertex_counts, 0, IMDD_ARRAY_BATCH_COUNT*sizeof(uint32_t));
+	memset(chunk->wire_vertex_counts, 0, IMDD_ARRAY_BATCH_COUNT*sizeof(uint32_t));
+	for (uint32_t lod_bucket_index = 0; lod_bucket_index < IMDD_EMIT_LOD_BUCKET_COUNT; ++lod_bucket_index) {
+		uint32_t const bucket_size = bucket_sizes[lod_bucket_index];
+		if (bucket_size == 0) {
+			continue;
+		}
+
+		uint32_t const lod_index = lod_bucket_index/IMDD_SHAPE_BUCKET_COUNT;
+		imdd_shape_header_t const header = imdd_shape_header_from_bucket_index(lod_bucket_index % IMDD_SHAPE_BUCKET_COUNT);
+		imdd_emit_desc_t const *const desc = state->desc_table + header.shape;
+		imdd_style_enum_t const style = (imdd_style_enum_t)header.style;
+		imdd_blend_enum_t const blend = (imdd_blend_enum_t)header.blend;
+		imdd_zmode_enum_t const zmode = (imdd_zmode_enum_t)header.zmode;
+
+		if (lod_index == IMDD_EMIT_LOD_SMALL) {
+			uint32_t const batch_index = imdd_array_batch_index(header.layer, blend, zmode);
+			chunk->wire_vertex_counts[batch_index] += 2*bucket_size;
+			continue;
+		}
+		if (desc->instance_func) {
+			uint32_t const batch_index = imdd_emit_instance_batch_index(state, lod_index, header);
+			chunk->instance_counts[batch_index] += bucket_size;
+		}
+		if (desc->filled_vertex_func && style == IMDD_STYLE_FILLED) {
+			uint32_t const batch_index = imdd_array_batch_index(header.layer, blend, zmode);
+			chunk->filled_vertex_counts[batch_index] += bucket_size*desc->filled_vertex_count;
+		}
+		if (desc->wire_vertex_func && style == IMDD_STYLE_WIRE) {
+			uint32_t const batch_index = imdd_emit_wire_batch_index(state, header);
+			chunk->wire_vertex_counts[batch_index] += bucket_size*desc->wire_vertex_count;
+		}
+	}
+}
+
+// gets the items read and written by a sort task, each pass after the first splits the items evenly between tasks
+static inline
+void imdd_emit_sort_task_items(
+	imdd_emit_state_t const *state,
+	uint32_t task_index,
+	imdd_emit_sort_item_t **src,
+	imdd_emit_sort_item_t **dst,
+	uint32_t *begin,
+	uint32_t *end)
+{
+	imdd_emit_sort_item_t *const front = state->alpha_sort->items;
+	imdd_emit_sort_item_t *const back = state->sort_items_back;
+	int const is_odd = (state->sort_pass & 1) != 0;
+	*src = is_odd ? back : front;
+	*dst = is_odd ? front : back;
+	if (state->sort_pass == 0) {
+		imdd_emit_chunk_t const *const chunk = &state->chunks[task_index];
+		*begin = chunk->item_begin;
+		*end = chunk->item_end;
+	} else {
+		uint64_t const item_count = state->sort_item_count;
+		uint32_t const task_count = state->sort_task_count;
+		*begin = (uint32_t)((item_count*task_index)/task_count);
+		*end = (uint32_t)((item_count*(task_index + 1))/task_count);
+	}
+}
+
+static
+void imdd_emit_sort_count(imdd_emit_state_t const *state, uint32_t task_index)
+{
+	imdd_emit_chunk_t *const chunk = &state->chunks[task_index];
+	uint32_t const shift = IMDD_EMIT_SORT_BUCKET_BITS + state->sort_pass*IMDD_EMIT_SORT_RADIX_BITS;
+	imdd_emit_sort_item_t *src;
+	imdd_emit_sort_item_t *dst;
+	uint32_t begin;
+	uint32_t end;
+	imdd_emit_sort_task_items(state, task_index, &src, &dst, &begin, &end);
+
+	// count into a local array, which cannot alias the items
+	uint32_t counts[IMDD_EMIT_SORT_RADIX_SIZE];
+	memset(counts, 0, IMDD_EMIT_SORT_RADIX_SIZE*sizeof(uint32_t));
+	for (uint32_t item_index = begin; item_index < end; ++item_index) {
+		++counts[(src[item_index].key >> shift) & (IMDD_EMIT_SORT_RADIX_SIZE - 1)];
+	}
+	memcpy(chunk->sort_offsets, counts, IMDD_EMIT_SORT_RADIX_SIZE*sizeof(uint32_t));
+}
+
+// turns the digit counts of every task into output offsets, in digit order then task order to keep the sort stable
+static
+void imdd_emit_sort_prefix(imdd_emit_state_t *state)
+{
+	uint32_t offset = 0;
+	for (uint32_t digit = 0; digit < IMDD_EMIT_SORT_RADIX_SIZE; ++digit) {
+		for (uint32_t task_index = 0; task_index < state->sort_task_count; ++task_index) {
+			uint32_t *const sort_offset = &state->chunks[task_index].sort_offsets[digit];
+			uint32_t const count = *sort_offset;
+			*sort_offset = offset;
+			offset += count;
+		}
+	}
+	state->sort_item_count = offset;
+}
+
+static
+void imdd_emit_sort_scatter(imdd_emit_state_t const *state, uint32_t task_index)
+{
+	imdd_emit_chunk_t *const chunk = &state->chunks[task_index];
+	uint32_t const shift = IMDD_EMIT_SORT_BUCKET_BITS + state->sort_pass*IMDD_EMIT_SORT_RADIX_BITS;
+	imdd_emit_sort_item_t *src;
+	imdd_emit_sort_item_t *dst;
+	uint32_t begin;
+	uint32_t end;
+	imdd_emit_sort_task_items(state, task_index, &src, &dst, &begin, &end);
+
+	uint32_t offsets[IMDD_EMIT_SORT_RADIX_SIZE];
+	memcpy(offsets, chunk->sort_offsets, IMDD_EMIT_SORT_RADIX_SIZE*sizeof(uint32_t));
+	for (uint32_t item_index = begin; item_index < end; ++item_index) {
+		imdd_emit_sort_item_t const item = src[item_index];
+		dst[offsets[(item.key >> shift) & (IMDD_EMIT_SORT_RADIX_SIZE - 1)]++] = item;
+	}
+}
+
+// moves on to the next sort pass, or after the last pass adds chunks to convert the sorted items and returns zero
+static
+int imdd_emit_sort_next_pass(imdd_emit_state_t *state)
+{
+	if (++state->sort_pass < IMDD_EMIT_SORT_PASS_COUNT) {
+		return 1;
+	}
+
+	state->sort_chunk_begin = state->chunk_count;
+	if (state->sort_item_count > 0) {
+		uint64_t const item_count = state->sort_item_count;
+		uint32_t const task_count = state->sort_task_count;
+		for (uint32_t task_index = 0; task_index < task_count; ++task_index) {
+			imdd_emit_chunk_t *const chunk = &state->chunks[state->chunk_count++];
+			memset(chunk, 0, sizeof(imdd_emit_chunk_t));
+			chunk->is_sorted_alpha = 1;
+			chunk->item_begin = (uint32_t)((item_count*task_index)/task_count);
+			chunk->item_end = (uint32_t)((item_count*(task_index + 1))/task_count);
+		}
+	}
+	return 0;
+}
+
+// assigns consecutive ranges to each chunk in turn for a group of batches, clamping counts to fit
+static
+uint32_t imdd_emit_partition_batches(
+	imdd_emit_chunk_t *chunks,
+	uint32_t chunk_count,
+	size_t counts_offset,
+	size_t offsets_offset,
+	uint32_t batch_count,
+	uint32_t capacity,
+	imdd_batch_t *batches,
+	uint32_t *required_count)
+{
+	uint32_t end_offset = 0;
+	uint32_t total_count = 0;
+	for (uint32_t batch_index = 0; batch_index < batch_count; ++batch_index) {
+		batches[batch_index].offset = end_offset;
+		for (uint32_t chunk_index = 0; chunk_index < chunk_count; ++chunk_index) {
+			uint8_t *const chunk = (uint8_t *)&chunks[chunk_index];
+			uint32_t *const count = (uint32_t *)(chunk + counts_offset) + batch_index;
+			uint32_t *const offset = (uint32_t *)(chunk + offsets_offset) + batch_index;
+			uint32_t const start_offset = end_offset;
+			total_count += *count;
+			end_offset += *count;
+			if (end_offset > capacity) {
+				end_offset = capacity;
+			}
+			*offset = start_offset;
+			*count = end_offset - start_offset;
+		}
+	}
+	*required_count = total_count;
+	return end_offset;
+}
+
+static
+void imdd_emit_partition(imdd_emit_state_t const *state)
+{
+	// partition the buffers between draw calls
+	uint32_t required_instance_count;
+	uint32_t required_filled_vertex_count;
+	uint32_t required_wire_vertex_count;
+	*state->instance_count = imdd_emit_partition_batches(
+		state->chunks,
+		state->chunk_count,
+		offsetof(imdd_emit_chunk_t, instance_counts),
+		offsetof(imdd_emit_chunk_t, instance_offsets),
+		IMDD_INSTANCE_BATCH_COUNT,
+		state->instance_capacity,
+		state->instance_batches,
+		&required_instance_count);
+	*state->filled_vertex_count = imdd_emit_partition_batches(
+		state->chunks,
+		state->chunk_count,
+		offsetof(imdd_emit_chunk_t, filled_vertex_counts),
+		offsetof(imdd_emit_chunk_t, filled_vertex_offsets),
+		IMDD_ARRAY_BATCH_COUNT,
+		state->filled_vertex_capacity,
+		state->filled_array_batches,
+		&required_filled_vertex_count);
+	*state->wire_vertex_count = imdd_emit_partition_batches(
+		state->chunks,
+		state->chunk_count,
+		offsetof(imdd_emit_chunk_t, wire_vertex_counts),
+		offsetof(imdd_emit_chunk_t, wire_vertex_offsets),
+		IMDD_ARRAY_BATCH_COUNT,
+		state->wire_vertex_capacity,
+		state->wire_array_batches,
+		&required_wire_vertex_count);
+
+	if (state->stats) {
+		state->stats->required_instance_count = required_instance_count;
+		state->stats->required_filled_vertex_count = required_filled_vertex_count;
+		state->stats->required_wire_vertex_count = required_wire_vertex_count;
+		state->stats->unsorted_alpha_flags = state->unsorted_alpha_flags;
+	}
+}
+
+#define IMDD_EMIT_SORT_BLOCK_SIZE		1024
+
+static
+void imdd_emit_write_sorted(
+	imdd_emit_state_t const *state,
+	imdd_emit_chunk_t const *chunk,
+	imdd_instance_stream_t *instance_streams,
+	imdd_filled_vertex_stream_t *filled_vertex_streams,
+	imdd_wire_vertex_stream_t *wire_vertex_streams,
+	imdd_emit_nt_state_t *nt_state)
+{
+	imdd_emit_loop_desc_t const *const loop_desc_table = state->loop_desc_table;
+	imdd_frustum_t const *const frustums = state->frustums;
+	uint32_t const frustum_count = state->frustum_count;
+	int const use_lod = (state->lod != NULL);
+	int const small_as_points = (state->flags & IMDD_EMIT_FLAG_SMALL_AS_POINTS) != 0;
+	int const sort_alpha = (state->alpha_sort != NULL);
+	uint32_t bucket_offsets[IMDD_EMIT_LOD_BUCKET_COUNT];
+	uint16_t bucket_indices[IMDD_EMIT_SORT_BLOCK_SIZE];
+	uint32_t header_offsets[IMDD_EMIT_SORT_BLOCK_SIZE];
+
+	for (uint32_t store_index = chunk->store_index_begin; store_index <= chunk->store_index_end; ++store_index) {
+		imdd_shape_store_t const *const store = state->stores[store_index];
+		uint32_t const header_begin = (store_index == chunk->store_index_begin) ? chunk->header_offset_begin : 0;
+		uint32_t const header_end = (store_index == chunk->store_index_end) ? chunk->header_offset_end : imdd_store_header_count(store);
+		for (uint32_t block_begin = header_begin; block_begin < header_end; block_begin += IMDD_EMIT_SORT_BLOCK_SIZE) {
+			uint32_t const block_end = (header_end - block_begin < IMDD_EMIT_SORT_BLOCK_SIZE) ? header_end : (block_begin + IMDD_EMIT_SORT_BLOCK_SIZE);
+
+			// counting sort the headers in this block by bucket and LOD
+			memset(bucket_offsets, 0, IMDD_EMIT_LOD_BUCKET_COUNT*sizeof(uint32_t));
+			for (uint32_t header_offset = block_begin; header_offset < block_end; ++header_offset) {
+				imdd_shape_header_t const header = store->header_store[header_offset];
+				uint32_t bucket_index = IMDD_EMIT_LOD_BUCKET_COUNT;
+				if (header.shape < IMDD_SHAPE_COUNT
+					&& imdd_emit_in_pass(state, header)
+					&& !(sort_alpha && header.blend == IMDD_BLEND_ALPHA)
+					&& !imdd_emit_is_duplicate(state, store_index, header_offset)
+					&& imdd_emit_is_visible(frustums, frustum_count, store, header)) {
+					bucket_index = imdd_bucket_index_from_shape_header(header);
+					if (use_lod) {
+						uint32_t const lod_index = imdd_emit_lod_index(state, store, header);
+						bucket_index = (lod_index == IMDD_EMIT_LOD_SMALL && !small_as_points)
+							? IMDD_EMIT_LOD_BUCKET_COUNT
+							: (bucket_index + lod_index*IMDD_SHAPE_BUCKET_COUNT);
+					}
+					if (bucket_index < IMDD_EMIT_LOD_BUCKET_COUNT) {
+						++bucket_offsets[bucket_index];
+					}
+				}
+				bucket_indices[header_offset - block_begin] = (uint16_t)bucket_index;
+			}
+			uint32_t sorted_count = 0;
+			for (uint32_t bucket_index = 0; bucket_index < IMDD_EMIT_LOD_BUCKET_COUNT; ++bucket_index) {
+				uint32_t const bucket_size = bucket_offsets[bucket_index];
+				bucket_offsets[bucket_index] = sorted_count;
+				sorted_count += bucket_size;
+			}
+			for (uint32_t header_offset = block_begin; header_offset < block_end; ++header_offset) {
+				uint32_t const bucket_index = bucket_indices[header_offset - block_begin];
+				if (bucket_index < IMDD_EMIT_LOD_BUCKET_COUNT) {
+					header_offsets[bucket_offsets[bucket_index]++] = header_offset;
+				}
+			}
+
+			// convert each bucket with the loop for its shape, offsets now point at the end of each bucket
+			uint32_t bucket_begin = 0;
+			for (uint32_t bucket_index = 0; bucket_index < IMDD_EMIT_LOD_BUCKET_COUNT; ++bucket_index) {
+				uint32_t const bucket_end = bucket_offsets[bucket_index];
+				uint32_t const count = bucket_end - bucket_begin;
+				if (count == 0) {
+					continue;
+				}
+
+				uint32_t const lod_index = bucket_index/IMDD_SHAPE_BUCKET_COUNT;
+				imdd_shape_header_t const header = imdd_shape_header_from_bucket_index(bucket_index % IMDD_SHAPE_BUCKET_COUNT);
+				imdd_emit_loop_desc_t const *const loop_desc = loop_desc_table + header.shape;
+				imdd_style_enum_t const style = (imdd_style_enum_t)header.style;
+				imdd_blend_enum_t const blend = (imdd_blend_enum_t)header.blend;
+				imdd_zmode_enum_t const zmode = (imdd_zmode_enum_t)header.zmode;
+				uint32_t const *const bucket_header_offsets = header_offsets + bucket_begin;
+				bucket_begin = bucket_end;
+
+				if (lod_index == IMDD_EMIT_LOD_SMALL) {
+					uint32_t const batch_index = imdd_array_batch_index(header.layer, blend, zmode);
+					imdd_wire_vertex_stream_t *const stream = wire_vertex_streams + batch_index;
+					for (uint32_t i = 0; i < count; ++i) {
+						imdd_shape_header_t const point_header = store->header_store[bucket_header_offsets[i]];
+						if (nt_state) {
+							imdd_emit_nt_reserve_wire_vertices(nt_state, batch_index, stream, 2);
+						}
+						imdd_emit_point(state, stream, point_header.color, (imdd_shape_enum_t)header.shape, store->data_qw_store + point_header.data_qw_offset);
+					}
+					continue;
+				}
+
+				if (loop_desc->instance_loop_func) {
+					uint32_t const batch_index = imdd_emit_instance_batch_index(state, lod_index, header);
+					loop_desc->instance_loop_func(nt_state, batch_index, instance_streams + batch_index, store, bucket_header_offsets, count);
+				}
+				if (loop_desc->filled_vertex_loop_func && style == IMDD_STYLE_FILLED) {
+					uint32_t const batch_index = imdd_array_batch_index(header.layer, blend, zmode);
+					loop_desc->filled_vertex_loop_func(nt_state, batch_index, filled_vertex_streams + batch_index, store, bucket_header_offsets, count);
+				}
+				if (loop_desc->wire_vertex_loop_func && style == IMDD_STYLE_WIRE) {
+					uint32_t const batch_index = imdd_emit_wire_batch_index(state, header);
+					loop_desc->wire_vertex_loop_func(nt_state, batch_index, wire_vertex_streams + batch_index, store, bucket_header_offsets, count);
+				}
+			}
+		}
+	}
+}
+
+// converts a single visible shape using the meshes for its LOD
+static inline
+void imdd_emit_write_shape(
+	imdd_emit_state_t const *state,
+	imdd_instance_stream_t *instance_streams,
+	imdd_filled_vertex_stream_t *filled_vertex_streams,
+	imdd_wire_vertex_stream_t *wire_vertex_streams,
+	imdd_emit_nt_state_t *nt_state,
+	imdd_shape_header_t header,
+	imdd_v4 const *data,
+	uint32_t lod_index)
+{
+	imdd_emit_desc_t const *const desc = state->desc_table + header.shape;
+	imdd_style_enum_t const style = (imdd_style_enum_t)header.style;
+	imdd_blend_enum_t const blend = (imdd_blend_enum_t)header.blend;
+	imdd_zmode_enum_t const zmode = (imdd_zmode_enum_t)header.zmode;
+
+	if (lod_index == IMDD_EMIT_LOD_SMALL) {
+		uint32_t const batch_index = imdd_array_batch_index(header.layer, blend, zmode);
+		if (nt_state) {
+			imdd_emit_nt_reserve_wire_vertices(nt_state, batch_index, wire_vertex_streams + batch_index, 2);
+		}
+		imdd_emit_point(state, wire_vertex_streams + batch_index, header.color, (imdd_shape_enum_t)header.shape, data);
+		return;
+	}
+	if (desc->instance_func) {
+		uint32_t const batch_index = imdd_emit_instance_batch_index(state, lod_index, header);
+		if (nt_state) {
+			imdd_emit_nt_reserve_instances(nt_state, batch_index, instance_streams + batch_index, 1);
+		}
+		desc->instance_func(instance_streams + batch_index, header.color, data);
+	}
+	if (desc->filled_vertex_func && style == IMDD_STYLE_FILLED) {
+		uint32_t const batch_index = imdd_array_batch_index(header.layer, blend, zmode);
+		if (nt_state) {
+			imdd_emit_nt_reserve_filled_vertices(nt_state, batch_index, filled_vertex_streams + batch_index, desc->filled_vertex_count);
+		}
+		desc->filled_vertex_func(filled_vertex_streams + batch_index, header.color, data);
+	}
+	if (desc->wire_vertex_func && style == IMDD_STYLE_WIRE) {
+		uint32_t const batch_index = imdd_emit_wire_batch_index(state, header);
+		if (nt_state) {
+			imdd_emit_nt_reserve_wire_vertices(nt_state, batch_index, wire_vertex_streams + batch_index, desc->wire_vertex_count);
+		}
+		desc->wire_vertex_func(wire_vertex_streams + batch_index, header.color, data);
+	}
+}
+
+static
+void imdd_emit_write_sorted_alpha(
+	imdd_emit_state_t const *state,
+	imdd_emit_chunk_t const *chunk,
+	imdd_instance_stream_t *instance_streams,
+	imdd_filled_vertex_stream_t *filled_vertex_streams,
+	imdd_wire_vertex_stream_t *wire_vertex_streams,
+	imdd_emit_nt_state_t *nt_state)
+{
+	imdd_emit_sort_item_t const *const items = state->sort_items_back;
+	for (uint32_t item_index = chunk->item_begin; item_index < chunk->item_end; ++item_index) {
+		// shapes are visited in a random order, so fetch headers and then shape data ahead of time
+		if (item_index + 2*IMDD_EMIT_SORT_PREFETCH_DISTANCE < chunk->item_end) {
+			uint32_t const ref = items[item_index + 2*IMDD_EMIT_SORT_PREFETCH_DISTANCE].ref;
+			imdd_prefetch(state->stores[ref >> IMDD_EMIT_SORT_STORE_SHIFT]->header_store + (ref & IMDD_EMIT_SORT_HEADER_MASK));
+		}
+		if (item_index + IMDD_EMIT_SORT_PREFETCH_DISTANCE < chunk->item_end) {
+			uint32_t const ref = items[item_index + IMDD_EMIT_SORT_PREFETCH_DISTANCE].ref;
+			imdd_shape_store_t const *const store = state->stores[ref >> IMDD_EMIT_SORT_STORE_SHIFT];
+			imdd_prefetch(store->data_qw_store + store->header_store[ref & IMDD_EMIT_SORT_HEADER_MASK].data_qw_offset);
+		}
+
+		imdd_emit_sort_item_t const item = items[item_index];
+		imdd_shape_store_t const *const store = state->stores[item.ref >> IMDD_EMIT_SORT_STORE_SHIFT];
+		imdd_shape_header_t const header = store->header_store[item.ref & IMDD_EMIT_SORT_HEADER_MASK];
+		uint32_t const lod_index = (item.key & IMDD_EMIT_SORT_BUCKET_MASK)/IMDD_SHAPE_BUCKET_COUNT;
+		imdd_emit_write_shape(
+			state,
+			instance_streams,
+			filled_vertex_streams,
+			wire_vertex_streams,
+			nt_state,
+			header,
+			store->data_qw_store + header.data_qw_offset,
+			lod_index);
+	}
+}
+
+// points the streams at the ranges of each batch assigned to this chunk within the layout
+static
+void imdd_emit_layout_begin(
+	imdd_emit_layout_t const *layout,
+	imdd_emit_chunk_t const *chunk,
+	imdd_instance_stream_t *instance_streams,
+	imdd_filled_vertex_stream_t *filled_vertex_streams,
+	imdd_wire_vertex_stream_t *wire_vertex_streams,
+	uint32_t filled_qw_size)
+{
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		imdd_instance_stream_t *const stream = &instance_streams[batch_index];
+		memset(stream, 0, sizeof(*stream));
+		stream->qw_size = IMDD_INSTANCE_TRANSFORM_QW_SIZE;
+		stream->layout = layout;
+		stream->index = chunk->instance_offsets[batch_index];
+		stream->index_end = stream->index + chunk->instance_counts[batch_index];
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_filled_vertex_stream_t *const stream = &filled_vertex_streams[batch_index];
+		memset(stream, 0, sizeof(*stream));
+		stream->qw_size = filled_qw_size;
+		stream->layout = layout;
+		stream->index = chunk->filled_vertex_offsets[batch_index];
+		stream->index_end = stream->index + chunk->filled_vertex_counts[batch_index];
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_wire_vertex_stream_t *const stream = &wire_vertex_streams[batch_index];
+		memset(stream, 0, sizeof(*stream));
+		stream->layout = layout;
+		stream->index = chunk->wire_vertex_offsets[batch_index];
+		stream->index_end = stream->index + chunk->wire_vertex_counts[batch_index];
+	}
+}
+
+// keeps how much was written, which is less than the range only if the layout is full
+static
+void imdd_emit_layout_end(
+	imdd_emit_chunk_t *chunk,
+	imdd_instance_stream_t const *instance_streams,
+	imdd_filled_vertex_stream_t const *filled_vertex_streams,
+	imdd_wire_vertex_stream_t const *wire_vertex_streams)
+{
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		chunk->instance_counts[batch_index] = instance_streams[batch_index].index - chunk->instance_offsets[batch_index];
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		chunk->filled_vertex_counts[batch_index] = filled_vertex_streams[batch_index].index - chunk->filled_vertex_offsets[batch_index];
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		chunk->wire_vertex_counts[batch_index] = wire_vertex_streams[batch_index].index - chunk->wire_vertex_offsets[batch_index];
+	}
+}
+
+static
+void imdd_emit_write_chunk(imdd_emit_state_t const *state, uint32_t chunk_index)
+{
+	imdd_emit_chunk_t *const chunk = &state->chunks[chunk_index];
+	imdd_emit_desc_t const *const desc_table = state->desc_table;
+	imdd_frustum_t const *const frustums = state->frustums;
+	uint32_t const frustum_count = state->frustum_count;
+	int const use_lod = (state->lod != NULL);
+	int const small_as_points = (state->flags & IMDD_EMIT_FLAG_SMALL_AS_POINTS) != 0;
+	int const sort_alpha = (state->alpha_sort != NULL);
+
+	// set up streams for the ranges of each batch assigned to this chunk
+	imdd_instance_stream_t instance_streams[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_filled_vertex_stream_t filled_vertex_streams[IMDD_ARRAY_BATCH_COUNT];
+	imdd_wire_vertex_stream_t wire_vertex_streams[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t const filled_qw_size = (state->flags & IMDD_EMIT_FLAG_FLAT_TRIANGLES) ? IMDD_ARRAY_FLAT_VERTEX_QW_SIZE : IMDD_ARRAY_FILLED_VERTEX_QW_SIZE;
+	imdd_emit_nt_state_t *const nt_state = (state->nt_states && (state->flags & IMDD_EMIT_FLAG_NON_TEMPORAL)) ? &state->nt_states[chunk_index] : NULL;
+	if (state->layout) {
+		// the layout kernels store each element straight into the buffers of the caller
+		imdd_emit_layout_begin(state->layout, chunk, instance_streams, filled_vertex_streams, wire_vertex_streams, filled_qw_size);
+	} else {
+		for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+			imdd_instance_format_enum_t const format = g_imdd_instance_groups[imdd_instance_group_from_batch_index(batch_index)].format;
+			uint32_t const qw_size = g_imdd_instance_format_qw_size[format];
+			uint32_t const start_offset = chunk->instance_offsets[batch_index];
+			imdd_v4 *const begin = (imdd_v4 *)state->instance_transform_buf
+				+ imdd_instance_format_qw_bias(state->instance_batches, format)
+				+ start_offset*qw_size;
+			instance_streams[batch_index].begin = begin;
+			instance_streams[batch_index].current = begin;
+			instance_streams[batch_index].end = begin + chunk->instance_counts[batch_index]*qw_size;
+			instance_streams[batch_index].color = state->instance_color_buf + start_offset;
+			instance_streams[batch_index].qw_size = qw_size;
+		}
+		for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+			imdd_v4 *const begin = (imdd_v4 *)state->filled_vertex_buf + chunk->filled_vertex_offsets[batch_index]*filled_qw_size;
+			filled_vertex_streams[batch_index].begin = begin;
+			filled_vertex_streams[batch_index].current = begin;
+			filled_vertex_streams[batch_index].end = begin + chunk->filled_vertex_counts[batch_index]*filled_qw_size;
+			filled_vertex_streams[batch_index].qw_size = filled_qw_size;
+		}
+		for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+			uint32_t const start_offset = chunk->wire_vertex_offsets[batch_index];
+			wire_vertex_streams[batch_index].begin = state->wire_vertex_buf + start_offset;
+			wire_vertex_streams[batch_index].current = state->wire_vertex_buf + start_offset;
+			wire_vertex_streams[batch_index].end = state->wire_vertex_buf + start_offset + chunk->wire_vertex_counts[batch_index];
+		}
+
+		// for non-temporal output, write through staging windows instead
+		if (nt_state) {
+			imdd_emit_nt_begin(nt_state, instance_streams, filled_vertex_streams, wire_vertex_streams);
+		}
+	}
+
+	// write the vertices through the streams
+	if (chunk->is_sorted_alpha) {
+		imdd_emit_write_sorted_alpha(state, chunk, instance_streams, filled_vertex_streams, wire_vertex_streams, nt_state);
+	} else if (state->flags & IMDD_EMIT_FLAG_SORTED) {
+		imdd_emit_write_sorted(state, chunk, instance_streams, filled_vertex_streams, wire_vertex_streams, nt_state);
+	} else {
+		for (uint32_t store_index = chunk->store_index_begin; store_index <= chunk->store_index_end; ++store_index) {
+			imdd_shape_store_t const *const store = state->stores[store_index];
+			uint32_t const header_begin = (store_index == chunk->store_index_begin) ? chunk->header_offset_begin : 0;
+			uint32_t const header_end = (store_index == chunk->store_index_end) ? chunk->header_offset_end : imdd_store_header_count(store);
+			for (uint32_t header_offset = header_begin; header_offset < header_end; ++header_offset) {
+				imdd_shape_header_t const header = store->header_store[header_offset];
+				if (header.shape >= IMDD_SHAPE_COUNT
+					|| !imdd_emit_in_pass(state, header)
+					|| (sort_alpha && header.blend == IMDD_BLEND_ALPHA)
+					|| imdd_emit_is_duplicate(state, store_index, header_offset)
+					|| !imdd_emit_is_visible(frustums, frustum_count, store, header)) {
+					continue;
+				}
+
+				imdd_emit_desc_t const *const desc = desc_table + header.shape;
+				imdd_v4 const *data = store->data_qw_store + header.data_qw_offset;
+				uint32_t const lod_index = (use_lod && desc->instance_func) ? imdd_emit_lod_index(state, store, header) : 0;
+				if (lod_index == IMDD_EMIT_LOD_SMALL && !small_as_points) {
+					continue;
+				}
+
+				// pair up with the next shape if it is in the same bucket and uses the same LOD
+				if (desc->instance_x2_func && lod_index != IMDD_EMIT_LOD_SMALL && header_offset + 1 < header_end) {
+					imdd_shape_header_t const next_header = store->header_store[header_offset + 1];
+					imdd_v4 const *next_data = store->data_qw_store + next_header.data_qw_offset;
+					if (imdd_bucket_index_from_shape_header(next_header) == imdd_bucket_index_from_shape_header(header)
+						&& imdd_emit_in_pass(state, next_header)
+						&& !imdd_emit_is_duplicate(state, store_index, header_offset + 1)
+						&& imdd_emit_is_visible(frustums, frustum_count, store, next_header)
+						&& (!use_lod || imdd_emit_lod_index(state, store, next_header) == lod_index)) {
+						uint32_t const batch_index = imdd_emit_instance_batch_index(state, lod_index, header);
+						if (nt_state) {
+							imdd_emit_nt_reserve_instances(nt_state, batch_index, instance_streams + batch_index, 2);
+						}
+						desc->instance_x2_func(instance_streams + batch_index, header.color, data, next_header.color, next_data);
+						++header_offset;
+						continue;
+					}
+				}
+
+				imdd_emit_write_shape(state, instance_streams, filled_vertex_streams, wire_vertex_streams, nt_state, header, data, lod_index);
+			}
+		}
+	}
+
+	if (state->layout) {
+		imdd_emit_layout_end(chunk, instance_streams, filled_vertex_streams, wire_vertex_streams);
+		return;
+	}
+	if (nt_state) {
+		imdd_emit_nt_end(nt_state, instance_streams, filled_vertex_streams, wire_vertex_streams);
+	}
+
+	// keep how much was written, which is less than the range only if the buffers are full
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		imdd_instance_stream_t const *const stream = &instance_streams[batch_index];
+		chunk->instance_counts[batch_index] = (uint32_t)(stream->current - stream->begin)/stream->qw_size;
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_filled_vertex_stream_t const *const stream = &filled_vertex_streams[batch_index];
+		chunk->filled_vertex_counts[batch_index] = (uint32_t)(stream->current - stream->begin)/stream->qw_size;
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_wire_vertex_stream_t const *const stream = &wire_vertex_streams[batch_index];
+		chunk->wire_vertex_counts[batch_index] = (uint32_t)(stream->current - stream->begin);
+	}
+}
+
+static
+void imdd_emit_end(imdd_emit_state_t const *state)
+{
+	if (state->stats) {
+		for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+			uint32_t count = 0;
+			for (uint32_t chunk_index = 0; chunk_index < state->chunk_count; ++chunk_index) {
+				count += state->chunks[chunk_index].culled_counts[shape];
+			}
+			state->stats->culled_counts[shape] = count;
+		}
+		for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+			uint32_t count = 0;
+			for (uint32_t chunk_index = 0; chunk_index < state->chunk_count; ++chunk_index) {
+				count += state->chunks[chunk_index].small_counts[shape];
+			}
+			state->stats->small_counts[shape] = count;
+		}
+		for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+			uint32_t count = 0;
+			for (uint32_t chunk_index = 0; chunk_index < state->chunk_count; ++chunk_index) {
+				count += state->chunks[chunk_index].duplicate_counts[shape];
+			}
+			state->stats->duplicate_counts[shape] = count;
 		}
-		filled_vertex_streams[batch_index].begin = filled_vertex_buf + start_offset;
-		filled_vertex_streams[batch_index].current = filled_vertex_buf + start_offset;
-		filled_vertex_streams[batch_index].end = filled_vertex_buf + end_offset;
 	}
-	*filled_vertex_count = end_offset;
 
-	end_offset = 0;
+	// write out the draw calls, only the last chunk with data in a batch can be short
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		uint32_t count = 0;
+		for (uint32_t chunk_index = 0; chunk_index < state->chunk_count; ++chunk_index) {
+			count += state->chunks[chunk_index].instance_counts[batch_index];
+		}
+		state->instance_batches[batch_index].count = count;
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		uint32_t count = 0;
+		for (uint32_t chunk_index = 0; chunk_index < state->chunk_count; ++chunk_index) {
+			count += state->chunks[chunk_index].filled_vertex_counts[batch_index];
+		}
+		state->filled_array_batches[batch_index].count = count;
+	}
 	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
-		uint32_t const start_offset = end_offset;
-		end_offset += wire_vertex_counts[batch_index];
-		if (end_offset > wire_vertex_capacity) {
-			end_offset = wire_vertex_capacity;
+		uint32_t count = 0;
+		for (uint32_t chunk_index = 0; chunk_index < state->chunk_count; ++chunk_index) {
+			count += state->chunks[chunk_index].wire_vertex_counts[batch_index];
 		}
-		wire_vertex_streams[batch_index].begin = wire_vertex_buf + start_offset;
-		wire_vertex_streams[batch_index].current = wire_vertex_buf + start_offset;
-		wire_vertex_streams[batch_index].end = wire_vertex_buf + end_offset;
+		state->wire_array_batches[batch_index].count = count;
 	}
-	*wire_vertex_count = end_offset;
+}
 
-	// write the vertices through the streams
+// batches of each view in order: instances, filled vertices, then wire vertices
+static
+imdd_batch_t *imdd_emit_view_range_list(imdd_emit_view_t *view, uint32_t view_batch_index)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		return &view->instance_range_lists[view_batch_index];
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		return &view->filled_range_lists[view_batch_index];
+	}
+	return &view->wire_range_lists[view_batch_index - IMDD_ARRAY_BATCH_COUNT];
+}
+
+// appends a range to the current batch, keeping one range free for each later batch
+static
+void imdd_emit_view_push_range(imdd_emit_view_t *view, imdd_batch_t *list, uint32_t later_batch_count, uint32_t offset, uint32_t count)
+{
+	if (view->range_count + later_batch_count < view->range_capacity) {
+		imdd_batch_t *const range = &view->ranges[view->range_count++];
+		range->offset = offset;
+		range->count = count;
+		++list->count;
+	} else if (list->count > 0) {
+		imdd_batch_t *const range = &view->ranges[view->range_count - 1];
+		range->count = offset + count - range->offset;
+	}
+}
+
+/*
+	Writes the visible ranges of one batch for all views at once, data is
+	the first element of the batch.  Instances are tested using the bounds
+	of their format, vertex arrays as primitives of prim_size vertices.
+*/
+static
+void imdd_emit_cull_view_batch(
+	imdd_emit_state_t const *state,
+	uint32_t view_batch_index,
+	imdd_batch_t const *batch,
+	imdd_v4 const *data,
+	uint32_t qw_stride,
+	uint32_t prim_size,
+	imdd_instance_format_enum_t format)		// IMDD_INSTANCE_FORMAT_COUNT for vertex arrays
+{
+	uint32_t const view_count = (state->frustum_count < IMDD_EMIT_MAX_VIEW_COUNT) ? state->frustum_count : IMDD_EMIT_MAX_VIEW_COUNT;
+	uint32_t const later_batch_count = IMDD_EMIT_VIEW_BATCH_COUNT - 1 - view_batch_index;
+	uint32_t const merge_size = IMDD_EMIT_VIEW_MERGE_GAP*prim_size;
+
+	// the open range of each view, empty when the end is zero
+	imdd_batch_t *lists[IMDD_EMIT_MAX_VIEW_COUNT];
+	uint32_t range_begins[IMDD_EMIT_MAX_VIEW_COUNT];
+	uint32_t range_ends[IMDD_EMIT_MAX_VIEW_COUNT];
+	for (uint32_t view_index = 0; view_index < view_count; ++view_index) {
+		lists[view_index] = imdd_emit_view_range_list(&state->views[view_index], view_batch_index);
+		lists[view_index]->offset = state->views[view_index].range_count;
+		lists[view_index]->count = 0;
+		range_ends[view_index] = 0;
+	}
+
+	for (uint32_t begin = 0; begin + prim_size <= batch->count; begin += prim_size, data += prim_size*qw_stride) {
+		imdd_v4 points[3];
+		if (format == IMDD_INSTANCE_FORMAT_COUNT) {
+			for (uint32_t point_index = 0; point_index < prim_size; ++point_index) {
+				points[point_index] = data[point_index*qw_stride];
+			}
+		}
+		uint32_t const end = begin + prim_size;
+		for (uint32_t view_index = 0; view_index < view_count; ++view_index) {
+			imdd_frustum_t const *const frustum = &state->frustums[view_index];
+			int const visible = (format == IMDD_INSTANCE_FORMAT_COUNT)
+				? imdd_frustum_test_points(frustum, points, prim_size)
+				: imdd_frustum_test_instance(frustum, format, data);
+			if (!visible) {
+				continue;
+			}
+			if (range_ends[view_index] != 0) {
+				if (begin <= range_ends[view_index] + merge_size) {
+					range_ends[view_index] = end;
+					continue;
+				}
+				imdd_emit_view_push_range(
+					&state->views[view_index],
+					lists[view_index],
+					later_batch_count,
+					batch->offset + range_begins[view_index],
+					range_ends[view_index] - range_begins[view_index]);
+			}
+			range_begins[view_index] = begin;
+			range_ends[view_index] = end;
+		}
+	}
+
+	for (uint32_t view_index = 0; view_index < view_count; ++view_index) {
+		if (range_ends[view_index] != 0) {
+			imdd_emit_view_push_range(
+				&state->views[view_index],
+				lists[view_index],
+				later_batch_count,
+				batch->offset + range_begins[view_index],
+				range_ends[view_index] - range_begins[view_index]);
+		}
+	}
+}
+
+// gets a converted batch in the same order as views, with the stride and primitive size to read it
+static
+imdd_batch_t const *imdd_emit_output_batch(
+	imdd_emit_state_t const *state,
+	uint32_t view_batch_index,
+	imdd_v4 const **data,
+	uint32_t *qw_stride,
+	uint32_t *prim_size,
+	imdd_instance_format_enum_t *format)		// IMDD_INSTANCE_FORMAT_COUNT for vertex arrays
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		imdd_batch_t const *const batch = &state->instance_batches[view_batch_index];
+		*format = g_imdd_instance_groups[imdd_instance_group_from_batch_index(view_batch_index)].format;
+		*qw_stride = g_imdd_instance_format_qw_size[*format];
+		*prim_size = 1;
+		*data = (imdd_v4 const *)state->instance_transform_buf
+			+ imdd_instance_format_qw_bias(state->instance_batches, *format)
+			+ batch->offset*(*qw_stride);
+		return batch;
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	*format = IMDD_INSTANCE_FORMAT_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		imdd_batch_t const *const batch = &state->filled_array_batches[view_batch_index];
+		*qw_stride = (state->flags & IMDD_EMIT_FLAG_FLAT_TRIANGLES) ? IMDD_ARRAY_FLAT_VERTEX_QW_SIZE : IMDD_ARRAY_FILLED_VERTEX_QW_SIZE;
+		*prim_size = 3;
+		*data = (imdd_v4 const *)state->filled_vertex_buf + batch->offset*(*qw_stride);
+		return batch;
+	}
+	view_batch_index -= IMDD_ARRAY_BATCH_COUNT;
+	imdd_batch_t const *const batch = &state->wire_array_batches[view_batch_index];
+	*qw_stride = 1;
+	// lines and points use the first half of the batches, indexed wire triangles the second
+	*prim_size = (view_batch_index & 4) ? 3 : 2;
+	*data = &state->wire_vertex_buf[batch->offset].pos_col;
+	return batch;
+}
+
+// reads back the converted shapes to write the visible ranges of each view
+static
+void imdd_emit_cull_views(imdd_emit_state_t const *state)
+{
+	uint32_t const view_count = (state->frustum_count < IMDD_EMIT_MAX_VIEW_COUNT) ? state->frustum_count : IMDD_EMIT_MAX_VIEW_COUNT;
+	for (uint32_t view_index = 0; view_index < view_count; ++view_index) {
+		state->views[view_index].range_count = 0;
+	}
+
+	for (uint32_t view_batch_index = 0; view_batch_index < IMDD_EMIT_VIEW_BATCH_COUNT; ++view_batch_index) {
+		imdd_v4 const *data;
+		uint32_t qw_stride;
+		uint32_t prim_size;
+		imdd_instance_format_enum_t format;
+		imdd_batch_t const *const batch = imdd_emit_output_batch(state, view_batch_index, &data, &qw_stride, &prim_size, &format);
+		imdd_emit_cull_view_batch(state, view_batch_index, batch, data, qw_stride, prim_size, format);
+	}
+}
+
+static
+imdd_batch_t *imdd_emit_bounds_cluster_list(imdd_emit_bounds_t *bounds, uint32_t view_batch_index)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		return &bounds->instance_cluster_lists[view_batch_index];
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		return &bounds->filled_cluster_lists[view_batch_index];
+	}
+	return &bounds->wire_cluster_lists[view_batch_index - IMDD_ARRAY_BATCH_COUNT];
+}
+
+static
+imdd_emit_bound_t *imdd_emit_bounds_batch_bound(imdd_emit_bounds_t *bounds, uint32_t view_batch_index)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		return &bounds->instance_bounds[view_batch_index];
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		return &bounds->filled_bounds[view_batch_index];
+	}
+	return &bounds->wire_bounds[view_batch_index - IMDD_ARRAY_BATCH_COUNT];
+}
+
+// gives each batch its clusters in batch order, until there is no room for the clusters of a batch
+static
+void imdd_emit_bounds_begin(imdd_emit_state_t const *state)
+{
+	imdd_emit_bounds_t *const bounds = state->bounds;
+	uint32_t cluster_capacity = bounds->clusters ? bounds->cluster_capacity : 0;
+	bounds->cluster_count = 0;
+	for (uint32_t view_batch_index = 0; view_batch_index < IMDD_EMIT_VIEW_BATCH_COUNT; ++view_batch_index) {
+		imdd_v4 const *data;
+		uint32_t qw_stride;
+		uint32_t prim_size;
+		imdd_instance_format_enum_t format;
+		imdd_batch_t const *const batch = imdd_emit_output_batch(state, view_batch_index, &data, &qw_stride, &prim_size, &format);
+		uint32_t const cluster_vertex_count = IMDD_EMIT_BOUNDS_CLUSTER_SIZE*prim_size;
+		uint32_t const cluster_count = (batch->count + cluster_vertex_count - 1)/cluster_vertex_count;
+
+		imdd_batch_t *const list = imdd_emit_bounds_cluster_list(bounds, view_batch_index);
+		list->offset = bounds->cluster_count;
+		list->count = 0;
+		if (bounds->cluster_count + cluster_count <= cluster_capacity) {
+			list->count = cluster_count;
+			bounds->cluster_count += cluster_count;
+		} else {
+			cluster_capacity = 0;
+		}
+	}
+}
+
+// instances are boxes of their format, with the transform format scaling a box from -1 to 1
+static inline
+void imdd_emit_instance_extent(imdd_instance_format_enum_t format, imdd_v4 const *data, imdd_v4 *centre, imdd_v4 *half_extent)
+{
+	switch (format) {
+		case IMDD_INSTANCE_FORMAT_BOX:
+			*centre = data[0];
+			*half_extent = data[1];
+			break;
+
+		case IMDD_INSTANCE_FORMAT_SPHERE:
+			*centre = data[0];
+			*half_extent = imdd_v4_swiz_wwww(data[0]);
+			break;
+
+		default: {
+			imdd_v4 x_axis = data[0];
+			imdd_v4 y_axis = data[1];
+			imdd_v4 z_axis = data[2];
+			*centre = imdd_v4_const_zero();
+			imdd_v4_transpose_inplace(x_axis, y_axis, z_axis, *centre);
+			*half_extent = imdd_v4_add(imdd_v4_add(imdd_v4_abs(x_axis), imdd_v4_abs(y_axis)), imdd_v4_abs(z_axis));
+		} break;
+	}
+}
+
+static inline
+void imdd_emit_store_bound(imdd_emit_bound_t *bound, imdd_v4 min, imdd_v4 max)
+{
+	imdd_v4 const zero = imdd_v4_const_zero();
+	bound->min = imdd_v4_set_w(min, zero);
+	bound->max = imdd_v4_set_w(max, zero);
+}
+
+// reads back one converted batch to write its bounds and the bounds of its clusters
+static
+void imdd_emit_bounds_batch(imdd_emit_state_t const *state, uint32_t view_batch_index)
+{
+	imdd_emit_bounds_t *const bounds = state->bounds;
+	imdd_v4 const *data;
+	uint32_t qw_stride;
+	uint32_t prim_size;
+	imdd_instance_format_enum_t format;
+	imdd_batch_t const *const batch = imdd_emit_output_batch(state, view_batch_index, &data, &qw_stride, &prim_size, &format);
+	imdd_batch_t const *const list = imdd_emit_bounds_cluster_list(bounds, view_batch_index);
+	uint32_t const cluster_vertex_count = IMDD_EMIT_BOUNDS_CLUSTER_SIZE*prim_size;
+
+	imdd_v4 const empty_min = imdd_v4_init_1f(FLT_MAX);
+	imdd_v4 const empty_max = imdd_v4_init_1f(-FLT_MAX);
+	imdd_v4 batch_min = empty_min;
+	imdd_v4 batch_max = empty_max;
+	uint32_t cluster_index = 0;
+	for (uint32_t begin = 0; begin < batch->count; begin += cluster_vertex_count, ++cluster_index) {
+		uint32_t const end = (batch->count - begin < cluster_vertex_count) ? batch->count : (begin + cluster_vertex_count);
+		imdd_v4 cluster_min = empty_min;
+		imdd_v4 cluster_max = empty_max;
+		if (format == IMDD_INSTANCE_FORMAT_COUNT) {
+			// the w component of vertex positions holds the color, and is cleared when storing
+			for (uint32_t index = begin; index < end; ++index, data += qw_stride) {
+				cluster_min = imdd_v4_min(cluster_min, *data);
+				cluster_max = imdd_v4_max(cluster_max, *data);
+			}
+		} else {
+			for (uint32_t index = begin; index < end; ++index, data += qw_stride) {
+				imdd_v4 centre;
+				imdd_v4 half_extent;
+				imdd_emit_instance_extent(format, data, &centre, &half_extent);
+				cluster_min = imdd_v4_min(cluster_min, imdd_v4_sub(centre, half_extent));
+				cluster_max = imdd_v4_max(cluster_max, imdd_v4_add(centre, half_extent));
+			}
+		}
+		if (cluster_index < list->count) {
+			imdd_emit_store_bound(&bounds->clusters[list->offset + cluster_index], cluster_min, cluster_max);
+		}
+		batch_min = imdd_v4_min(batch_min, cluster_min);
+		batch_max = imdd_v4_max(batch_max, cluster_max);
+	}
+	imdd_emit_store_bound(imdd_emit_bounds_batch_bound(bounds, view_batch_index), batch_min, batch_max);
+}
+
+#define IMDD_EMIT_MAX_CHUNK_COUNT				16
+#define IMDD_EMIT_MIN_CHUNK_HEADER_COUNT		1024
+#define IMDD_EMIT_STACK_CHUNK_COUNT				2		// enough to sort alpha blended shapes on the calling thread
+
+#define IMDD_EMIT_SCRATCH_ALIGN(SIZE)			(((SIZE) + IMDD_EMIT_NT_LINE_SIZE - 1) & ~(uint32_t)(IMDD_EMIT_NT_LINE_SIZE - 1))
+
+// scratch for up to chunk_count chunks, with staging windows if flags include IMDD_EMIT_FLAG_NON_TEMPORAL
+static inline
+uint32_t imdd_emit_scratch_size(uint32_t chunk_count, uint32_t flags)
+{
+	uint32_t const nt_size = (flags & IMDD_EMIT_FLAG_NON_TEMPORAL) ? chunk_count*(uint32_t)sizeof(imdd_emit_nt_state_t) : 0;
+	return IMDD_EMIT_NT_LINE_SIZE + IMDD_EMIT_SCRATCH_ALIGN(chunk_count*(uint32_t)sizeof(imdd_emit_chunk_t)) + nt_size;
+}
+
+// takes up to chunk_capacity chunks from the scratch in the options, returns how many fit
+static
+uint32_t imdd_emit_scratch_split(
+	imdd_emit_options_t const *options,
+	uint32_t chunk_capacity,
+	imdd_emit_chunk_t **chunks,
+	imdd_emit_nt_state_t **nt_states)
+{
+	imdd_emit_scratch_t const *const scratch = options ? options->scratch : NULL;
+	*chunks = NULL;
+	*nt_states = NULL;
+	if (!scratch || !scratch->memory) {
+		return 0;
+	}
+
+	// prefer fewer chunks with staging windows, only drop the windows if not even one chunk fits with them
+	uintptr_t const base = ((uintptr_t)scratch->memory + IMDD_EMIT_NT_LINE_SIZE - 1) & ~(uintptr_t)(IMDD_EMIT_NT_LINE_SIZE - 1);
+	uint32_t flags = options->flags & IMDD_EMIT_FLAG_NON_TEMPORAL;
+	uint32_t chunk_count = chunk_capacity;
+	while (chunk_count > 0 && imdd_emit_scratch_size(chunk_count, flags) > scratch->size) {
+		if (--chunk_count == 0 && flags) {
+			flags = 0;
+			chunk_count = chunk_capacity;
+		}
+	}
+	if (chunk_count > 0) {
+		*chunks = (imdd_emit_chunk_t *)base;
+		if (flags) {
+			*nt_states = (imdd_emit_nt_state_t *)(base + IMDD_EMIT_SCRATCH_ALIGN(chunk_count*(uint32_t)sizeof(imdd_emit_chunk_t)));
+		}
+	}
+	return chunk_count;
+}
+
+static
+void imdd_emit_dedupe_task(void *ctx, uint32_t index)
+{
+	imdd_emit_dedupe_chunk((imdd_emit_state_t const *)ctx, index);
+}
+
+static
+void imdd_emit_bounds_task(void *ctx, uint32_t index)
+{
+	imdd_emit_bounds_batch((imdd_emit_state_t const *)ctx, index);
+}
+
+static
+void imdd_emit_count_task(void *ctx, uint32_t index)
+{
+	imdd_emit_count_chunk((imdd_emit_state_t const *)ctx, index);
+}
+
+static
+void imdd_emit_write_task(void *ctx, uint32_t index)
+{
+	imdd_emit_write_chunk((imdd_emit_state_t const *)ctx, index);
+}
+
+static
+void imdd_emit_sort_count_task(void *ctx, uint32_t index)
+{
+	imdd_emit_sort_count((imdd_emit_state_t const *)ctx, index);
+}
+
+static
+void imdd_emit_sort_scatter_task(void *ctx, uint32_t index)
+{
+	imdd_emit_sort_scatter((imdd_emit_state_t const *)ctx, index);
+}
+
+static
+void imdd_emit_count_sorted_alpha_task(void *ctx, uint32_t index)
+{
+	imdd_emit_state_t const *const state = (imdd_emit_state_t const *)ctx;
+	imdd_emit_count_chunk(state, state->sort_chunk_begin + index);
+}
+
+// runs the tasks with the scheduler if there is one and more than one task, otherwise in order on this thread
+static
+void imdd_emit_run_tasks(imdd_scheduler_t const *scheduler, uint32_t count, imdd_task_func_t fn, void *ctx)
+{
+	if (scheduler && count > 1) {
+		scheduler->parallel_for(scheduler->user_data, count, fn, ctx);
+		scheduler->wait(scheduler->user_data);
+	} else {
+		for (uint32_t index = 0; index < count; ++index) {
+			fn(ctx, index);
+		}
+	}
+}
+
+// chunk count to share header_count shapes with the scheduler, or a single chunk without one
+static
+uint32_t imdd_emit_chunk_capacity(imdd_scheduler_t const *scheduler, uint32_t header_count, int alpha_sort)
+{
+	uint32_t chunk_capacity = 1;
+	if (scheduler) {
+		chunk_capacity = header_count/IMDD_EMIT_MIN_CHUNK_HEADER_COUNT;
+		if (chunk_capacity > IMDD_EMIT_MAX_CHUNK_COUNT) {
+			chunk_capacity = IMDD_EMIT_MAX_CHUNK_COUNT;
+		}
+		if (chunk_capacity < 1) {
+			chunk_capacity = 1;
+		}
+	}
+	if (alpha_sort) {
+		// leave room for the chunks that convert sorted alpha blended shapes
+		chunk_capacity = (2*chunk_capacity < IMDD_EMIT_MAX_CHUNK_COUNT) ? 2*chunk_capacity : IMDD_EMIT_MAX_CHUNK_COUNT;
+	}
+	return chunk_capacity;
+}
+
+// runs every phase after imdd_emit_begin for the chunks in the state
+static
+void imdd_emit_run(imdd_emit_state_t *state, imdd_scheduler_t const *scheduler)
+{
+	if (state->dedupe_slots) {
+		uint32_t const slot_count = state->dedupe_slot_mask + 1;
+		memset((void *)state->dedupe_slots, 0xff, slot_count*sizeof(imdd_atomic_uint));
+		memset(state->dedupe_marks, 0, state->dedupe_mark_count);
+		imdd_emit_run_tasks(scheduler, state->chunk_count, imdd_emit_dedupe_task, state);
+	}
+	imdd_emit_run_tasks(scheduler, state->chunk_count, imdd_emit_count_task, state);
+	if (state->sort_task_count > 0) {
+		do {
+			imdd_emit_run_tasks(scheduler, state->sort_task_count, imdd_emit_sort_count_task, state);
+			imdd_emit_sort_prefix(state);
+			imdd_emit_run_tasks(scheduler, state->sort_task_count, imdd_emit_sort_scatter_task, state);
+		} while (imdd_emit_sort_next_pass(state));
+		imdd_emit_run_tasks(scheduler, state->chunk_count - state->sort_chunk_begin, imdd_emit_count_sorted_alpha_task, state);
+	}
+	imdd_emit_partition(state);
+	imdd_emit_run_tasks(scheduler, state->chunk_count, imdd_emit_write_task, state);
+	imdd_emit_end(state);
+	if (state->views && state->frustum_count > 0 && !state->layout) {
+		imdd_emit_cull_views(state);
+	}
+	if (state->bounds && !state->layout) {
+		imdd_emit_bounds_begin(state);
+		imdd_emit_run_tasks(scheduler, IMDD_EMIT_VIEW_BATCH_COUNT, imdd_emit_bounds_task, state);
+	}
+}
+
+// counts the shapes of stores that will not be converted, for renderers that have to drop them
+static inline
+void imdd_emit_count_dropped(imdd_emit_stats_t *stats, imdd_shape_store_t const *const *stores, uint32_t store_count)
+{
+	for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
+		imdd_shape_store_t const *const store = stores[store_index];
+		uint32_t const header_count = imdd_store_header_count(store);
+		for (uint32_t header_index = 0; header_index < header_count; ++header_index) {
+			++stats->dropped_counts[store->header_store[header_index].shape];
+		}
+	}
+}
+
+// adds the stats of one window to the stats of all the windows so far
+static
+void imdd_emit_accumulate_stats(imdd_emit_stats_t *stats, imdd_emit_stats_t const *window_stats)
+{
+	for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+		stats->culled_counts[shape] += window_stats->culled_counts[shape];
+		stats->small_counts[shape] += window_stats->small_counts[shape];
+		stats->duplicate_counts[shape] += window_stats->duplicate_counts[shape];
+	}
+	stats->unsorted_alpha_flags |= window_stats->unsorted_alpha_flags;
+	if (stats->required_instance_count < window_stats->required_instance_count) {
+		stats->required_instance_count = window_stats->required_instance_count;
+	}
+	if (stats->required_filled_vertex_count < window_stats->required_filled_vertex_count) {
+		stats->required_filled_vertex_count = window_stats->required_filled_vertex_count;
+	}
+	if (stats->required_wire_vertex_count < window_stats->required_wire_vertex_count) {
+		stats->required_wire_vertex_count = window_stats->required_wire_vertex_count;
+	}
+}
+
+// finds which passes have shapes, so that empty passes are not walked
+static
+uint32_t imdd_emit_used_pass_mask(imdd_shape_store_t const *const *stores, uint32_t store_count)
+{
+	uint32_t pass_mask = 0;
 	for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
 		imdd_shape_store_t const *const store = stores[store_index];
-		uint32_t header_count = imdd_atomic_load(&store->header_count);
+		uint32_t const header_count = imdd_store_header_count(store);
 		for (uint32_t header_offset = 0; header_offset < header_count; ++header_offset) {
 			imdd_shape_header_t const header = store->header_store[header_offset];
-			if (header.shape >= IMDD_SHAPE_COUNT) {
-				continue;
+			if (header.shape < IMDD_SHAPE_COUNT) {
+				pass_mask |= 1U << imdd_emit_pass_index(header.layer, (imdd_zmode_enum_t)header.zmode, (imdd_blend_enum_t)header.blend);
 			}
+		}
+	}
+	return pass_mask;
+}
+
+// converts each pass in windows of shapes, calling flush after each window with something to draw
+static
+void imdd_emit_shapes_streamed(
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+
+	imdd_instance_transform_t *instance_transform_buf,
+	imdd_instance_color_t *instance_color_buf,
+	uint32_t instance_capacity,
+	imdd_batch_t *instance_batches,
+	uint32_t *instance_count,
+
+	imdd_array_filled_vertex_t *filled_vertex_buf,
+	uint32_t filled_vertex_capacity,
+	imdd_batch_t *filled_array_batches,
+	uint32_t *filled_vertex_count,
+
+	imdd_array_wire_vertex_t *wire_vertex_buf,
+	uint32_t wire_vertex_capacity,
+	imdd_batch_t *wire_array_batches,
+	uint32_t *wire_vertex_count,
+
+	imdd_emit_options_t const *options)
+{
+	imdd_emit_stream_t const *const stream = options->stream;
+	uint32_t const window_size = (stream->window_shape_count > 0) ? stream->window_shape_count : 1;
+
+	// each window writes its own stats, which are then combined
+	imdd_emit_options_t window_options = *options;
+	imdd_emit_stats_t window_stats;
+	if (options->stats) {
+		memset(options->stats, 0, sizeof(imdd_emit_stats_t));
+		window_options.stats = &window_stats;
+	}
+
+	uint32_t total_header_count = 0;
+	for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
+		total_header_count += imdd_store_header_count(stores[store_index]);
+	}
 
-			imdd_emit_desc_t const *const desc = g_imdd_emit_instance_desc + header.shape;
-			imdd_style_enum_t const style = (imdd_style_enum_t)header.style;
-			imdd_blend_enum_t const blend = (imdd_blend_enum_t)header.blend;
-			imdd_zmode_enum_t const zmode = (imdd_zmode_enum_t)header.zmode;
-			imdd_v4 const *data = store->data_qw_store + header.data_qw_offset;
+	// take the chunks from scratch if possible, otherwise convert on this thread
+	imdd_emit_chunk_t stack_chunks[IMDD_EMIT_STACK_CHUNK_COUNT];
+	imdd_emit_chunk_t *chunks;
+	imdd_emit_nt_state_t *nt_states;
+	uint32_t const scratch_chunk_count = imdd_emit_scratch_split(options, IMDD_EMIT_MAX_CHUNK_COUNT, &chunks, &nt_states);
+	imdd_scheduler_t const *const scheduler = (scratch_chunk_count > 0) ? options->scheduler : NULL;
+	if (scratch_chunk_count == 0) {
+		chunks = stack_chunks;
+	}
 
-			if (desc->instance_func) {
-				imdd_mesh_enum_t const mesh = g_imdd_mesh_from_shape[header.shape];
-				uint32_t const batch_index = imdd_instance_batch_index(mesh, style, blend, zmode);
-				desc->instance_func(instance_streams + batch_index, header.color, data);
+	imdd_emit_state_t state;
+	uint32_t const used_pass_mask = imdd_emit_used_pass_mask(stores, store_count);
+	for (uint32_t layer = 0; layer < IMDD_LAYER_COUNT; ++layer)
+	for (imdd_zmode_enum_t zmode = (imdd_zmode_enum_t)0; zmode < IMDD_ZMODE_COUNT; zmode = (imdd_zmode_enum_t)(zmode + 1))
+	for (imdd_blend_enum_t blend = (imdd_blend_enum_t)0; blend < IMDD_BLEND_COUNT; blend = (imdd_blend_enum_t)(blend + 1)) {
+		uint32_t const pass_mask = 1U << imdd_emit_pass_index(layer, zmode, blend);
+		if (!(used_pass_mask & pass_mask)) {
+			continue;
+		}
+		for (uint32_t header_begin = 0; header_begin < total_header_count; header_begin += window_size) {
+			uint32_t const remaining_header_count = total_header_count - header_begin;
+			uint32_t const header_count = (remaining_header_count < window_size) ? remaining_header_count : window_size;
+			imdd_emit_init(
+				&state,
+				stores,
+				store_count,
+				instance_transform_buf,
+				instance_color_buf,
+				instance_capacity,
+				instance_batches,
+				instance_count,
+				filled_vertex_buf,
+				filled_vertex_capacity,
+				filled_array_batches,
+				filled_vertex_count,
+				wire_vertex_buf,
+				wire_vertex_capacity,
+				wire_array_batches,
+				wire_vertex_count,
+				&window_options);
+			state.pass_mask = pass_mask;
+			uint32_t chunk_capacity = imdd_emit_chunk_capacity(scheduler, header_count, options->alpha_sort != NULL);
+			if (scratch_chunk_count > 0 && chunk_capacity > scratch_chunk_count) {
+				chunk_capacity = scratch_chunk_count;
 			}
-			if (desc->filled_vertex_func && style == IMDD_STYLE_FILLED) {
-				uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-				desc->filled_vertex_func(filled_vertex_streams + batch_index, header.color, data);
+			imdd_emit_begin_window(
+				&state,
+				chunks,
+				chunk_capacity,
+				header_begin,
+				header_count);
+			state.nt_states = nt_states;
+			imdd_emit_run(&state, scheduler);
+
+			if (options->stats) {
+				imdd_emit_accumulate_stats(options->stats, &window_stats);
 			}
-			if (desc->wire_vertex_func && style == IMDD_STYLE_WIRE) {
-				uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-				desc->wire_vertex_func(wire_vertex_streams + batch_index, header.color, data);
+			if (*instance_count > 0 || *filled_vertex_count > 0 || *wire_vertex_count > 0) {
+				stream->flush(stream->user_data, layer, zmode, blend);
 			}
 		}
 	}
+}
 
-	// write out the draw calls
-	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
-		imdd_instance_stream_t const *const stream = &instance_streams[batch_index];
-		instance_batches[batch_index].offset = (uint32_t)(stream->begin - instance_transform_buf);
-		instance_batches[batch_index].count = (uint32_t)(stream->current - stream->begin);
+static
+void imdd_emit_shapes(
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+
+	imdd_instance_transform_t *instance_transform_buf,
+	imdd_instance_color_t *instance_color_buf,
+	uint32_t instance_capacity,
+	imdd_batch_t *instance_batches,
+	uint32_t *instance_count,
+
+	imdd_array_filled_vertex_t *filled_vertex_buf,
+	uint32_t filled_vertex_capacity,
+	imdd_batch_t *filled_array_batches,
+	uint32_t *filled_vertex_count,
+
+	imdd_array_wire_vertex_t *wire_vertex_buf,
+	uint32_t wire_vertex_capacity,
+	imdd_batch_t *wire_array_batches,
+	uint32_t *wire_vertex_count,
+
+	imdd_emit_options_t const *options)
+{
+	if (options && options->stream) {
+		imdd_emit_shapes_streamed(
+			stores,
+			store_count,
+			instance_transform_buf,
+			instance_color_buf,
+			instance_capacity,
+			instance_batches,
+			instance_count,
+			filled_vertex_buf,
+			filled_vertex_capacity,
+			filled_array_batches,
+			filled_vertex_count,
+			wire_vertex_buf,
+			wire_vertex_capacity,
+			wire_array_batches,
+			wire_vertex_count,
+			options);
+		return;
 	}
-	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
-		imdd_filled_vertex_stream_t const *const stream = &filled_vertex_streams[batch_index];
-		filled_array_batches[batch_index].offset = (uint32_t)(stream->begin - filled_vertex_buf);
-		filled_array_batches[batch_index].count = (uint32_t)(stream->current - stream->begin);
+
+	// convert as a single chunk on this thread, unless there is enough work and scratch to share with the scheduler
+	imdd_emit_chunk_t stack_chunks[IMDD_EMIT_STACK_CHUNK_COUNT];
+	imdd_emit_chunk_t *chunks;
+	imdd_emit_nt_state_t *nt_states;
+	uint32_t const scratch_chunk_count = imdd_emit_scratch_split(options, IMDD_EMIT_MAX_CHUNK_COUNT, &chunks, &nt_states);
+	imdd_scheduler_t const *const scheduler = (scratch_chunk_count > 0) ? options->scheduler : NULL;
+	uint32_t total_header_count = 0;
+	if (scheduler) {
+		for (uint32_t store_index = 0; store_index < store_count; ++store_index) {
+			total_header_count += imdd_store_header_count(stores[store_index]);
+		}
 	}
-	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
-		imdd_wire_vertex_stream_t const *const stream = &wire_vertex_streams[batch_index];
-		wire_array_batches[batch_index].offset = (uint32_t)(stream->begin - wire_vertex_buf);
-		wire_array_batches[batch_index].count = (uint32_t)(stream->current - stream->begin);
+	uint32_t chunk_capacity = imdd_emit_chunk_capacity(scheduler, total_header_count, options && options->alpha_sort);
+	if (scratch_chunk_count == 0) {
+		chunks = stack_chunks;
+	} else if (chunk_capacity > scratch_chunk_count) {
+		chunk_capacity = scratch_chunk_count;
 	}
+
+	imdd_emit_state_t state;
+	imdd_emit_begin(
+		&state,
+		chunks,
+		chunk_capacity,
+		stores,
+		store_count,
+		instance_transform_buf,
+		instance_color_buf,
+		instance_capacity,
+		instance_batches,
+		instance_count,
+		filled_vertex_buf,
+		filled_vertex_capacity,
+		filled_array_batches,
+		filled_vertex_count,
+		wire_vertex_buf,
+		wire_vertex_capacity,
+		wire_array_batches,
+		wire_vertex_count,
+		options);
+	state.nt_states = nt_states;
+	imdd_emit_run(&state, scheduler);
 }
 
 #ifdef __cplusplus
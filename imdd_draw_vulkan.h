@@ -1,6 +1,7 @@
 #pragma once
 
 #include "imdd_draw_util.h"
+#include <stdlib.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,9 +11,13 @@ extern "C" {
 	How many buffer copies do we need to be able to prepare shapes for
 	rendering without affecting data still in use by the GPU.  Typically
 	can be left at 2 for applications that allow at most 1 frame of
-	overlap between CPU and GPU.
+	overlap between CPU and GPU, and must be at least 3 when converting with
+	an async scheduler, since shapes are then drawn one frame after they are
+	converted.
 */
+#ifndef IMDD_VULKAN_FRAME_COUNT
 #define IMDD_VULKAN_FRAME_COUNT				2
+#endif
 
 /*
 	How many descriptor copies do we need to be able prepare draw calls
@@ -32,7 +37,11 @@ typedef enum {
 	IMDD_VULKAN_DRAW_TYPE_COUNT		// keep last
 } imdd_vulkan_draw_type_enum_t;
 
-#define IMDD_VULKAN_PIPELINE_COUNT			(IMDD_VULKAN_DRAW_TYPE_COUNT*IMDD_STYLE_COUNT*IMDD_ZMODE_COUNT*IMDD_BLEND_COUNT)
+// alpha blended shapes of additive layers use pipelines for an extra blend mode
+#define IMDD_VULKAN_BLEND_ADDITIVE			IMDD_BLEND_COUNT
+#define IMDD_VULKAN_BLEND_STATE_COUNT		(IMDD_BLEND_COUNT + 1)
+
+#define IMDD_VULKAN_PIPELINE_COUNT			(IMDD_VULKAN_DRAW_TYPE_COUNT*IMDD_STYLE_COUNT*IMDD_ZMODE_COUNT*IMDD_VULKAN_BLEND_STATE_COUNT)
 
 typedef void (* imdd_vulkan_verify_fn_t)(VkResult);
 
@@ -46,9 +55,11 @@ typedef struct imdd_vulkan_fp_t {
 	PFN_vkCreateGraphicsPipelines vkCreateGraphicsPipelines;
 
 	PFN_vkAllocateMemory vkAllocateMemory;
+	PFN_vkFreeMemory vkFreeMemory;
 	PFN_vkMapMemory vkMapMemory;
 	PFN_vkFlushMappedMemoryRanges vkFlushMappedMemoryRanges;
 	PFN_vkCreateBuffer vkCreateBuffer;
+	PFN_vkDestroyBuffer vkDestroyBuffer;
 	PFN_vkGetBufferMemoryRequirements vkGetBufferMemoryRequirements;
 	PFN_vkBindBufferMemory vkBindBufferMemory;
 
@@ -64,8 +75,18 @@ typedef struct imdd_vulkan_fp_t {
 	PFN_vkCmdBindIndexBuffer vkCmdBindIndexBuffer;
 	PFN_vkCmdDraw vkCmdDraw;
 	PFN_vkCmdDrawIndexed vkCmdDrawIndexed;
+	PFN_vkCmdSetDepthBias vkCmdSetDepthBias;
+	PFN_vkCmdSetLineWidth vkCmdSetLineWidth;
 } imdd_vulkan_fp_t;
 
+// render state for the shapes of each layer, layers are drawn in order
+typedef struct imdd_vulkan_layer_t {
+	float depth_bias_constant;	// for vkCmdSetDepthBias on filled shapes
+	float depth_bias_slope;
+	float line_width;			// widths other than 1 need the wideLines feature
+	int additive;				// alpha blended shapes are added to the target
+} imdd_vulkan_layer_t;
+
 typedef struct imdd_vulkan_mesh_buffer_t {
 	imdd_mesh_layout_t layout;
 	VkDeviceSize vertex_buffer_size;
@@ -82,7 +103,22 @@ typedef struct imdd_vulkan_mesh_buffer_t {
 	VkDeviceSize index_offset;
 } imdd_vulkan_mesh_buffer_t;
 
+// batches of shapes written from these offsets into the buffers of a frame
+typedef struct imdd_vulkan_batches_t {
+	uint32_t instance_offset;
+	uint32_t filled_vertex_offset;
+	uint32_t wire_vertex_offset;
+	imdd_batch_t instance_batches[IMDD_INSTANCE_BATCH_COUNT];
+	imdd_batch_t filled_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	imdd_batch_t wire_array_batches[IMDD_ARRAY_BATCH_COUNT];
+} imdd_vulkan_batches_t;
+
 typedef struct imdd_vulkan_frame_t {
+	VkDeviceMemory memory;
+	uint32_t instance_capacity;
+	uint32_t filled_vertex_capacity;
+	uint32_t wire_vertex_capacity;
+
 	VkBuffer instance_transform_buffer;
 	VkDeviceSize instance_transform_offset;
 	imdd_instance_transform_t *instance_transform_base;
@@ -98,8 +134,47 @@ typedef struct imdd_vulkan_frame_t {
 	VkBuffer wire_vertex_buffer;
 	VkDeviceSize wire_vertex_offset;
 	imdd_array_wire_vertex_t *wire_vertex_base;
+
+	imdd_vulkan_batches_t batches;		// of everything in the buffers, at offset zero
 } imdd_vulkan_frame_t;
 
+// stores converted by imdd_vulkan_update_cached, which are only converted again when their contents change
+#define IMDD_VULKAN_CACHED_STORE_COUNT	4
+
+typedef struct imdd_vulkan_cached_store_t {
+	imdd_shape_store_t const *store;	// NULL if this slot is not drawn
+	uint32_t generation;
+	uint32_t header_count;
+	uint32_t data_qw_count;
+	uint32_t update_count;				// of the last conversion, the GPU may copy from staging until IMDD_VULKAN_FRAME_COUNT updates later
+	int has_buffers;
+	imdd_vulkan_frame_t staging;		// host memory that shapes are converted into
+	imdd_vulkan_frame_t output;			// device memory copied from staging, which is drawn
+	int has_retired;
+	uint32_t retired_update_count;
+	imdd_vulkan_frame_t retired;		// output from before the buffers grew, until the GPU is done with it
+} imdd_vulkan_cached_store_t;
+
+// stores converted between imdd_vulkan_begin_update and imdd_vulkan_end_update, later stores are counted in imdd_emit_stats_t::dropped_counts
+#define IMDD_VULKAN_MAX_SUBMISSION_COUNT	16
+
+/*
+	Views (see imdd_emit_view_t) read back what was converted, which is slow
+	from host memory that the CPU does not cache, so when the options have
+	views the shapes are converted here first and then copied to the frame.
+	Allocated with malloc on first use, and again if the frames grow.
+*/
+typedef struct imdd_vulkan_view_copy_t {
+	void *memory;
+	uint32_t instance_capacity;
+	uint32_t filled_vertex_capacity;
+	uint32_t wire_vertex_capacity;
+	imdd_instance_transform_t *instance_transforms;
+	imdd_instance_color_t *instance_colors;
+	imdd_array_filled_vertex_t *filled_vertices;
+	imdd_array_wire_vertex_t *wire_vertices;
+} imdd_vulkan_view_copy_t;
+
 typedef struct imdd_vulkan_descriptor_t {
 	VkBuffer common_uniform_buffer;
 	VkDeviceSize common_uniform_offset;
@@ -109,14 +184,37 @@ typedef struct imdd_vulkan_descriptor_t {
 
 #define IMDD_VULKAN_FLAG_MULTIVIEW		(1 << 0)
 
+/*
+	Resize the buffers for each frame to fit the shapes of the previous frame,
+	using the capacities from init as the minimum.  Buffers for a frame are
+	only recreated when that frame is next updated, which is once the GPU has
+	finished with them.  Needs vkFreeMemory and vkDestroyBuffer.
+*/
+#define IMDD_VULKAN_FLAG_GROW			(1 << 1)
+
+/*
+	Write shapes with non-temporal stores (see IMDD_EMIT_FLAG_NON_TEMPORAL)
+	when the host visible memory for each frame is not cached by the CPU.
+	Whether this is faster depends on the platform, so compare update times
+	with and without it first (example_vulkan -p and -p -n).
+*/
+#define IMDD_VULKAN_FLAG_NON_TEMPORAL	(1 << 2)
+
 typedef struct imdd_vulkan_context_t {
 	imdd_vulkan_fp_t fp;
 	imdd_vulkan_verify_fn_t verify_fn;
 	uint32_t flags;
+	imdd_vulkan_layer_t layers[IMDD_LAYER_COUNT];	// can be changed before each draw
 	uint32_t instance_capacity;
 	uint32_t filled_vertex_capacity;
 	uint32_t wire_vertex_capacity;
+	imdd_capacity_tracker_t instance_tracker;
+	imdd_capacity_tracker_t filled_vertex_tracker;
+	imdd_capacity_tracker_t wire_vertex_tracker;
 	VkDeviceSize atom_size;
+	uint32_t frame_memory_type_index;
+	uint32_t staging_memory_type_index;
+	uint32_t device_memory_type_index;
 
 	VkShaderModule instance_filled_vert;
 	VkShaderModule instance_wire_vert;
@@ -135,15 +233,32 @@ typedef struct imdd_vulkan_context_t {
 	uint32_t mesh_copy_done;
 
 	imdd_vulkan_frame_t frames[IMDD_VULKAN_FRAME_COUNT];
-	uint32_t frame_index;
+	uint32_t frame_index;			// written by the last update
+	uint32_t draw_frame_index;		// drawn by imdd_vulkan_draw, behind frame_index when async
+	uint32_t update_count;
+	imdd_vulkan_cached_store_t cached_stores[IMDD_VULKAN_CACHED_STORE_COUNT];
+
+	imdd_emit_options_t submit_options;
+	imdd_emit_stats_t submit_stats;
+	imdd_vulkan_batches_t submissions[IMDD_VULKAN_MAX_SUBMISSION_COUNT];	// drawn in place of the frame batches if any
+	uint32_t submission_count;
+	uint32_t submit_instance_count;
+	uint32_t submit_filled_vertex_count;
+	uint32_t submit_wire_vertex_count;
 	imdd_vulkan_descriptor_t descriptors[IMDD_VULKAN_DESCRIPTOR_COUNT];
 	uint32_t descriptor_index;
 	VkDeviceMemory host_memory;
 	void *host_memory_base;
-
-	imdd_batch_t instance_batches[IMDD_INSTANCE_BATCH_COUNT];
-	imdd_batch_t filled_array_batches[IMDD_ARRAY_BATCH_COUNT];
-	imdd_batch_t wire_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	imdd_emit_options_t emit_options;
+	imdd_emit_scratch_t emit_scratch;			// used when the options have no scratch, conversions are one at a time
+	imdd_vulkan_view_copy_t view_copy;			// used when the options have views, conversions are one at a time
+
+	imdd_scheduler_t const *async_scheduler;	// set by imdd_vulkan_set_async_scheduler
+	imdd_shape_store_t const *const *async_stores;
+	uint32_t async_store_count;
+	VkDevice async_device;
+	imdd_emit_options_t async_options;
+	int async_pending;
 } imdd_vulkan_context_t;
 
 /*
@@ -863,10 +978,10 @@ static inline
 uint32_t imdd_vulkan_pipeline_index(
 	imdd_vulkan_draw_type_enum_t draw_type,
 	imdd_style_enum_t style,
-	imdd_blend_enum_t blend,
+	uint32_t blend_state,
 	imdd_zmode_enum_t zmode)
 {
-	return (draw_type << 3) | (style << 2) | (blend << 1) | zmode;
+	return ((draw_type*IMDD_STYLE_COUNT + style)*IMDD_VULKAN_BLEND_STATE_COUNT + blend_state)*IMDD_ZMODE_COUNT + zmode;
 }
 
 static
@@ -961,6 +1076,146 @@ uint32_t imdd_vulkan_get_memory_type_index(
 	return 0xffffffffU;
 }
 
+/*
+	Creates the buffers of a frame (or of a cached store) at these
+	capacities, in memory of their own so that they can be resized.  Host
+	visible memory is kept mapped, device local memory has no pointers.
+*/
+static
+void imdd_vulkan_create_buffers(
+	imdd_vulkan_context_t const *ctx,
+	VkDevice device,
+	uint32_t instance_capacity,
+	uint32_t filled_vertex_capacity,
+	uint32_t wire_vertex_capacity,
+	VkBufferUsageFlags usage,
+	uint32_t memory_type_index,
+	int is_host_visible,
+	imdd_vulkan_frame_t *frame)
+{
+	VkDeviceSize next_offset = 0;
+	uint32_t memory_type_bits = 0xffffffffU;
+	frame->instance_transform_buffer = imdd_vulkan_create_buffer(
+		ctx, device,
+		sizeof(imdd_instance_transform_t)*instance_capacity,
+		usage,
+		&frame->instance_transform_offset,
+		&next_offset,
+		&memory_type_bits);
+	frame->instance_color_buffer = imdd_vulkan_create_buffer(
+		ctx, device,
+		sizeof(imdd_instance_color_t)*instance_capacity,
+		usage,
+		&frame->instance_color_offset,
+		&next_offset,
+		&memory_type_bits);
+	frame->filled_vertex_buffer = imdd_vulkan_create_buffer(
+		ctx, device,
+		sizeof(imdd_array_filled_vertex_t)*filled_vertex_capacity,
+		usage,
+		&frame->filled_vertex_offset,
+		&next_offset,
+		&memory_type_bits);
+	frame->wire_vertex_buffer = imdd_vulkan_create_buffer(
+		ctx, device,
+		sizeof(imdd_array_wire_vertex_t)*wire_vertex_capacity,
+		usage,
+		&frame->wire_vertex_offset,
+		&next_offset,
+		&memory_type_bits);
+
+	VkMemoryAllocateInfo memory_allocate_info;
+	IMDD_VULKAN_SET_ZERO(memory_allocate_info);
+	memory_allocate_info.sType				= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memory_allocate_info.allocationSize		= next_offset;
+	memory_allocate_info.memoryTypeIndex	= memory_type_index;
+	imdd_vulkan_verify(ctx, ctx->fp.vkAllocateMemory(
+		device,
+		&memory_allocate_info,
+		NULL,
+		&frame->memory));
+
+	// keep a mapping open to host memory
+	void *memory_base = NULL;
+	if (is_host_visible) {
+		imdd_vulkan_verify(ctx, ctx->fp.vkMapMemory(
+			device,
+			frame->memory,
+			0,
+			VK_WHOLE_SIZE,
+			0,
+			&memory_base));
+	}
+
+	imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
+		device,
+		frame->instance_transform_buffer,
+		frame->memory,
+		frame->instance_transform_offset));
+	imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
+		device,
+		frame->instance_color_buffer,
+		frame->memory,
+		frame->instance_color_offset));
+	imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
+		device,
+		frame->filled_vertex_buffer,
+		frame->memory,
+		frame->filled_vertex_offset));
+	imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
+		device,
+		frame->wire_vertex_buffer,
+		frame->memory,
+		frame->wire_vertex_offset));
+	if (memory_base) {
+		frame->instance_transform_base = (imdd_instance_transform_t *)((uintptr_t)memory_base + frame->instance_transform_offset);
+		frame->instance_color_base = (imdd_instance_color_t *)((uintptr_t)memory_base + frame->instance_color_offset);
+		frame->filled_vertex_base = (imdd_array_filled_vertex_t *)((uintptr_t)memory_base + frame->filled_vertex_offset);
+		frame->wire_vertex_base = (imdd_array_wire_vertex_t *)((uintptr_t)memory_base + frame->wire_vertex_offset);
+	} else {
+		frame->instance_transform_base = NULL;
+		frame->instance_color_base = NULL;
+		frame->filled_vertex_base = NULL;
+		frame->wire_vertex_base = NULL;
+	}
+
+	frame->instance_capacity = instance_capacity;
+	frame->filled_vertex_capacity = filled_vertex_capacity;
+	frame->wire_vertex_capacity = wire_vertex_capacity;
+}
+
+// creates buffers for a frame at the current capacities, in host memory
+static
+void imdd_vulkan_create_frame(
+	imdd_vulkan_context_t const *ctx,
+	VkDevice device,
+	imdd_vulkan_frame_t *frame)
+{
+	imdd_vulkan_create_buffers(
+		ctx, device,
+		ctx->instance_capacity,
+		ctx->filled_vertex_capacity,
+		ctx->wire_vertex_capacity,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		ctx->frame_memory_type_index,
+		1,
+		frame);
+}
+
+// the GPU must have finished with these buffers, freeing the memory also unmaps it
+static
+void imdd_vulkan_destroy_frame(
+	imdd_vulkan_context_t const *ctx,
+	VkDevice device,
+	imdd_vulkan_frame_t *frame)
+{
+	ctx->fp.vkDestroyBuffer(device, frame->instance_transform_buffer, NULL);
+	ctx->fp.vkDestroyBuffer(device, frame->instance_color_buffer, NULL);
+	ctx->fp.vkDestroyBuffer(device, frame->filled_vertex_buffer, NULL);
+	ctx->fp.vkDestroyBuffer(device, frame->wire_vertex_buffer, NULL);
+	ctx->fp.vkFreeMemory(device, frame->memory, NULL);
+}
+
 #define IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, NAME)	(FP)->NAME = &NAME
 
 #define IMDD_VULKAN_SET_GLOBAL_FP(FP)												\
@@ -972,9 +1227,11 @@ uint32_t imdd_vulkan_get_memory_type_index(
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCreatePipelineLayout);					\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCreateGraphicsPipelines);				\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkAllocateMemory);						\
+		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkFreeMemory);							\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkMapMemory);							\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkFlushMappedMemoryRanges);				\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCreateBuffer);							\
+		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkDestroyBuffer);						\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkGetBufferMemoryRequirements);			\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkBindBufferMemory);						\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCreateDescriptorPool);					\
@@ -988,6 +1245,8 @@ uint32_t imdd_vulkan_get_memory_type_index(
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCmdBindIndexBuffer);					\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCmdDraw);								\
 		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCmdDrawIndexed);						\
+		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCmdSetDepthBias);						\
+		IMDD_VULKAN_SET_GLOBAL_FP_IMPL(FP, vkCmdSetLineWidth);						\
 	} while(0)
 
 void imdd_vulkan_init(
@@ -1009,9 +1268,15 @@ void imdd_vulkan_init(
 	memcpy(&ctx->fp, fp, sizeof(imdd_vulkan_fp_t));
 	ctx->verify_fn = verify_fn;
 	ctx->flags = flags;
+	for (uint32_t layer = 0; layer < IMDD_LAYER_COUNT; ++layer) {
+		ctx->layers[layer].line_width = 1.f;
+	}
 	ctx->instance_capacity = instance_capacity;
 	ctx->filled_vertex_capacity = filled_vertex_capacity;
 	ctx->wire_vertex_capacity = wire_vertex_capacity;
+	imdd_capacity_tracker_init(&ctx->instance_tracker, instance_capacity);
+	imdd_capacity_tracker_init(&ctx->filled_vertex_tracker, filled_vertex_capacity);
+	imdd_capacity_tracker_init(&ctx->wire_vertex_tracker, wire_vertex_capacity);
 
 	uint32_t const uniform_size_per_draw = ((flags & IMDD_VULKAN_FLAG_MULTIVIEW) ? 2 : 1)*16*sizeof(float);
 
@@ -1100,6 +1365,10 @@ void imdd_vulkan_init(
 		uint32_t const vertex_size = (style == IMDD_STYLE_FILLED) ? sizeof(imdd_mesh_filled_vertex_t) : sizeof(imdd_mesh_wire_vertex_t);
 		mesh_buffer->vertex_buffer_size = mesh_buffer->layout.vertex_count*vertex_size;
 		mesh_buffer->index_buffer_size = mesh_buffer->layout.index_count*sizeof(uint16_t);
+		if (style == IMDD_STYLE_WIRE) {
+			// the index pattern for wire triangles follows the mesh indices
+			mesh_buffer->index_buffer_size += IMDD_WIRE_TRIANGLE_INDEX_COUNT*sizeof(uint16_t);
+		}
 
 		mesh_buffer->vertex_staging_buffer = imdd_vulkan_create_buffer(
 			ctx, device,
@@ -1131,37 +1400,6 @@ void imdd_vulkan_init(
 			&device_next_offset,
 			&device_memory_type_bits);
 	}
-	for (uint32_t frame_index = 0; frame_index < IMDD_VULKAN_FRAME_COUNT; ++frame_index) {
-		imdd_vulkan_frame_t *const frame = &ctx->frames[frame_index];
-		frame->instance_transform_buffer = imdd_vulkan_create_buffer(
-			ctx, device,
-			sizeof(imdd_instance_transform_t)*instance_capacity,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			&frame->instance_transform_offset,
-			&host_next_offset,
-			&host_memory_type_bits);
-		frame->instance_color_buffer = imdd_vulkan_create_buffer(
-			ctx, device,
-			sizeof(imdd_instance_color_t)*instance_capacity,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			&frame->instance_color_offset,
-			&host_next_offset,
-			&host_memory_type_bits);
-		frame->filled_vertex_buffer = imdd_vulkan_create_buffer(
-			ctx, device,
-			sizeof(imdd_array_filled_vertex_t)*filled_vertex_capacity,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			&frame->filled_vertex_offset,
-			&host_next_offset,
-			&host_memory_type_bits);
-		frame->wire_vertex_buffer = imdd_vulkan_create_buffer(
-			ctx, device,
-			sizeof(imdd_array_wire_vertex_t)*wire_vertex_capacity,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			&frame->wire_vertex_offset,
-			&host_next_offset,
-			&host_memory_type_bits);
-	}
 	for (uint32_t descriptor_index = 0; descriptor_index < IMDD_VULKAN_DESCRIPTOR_COUNT; ++descriptor_index) {
 		imdd_vulkan_descriptor_t *const desc = &ctx->descriptors[descriptor_index];
 		desc->common_uniform_buffer = imdd_vulkan_create_buffer(
@@ -1188,11 +1426,13 @@ void imdd_vulkan_init(
 		&device_memory_allocate_info,
 		NULL,
 		&ctx->device_memory));
+	ctx->device_memory_type_index = device_memory_type_index;
 
 	uint32_t const host_memory_type_index = imdd_vulkan_get_memory_type_index(
 		&physical_device_memory_properties,
 		host_memory_type_bits,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
 	VkMemoryAllocateInfo host_memory_allocate_info;
 	IMDD_VULKAN_SET_ZERO(host_memory_allocate_info);
 	host_memory_allocate_info.sType				= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
@@ -1203,6 +1443,7 @@ void imdd_vulkan_init(
 		&host_memory_allocate_info,
 		NULL,
 		&ctx->host_memory));
+	ctx->staging_memory_type_index = host_memory_type_index;
 
 	// keep a mapping open to host memory
 	imdd_vulkan_verify(ctx, ctx->fp.vkMapMemory(
@@ -1239,10 +1480,14 @@ void imdd_vulkan_init(
 			ctx->device_memory,
 			mesh_buffer->index_offset));
 
+		uint16_t *const indices = (uint16_t *)((uintptr_t)ctx->host_memory_base + mesh_buffer->index_staging_offset);
 		imdd_mesh_layout_write(
 			&mesh_buffer->layout,
 			(void *)((uintptr_t)ctx->host_memory_base + mesh_buffer->vertex_staging_offset),
-			(uint16_t *)((uintptr_t)ctx->host_memory_base + mesh_buffer->index_staging_offset));
+			indices);
+		if (style == IMDD_STYLE_WIRE) {
+			imdd_wire_triangle_indices_write(indices + mesh_buffer->layout.index_count);
+		}
 
 		VkMappedMemoryRange memory_ranges[2];
 		IMDD_VULKAN_SET_ZERO(memory_ranges);
@@ -1256,33 +1501,42 @@ void imdd_vulkan_init(
 		memory_ranges[1].size = imdd_vulkan_align(mesh_buffer->index_buffer_size, ctx->atom_size);
 		imdd_vulkan_verify(ctx, ctx->fp.vkFlushMappedMemoryRanges(device, 2, memory_ranges));
 	}
+
+	// pick host memory for the buffers of each frame, using buffers of the same usage to find the memory type
+	{
+		VkDeviceSize frame_next_offset = 0;
+		uint32_t frame_memory_type_bits = 0xffffffffU;
+		VkDeviceSize unused_offset;
+		VkBuffer const buffer = imdd_vulkan_create_buffer(
+			ctx, device,
+			sizeof(imdd_instance_transform_t),
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			&unused_offset,
+			&frame_next_offset,
+			&frame_memory_type_bits);
+		ctx->frame_memory_type_index = imdd_vulkan_get_memory_type_index(
+			&physical_device_memory_properties,
+			frame_memory_type_bits,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		ctx->fp.vkDestroyBuffer(device, buffer, NULL);
+	}
 	for (uint32_t frame_index = 0; frame_index < IMDD_VULKAN_FRAME_COUNT; ++frame_index) {
-		imdd_vulkan_frame_t *const frame = &ctx->frames[frame_index];
-		imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
-			device,
-			frame->instance_transform_buffer,
-			ctx->host_memory,
-			frame->instance_transform_offset));
-		imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
-			device,
-			frame->instance_color_buffer,
-			ctx->host_memory,
-			frame->instance_color_offset));
-		imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
-			device,
-			frame->filled_vertex_buffer,
-			ctx->host_memory,
-			frame->filled_vertex_offset));
-		imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
-			device,
-			frame->wire_vertex_buffer,
-			ctx->host_memory,
-			frame->wire_vertex_offset));
-		frame->instance_transform_base = (imdd_instance_transform_t *)((uintptr_t)ctx->host_memory_base + frame->instance_transform_offset);
-		frame->instance_color_base = (imdd_instance_color_t *)((uintptr_t)ctx->host_memory_base + frame->instance_color_offset);
-		frame->filled_vertex_base = (imdd_array_filled_vertex_t *)((uintptr_t)ctx->host_memory_base + frame->filled_vertex_offset);
-		frame->wire_vertex_base = (imdd_array_wire_vertex_t *)((uintptr_t)ctx->host_memory_base + frame->wire_vertex_offset);
+		imdd_vulkan_create_frame(ctx, device, &ctx->frames[frame_index]);
 	}
+
+	// if requested, avoid partially writing host memory that the CPU does not cache
+	VkMemoryPropertyFlags const frame_memory_property_flags = physical_device_memory_properties.memoryTypes[ctx->frame_memory_type_index].propertyFlags;
+	if ((flags & IMDD_VULKAN_FLAG_NON_TEMPORAL) && (frame_memory_property_flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) == 0) {
+		ctx->emit_options.flags |= IMDD_EMIT_FLAG_NON_TEMPORAL;
+	}
+
+	// draw wire triangles using the index pattern in the wire mesh buffer
+	ctx->emit_options.flags |= IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES;
+
+	// enough to split conversion between as many threads as it can use, with or without non-temporal stores
+	ctx->emit_scratch.size = imdd_emit_scratch_size(IMDD_EMIT_MAX_CHUNK_COUNT, IMDD_EMIT_FLAG_NON_TEMPORAL);
+	ctx->emit_scratch.memory = malloc(ctx->emit_scratch.size);
+
 	for (uint32_t descriptor_index = 0; descriptor_index < IMDD_VULKAN_DESCRIPTOR_COUNT; ++descriptor_index) {
 		imdd_vulkan_descriptor_t *const desc = &ctx->descriptors[descriptor_index];
 		imdd_vulkan_verify(ctx, ctx->fp.vkBindBufferMemory(
@@ -1333,9 +1587,10 @@ void imdd_vulkan_create_pipelines(
 {
 	for (imdd_vulkan_draw_type_enum_t draw_type = (imdd_vulkan_draw_type_enum_t)0; draw_type < IMDD_VULKAN_DRAW_TYPE_COUNT; draw_type = (imdd_vulkan_draw_type_enum_t)(draw_type + 1))
 	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1))
-	for (imdd_blend_enum_t blend = (imdd_blend_enum_t)0; blend < IMDD_BLEND_COUNT; blend = (imdd_blend_enum_t)(blend + 1))
+	for (uint32_t blend_state = 0; blend_state < IMDD_VULKAN_BLEND_STATE_COUNT; ++blend_state)
 	for (imdd_zmode_enum_t zmode = (imdd_zmode_enum_t)0; zmode < IMDD_ZMODE_COUNT; zmode = (imdd_zmode_enum_t)(zmode + 1)) {
-		uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend, zmode);
+		uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend_state, zmode);
+		imdd_blend_enum_t const blend = (blend_state == IMDD_BLEND_OPAQUE) ? IMDD_BLEND_OPAQUE : IMDD_BLEND_ALPHA;
 
 		VkPipelineShaderStageCreateInfo shader_stage_create_info[2];
 		IMDD_VULKAN_SET_ZERO(shader_stage_create_info);
@@ -1458,6 +1713,7 @@ void imdd_vulkan_create_pipelines(
 		rasterization_state_create_info.sType			= VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 		rasterization_state_create_info.polygonMode		= VK_POLYGON_MODE_FILL;
 		rasterization_state_create_info.cullMode		= (draw_type == IMDD_VULKAN_DRAW_TYPE_INSTANCE) ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
+		rasterization_state_create_info.depthBiasEnable	= (style == IMDD_STYLE_FILLED) ? VK_TRUE : VK_FALSE;
 		rasterization_state_create_info.lineWidth		= 1.f;
 
 		VkPipelineMultisampleStateCreateInfo multisample_state_create_info;
@@ -1481,7 +1737,7 @@ void imdd_vulkan_create_pipelines(
 		if (blend == IMDD_BLEND_ALPHA) {
 			color_blend_attachment_state.blendEnable			= VK_TRUE;
 			color_blend_attachment_state.srcColorBlendFactor	= VK_BLEND_FACTOR_SRC_ALPHA;
-			color_blend_attachment_state.dstColorBlendFactor	= VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+			color_blend_attachment_state.dstColorBlendFactor	= (blend_state == IMDD_VULKAN_BLEND_ADDITIVE) ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
 			color_blend_attachment_state.colorBlendOp			= VK_BLEND_OP_ADD;
 			color_blend_attachment_state.srcAlphaBlendFactor	= VK_BLEND_FACTOR_SRC_ALPHA;
 			color_blend_attachment_state.dstAlphaBlendFactor	= VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
@@ -1494,15 +1750,18 @@ void imdd_vulkan_create_pipelines(
 		color_blend_state_create_info.attachmentCount	= 1;
 		color_blend_state_create_info.pAttachments		= &color_blend_attachment_state;
 
-		VkDynamicState const dynamic_states[2] = {
+		// layer state is dynamic in every pipeline, so that it is kept when switching pipelines
+		VkDynamicState const dynamic_states[4] = {
 			VK_DYNAMIC_STATE_VIEWPORT,
-			VK_DYNAMIC_STATE_SCISSOR
+			VK_DYNAMIC_STATE_SCISSOR,
+			VK_DYNAMIC_STATE_LINE_WIDTH,
+			VK_DYNAMIC_STATE_DEPTH_BIAS
 		};
 
 		VkPipelineDynamicStateCreateInfo dynamic_state_create_info;
 		IMDD_VULKAN_SET_ZERO(dynamic_state_create_info);
 		dynamic_state_create_info.sType					= VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dynamic_state_create_info.dynamicStateCount		= 2;
+		dynamic_state_create_info.dynamicStateCount		= 4;
 		dynamic_state_create_info.pDynamicStates		= dynamic_states;
 
 		VkGraphicsPipelineCreateInfo pipeline_create_info;
@@ -1531,11 +1790,248 @@ void imdd_vulkan_create_pipelines(
 	}
 }
 
-void imdd_vulkan_update(
+// converts shapes into the buffers of a frame, which can be done on any thread
+// flushes what was written to the start of each buffer
+static
+void imdd_vulkan_flush_buffers(
+	imdd_vulkan_context_t const *ctx,
+	VkDevice device,
+	imdd_vulkan_frame_t const *frame,
+	uint32_t instance_count,
+	uint32_t filled_vertex_count,
+	uint32_t wire_vertex_count)
+{
+	VkMappedMemoryRange memory_ranges[4];
+	IMDD_VULKAN_SET_ZERO(memory_ranges);
+	uint32_t memory_range_count = 0;
+	if (instance_count > 0) {
+		VkMappedMemoryRange *const transform_range = &memory_ranges[memory_range_count];
+		transform_range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		transform_range->memory = frame->memory;
+		transform_range->offset = frame->instance_transform_offset;
+		transform_range->size = imdd_vulkan_align(instance_count*sizeof(imdd_instance_transform_t), ctx->atom_size);
+		++memory_range_count;
+
+		VkMappedMemoryRange *const color_range = &memory_ranges[memory_range_count];
+		color_range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		color_range->memory = frame->memory;
+		color_range->offset = frame->instance_color_offset;
+		color_range->size = imdd_vulkan_align(instance_count*sizeof(imdd_instance_color_t), ctx->atom_size);
+		++memory_range_count;
+	}
+	if (filled_vertex_count > 0) {
+		VkMappedMemoryRange *const range = &memory_ranges[memory_range_count];
+		range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range->memory = frame->memory;
+		range->offset = frame->filled_vertex_offset;
+		range->size = imdd_vulkan_align(filled_vertex_count*sizeof(imdd_array_filled_vertex_t), ctx->atom_size);
+		++memory_range_count;
+	}
+	if (wire_vertex_count > 0) {
+		VkMappedMemoryRange *const range = &memory_ranges[memory_range_count];
+		range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range->memory = frame->memory;
+		range->offset = frame->wire_vertex_offset;
+		range->size = imdd_vulkan_align(wire_vertex_count*sizeof(imdd_array_wire_vertex_t), ctx->atom_size);
+		++memory_range_count;
+	}
+	imdd_vulkan_verify(ctx, ctx->fp.vkFlushMappedMemoryRanges(device, memory_range_count, memory_ranges));
+}
+
+// picks capacities for the next frames, each frame picks these up when next updated
+static
+void imdd_vulkan_track_capacity(imdd_vulkan_context_t *ctx, imdd_emit_stats_t const *required)
+{
+	ctx->instance_capacity = imdd_capacity_tracker_update(&ctx->instance_tracker, ctx->instance_capacity, required->required_instance_count);
+	ctx->filled_vertex_capacity = imdd_capacity_tracker_update(&ctx->filled_vertex_tracker, ctx->filled_vertex_capacity, required->required_filled_vertex_count);
+	ctx->wire_vertex_capacity = imdd_capacity_tracker_update(&ctx->wire_vertex_tracker, ctx->wire_vertex_capacity, required->required_wire_vertex_count);
+}
+
+// makes sure the view copy fits everything the frame can hold
+static
+void imdd_vulkan_reserve_view_copy(imdd_vulkan_view_copy_t *copy, imdd_vulkan_frame_t const *frame)
+{
+	if (copy->memory
+		&& copy->instance_capacity >= frame->instance_capacity
+		&& copy->filled_vertex_capacity >= frame->filled_vertex_capacity
+		&& copy->wire_vertex_capacity >= frame->wire_vertex_capacity
+	) {
+		return;
+	}
+	free(copy->memory);
+	size_t const transform_size = sizeof(imdd_instance_transform_t)*frame->instance_capacity;
+	size_t const color_size = sizeof(imdd_instance_color_t)*frame->instance_capacity;
+	size_t const filled_size = sizeof(imdd_array_filled_vertex_t)*frame->filled_vertex_capacity;
+	size_t const wire_size = sizeof(imdd_array_wire_vertex_t)*frame->wire_vertex_capacity;
+	copy->memory = malloc(transform_size + color_size + filled_size + wire_size);
+	copy->instance_capacity = frame->instance_capacity;
+	copy->filled_vertex_capacity = frame->filled_vertex_capacity;
+	copy->wire_vertex_capacity = frame->wire_vertex_capacity;
+	copy->instance_transforms = (imdd_instance_transform_t *)copy->memory;
+	copy->instance_colors = (imdd_instance_color_t *)((uintptr_t)copy->memory + transform_size);
+	copy->filled_vertices = (imdd_array_filled_vertex_t *)((uintptr_t)copy->memory + transform_size + color_size);
+	copy->wire_vertices = (imdd_array_wire_vertex_t *)((uintptr_t)copy->memory + transform_size + color_size + filled_size);
+}
+
+/*
+	The caller's emit flags combined with ours.  The SPIR-V above is only
+	generated from shaders that read full instance transforms and filled
+	vertices with normals, so IMDD_EMIT_FLAG_COMPACT_INSTANCES and
+	IMDD_EMIT_FLAG_FLAT_TRIANGLES are only supported by the GL3 renderer,
+	and are cleared here until compact and flat shaders are added to gen/.
+*/
+static
+uint32_t imdd_vulkan_emit_flags(imdd_vulkan_context_t const *ctx, uint32_t flags)
+{
+	return (flags | ctx->emit_options.flags) & ~(uint32_t)(IMDD_EMIT_FLAG_COMPACT_INSTANCES | IMDD_EMIT_FLAG_FLAT_TRIANGLES);
+}
+
+static
+void imdd_vulkan_convert(
 	imdd_vulkan_context_t *ctx,
+	imdd_vulkan_frame_t *frame,
 	imdd_shape_store_t const *const *stores,
 	uint32_t store_count,
 	VkDevice device,
+	imdd_emit_options_t const *options)
+{
+	// combine the caller's options with what suits our memory
+	imdd_emit_options_t emit_options;
+	imdd_emit_stats_t stats;
+	if (options) {
+		emit_options = *options;
+	} else {
+		IMDD_VULKAN_SET_ZERO(emit_options);
+	}
+	emit_options.flags = imdd_vulkan_emit_flags(ctx, emit_options.flags);
+	emit_options.bounds = NULL;		// we draw every batch, from our own buffers, in one go
+	emit_options.layout = NULL;
+	emit_options.stream = NULL;
+	if (!emit_options.scratch) {
+		emit_options.scratch = &ctx->emit_scratch;
+	}
+	if ((ctx->flags & IMDD_VULKAN_FLAG_GROW) && !emit_options.stats) {
+		emit_options.stats = &stats;
+	}
+
+	// views read back what was written, so write to our cached copy instead of the frame
+	imdd_instance_transform_t *instance_transforms = frame->instance_transform_base;
+	imdd_instance_color_t *instance_colors = frame->instance_color_base;
+	imdd_array_filled_vertex_t *filled_vertices = frame->filled_vertex_base;
+	imdd_array_wire_vertex_t *wire_vertices = frame->wire_vertex_base;
+	if (emit_options.views) {
+		imdd_vulkan_view_copy_t *const copy = &ctx->view_copy;
+		imdd_vulkan_reserve_view_copy(copy, frame);
+		instance_transforms = copy->instance_transforms;
+		instance_colors = copy->instance_colors;
+		filled_vertices = copy->filled_vertices;
+		wire_vertices = copy->wire_vertices;
+		emit_options.flags &= ~(uint32_t)IMDD_EMIT_FLAG_NON_TEMPORAL;
+	}
+
+	// partition our memory between shapes based on usage, emit all the shapes into it
+	uint32_t instance_count = 0;
+	uint32_t filled_vertex_count = 0;
+	uint32_t wire_vertex_count = 0;
+	imdd_emit_shapes(
+		stores,
+		store_count,
+		instance_transforms,
+		instance_colors,
+		frame->instance_capacity,
+		frame->batches.instance_batches,
+		&instance_count,
+		filled_vertices,
+		frame->filled_vertex_capacity,
+		frame->batches.filled_array_batches,
+		&filled_vertex_count,
+		wire_vertices,
+		frame->wire_vertex_capacity,
+		frame->batches.wire_array_batches,
+		&wire_vertex_count,
+		&emit_options);
+
+	// copy what was written in one pass, which suits memory that is not cached
+	if (emit_options.views) {
+		memcpy(frame->instance_transform_base, instance_transforms, instance_count*sizeof(imdd_instance_transform_t));
+		memcpy(frame->instance_color_base, instance_colors, instance_count*sizeof(imdd_instance_color_t));
+		memcpy(frame->filled_vertex_base, filled_vertices, filled_vertex_count*sizeof(imdd_array_filled_vertex_t));
+		memcpy(frame->wire_vertex_base, wire_vertices, wire_vertex_count*sizeof(imdd_array_wire_vertex_t));
+	}
+
+	// flush these writes
+	imdd_vulkan_flush_buffers(ctx, device, frame, instance_count, filled_vertex_count, wire_vertex_count);
+
+	if (ctx->flags & IMDD_VULKAN_FLAG_GROW) {
+		imdd_vulkan_track_capacity(ctx, emit_options.stats);
+	}
+}
+
+// converts the stores of the last update on a thread of the async scheduler
+static
+void imdd_vulkan_async_task(void *task_ctx, uint32_t index)
+{
+	imdd_vulkan_context_t *const ctx = (imdd_vulkan_context_t *)task_ctx;
+	(void)index;
+	imdd_vulkan_convert(ctx, &ctx->frames[ctx->frame_index], ctx->async_stores, ctx->async_store_count, ctx->async_device, &ctx->async_options);
+}
+
+// waits for the conversion started by the last update (if any), then draws its frame
+static
+void imdd_vulkan_finish_async(imdd_vulkan_context_t *ctx)
+{
+	if (ctx->async_pending) {
+		ctx->async_scheduler->wait(ctx->async_scheduler->user_data);
+		ctx->async_pending = 0;
+		ctx->draw_frame_index = ctx->frame_index;
+	}
+}
+
+/*
+	With an async scheduler, imdd_vulkan_update starts converting the stores
+	into the next frame as a single task on the scheduler, and draws use the
+	frame converted by the previous update, so shapes are drawn one frame
+	late.  The frame being converted must not be the one drawn by the
+	previous update, which the GPU may still be using, so this needs an
+	IMDD_VULKAN_FRAME_COUNT of at least 3: with fewer the scheduler is not
+	used and 0 is returned.  The stores (and the array of them, and anything
+	the options point to) belong to the context until the next update, so
+	the caller should alternate between two sets of stores.  The task
+	converts on one thread, so the scheduler of the options is not used, and
+	stats are written during the task.  Waits for the last conversion if the
+	scheduler is changed, and NULL goes back to converting during
+	imdd_vulkan_update.
+*/
+int imdd_vulkan_set_async_scheduler(imdd_vulkan_context_t *ctx, imdd_scheduler_t const *scheduler)
+{
+	imdd_vulkan_finish_async(ctx);
+#if IMDD_VULKAN_FRAME_COUNT < 3
+	ctx->async_scheduler = NULL;
+	return scheduler == NULL;
+#else
+	ctx->async_scheduler = scheduler;
+	return 1;
+#endif
+}
+
+// frees the output of a cached store from before it grew, once the GPU is done with it
+static
+void imdd_vulkan_release_retired(
+	imdd_vulkan_context_t const *ctx,
+	VkDevice device,
+	imdd_vulkan_cached_store_t *cached)
+{
+	if (cached->has_retired && ctx->update_count - cached->retired_update_count >= IMDD_VULKAN_FRAME_COUNT) {
+		imdd_vulkan_destroy_frame(ctx, device, &cached->retired);
+		cached->has_retired = 0;
+	}
+}
+
+// copies mesh data on first use, then advances to a frame that the GPU is done with
+static
+imdd_vulkan_frame_t *imdd_vulkan_begin_frame(
+	imdd_vulkan_context_t *ctx,
+	VkDevice device,
 	VkCommandBuffer command_buffer)
 {
 	// copy mesh data if not yet copied
@@ -1604,77 +2100,384 @@ void imdd_vulkan_update(
 		ctx->mesh_copy_done = 1;
 	}
 
-	// advance to next frame
+	// draw what the last update converted, then advance to next frame
+	imdd_vulkan_finish_async(ctx);
 	ctx->frame_index = (1 + ctx->frame_index) % IMDD_VULKAN_FRAME_COUNT;
-	imdd_vulkan_frame_t const *const frame = &ctx->frames[ctx->frame_index];
+	imdd_vulkan_frame_t *const frame = &ctx->frames[ctx->frame_index];
+	++ctx->update_count;
+	for (uint32_t slot = 0; slot < IMDD_VULKAN_CACHED_STORE_COUNT; ++slot) {
+		imdd_vulkan_release_retired(ctx, device, &ctx->cached_stores[slot]);
+	}
 
-	// partition our memory between shapes based on usage, emit all the shapes into it
+	// the GPU is done with this frame, so resize its buffers if capacity changed since they were made
+	if (frame->instance_capacity != ctx->instance_capacity
+		|| frame->filled_vertex_capacity != ctx->filled_vertex_capacity
+		|| frame->wire_vertex_capacity != ctx->wire_vertex_capacity
+	) {
+		imdd_vulkan_destroy_frame(ctx, device, frame);
+		imdd_vulkan_create_frame(ctx, device, frame);
+	}
+	return frame;
+}
+
+void imdd_vulkan_update(
+	imdd_vulkan_context_t *ctx,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+	VkDevice device,
+	VkCommandBuffer command_buffer,
+	imdd_emit_options_t const *options)
+{
+	imdd_vulkan_frame_t *const frame = imdd_vulkan_begin_frame(ctx, device, command_buffer);
+	ctx->submission_count = 0;
+
+	if (ctx->async_scheduler) {
+		if (options) {
+			ctx->async_options = *options;
+		} else {
+			IMDD_VULKAN_SET_ZERO(ctx->async_options);
+		}
+		ctx->async_options.scheduler = NULL;
+		ctx->async_stores = stores;
+		ctx->async_store_count = store_count;
+		ctx->async_device = device;
+		ctx->async_pending = 1;
+		ctx->async_scheduler->parallel_for(ctx->async_scheduler->user_data, 1, &imdd_vulkan_async_task, ctx);
+	} else {
+		imdd_vulkan_convert(ctx, frame, stores, store_count, device, options);
+		ctx->draw_frame_index = ctx->frame_index;
+	}
+}
+
+/*
+	Stores that are finished at different times can be converted as each one
+	is ready, instead of waiting for all of them as imdd_vulkan_update does.
+	imdd_vulkan_begin_update advances to the next frame, then each call to
+	imdd_vulkan_submit_stores converts its stores straight away into the
+	frame memory left by previous calls.  It makes no Vulkan calls, so can
+	run on any thread (one at a time) while the rest of the frame is still
+	being built.  imdd_vulkan_end_update flushes what was written, and each
+	batch is then drawn once per submission, so shapes are drawn in
+	submission order without being copied.
+
+	Alpha blended shapes are only sorted within each submission, views,
+	bounds and layouts from the options are not used, and stats are written
+	by imdd_vulkan_end_update.  Not for use with an async scheduler.
+*/
+void imdd_vulkan_begin_update(
+	imdd_vulkan_context_t *ctx,
+	VkDevice device,
+	VkCommandBuffer command_buffer,
+	imdd_emit_options_t const *options)
+{
+	imdd_vulkan_frame_t *const frame = imdd_vulkan_begin_frame(ctx, device, command_buffer);
+	IMDD_VULKAN_SET_ZERO(frame->batches);
+
+	if (options) {
+		ctx->submit_options = *options;
+	} else {
+		IMDD_VULKAN_SET_ZERO(ctx->submit_options);
+	}
+	ctx->submit_options.flags = imdd_vulkan_emit_flags(ctx, ctx->submit_options.flags);
+	ctx->submit_options.views = NULL;
+	ctx->submit_options.bounds = NULL;
+	ctx->submit_options.layout = NULL;
+	ctx->submit_options.stream = NULL;
+	if (!ctx->submit_options.scratch) {
+		ctx->submit_options.scratch = &ctx->emit_scratch;
+	}
+	IMDD_VULKAN_SET_ZERO(ctx->submit_stats);
+
+	ctx->submission_count = 0;
+	ctx->submit_instance_count = 0;
+	ctx->submit_filled_vertex_count = 0;
+	ctx->submit_wire_vertex_count = 0;
+}
+
+void imdd_vulkan_submit_stores(
+	imdd_vulkan_context_t *ctx,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count)
+{
+	if (ctx->submission_count == IMDD_VULKAN_MAX_SUBMISSION_COUNT) {
+		imdd_emit_count_dropped(&ctx->submit_stats, stores, store_count);
+		return;
+	}
+	imdd_vulkan_frame_t *const frame = &ctx->frames[ctx->frame_index];
+	imdd_vulkan_batches_t *const submission = &ctx->submissions[ctx->submission_count++];
+	submission->instance_offset = ctx->submit_instance_count;
+	submission->filled_vertex_offset = ctx->submit_filled_vertex_count;
+	submission->wire_vertex_offset = ctx->submit_wire_vertex_count;
+
+	// convert into the frame after the previous submissions
+	imdd_emit_options_t emit_options = ctx->submit_options;
+	imdd_emit_stats_t stats;
+	emit_options.stats = &stats;
 	uint32_t instance_count = 0;
 	uint32_t filled_vertex_count = 0;
 	uint32_t wire_vertex_count = 0;
 	imdd_emit_shapes(
 		stores,
 		store_count,
-		frame->instance_transform_base,
-		frame->instance_color_base,
-		ctx->instance_capacity,
-		ctx->instance_batches,
+		frame->instance_transform_base + submission->instance_offset,
+		frame->instance_color_base + submission->instance_offset,
+		frame->instance_capacity - submission->instance_offset,
+		submission->instance_batches,
 		&instance_count,
-		frame->filled_vertex_base,
-		ctx->filled_vertex_capacity,
-		ctx->filled_array_batches,
+		frame->filled_vertex_base + submission->filled_vertex_offset,
+		frame->filled_vertex_capacity - submission->filled_vertex_offset,
+		submission->filled_array_batches,
 		&filled_vertex_count,
-		frame->wire_vertex_base,
-		ctx->wire_vertex_capacity,
-		ctx->wire_array_batches,
-		&wire_vertex_count);
+		frame->wire_vertex_base + submission->wire_vertex_offset,
+		frame->wire_vertex_capacity - submission->wire_vertex_offset,
+		submission->wire_array_batches,
+		&wire_vertex_count,
+		&emit_options);
+	ctx->submit_instance_count += instance_count;
+	ctx->submit_filled_vertex_count += filled_vertex_count;
+	ctx->submit_wire_vertex_count += wire_vertex_count;
+
+	// submissions share the frame, so the space they need adds up
+	for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+		ctx->submit_stats.culled_counts[shape] += stats.culled_counts[shape];
+		ctx->submit_stats.small_counts[shape] += stats.small_counts[shape];
+		ctx->submit_stats.duplicate_counts[shape] += stats.duplicate_counts[shape];
+	}
+	ctx->submit_stats.unsorted_alpha_flags |= stats.unsorted_alpha_flags;
+	ctx->submit_stats.required_instance_count += stats.required_instance_count;
+	ctx->submit_stats.required_filled_vertex_count += stats.required_filled_vertex_count;
+	ctx->submit_stats.required_wire_vertex_count += stats.required_wire_vertex_count;
+}
 
-	// flush these writes
-	VkMappedMemoryRange memory_ranges[4];
-	IMDD_VULKAN_SET_ZERO(memory_ranges);
-	uint32_t memory_range_count = 0;
-	if (instance_count > 0) {
-		VkMappedMemoryRange *const transform_range = &memory_ranges[memory_range_count];
-		transform_range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		transform_range->memory = ctx->host_memory;
-		transform_range->offset = frame->instance_transform_offset;
-		transform_range->size = imdd_vulkan_align(instance_count*sizeof(imdd_instance_transform_t), ctx->atom_size);
-		++memory_range_count;
+void imdd_vulkan_end_update(imdd_vulkan_context_t *ctx, VkDevice device)
+{
+	imdd_vulkan_frame_t const *const frame = &ctx->frames[ctx->frame_index];
+	imdd_vulkan_flush_buffers(ctx, device, frame, ctx->submit_instance_count, ctx->submit_filled_vertex_count, ctx->submit_wire_vertex_count);
+	ctx->draw_frame_index = ctx->frame_index;
 
-		VkMappedMemoryRange *const color_range = &memory_ranges[memory_range_count];
-		color_range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		color_range->memory = ctx->host_memory;
-		color_range->offset = frame->instance_color_offset;
-		color_range->size = imdd_vulkan_align(instance_count*sizeof(imdd_instance_color_t), ctx->atom_size);
+	if (ctx->submit_options.stats) {
+		*ctx->submit_options.stats = ctx->submit_stats;
 	}
-	if (filled_vertex_count > 0) {
-		VkMappedMemoryRange *const range = &memory_ranges[memory_range_count];
-		range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		range->memory = ctx->host_memory;
-		range->offset = frame->filled_vertex_offset;
-		range->size = imdd_vulkan_align(filled_vertex_count*sizeof(imdd_array_filled_vertex_t), ctx->atom_size);
-		++memory_range_count;
+	if (ctx->flags & IMDD_VULKAN_FLAG_GROW) {
+		imdd_vulkan_track_capacity(ctx, &ctx->submit_stats);
 	}
-	if (wire_vertex_count > 0) {
-		VkMappedMemoryRange *const range = &memory_ranges[memory_range_count];
-		range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		range->memory = ctx->host_memory;
-		range->offset = frame->wire_vertex_offset;
-		range->size = imdd_vulkan_align(wire_vertex_count*sizeof(imdd_array_wire_vertex_t), ctx->atom_size);
-		++memory_range_count;
+}
+
+// creates the buffers of a cached store, keeping the previous output until the GPU is done with it
+static
+void imdd_vulkan_create_cached_buffers(
+	imdd_vulkan_context_t *ctx,
+	VkDevice device,
+	imdd_vulkan_cached_store_t *cached,
+	uint32_t instance_capacity,
+	uint32_t filled_vertex_capacity,
+	uint32_t wire_vertex_capacity)
+{
+	if (cached->has_buffers) {
+		// only called when converting, which is long enough after the last conversion for staging and any retired output
+		imdd_vulkan_release_retired(ctx, device, cached);
+		imdd_vulkan_destroy_frame(ctx, device, &cached->staging);
+		cached->retired = cached->output;
+		cached->retired_update_count = ctx->update_count;
+		cached->has_retired = 1;
 	}
-	imdd_vulkan_verify(ctx, ctx->fp.vkFlushMappedMemoryRanges(device, memory_range_count, memory_ranges));
+	imdd_vulkan_create_buffers(
+		ctx, device,
+		instance_capacity,
+		filled_vertex_capacity,
+		wire_vertex_capacity,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		ctx->staging_memory_type_index,
+		1,
+		&cached->staging);
+	imdd_vulkan_create_buffers(
+		ctx, device,
+		instance_capacity,
+		filled_vertex_capacity,
+		wire_vertex_capacity,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		ctx->device_memory_type_index,
+		0,
+		&cached->output);
+	cached->has_buffers = 1;
+}
+
+/*
+	Stores with content that rarely changes (such as level geometry) can be
+	converted into device local buffers of their own, which are drawn after
+	the shapes of the frame in each layer by imdd_vulkan_draw and
+	imdd_vulkan_draw_view.  Call this every frame after imdd_vulkan_update,
+	with the same command buffer: conversion and the copy to device memory
+	are skipped while the store has not been reset and has had no shapes
+	added since the last conversion.
+
+	Each slot converts into staging memory of its own, which the GPU copies
+	from during the command buffer, so a slot is converted again at most
+	once every IMDD_VULKAN_FRAME_COUNT updates and draws its previous
+	contents until then.  Shapes are not culled or given LODs, since the
+	result must not depend on the camera, and only the flags, scheduler and
+	scratch of the options are used.
+*/
+void imdd_vulkan_update_cached(
+	imdd_vulkan_context_t *ctx,
+	uint32_t slot,
+	imdd_shape_store_t const *store,
+	VkDevice device,
+	VkCommandBuffer command_buffer,
+	imdd_emit_options_t const *options)
+{
+	imdd_vulkan_cached_store_t *const cached = &ctx->cached_stores[slot];
+	uint32_t const header_count = imdd_atomic_load(&store->header_count);
+	uint32_t const data_qw_count = imdd_atomic_load(&store->data_qw_count);
+	if (cached->store == store
+		&& cached->generation == store->generation
+		&& cached->header_count == header_count
+		&& cached->data_qw_count == data_qw_count) {
+		return;
+	}
+	if (cached->has_buffers && ctx->update_count - cached->update_count < IMDD_VULKAN_FRAME_COUNT) {
+		return;
+	}
+	imdd_vulkan_finish_async(ctx);
+	if (!cached->has_buffers) {
+		imdd_vulkan_create_cached_buffers(ctx, device, cached, ctx->instance_capacity, ctx->filled_vertex_capacity, ctx->wire_vertex_capacity);
+	}
+
+	imdd_emit_options_t emit_options;
+	imdd_emit_stats_t stats;
+	IMDD_VULKAN_SET_ZERO(emit_options);
+	if (options) {
+		emit_options.flags = options->flags;
+		emit_options.scheduler = options->scheduler;
+		emit_options.scratch = options->scratch;
+	}
+	if (!emit_options.scratch) {
+		emit_options.scratch = &ctx->emit_scratch;
+	}
+	emit_options.flags = imdd_vulkan_emit_flags(ctx, emit_options.flags);
+	emit_options.stats = &stats;
+
+	// convert into staging memory, growing the buffers once if the store does not fit
+	uint32_t instance_count = 0;
+	uint32_t filled_vertex_count = 0;
+	uint32_t wire_vertex_count = 0;
+	for (;;) {
+		imdd_emit_shapes(
+			&store,
+			1,
+			cached->staging.instance_transform_base,
+			cached->staging.instance_color_base,
+			cached->staging.instance_capacity,
+			cached->output.batches.instance_batches,
+			&instance_count,
+			cached->staging.filled_vertex_base,
+			cached->staging.filled_vertex_capacity,
+			cached->output.batches.filled_array_batches,
+			&filled_vertex_count,
+			cached->staging.wire_vertex_base,
+			cached->staging.wire_vertex_capacity,
+			cached->output.batches.wire_array_batches,
+			&wire_vertex_count,
+			&emit_options);
+		if (stats.required_instance_count <= cached->staging.instance_capacity
+			&& stats.required_filled_vertex_count <= cached->staging.filled_vertex_capacity
+			&& stats.required_wire_vertex_count <= cached->staging.wire_vertex_capacity) {
+			break;
+		}
+		imdd_vulkan_create_cached_buffers(
+			ctx, device, cached,
+			(stats.required_instance_count > cached->staging.instance_capacity) ? stats.required_instance_count : cached->staging.instance_capacity,
+			(stats.required_filled_vertex_count > cached->staging.filled_vertex_capacity) ? stats.required_filled_vertex_count : cached->staging.filled_vertex_capacity,
+			(stats.required_wire_vertex_count > cached->staging.wire_vertex_capacity) ? stats.required_wire_vertex_count : cached->staging.wire_vertex_capacity);
+	}
+	imdd_vulkan_flush_buffers(ctx, device, &cached->staging, instance_count, filled_vertex_count, wire_vertex_count);
+
+	// wait for earlier draws from this slot, then copy to device memory for the draws that follow
+	ctx->fp.vkCmdPipelineBarrier(
+		command_buffer,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, NULL,
+		0, NULL,
+		0, NULL);
+
+	VkBuffer const src_buffers[4] = {
+		cached->staging.instance_transform_buffer,
+		cached->staging.instance_color_buffer,
+		cached->staging.filled_vertex_buffer,
+		cached->staging.wire_vertex_buffer
+	};
+	VkBuffer const dst_buffers[4] = {
+		cached->output.instance_transform_buffer,
+		cached->output.instance_color_buffer,
+		cached->output.filled_vertex_buffer,
+		cached->output.wire_vertex_buffer
+	};
+	VkDeviceSize const copy_sizes[4] = {
+		instance_count*sizeof(imdd_instance_transform_t),
+		instance_count*sizeof(imdd_instance_color_t),
+		filled_vertex_count*sizeof(imdd_array_filled_vertex_t),
+		wire_vertex_count*sizeof(imdd_array_wire_vertex_t)
+	};
+	VkBufferMemoryBarrier buffer_memory_barriers[4];
+	IMDD_VULKAN_SET_ZERO(buffer_memory_barriers);
+	uint32_t buffer_memory_barrier_count = 0;
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (copy_sizes[i] == 0) {
+			continue;
+		}
+		VkBufferCopy buffer_copy;
+		IMDD_VULKAN_SET_ZERO(buffer_copy);
+		buffer_copy.size = copy_sizes[i];
+		ctx->fp.vkCmdCopyBuffer(command_buffer, src_buffers[i], dst_buffers[i], 1, &buffer_copy);
+
+		VkBufferMemoryBarrier *const barrier = &buffer_memory_barriers[buffer_memory_barrier_count++];
+		barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier->dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier->buffer = dst_buffers[i];
+		barrier->size = VK_WHOLE_SIZE;
+	}
+	if (buffer_memory_barrier_count > 0) {
+		ctx->fp.vkCmdPipelineBarrier(
+			command_buffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+			0,
+			0, NULL,
+			buffer_memory_barrier_count, buffer_memory_barriers,
+			0, NULL);
+	}
+
+	cached->store = store;
+	cached->generation = store->generation;
+	cached->header_count = header_count;
+	cached->data_qw_count = data_qw_count;
+	cached->update_count = ctx->update_count;
+}
+
+// stops drawing a cached store, its buffers are kept for the next store in this slot
+void imdd_vulkan_clear_cached(imdd_vulkan_context_t *ctx, uint32_t slot)
+{
+	ctx->cached_stores[slot].store = NULL;
 }
 
 static
 void imdd_vulkan_draw_instances(
 	imdd_vulkan_context_t const *ctx,
 	VkCommandBuffer command_buffer,
+	imdd_vulkan_frame_t const *frame,
+	imdd_vulkan_batches_t const *batches,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
 	imdd_style_enum_t style,
 	imdd_blend_enum_t blend,
+	uint32_t blend_state,
 	imdd_zmode_enum_t zmode)
 {
-	imdd_vulkan_frame_t const *const frame = &ctx->frames[ctx->frame_index];
 	imdd_vulkan_draw_type_enum_t const draw_type = IMDD_VULKAN_DRAW_TYPE_INSTANCE;
 
 	imdd_vulkan_mesh_buffer_t const *const mesh_buffer = &ctx->mesh_buffers[style];
@@ -1686,17 +2489,25 @@ void imdd_vulkan_draw_instances(
 	ctx->fp.vkCmdBindVertexBuffers(command_buffer, 0, 3, vertex_buffers, zero_offsets);
 	ctx->fp.vkCmdBindIndexBuffer(command_buffer, mesh_buffer->index_buffer, 0, VK_INDEX_TYPE_UINT16);
 
+	// only the transform format is written, which has a group per mesh
 	for (imdd_mesh_enum_t mesh = (imdd_mesh_enum_t)0; mesh < IMDD_MESH_COUNT; mesh = (imdd_mesh_enum_t)(mesh + 1)) {
-		uint32_t const batch_index = imdd_instance_batch_index(mesh, style, blend, zmode);
-		imdd_batch_t const *const batch = &ctx->instance_batches[batch_index];
-		if (batch->count) {
+		uint32_t const batch_index = imdd_instance_group_batch_index(mesh, layer, style, blend, zmode);
+		imdd_batch_t const *ranges = &batches->instance_batches[batch_index];
+		uint32_t range_count = 1;
+		if (view) {
+			ranges = view->ranges + view->instance_range_lists[batch_index].offset;
+			range_count = view->instance_range_lists[batch_index].count;
+		}
+		if (range_count && ranges->count) {
 			imdd_mesh_desc_t const *const mesh_desc = &mesh_buffer->layout.mesh_desc[mesh];
 			imdd_mesh_offsets_t const *const mesh_offsets = &mesh_buffer->layout.mesh_offsets[mesh];
 
-			uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend, zmode);
+			uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend_state, zmode);
 			ctx->fp.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipelines[pipeline_index]);
 
-			ctx->fp.vkCmdDrawIndexed(command_buffer, mesh_desc->index_count, batch->count, mesh_offsets->index_offset, 0, batch->offset);
+			for (uint32_t range_index = 0; range_index < range_count; ++range_index) {
+				ctx->fp.vkCmdDrawIndexed(command_buffer, mesh_desc->index_count, ranges[range_index].count, mesh_offsets->index_offset, 0, batches->instance_offset + ranges[range_index].offset);
+			}
 		}
 	}
 }
@@ -1705,23 +2516,34 @@ static
 void imdd_vulkan_draw_filled_arrays(
 	imdd_vulkan_context_t const *ctx,
 	VkCommandBuffer command_buffer,
+	imdd_vulkan_frame_t const *frame,
+	imdd_vulkan_batches_t const *batches,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
 	imdd_blend_enum_t blend,
+	uint32_t blend_state,
 	imdd_zmode_enum_t zmode)
 {
-	imdd_vulkan_frame_t const *const frame = &ctx->frames[ctx->frame_index];
 	imdd_vulkan_draw_type_enum_t const draw_type = IMDD_VULKAN_DRAW_TYPE_ARRAY;
 	imdd_style_enum_t const style = IMDD_STYLE_FILLED;
 
-	uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-	imdd_batch_t const *const batch = &ctx->filled_array_batches[batch_index];
-	if (batch->count) {
-		uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend, zmode);
+	uint32_t const batch_index = imdd_array_batch_index(layer, blend, zmode);
+	imdd_batch_t const *ranges = &batches->filled_array_batches[batch_index];
+	uint32_t range_count = 1;
+	if (view) {
+		ranges = view->ranges + view->filled_range_lists[batch_index].offset;
+		range_count = view->filled_range_lists[batch_index].count;
+	}
+	if (range_count && ranges->count) {
+		uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend_state, zmode);
 		ctx->fp.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipelines[pipeline_index]);
 
 		VkDeviceSize const zero_offset = 0;
 		ctx->fp.vkCmdBindVertexBuffers(command_buffer, 0, 1, &frame->filled_vertex_buffer, &zero_offset);
 
-		ctx->fp.vkCmdDraw(command_buffer, batch->count, 1, batch->offset, 0);
+		for (uint32_t range_index = 0; range_index < range_count; ++range_index) {
+			ctx->fp.vkCmdDraw(command_buffer, ranges[range_index].count, 1, batches->filled_vertex_offset + ranges[range_index].offset, 0);
+		}
 	}
 }
 
@@ -1729,31 +2551,90 @@ static
 void imdd_vulkan_draw_wire_arrays(
 	imdd_vulkan_context_t const *ctx,
 	VkCommandBuffer command_buffer,
+	imdd_vulkan_frame_t const *frame,
+	imdd_vulkan_batches_t const *batches,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
 	imdd_blend_enum_t blend,
+	uint32_t blend_state,
 	imdd_zmode_enum_t zmode)
 {
-	imdd_vulkan_frame_t const *const frame = &ctx->frames[ctx->frame_index];
 	imdd_vulkan_draw_type_enum_t const draw_type = IMDD_VULKAN_DRAW_TYPE_ARRAY;
 	imdd_style_enum_t const style = IMDD_STYLE_WIRE;
 
-	uint32_t const batch_index = imdd_array_batch_index(blend, zmode);
-	imdd_batch_t const *const batch = &ctx->wire_array_batches[batch_index];
-	if (batch->count) {
-		uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend, zmode);
+	uint32_t const batch_index = imdd_array_batch_index(layer, blend, zmode);
+	imdd_batch_t const *ranges = &batches->wire_array_batches[batch_index];
+	uint32_t range_count = 1;
+	uint32_t const triangle_batch_index = imdd_array_wire_triangle_batch_index(layer, blend, zmode);
+	imdd_batch_t const *triangle_ranges = &batches->wire_array_batches[triangle_batch_index];
+	uint32_t triangle_range_count = 1;
+	if (view) {
+		ranges = view->ranges + view->wire_range_lists[batch_index].offset;
+		range_count = view->wire_range_lists[batch_index].count;
+		triangle_ranges = view->ranges + view->wire_range_lists[triangle_batch_index].offset;
+		triangle_range_count = view->wire_range_lists[triangle_batch_index].count;
+	}
+	int const has_lines = (range_count && ranges->count);
+	int const has_triangles = (triangle_range_count && triangle_ranges->count);
+	if (has_lines || has_triangles) {
+		uint32_t const pipeline_index = imdd_vulkan_pipeline_index(draw_type, style, blend_state, zmode);
 		ctx->fp.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipelines[pipeline_index]);
 
 		VkDeviceSize const zero_offset = 0;
 		ctx->fp.vkCmdBindVertexBuffers(command_buffer, 0, 1, &frame->wire_vertex_buffer, &zero_offset);
+	}
+	if (has_lines) {
+		for (uint32_t range_index = 0; range_index < range_count; ++range_index) {
+			ctx->fp.vkCmdDraw(command_buffer, ranges[range_index].count, 1, batches->wire_vertex_offset + ranges[range_index].offset, 0);
+		}
+	}
+	if (has_triangles) {
+		// draw triangles as lines using the index pattern, one block at a time
+		imdd_vulkan_mesh_buffer_t const *const mesh_buffer = &ctx->mesh_buffers[IMDD_STYLE_WIRE];
+		ctx->fp.vkCmdBindIndexBuffer(command_buffer, mesh_buffer->index_buffer, 0, VK_INDEX_TYPE_UINT16);
+
+		for (uint32_t range_index = 0; range_index < triangle_range_count; ++range_index) {
+			imdd_batch_t const *const range = &triangle_ranges[range_index];
+			uint32_t const triangle_count = range->count/3;
+			for (uint32_t first = 0; first < triangle_count; first += IMDD_WIRE_TRIANGLE_BLOCK_SIZE) {
+				uint32_t const remaining_count = triangle_count - first;
+				uint32_t const block_count = (remaining_count < IMDD_WIRE_TRIANGLE_BLOCK_SIZE) ? remaining_count : IMDD_WIRE_TRIANGLE_BLOCK_SIZE;
+				ctx->fp.vkCmdDrawIndexed(command_buffer, 6*block_count, 1, mesh_buffer->layout.index_count, batches->wire_vertex_offset + range->offset + 3*first, 0);
+			}
+		}
+	}
+}
 
-		ctx->fp.vkCmdDraw(command_buffer, batch->count, 1, batch->offset, 0);
+// draws the batches of one part of a frame for this layer, blend mode and zmode
+static
+void imdd_vulkan_draw_pass(
+	imdd_vulkan_context_t const *ctx,
+	VkCommandBuffer command_buffer,
+	imdd_vulkan_frame_t const *frame,
+	imdd_vulkan_batches_t const *batches,
+	imdd_emit_view_t const *view,
+	uint32_t layer,
+	imdd_blend_enum_t blend,
+	uint32_t blend_state,
+	imdd_zmode_enum_t zmode)
+{
+	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
+		imdd_vulkan_draw_instances(ctx, command_buffer, frame, batches, view, layer, style, blend, blend_state, zmode);
+		if (style == IMDD_STYLE_FILLED) {
+			imdd_vulkan_draw_filled_arrays(ctx, command_buffer, frame, batches, view, layer, blend, blend_state, zmode);
+		} else {
+			imdd_vulkan_draw_wire_arrays(ctx, command_buffer, frame, batches, view, layer, blend, blend_state, zmode);
+		}
 	}
 }
 
-void imdd_vulkan_draw(
+static
+void imdd_vulkan_draw_batches(
 	imdd_vulkan_context_t *ctx,
 	float const *proj_from_world,
 	VkDevice device,
-	VkCommandBuffer command_buffer)
+	VkCommandBuffer command_buffer,
+	imdd_emit_view_t const *view)
 {
 	// advance to next draw
 	ctx->descriptor_index = (1 + ctx->descriptor_index) % IMDD_VULKAN_DESCRIPTOR_COUNT;
@@ -1781,19 +2662,59 @@ void imdd_vulkan_draw(
 		1, &desc->common_descriptor_set,
 		0, NULL);
 
-	// emit all draw calls
-	for (imdd_zmode_enum_t zmode = (imdd_zmode_enum_t)0; zmode < IMDD_ZMODE_COUNT; zmode = (imdd_zmode_enum_t)(zmode + 1))
-	for (imdd_blend_enum_t blend = (imdd_blend_enum_t)0; blend < IMDD_BLEND_COUNT; blend = (imdd_blend_enum_t)(blend + 1))
-	for (imdd_style_enum_t style = (imdd_style_enum_t)0; style < IMDD_STYLE_COUNT; style = (imdd_style_enum_t)(style + 1)) {
-		imdd_vulkan_draw_instances(ctx, command_buffer, style, blend, zmode);
-		if (style == IMDD_STYLE_FILLED) {
-			imdd_vulkan_draw_filled_arrays(ctx, command_buffer, blend, zmode);
-		} else {
-			imdd_vulkan_draw_wire_arrays(ctx, command_buffer, blend, zmode);
+	// emit all draw calls, one layer after another with the state of that layer
+	for (uint32_t layer = 0; layer < IMDD_LAYER_COUNT; ++layer) {
+		imdd_vulkan_layer_t const *const layer_state = &ctx->layers[layer];
+		ctx->fp.vkCmdSetDepthBias(command_buffer, layer_state->depth_bias_constant, 0.f, layer_state->depth_bias_slope);
+		ctx->fp.vkCmdSetLineWidth(command_buffer, layer_state->line_width);
+
+		for (imdd_zmode_enum_t zmode = (imdd_zmode_enum_t)0; zmode < IMDD_ZMODE_COUNT; zmode = (imdd_zmode_enum_t)(zmode + 1))
+		for (imdd_blend_enum_t blend = (imdd_blend_enum_t)0; blend < IMDD_BLEND_COUNT; blend = (imdd_blend_enum_t)(blend + 1)) {
+			// the shapes of this frame (in submission order when submitted), then cached stores
+			uint32_t const blend_state = (blend == IMDD_BLEND_ALPHA && layer_state->additive) ? IMDD_VULKAN_BLEND_ADDITIVE : blend;
+			imdd_vulkan_frame_t const *const frame = &ctx->frames[ctx->draw_frame_index];
+			if (ctx->submission_count > 0) {
+				for (uint32_t submission_index = 0; submission_index < ctx->submission_count; ++submission_index) {
+					imdd_vulkan_draw_pass(ctx, command_buffer, frame, &ctx->submissions[submission_index], NULL, layer, blend, blend_state, zmode);
+				}
+			} else {
+				imdd_vulkan_draw_pass(ctx, command_buffer, frame, &frame->batches, view, layer, blend, blend_state, zmode);
+			}
+			for (uint32_t slot = 0; slot < IMDD_VULKAN_CACHED_STORE_COUNT; ++slot) {
+				imdd_vulkan_cached_store_t const *const cached = &ctx->cached_stores[slot];
+				if (cached->store) {
+					imdd_vulkan_draw_pass(ctx, command_buffer, &cached->output, &cached->output.batches, NULL, layer, blend, blend_state, zmode);
+				}
+			}
 		}
 	}
 }
 
+void imdd_vulkan_draw(
+	imdd_vulkan_context_t *ctx,
+	float const *proj_from_world,
+	VkDevice device,
+	VkCommandBuffer command_buffer)
+{
+	imdd_vulkan_draw_batches(ctx, proj_from_world, device, command_buffer, NULL);
+}
+
+/*
+	Draws only the ranges visible in a view, written by the update of the
+	frame being drawn using imdd_emit_options_t::views.  With an async
+	scheduler, that is the update before last, so alternate between two sets
+	of views like the stores.
+*/
+void imdd_vulkan_draw_view(
+	imdd_vulkan_context_t *ctx,
+	float const *proj_from_world,
+	VkDevice device,
+	VkCommandBuffer command_buffer,
+	imdd_emit_view_t const *view)
+{
+	imdd_vulkan_draw_batches(ctx, proj_from_world, device, command_buffer, view);
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
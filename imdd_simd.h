@@ -18,6 +18,11 @@ uint32_t imdd_asuint(float f)
 
 #if defined(IMDD_NO_SIMD)
 #include "imdd_simd_fallback.h"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include "imdd_simd_neon.h"
 #else
 #include "imdd_simd_sse.h"
+#if !defined(IMDD_NO_AVX) && (defined(__AVX__) || defined(_MSC_VER) || defined(__GNUC__))
+#include "imdd_simd_avx.h"
+#endif
 #endif
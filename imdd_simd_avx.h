@@ -0,0 +1,114 @@
+#pragma once
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+	8-wide types for processing two shapes per instruction.  Each 128-bit
+	lane holds one imdd_v4, and all operations work independently per lane,
+	so results are bit-identical to running the imdd_v4 code on each shape.
+
+	Unless the whole build targets AVX, these are only available within
+	functions marked with IMDD_AVX_TARGET, which must only be called after
+	imdd_simd_has_avx() has returned non-zero.  This keeps imdd_v4 (and
+	the inline emitters in imdd.h) unchanged for the baseline ISA.
+
+	There is no separate AVX2 or AVX-512 path.  The conversion kernels
+	only use float arithmetic and in-lane shuffles, which AVX1 already
+	has at full width, so an AVX2 build of these functions is the same
+	code.  Four shapes per op would need AVX-512, which is not supported
+	yet.
+*/
+#define IMDD_SIMD_V8
+
+#if defined(__AVX__)
+#define IMDD_AVX_TARGET
+static inline int imdd_simd_has_avx(void) { return 1; }
+#elif defined(_MSC_VER)
+#define IMDD_AVX_TARGET
+static inline
+int imdd_simd_has_avx(void)
+{
+	// check the CPU supports AVX and the OS saves YMM state
+	int info[4];
+	__cpuid(info, 1);
+	int const osxsave_and_avx = (1 << 27) | (1 << 28);
+	if ((info[2] & osxsave_and_avx) != osxsave_and_avx) {
+		return 0;
+	}
+	return (_xgetbv(0) & 6) == 6;
+}
+#else
+#define IMDD_AVX_TARGET			__attribute__((target("avx")))
+static inline int imdd_simd_has_avx(void) { return __builtin_cpu_supports("avx"); }
+#endif
+
+typedef __m256 imdd_v8;
+
+#define imdd_v8_const_zero()			_mm256_setzero_ps()
+#define imdd_v8_const_0_5f()			_mm256_set1_ps(.5f)
+
+#define imdd_v8_init_1f(s)				_mm256_set1_ps((s))
+#define imdd_v8_init_2v4(lo, hi)		_mm256_insertf128_ps(_mm256_castps128_ps256((lo)), (hi), 1)
+#define imdd_v8_get_lo(v)				_mm256_castps256_ps128((v))
+#define imdd_v8_get_hi(v)				_mm256_extractf128_ps((v), 1)
+
+#define imdd_v8_loadu(p)				_mm256_loadu_ps((float const *)(p))
+#define imdd_v8_storeu(p, v)			_mm256_storeu_ps((float *)(p), (v))
+
+#define imdd_v8_swiz_wwww(v)			_mm256_permute_ps((v), imdd_v4_shuf_code(3, 3, 3, 3))
+
+#define imdd_v8_swiz_xyab(xyzw, abcd)	_mm256_shuffle_ps((xyzw), (abcd), imdd_v4_shuf_code(0, 1, 0, 1))
+#define imdd_v8_swiz_zwcd(xyzw, abcd)	_mm256_shuffle_ps((xyzw), (abcd), imdd_v4_shuf_code(2, 3, 2, 3))
+#define imdd_v8_swiz_xayb(xyzw, abcd)	_mm256_unpacklo_ps((xyzw), (abcd))
+#define imdd_v8_swiz_zcwd(xyzw, abcd)	_mm256_unpackhi_ps((xyzw), (abcd))
+
+// transposes the 4x4 matrix in each 128-bit lane independently
+#define imdd_v8_transpose_inplace(io0, io1, io2, io3)				\
+	do {															\
+		imdd_v8 const t0 = imdd_v8_swiz_xayb((io0), (io1));			\
+		imdd_v8 const t1 = imdd_v8_swiz_xayb((io2), (io3));			\
+		imdd_v8 const t2 = imdd_v8_swiz_zcwd((io0), (io1));			\
+		imdd_v8 const t3 = imdd_v8_swiz_zcwd((io2), (io3));			\
+		(io0) = imdd_v8_swiz_xyab(t0, t1);							\
+		(io1) = imdd_v8_swiz_zwcd(t0, t1);							\
+		(io2) = imdd_v8_swiz_xyab(t2, t3);							\
+		(io3) = imdd_v8_swiz_zwcd(t2, t3);							\
+	} while(0);
+
+#define imdd_v8_set_x(v, s)		_mm256_blend_ps((v), (s), 0x11)
+#define imdd_v8_set_y(v, s)		_mm256_blend_ps((v), (s), 0x22)
+#define imdd_v8_set_z(v, s)		_mm256_blend_ps((v), (s), 0x44)
+#define imdd_v8_set_w(v, s)		_mm256_blend_ps((v), (s), 0x88)
+
+#define imdd_v8_add(a, b)		_mm256_add_ps((a), (b))
+#define imdd_v8_sub(a, b)		_mm256_sub_ps((a), (b))
+#define imdd_v8_mul(a, b)		_mm256_mul_ps((a), (b))
+
+/*
+	Writes rows r0, r1, r2 of the lower lane then rows r0, r1, r2 of the
+	upper lane to 6 consecutive imdd_v4 (i.e. two consecutive 3-row
+	transforms).
+*/
+static inline IMDD_AVX_TARGET
+void imdd_v8_store_rows_2x3(void *p, imdd_v8 r0, imdd_v8 r1, imdd_v8 r2)
+{
+	float *const dst = (float *)p;
+	_mm256_storeu_ps(dst + 0, _mm256_permute2f128_ps(r0, r1, 0x20));
+	_mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(r2, r0, 0x30));
+	_mm256_storeu_ps(dst + 16, _mm256_permute2f128_ps(r1, r2, 0x31));
+}
+
+/*
+	Writes rows r0, r1 of the lower lane then rows r0, r1 of the upper
+	lane to 4 consecutive imdd_v4.
+*/
+static inline IMDD_AVX_TARGET
+void imdd_v8_store_rows_2x2(void *p, imdd_v8 r0, imdd_v8 r1)
+{
+	float *const dst = (float *)p;
+	_mm256_storeu_ps(dst + 0, _mm256_permute2f128_ps(r0, r1, 0x20));
+	_mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(r0, r1, 0x31));
+}
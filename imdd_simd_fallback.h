@@ -56,6 +56,12 @@ void imdd_v4_store_3f(float *p, imdd_v4 v)
 	p[2] = v.z;
 }
 
+#define imdd_v4_store_nt(p, v)		(*(p) = (v))
+#define imdd_u32_store_nt(p, u)		(*(p) = (u))
+#define imdd_store_nt_fence()		((void)0)
+
+#define imdd_prefetch(p)		((void)(p))
+
 #define imdd_v4_swiz_xxxx(v)		imdd_v4_init_1f((v).x)
 #define imdd_v4_swiz_yyyy(v)		imdd_v4_init_1f((v).y)
 #define imdd_v4_swiz_zzzz(v)		imdd_v4_init_1f((v).z)
@@ -70,6 +76,7 @@ void imdd_v4_store_3f(float *p, imdd_v4 v)
 		io0 = imdd_v4_init_4f(t0.x, t1.x, t2.x, t3.x);		\
 		io1 = imdd_v4_init_4f(t0.y, t1.y, t2.y, t3.y);		\
 		io2 = imdd_v4_init_4f(t0.z, t1.z, t2.z, t3.z);		\
+		io3 = imdd_v4_init_4f(t0.w, t1.w, t2.w, t3.w);		\
 	} while(0);
 
 static inline imdd_v4 imdd_v4_set_x(imdd_v4 a, imdd_v4 b) { a.x = b.x; return a; }
@@ -101,6 +108,42 @@ static inline imdd_v4 imdd_v4_sub(imdd_v4 a, imdd_v4 b)	{ IMDD_V4_OP_IMPL(-) }
 static inline imdd_v4 imdd_v4_mul(imdd_v4 a, imdd_v4 b)	{ IMDD_V4_OP_IMPL(*) }
 static inline imdd_v4 imdd_v4_div(imdd_v4 a, imdd_v4 b)	{ IMDD_V4_OP_IMPL(/) }
 
+static inline
+imdd_v4 imdd_v4_abs(imdd_v4 a)
+{
+	return imdd_v4_init_4f(fabsf(a.x), fabsf(a.y), fabsf(a.z), fabsf(a.w));
+}
+
+static inline
+imdd_v4 imdd_v4_min(imdd_v4 a, imdd_v4 b)
+{
+	return imdd_v4_init_4f(
+		(a.x < b.x) ? a.x : b.x,
+		(a.y < b.y) ? a.y : b.y,
+		(a.z < b.z) ? a.z : b.z,
+		(a.w < b.w) ? a.w : b.w);
+}
+
+static inline
+imdd_v4 imdd_v4_max(imdd_v4 a, imdd_v4 b)
+{
+	return imdd_v4_init_4f(
+		(a.x > b.x) ? a.x : b.x,
+		(a.y > b.y) ? a.y : b.y,
+		(a.z > b.z) ? a.z : b.z,
+		(a.w > b.w) ? a.w : b.w);
+}
+
+// sign bit of each lane in bits 0 to 3
+static inline
+int imdd_v4_signmask(imdd_v4 a)
+{
+	return (int)((imdd_asuint(a.x) >> 31)
+		| ((imdd_asuint(a.y) >> 31) << 1)
+		| ((imdd_asuint(a.z) >> 31) << 2)
+		| ((imdd_asuint(a.w) >> 31) << 3));
+}
+
 static inline
 imdd_v4 imdd_v4_dot3(imdd_v4 a, imdd_v4 b)
 {
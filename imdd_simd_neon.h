@@ -0,0 +1,176 @@
+#pragma once
+
+#include <arm_neon.h>
+
+#define IMDD_VECTORCALL
+
+typedef float32x4_t imdd_v4;
+
+static inline
+imdd_v4 imdd_v4_init_4f(float x, float y, float z, float w)
+{
+	float const f[4] = { x, y, z, w };
+	return vld1q_f32(f);
+}
+#define imdd_v4_init_3f(x, y, z)		imdd_v4_init_4f((x), (y), (z), 0.f)
+#define imdd_v4_init_1f(s)				vdupq_n_f32((s))
+
+static uint32_t const imdd_v4_data_mask_x[4] = { 0xffffffffU, 0, 0, 0 };
+static uint32_t const imdd_v4_data_mask_y[4] = { 0, 0xffffffffU, 0, 0 };
+static uint32_t const imdd_v4_data_mask_z[4] = { 0, 0, 0xffffffffU, 0 };
+static uint32_t const imdd_v4_data_mask_w[4] = { 0, 0, 0, 0xffffffffU };
+
+#define imdd_v4_const_zero()		vdupq_n_f32(0.f)
+#define imdd_v4_const_0_5f()		vdupq_n_f32(.5f)
+#define imdd_v4_const_signbit()		vreinterpretq_f32_u32(vdupq_n_u32(0x80000000U))
+#define imdd_v4_const_mask_x()		vreinterpretq_f32_u32(vld1q_u32(imdd_v4_data_mask_x))
+#define imdd_v4_const_mask_y()		vreinterpretq_f32_u32(vld1q_u32(imdd_v4_data_mask_y))
+#define imdd_v4_const_mask_z()		vreinterpretq_f32_u32(vld1q_u32(imdd_v4_data_mask_z))
+#define imdd_v4_const_mask_w()		vreinterpretq_f32_u32(vld1q_u32(imdd_v4_data_mask_w))
+
+static inline
+imdd_v4 imdd_v4_load_3f(float const *p)		{ return imdd_v4_init_4f(p[0], p[1], p[2], 0.f); }
+
+static inline
+void imdd_v4_store_3f(float *p, imdd_v4 v)
+{
+	vst1_f32(p, vget_low_f32(v));
+	vst1q_lane_f32(p + 2, v, 2);
+}
+
+// no non-temporal hint is exposed through intrinsics, so use plain stores
+#define imdd_v4_store_nt(p, v)		vst1q_f32((float *)(p), (v))
+#define imdd_u32_store_nt(p, u)		(*(p) = (u))
+#define imdd_store_nt_fence()		((void)0)
+
+#if defined(__GNUC__) || defined(__clang__)
+#define imdd_prefetch(p)		__builtin_prefetch((p))
+#else
+#define imdd_prefetch(p)		((void)(p))
+#endif
+
+static inline imdd_v4 imdd_v4_swiz_xxxx(imdd_v4 v)	{ return vdupq_laneq_f32(v, 0); }
+static inline imdd_v4 imdd_v4_swiz_yyyy(imdd_v4 v)	{ return vdupq_laneq_f32(v, 1); }
+static inline imdd_v4 imdd_v4_swiz_zzzz(imdd_v4 v)	{ return vdupq_laneq_f32(v, 2); }
+static inline imdd_v4 imdd_v4_swiz_wwww(imdd_v4 v)	{ return vdupq_laneq_f32(v, 3); }
+
+static inline
+imdd_v4 imdd_v4_swiz_yzxw(imdd_v4 v)
+{
+	imdd_v4 const yzwx = vextq_f32(v, v, 1);
+	return vcopyq_laneq_f32(vcopyq_laneq_f32(yzwx, 2, v, 0), 3, v, 3);
+}
+
+#define imdd_v4_swiz_xyab(xyzw, abcd)	vcombine_f32(vget_low_f32((xyzw)), vget_low_f32((abcd)))
+#define imdd_v4_swiz_zwcd(xyzw, abcd)	vcombine_f32(vget_high_f32((xyzw)), vget_high_f32((abcd)))
+#define imdd_v4_swiz_xayb(xyzw, abcd)	vzip1q_f32((xyzw), (abcd))
+#define imdd_v4_swiz_zcwd(xyzw, abcd)	vzip2q_f32((xyzw), (abcd))
+
+#define imdd_v4_transpose_stage1(t0, t1, t2, t3, i0, i1, i2, i3)	\
+	do {															\
+		(t0) = imdd_v4_swiz_xayb((i0), (i1));						\
+		(t1) = imdd_v4_swiz_xayb((i2), (i3));						\
+		(t2) = imdd_v4_swiz_zcwd((i0), (i1));						\
+		(t3) = imdd_v4_swiz_zcwd((i2), (i3));						\
+	} while(0);
+#define imdd_v4_transpose_stage2(o0, o1, o2, o3, t0, t1, t2, t3)	\
+	do {															\
+		(o0) = imdd_v4_swiz_xyab((t0), (t1));						\
+		(o1) = imdd_v4_swiz_zwcd((t0), (t1));						\
+		(o2) = imdd_v4_swiz_xyab((t2), (t3));						\
+		(o3) = imdd_v4_swiz_zwcd((t2), (t3));						\
+	} while(0);
+#define imdd_v4_transpose_inplace(io0, io1, io2, io3)							\
+	do {																		\
+		imdd_v4 t0, t1, t2, t3;													\
+		imdd_v4_transpose_stage1(t0, t1, t2, t3, (io0), (io1), (io2), (io3));	\
+		imdd_v4_transpose_stage2((io0), (io1), (io2), (io3), t0, t1, t2, t3);	\
+	} while(0);
+
+static inline
+imdd_v4 imdd_v4_select(imdd_v4 mask, imdd_v4 true_val, imdd_v4 false_val)
+{
+	return vbslq_f32(vreinterpretq_u32_f32(mask), true_val, false_val);
+}
+
+#define imdd_v4_set_x(v, s)		vcopyq_laneq_f32((v), 0, (s), 0)
+#define imdd_v4_set_y(v, s)		vcopyq_laneq_f32((v), 1, (s), 1)
+#define imdd_v4_set_z(v, s)		vcopyq_laneq_f32((v), 2, (s), 2)
+#define imdd_v4_set_w(v, s)		vcopyq_laneq_f32((v), 3, (s), 3)
+
+static inline
+imdd_v4 imdd_v4_mul_sign(imdd_v4 a, imdd_v4 b)
+{
+	uint32x4_t const sign = vandq_u32(vreinterpretq_u32_f32(b), vdupq_n_u32(0x80000000U));
+	return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), sign));
+}
+
+#define imdd_v4_add(a, b)		vaddq_f32((a), (b))
+#define imdd_v4_sub(a, b)		vsubq_f32((a), (b))
+#define imdd_v4_mul(a, b)		vmulq_f32((a), (b))
+#define imdd_v4_div(a, b)		vdivq_f32((a), (b))
+
+#define imdd_v4_abs(a)			vabsq_f32((a))
+#define imdd_v4_min(a, b)		vminq_f32((a), (b))
+#define imdd_v4_max(a, b)		vmaxq_f32((a), (b))
+
+// sign bit of each lane in bits 0 to 3
+static inline
+int imdd_v4_signmask(imdd_v4 a)
+{
+	static int32_t const shifts[4] = { 0, 1, 2, 3 };
+	uint32x4_t const signs = vshrq_n_u32(vreinterpretq_u32_f32(a), 31);
+	return (int)vaddvq_u32(vshlq_u32(signs, vld1q_s32(shifts)));
+}
+
+// sums in the same order as the SSE version so that results match
+static inline
+imdd_v4 imdd_v4_dot3(imdd_v4 a, imdd_v4 b)
+{
+	imdd_v4 const ab = vmulq_f32(a, b);
+	imdd_v4 p = imdd_v4_swiz_xxxx(ab);
+	p = vaddq_f32(p, imdd_v4_swiz_yyyy(ab));
+	p = vaddq_f32(p, imdd_v4_swiz_zzzz(ab));
+	return p;
+}
+
+// with IMDD_FAST_MATH, results differ from the default (and from SSE) in the last bits, see imdd_simd_sse.h
+#ifdef IMDD_FAST_MATH
+
+static inline
+imdd_v4 imdd_v4_cross(imdd_v4 a, imdd_v4 b)
+{
+	imdd_v4 const t0 = vmulq_f32(a, imdd_v4_swiz_yzxw(b));
+	return imdd_v4_swiz_yzxw(vfmsq_f32(t0, imdd_v4_swiz_yzxw(a), b));
+}
+
+static inline
+imdd_v4 imdd_v4_normalize3(imdd_v4 a)
+{
+	// the estimate only has 8 bits, so refine it twice using r*(3 - x*r*r)/2
+	imdd_v4 const len_sq = imdd_v4_dot3(a, a);
+	imdd_v4 r = vrsqrteq_f32(len_sq);
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(len_sq, r), r));
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(len_sq, r), r));
+	return vmulq_f32(a, r);
+}
+
+#else
+
+static inline
+imdd_v4 imdd_v4_cross(imdd_v4 a, imdd_v4 b)
+{
+	imdd_v4 const t0 = vmulq_f32(a, imdd_v4_swiz_yzxw(b));
+	imdd_v4 const t1 = vmulq_f32(imdd_v4_swiz_yzxw(a), b);
+	return imdd_v4_swiz_yzxw(vsubq_f32(t0, t1));
+}
+
+static inline
+imdd_v4 imdd_v4_normalize3(imdd_v4 a)
+{
+	imdd_v4 const len_sq = imdd_v4_dot3(a, a);
+	imdd_v4 const len = vsqrtq_f32(len_sq);
+	return vdivq_f32(a, len);
+}
+
+#endif // def IMDD_FAST_MATH
@@ -4,6 +4,27 @@
 #include <emmintrin.h>
 #include <smmintrin.h>
 
+/*
+	Define IMDD_FAST_MATH to compute normalize3 from a reciprocal square root
+	estimate refined by one Newton-Raphson step, instead of a square root and
+	divide.  When compiling with FMA enabled (e.g. -mfma or /arch:AVX2) the
+	refinement and cross product also use fused multiply-adds.  Results then
+	differ from the default in the last bits.  This is only a win on CPUs
+	with slow square root and divide, so measure before enabling it.
+
+	imdd_simd_neon.h does the same with two refinement steps (its estimate
+	is less accurate) and always fuses.  The imdd_v8 kernels in
+	imdd_simd_avx.h never normalize, so have no fast math variant.
+*/
+#if defined(IMDD_FAST_MATH) && defined(__FMA__)
+#include <immintrin.h>
+#define imdd_v4_fmsub(a, b, c)		_mm_fmsub_ps((a), (b), (c))
+#define imdd_v4_fnmadd(a, b, c)		_mm_fnmadd_ps((a), (b), (c))
+#else
+#define imdd_v4_fmsub(a, b, c)		_mm_sub_ps(_mm_mul_ps((a), (b)), (c))
+#define imdd_v4_fnmadd(a, b, c)		_mm_sub_ps((c), _mm_mul_ps((a), (b)))
+#endif
+
 #ifdef _MSC_VER
 #define IDMD_SSE_ALIGN(DECL)	__declspec(align(16)) DECL
 #define IMDD_VECTORCALL			__vectorcall
@@ -47,6 +68,14 @@ void imdd_v4_store_3f(float *p, imdd_v4 v)
 	p[2] = s[2];
 }
 
+// non-temporal stores bypass the cache, call imdd_store_nt_fence() once done
+#define imdd_v4_store_nt(p, v)		_mm_stream_ps((float *)(p), (v))
+#define imdd_u32_store_nt(p, u)		_mm_stream_si32((int *)(p), (int)(u))
+#define imdd_store_nt_fence()		_mm_sfence()
+
+// fetches a cache line ahead of a load
+#define imdd_prefetch(p)			_mm_prefetch((char const *)(p), _MM_HINT_T0)
+
 #define imdd_v4_shuf_code(x, y, z, w)	((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
 
 static inline imdd_v4 imdd_v4_swiz_xxxx(imdd_v4 v)	{ return _mm_shuffle_ps(v, v, imdd_v4_shuf_code(0, 0, 0, 0)); }
@@ -99,6 +128,11 @@ imdd_v4 imdd_v4_select(imdd_v4 mask, imdd_v4 true_val, imdd_v4 false_val)
 #define imdd_v4_mul(a, b)		_mm_mul_ps((a), (b))
 #define imdd_v4_div(a, b)		_mm_div_ps((a), (b))
 
+#define imdd_v4_abs(a)			_mm_andnot_ps(imdd_v4_const_signbit(), (a))
+#define imdd_v4_min(a, b)		_mm_min_ps((a), (b))
+#define imdd_v4_max(a, b)		_mm_max_ps((a), (b))
+#define imdd_v4_signmask(a)		_mm_movemask_ps((a))		// sign bit of each lane in bits 0 to 3
+
 static inline
 imdd_v4 imdd_v4_dot3(imdd_v4 a, imdd_v4 b)
 {
@@ -109,6 +143,27 @@ imdd_v4 imdd_v4_dot3(imdd_v4 a, imdd_v4 b)
 	return p;
 }
 
+#ifdef IMDD_FAST_MATH
+
+static inline
+imdd_v4 imdd_v4_cross(imdd_v4 a, imdd_v4 b)
+{
+	imdd_v4 const t1 = _mm_mul_ps(imdd_v4_swiz_yzxw(a), b);
+	return imdd_v4_swiz_yzxw(imdd_v4_fmsub(a, imdd_v4_swiz_yzxw(b), t1));
+}
+
+static inline
+imdd_v4 imdd_v4_normalize3(imdd_v4 a)
+{
+	// refine the estimate r using r*(3 - x*r*r)/2
+	imdd_v4 const len_sq = imdd_v4_dot3(a, a);
+	imdd_v4 const r = _mm_rsqrt_ps(len_sq);
+	imdd_v4 const e = imdd_v4_fnmadd(_mm_mul_ps(len_sq, r), r, _mm_set1_ps(3.f));
+	return _mm_mul_ps(a, _mm_mul_ps(_mm_mul_ps(r, imdd_v4_const_0_5f()), e));
+}
+
+#else
+
 static inline
 imdd_v4 imdd_v4_cross(imdd_v4 a, imdd_v4 b)
 {
@@ -124,3 +179,5 @@ imdd_v4 imdd_v4_normalize3(imdd_v4 a)
 	imdd_v4 const len = imdd_v4_swiz_xxxx(_mm_sqrt_ss(len_sq));
 	return _mm_div_ps(a, len);
 }
+
+#endif // def IMDD_FAST_MATH
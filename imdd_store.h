@@ -6,17 +6,19 @@
 extern "C" {
 #endif
 
-// low 8 bits of the structure is the bucket index (used for batching)
+// low 7 bits of the structure and the layer are the bucket index (used for batching)
 typedef struct {
 	uint32_t style : 1;
 	uint32_t zmode : 1;
 	uint32_t blend : 1;
-	uint32_t shape : 5;
-	uint32_t data_qw_offset : 24;
+	uint32_t shape : 4;
+	uint32_t layer : 2;
+	uint32_t data_qw_offset : 23;
 	uint32_t color;
 } imdd_shape_header_t;
 
 #define IMDD_CACHE_LINE_SIZE	64
+#define IMDD_MAX_DATA_QW_COUNT	(1U << 23)	// fits in data_qw_offset
 
 struct imdd_shape_store_tag {
 	imdd_atomic_uint header_count;
@@ -29,6 +31,8 @@ struct imdd_shape_store_tag {
 	imdd_v4 *data_qw_store;
 	uint32_t header_capacity;
 	uint32_t data_qw_capacity;
+	imdd_atomic_uint layer;	// shared by every thread emitting into this store
+	uint32_t generation;	// changed by each reset, so that converted shapes can be kept while it is unchanged
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,176 @@
+#include "test_common.h"
+#include "example_common.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_RANDOM_SHAPE_COUNT	200000
+#define BENCH_PERF_SHAPE_COUNT		(40*40*40)
+#define BENCH_ITERATION_COUNT		10
+#define BENCH_THREAD_COUNT			4
+
+typedef struct {
+	char const *name;
+	imdd_shape_store_t *store;
+	uint32_t shape_count;
+} bench_scene_t;
+
+typedef struct {
+	bench_scene_t scenes[3];
+	uint32_t scene_count;
+	test_output_t output;
+	imdd_emit_sort_item_t *sort_items;
+	test_pool_t *pool;
+} bench_context_t;
+
+// best time over several conversions, to skip page faults on first use and other noise
+static double bench_convert(bench_context_t *ctx, bench_scene_t const *scene, imdd_emit_options_t const *options)
+{
+	double best = 1e9;
+	for (uint32_t i = 0; i < BENCH_ITERATION_COUNT; ++i) {
+		double const start = test_time_now();
+		test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)&scene->store, 1, options);
+		double const elapsed = test_time_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	return best;
+}
+
+static void bench_print(char const *name, bench_scene_t const *scene, double elapsed)
+{
+	printf("  %-24s %-8s %8.2f ms %8.2f Mshapes/s\n", name, scene->name, 1000.0*elapsed, 1e-6*scene->shape_count/elapsed);
+}
+
+static void bench_simd_levels(bench_context_t *ctx)
+{
+	static char const *const level_names[IMDD_SIMD_LEVEL_COUNT] = { "default", "avx" };
+
+	printf("conversion per SIMD level:\n");
+	imdd_simd_level_enum_t const max_level = imdd_emit_detect_simd_level();
+	for (uint32_t scene_index = 0; scene_index < ctx->scene_count; ++scene_index) {
+		bench_scene_t const *const scene = &ctx->scenes[scene_index];
+		for (uint32_t level = 0; level <= (uint32_t)max_level; ++level) {
+			imdd_emit_options_t options = { 0 };
+			options.flags = (level == IMDD_SIMD_LEVEL_DEFAULT) ? IMDD_EMIT_FLAG_DEFAULT_SIMD : 0;
+			bench_print(level_names[level], scene, bench_convert(ctx, scene, &options));
+		}
+	}
+}
+
+static void bench_sorted(bench_context_t *ctx)
+{
+	printf("conversion sorted by bucket:\n");
+	for (uint32_t scene_index = 0; scene_index < ctx->scene_count; ++scene_index) {
+		bench_scene_t const *const scene = &ctx->scenes[scene_index];
+		imdd_emit_options_t options = { 0 };
+		double const unsorted = bench_convert(ctx, scene, &options);
+		options.flags = IMDD_EMIT_FLAG_SORTED;
+		double const sorted = bench_convert(ctx, scene, &options);
+		bench_print("unsorted", scene, unsorted);
+		bench_print("sorted", scene, sorted);
+		printf("  %-24s %-8s %8.2fx\n", "speedup", scene->name, unsorted/sorted);
+	}
+}
+
+// the box scene seen from far enough away that each box is under a pixel across
+static void bench_small(bench_context_t *ctx)
+{
+	static char const *const names[3] = { "meshes", "small skipped", "small as points" };
+
+	printf("conversion of sub-pixel shapes:\n");
+	bench_scene_t const *const scene = &ctx->scenes[1];
+	imdd_emit_lod_t lod = { { 0.f, 0.f, 100.f }, 500.f, 0.f };
+	imdd_emit_options_t options = { 0 };
+	options.lod = &lod;
+	for (uint32_t mode = 0; mode < 3; ++mode) {
+		lod.min_pixel_radius = (mode == 0) ? 0.f : 1.f;
+		options.flags = (mode == 2) ? IMDD_EMIT_FLAG_SMALL_AS_POINTS : 0;
+		double const elapsed = bench_convert(ctx, scene, &options);
+		bench_print(names[mode], scene, elapsed);
+		printf("  %-24s %-8s %8u instances %8u wire vertices\n", "", scene->name, ctx->output.instance_count, ctx->output.wire_vertex_count);
+	}
+}
+
+// every triangle needs a normal, so compare with imdd_bench_fast_math to see what IMDD_FAST_MATH is worth on this CPU
+static void bench_filled_triangles(bench_context_t *ctx)
+{
+#ifdef IMDD_FAST_MATH
+	char const *const name = "fast math";
+#else
+	char const *const name = "sqrt and divide";
+#endif
+	printf("conversion of filled triangles:\n");
+	bench_scene_t const *const scene = &ctx->scenes[2];
+	imdd_emit_options_t options = { 0 };
+	bench_print(name, scene, bench_convert(ctx, scene, &options));
+}
+
+// the cost of the staging windows when writing to cached memory, see example_vulkan -p -n for write-combined memory
+static void bench_non_temporal(bench_context_t *ctx)
+{
+	printf("conversion to cached memory:\n");
+	for (uint32_t scene_index = 0; scene_index < ctx->scene_count; ++scene_index) {
+		bench_scene_t const *const scene = &ctx->scenes[scene_index];
+		imdd_emit_options_t options = { 0 };
+		options.scratch = test_scratch();
+		bench_print("normal stores", scene, bench_convert(ctx, scene, &options));
+		options.flags = IMDD_EMIT_FLAG_NON_TEMPORAL;
+		bench_print("non-temporal stores", scene, bench_convert(ctx, scene, &options));
+	}
+}
+
+// sorting on the calling thread and on a pool of threads, against conversion without sorting
+static void bench_alpha_sort(bench_context_t *ctx)
+{
+	printf("conversion with alpha sorting (%u threads):\n", BENCH_THREAD_COUNT);
+	bench_scene_t const *const scene = &ctx->scenes[0];
+	imdd_emit_alpha_sort_t sort = { { 1.f, 2.f, 3.f }, ctx->sort_items, 2*BENCH_RANDOM_SHAPE_COUNT };
+	imdd_emit_options_t options = { 0 };
+	options.scratch = test_scratch();
+	for (uint32_t threaded = 0; threaded < 2; ++threaded) {
+		options.scheduler = threaded ? test_pool_scheduler(ctx->pool) : NULL;
+		options.alpha_sort = NULL;
+		double const unsorted = bench_convert(ctx, scene, &options);
+		options.alpha_sort = &sort;
+		double const sorted = bench_convert(ctx, scene, &options);
+		bench_print(threaded ? "unsorted, threaded" : "unsorted", scene, unsorted);
+		bench_print(threaded ? "sorted, threaded" : "sorted", scene, sorted);
+	}
+}
+
+int main(void)
+{
+	bench_context_t ctx;
+	ctx.scene_count = 3;
+	ctx.scenes[0].name = "random";
+	ctx.scenes[0].shape_count = BENCH_RANDOM_SHAPE_COUNT;
+	ctx.scenes[0].store = test_store_create(BENCH_RANDOM_SHAPE_COUNT);
+	test_scene_random(ctx.scenes[0].store, BENCH_RANDOM_SHAPE_COUNT, 10.f, 1);
+	ctx.scenes[1].name = "boxes";
+	ctx.scenes[1].shape_count = BENCH_PERF_SHAPE_COUNT;
+	ctx.scenes[1].store = test_store_create(BENCH_PERF_SHAPE_COUNT);
+	imdd_perf_test(ctx.scenes[1].store);
+	ctx.scenes[2].name = "triangles";
+	ctx.scenes[2].shape_count = BENCH_RANDOM_SHAPE_COUNT;
+	ctx.scenes[2].store = test_store_create(BENCH_RANDOM_SHAPE_COUNT);
+	test_scene_triangles(ctx.scenes[2].store, BENCH_RANDOM_SHAPE_COUNT, 10.f, 1);
+	test_output_init(&ctx.output, BENCH_RANDOM_SHAPE_COUNT);
+	ctx.sort_items = (imdd_emit_sort_item_t *)malloc(2*BENCH_RANDOM_SHAPE_COUNT*sizeof(imdd_emit_sort_item_t));
+	ctx.pool = test_pool_create(BENCH_THREAD_COUNT);
+
+	bench_simd_levels(&ctx);
+	bench_sorted(&ctx);
+	bench_small(&ctx);
+	bench_filled_triangles(&ctx);
+	bench_non_temporal(&ctx);
+	bench_alpha_sort(&ctx);
+
+	test_pool_destroy(ctx.pool);
+	free(ctx.sort_items);
+	test_output_destroy(&ctx.output);
+	for (uint32_t scene_index = 0; scene_index < ctx.scene_count; ++scene_index) {
+		test_store_destroy(ctx.scenes[scene_index].store);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,384 @@
+#define IMDD_IMPLEMENTATION
+#include "test_common.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int g_test_failure_count = 0;
+
+void test_check(int ok, char const *cond, char const *file, int line)
+{
+	if (!ok) {
+		fprintf(stderr, "%s(%d): check failed: %s\n", file, line, cond);
+		++g_test_failure_count;
+	}
+}
+
+int test_failure_count(void)
+{
+	return g_test_failure_count;
+}
+
+double test_time_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+imdd_shape_store_t *test_store_create(uint32_t shape_capacity)
+{
+	// leave room for the largest shapes, aligned so that the store starts at the allocation
+	uint32_t const size = 2*IMDD_APPROX_SHAPE_SIZE_IN_BYTES*shape_capacity;
+	return imdd_init(aligned_alloc(IMDD_CACHE_LINE_SIZE, size), size);
+}
+
+void test_store_destroy(imdd_shape_store_t *store)
+{
+	free(store);
+}
+
+static float test_rand(uint32_t *state)
+{
+	*state = *state*1664525U + 1013904223U;
+	return (float)(*state >> 8)/16777216.f;
+}
+
+static uint32_t test_rand_bits(uint32_t *state)
+{
+	*state = *state*1664525U + 1013904223U;
+	return *state;
+}
+
+void test_scene_random(imdd_shape_store_t *store, uint32_t shape_count, float extent, uint32_t seed)
+{
+	uint32_t s = seed;
+	for (uint32_t i = 0; i < shape_count; ++i) {
+		float const cx = extent*(2.f*test_rand(&s) - 1.f);
+		float const cy = extent*(2.f*test_rand(&s) - 1.f);
+		float const cz = extent*(2.f*test_rand(&s) - 1.f);
+		float const hx = test_rand(&s) + .01f;
+		float const hy = test_rand(&s) + .01f;
+		float const hz = test_rand(&s) + .01f;
+		uint32_t const bits = test_rand_bits(&s) >> 8;
+		uint32_t const color = ((bits & 0x3) == 0 ? 0x7f000000U : 0xff000000U) | (test_rand_bits(&s) & 0xffffffU);
+		imdd_style_enum_t const style = (bits & 0x4) ? IMDD_STYLE_FILLED : IMDD_STYLE_WIRE;
+		imdd_zmode_enum_t const zmode = (bits & 0x8) ? IMDD_ZMODE_TEST : IMDD_ZMODE_NO_TEST;
+		if ((bits & 0xf00) == 0) {
+			imdd_set_layer(store, (bits >> 12) % IMDD_LAYER_COUNT);
+		}
+		imdd_v4 const centre = imdd_v4_init_3f(cx, cy, cz);
+		imdd_v4 const half = imdd_v4_init_3f(hx, hy, hz);
+		imdd_v4 const x_axis = imdd_v4_init_3f(hx, 0.f, 0.f);
+		imdd_v4 const y_axis = imdd_v4_init_3f(0.f, hy, 0.f);
+		imdd_v4 const z_axis = imdd_v4_init_3f(0.f, 0.f, hz);
+		switch ((bits >> 4) & 0x7) {
+			case 0:
+				imdd_line(store, zmode, imdd_v4_sub(centre, half), imdd_v4_add(centre, half), color);
+				break;
+			case 1:
+				imdd_triangle(store, style, zmode, centre, imdd_v4_add(centre, x_axis), imdd_v4_add(centre, y_axis), color);
+				break;
+			case 2:
+				imdd_aabb(store, style, zmode, imdd_v4_sub(centre, half), imdd_v4_add(centre, half), color);
+				break;
+			case 3:
+				imdd_obb(store, style, zmode, x_axis, y_axis, z_axis, centre, color);
+				break;
+			case 4:
+				imdd_sphere(store, style, zmode, imdd_v4_init_4f(cx, cy, cz, hx), color);
+				break;
+			case 5:
+				imdd_ellipsoid(store, style, zmode, x_axis, y_axis, z_axis, centre, color);
+				break;
+			case 6:
+				imdd_cone(store, style, zmode, x_axis, y_axis, z_axis, centre, color);
+				break;
+			default:
+				imdd_cylinder(store, style, zmode, x_axis, y_axis, z_axis, centre, color);
+				break;
+		}
+	}
+}
+
+void test_scene_triangles(imdd_shape_store_t *store, uint32_t shape_count, float extent, uint32_t seed)
+{
+	uint32_t s = seed;
+	for (uint32_t i = 0; i < shape_count; ++i) {
+		float const cx = extent*(2.f*test_rand(&s) - 1.f);
+		float const cy = extent*(2.f*test_rand(&s) - 1.f);
+		float const cz = extent*(2.f*test_rand(&s) - 1.f);
+		imdd_v4 corners[3];
+		for (uint32_t j = 0; j < 3; ++j) {
+			float const x = cx + 2.f*test_rand(&s) - 1.f;
+			float const y = cy + 2.f*test_rand(&s) - 1.f;
+			float const z = cz + 2.f*test_rand(&s) - 1.f;
+			corners[j] = imdd_v4_init_3f(x, y, z);
+		}
+		uint32_t const color = 0xff000000U | (test_rand_bits(&s) & 0xffffffU);
+		imdd_triangle(store, IMDD_STYLE_FILLED, IMDD_ZMODE_TEST, corners[0], corners[1], corners[2], color);
+	}
+}
+
+void test_output_init(test_output_t *output, uint32_t shape_capacity)
+{
+	// every shape could be a wire triangle, which uses 6 vertices
+	memset(output, 0, sizeof(test_output_t));
+	output->instance_capacity = shape_capacity;
+	output->instance_transforms = (imdd_instance_transform_t *)malloc(shape_capacity*sizeof(imdd_instance_transform_t));
+	output->instance_colors = (imdd_instance_color_t *)malloc(shape_capacity*sizeof(imdd_instance_color_t));
+	output->filled_vertex_capacity = 3*shape_capacity;
+	output->filled_vertices = (imdd_array_filled_vertex_t *)malloc(output->filled_vertex_capacity*sizeof(imdd_array_filled_vertex_t));
+	output->wire_vertex_capacity = 6*shape_capacity;
+	output->wire_vertices = (imdd_array_wire_vertex_t *)malloc(output->wire_vertex_capacity*sizeof(imdd_array_wire_vertex_t));
+}
+
+void test_output_destroy(test_output_t *output)
+{
+	free(output->instance_transforms);
+	free(output->instance_colors);
+	free(output->filled_vertices);
+	free(output->wire_vertices);
+}
+
+void test_output_convert(
+	test_output_t *output,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+	imdd_emit_options_t const *options)
+{
+	imdd_emit_shapes(
+		stores,
+		store_count,
+		output->instance_transforms,
+		output->instance_colors,
+		output->instance_capacity,
+		output->instance_batches,
+		&output->instance_count,
+		output->filled_vertices,
+		output->filled_vertex_capacity,
+		output->filled_array_batches,
+		&output->filled_vertex_count,
+		output->wire_vertices,
+		output->wire_vertex_capacity,
+		output->wire_array_batches,
+		&output->wire_vertex_count,
+		options);
+}
+
+uint64_t test_hash(uint64_t hash, void const *data, size_t size)
+{
+	uint8_t const *bytes = (uint8_t const *)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+uint64_t test_output_hash(test_output_t const *output)
+{
+	// instances of every format are packed into the transform buffer after the batches before them
+	uint32_t const instance_qw_count = imdd_instance_qw_count(output->instance_batches, output->instance_count);
+	uint64_t hash = TEST_HASH_INIT;
+	hash = test_hash(hash, output->instance_batches, sizeof(output->instance_batches));
+	hash = test_hash(hash, output->filled_array_batches, sizeof(output->filled_array_batches));
+	hash = test_hash(hash, output->wire_array_batches, sizeof(output->wire_array_batches));
+	hash = test_hash(hash, output->instance_transforms, instance_qw_count*sizeof(imdd_v4));
+	hash = test_hash(hash, output->instance_colors, output->instance_count*sizeof(imdd_instance_color_t));
+	hash = test_hash(hash, output->filled_vertices, output->filled_vertex_count*sizeof(imdd_array_filled_vertex_t));
+	hash = test_hash(hash, output->wire_vertices, output->wire_vertex_count*sizeof(imdd_array_wire_vertex_t));
+	return hash;
+}
+
+static size_t g_test_sort_size;
+
+static int test_compare_elements(void const *a, void const *b)
+{
+	return memcmp(a, b, g_test_sort_size);
+}
+
+// sorts count elements of element_size bytes from src (gathered with the given stride) and hashes them
+static uint64_t test_hash_sorted(uint64_t hash, void const *src, uint32_t count, uint32_t element_size, uint32_t stride)
+{
+	uint8_t *const tmp = (uint8_t *)malloc((size_t)count*element_size + 1);
+	for (uint32_t i = 0; i < count; ++i) {
+		memcpy(tmp + (size_t)i*element_size, (uint8_t const *)src + (size_t)i*stride, element_size);
+	}
+	g_test_sort_size = element_size;
+	qsort(tmp, count, element_size, test_compare_elements);
+	hash = test_hash(hash, &count, sizeof(count));
+	hash = test_hash(hash, tmp, (size_t)count*element_size);
+	free(tmp);
+	return hash;
+}
+
+uint64_t test_output_unordered_hash(test_output_t const *output)
+{
+	uint64_t hash = TEST_HASH_INIT;
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		// transforms and colors are sorted separately, which is enough to catch missing or changed instances
+		imdd_instance_format_enum_t const format = g_imdd_instance_groups[imdd_instance_group_from_batch_index(batch_index)].format;
+		uint32_t const qw_size = g_imdd_instance_format_qw_size[format];
+		imdd_batch_t const batch = output->instance_batches[batch_index];
+		imdd_v4 const *const transforms = (imdd_v4 const *)output->instance_transforms
+			+ imdd_instance_format_qw_bias(output->instance_batches, format)
+			+ batch.offset*qw_size;
+		hash = test_hash_sorted(hash, transforms, batch.count, qw_size*sizeof(imdd_v4), qw_size*sizeof(imdd_v4));
+		hash = test_hash_sorted(hash, output->instance_colors + batch.offset, batch.count, sizeof(imdd_instance_color_t), sizeof(imdd_instance_color_t));
+	}
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_batch_t const filled = output->filled_array_batches[batch_index];
+		imdd_batch_t const wire = output->wire_array_batches[batch_index];
+		hash = test_hash_sorted(hash, output->filled_vertices + filled.offset, filled.count/3, 3*sizeof(imdd_array_filled_vertex_t), 3*sizeof(imdd_array_filled_vertex_t));
+		hash = test_hash_sorted(hash, output->wire_vertices + wire.offset, wire.count, sizeof(imdd_array_wire_vertex_t), sizeof(imdd_array_wire_vertex_t));
+	}
+	return hash;
+}
+
+static void test_serial_parallel_for(void *user_data, uint32_t count, imdd_task_func_t fn, void *ctx)
+{
+	(void)user_data;
+	for (uint32_t index = 0; index < count; ++index) {
+		fn(ctx, index);
+	}
+}
+
+static void test_serial_wait(void *user_data)
+{
+	(void)user_data;
+}
+
+imdd_scheduler_t const g_test_serial_scheduler = { &test_serial_parallel_for, &test_serial_wait, NULL };
+
+static void test_reverse_parallel_for(void *user_data, uint32_t count, imdd_task_func_t fn, void *ctx)
+{
+	(void)user_data;
+	for (uint32_t index = count; index > 0; --index) {
+		fn(ctx, index - 1);
+	}
+}
+
+imdd_scheduler_t const g_test_reverse_scheduler = { &test_reverse_parallel_for, &test_serial_wait, NULL };
+
+// a stand-in for the job system of an engine, with a fixed set of threads with small stacks
+struct test_pool_t {
+	imdd_scheduler_t scheduler;
+	pthread_t threads[TEST_POOL_MAX_THREADS];
+	uint32_t thread_count;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	imdd_task_func_t fn;
+	void *ctx;
+	uint32_t task_count;
+	uint32_t next_task;
+	uint32_t done_count;
+	int quit;
+};
+
+static void *test_pool_thread(void *arg)
+{
+	test_pool_t *const pool = (test_pool_t *)arg;
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->next_task == pool->task_count) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		}
+		if (pool->quit) {
+			break;
+		}
+		uint32_t const index = pool->next_task++;
+		imdd_task_func_t const fn = pool->fn;
+		void *const ctx = pool->ctx;
+		pthread_mutex_unlock(&pool->mutex);
+
+		fn(ctx, index);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (++pool->done_count == pool->task_count) {
+			pthread_cond_broadcast(&pool->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void test_pool_parallel_for(void *user_data, uint32_t count, imdd_task_func_t fn, void *ctx)
+{
+	test_pool_t *const pool = (test_pool_t *)user_data;
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->done_count != pool->task_count) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->task_count = count;
+	pool->next_task = 0;
+	pool->done_count = 0;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void test_pool_wait(void *user_data)
+{
+	test_pool_t *const pool = (test_pool_t *)user_data;
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->done_count != pool->task_count) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+test_pool_t *test_pool_create(uint32_t thread_count)
+{
+	test_pool_t *const pool = (test_pool_t *)calloc(1, sizeof(test_pool_t));
+	pool->scheduler.parallel_for = &test_pool_parallel_for;
+	pool->scheduler.wait = &test_pool_wait;
+	pool->scheduler.user_data = pool;
+	pool->thread_count = (thread_count < TEST_POOL_MAX_THREADS) ? thread_count : TEST_POOL_MAX_THREADS;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, TEST_POOL_STACK_SIZE);
+	for (uint32_t i = 0; i < pool->thread_count; ++i) {
+		pthread_create(&pool->threads[i], &attr, &test_pool_thread, pool);
+	}
+	pthread_attr_destroy(&attr);
+	return pool;
+}
+
+void test_pool_destroy(test_pool_t *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (uint32_t i = 0; i < pool->thread_count; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+imdd_scheduler_t const *test_pool_scheduler(test_pool_t *pool)
+{
+	return &pool->scheduler;
+}
+
+imdd_emit_scratch_t const *test_scratch(void)
+{
+	static imdd_emit_scratch_t scratch;
+	if (!scratch.memory) {
+		scratch.size = imdd_emit_scratch_size(IMDD_EMIT_MAX_CHUNK_COUNT, IMDD_EMIT_FLAG_NON_TEMPORAL);
+		scratch.memory = malloc(scratch.size);
+	}
+	return &scratch;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "imdd.h"
+#include "imdd_draw_util.h"
+
+#define TEST_CHECK(COND)	test_check((COND) != 0, #COND, __FILE__, __LINE__)
+
+// stack size of the pool threads, to match the fibers of a typical job system
+#define TEST_POOL_STACK_SIZE	(64*1024)
+#define TEST_POOL_MAX_THREADS	16
+
+typedef struct test_pool_t test_pool_t;
+
+typedef struct {
+	imdd_instance_transform_t *instance_transforms;
+	imdd_instance_color_t *instance_colors;
+	uint32_t instance_capacity;
+	imdd_batch_t instance_batches[IMDD_INSTANCE_BATCH_COUNT];
+	uint32_t instance_count;
+
+	imdd_array_filled_vertex_t *filled_vertices;
+	uint32_t filled_vertex_capacity;
+	imdd_batch_t filled_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t filled_vertex_count;
+
+	imdd_array_wire_vertex_t *wire_vertices;
+	uint32_t wire_vertex_capacity;
+	imdd_batch_t wire_array_batches[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t wire_vertex_count;
+} test_output_t;
+
+void test_check(int ok, char const *cond, char const *file, int line);
+int test_failure_count(void);
+
+double test_time_now(void);
+
+imdd_shape_store_t *test_store_create(uint32_t shape_capacity);
+void test_store_destroy(imdd_shape_store_t *store);
+
+// a mix of every shape, style, zmode, blend mode and layer in a cube of half size extent around the origin
+void test_scene_random(imdd_shape_store_t *store, uint32_t shape_count, float extent, uint32_t seed);
+
+// filled triangles with corners in random directions, so every normal needs the full cross product and normalize
+void test_scene_triangles(imdd_shape_store_t *store, uint32_t shape_count, float extent, uint32_t seed);
+
+void test_output_init(test_output_t *output, uint32_t shape_capacity);
+void test_output_destroy(test_output_t *output);
+void test_output_convert(
+	test_output_t *output,
+	imdd_shape_store_t const *const *stores,
+	uint32_t store_count,
+	imdd_emit_options_t const *options);
+
+// FNV-1a, which can be continued over data written in several parts
+#define TEST_HASH_INIT		1469598103934665603ULL
+uint64_t test_hash(uint64_t hash, void const *data, size_t size);
+
+// hash of everything written in order, or of each batch after sorting its elements when order is not kept
+uint64_t test_output_hash(test_output_t const *output);
+uint64_t test_output_unordered_hash(test_output_t const *output);
+
+extern imdd_scheduler_t const g_test_serial_scheduler;
+
+// runs the tasks of each parallel_for from last to first, as the latest chunks can finish first on a pool
+extern imdd_scheduler_t const g_test_reverse_scheduler;
+
+test_pool_t *test_pool_create(uint32_t thread_count);
+void test_pool_destroy(test_pool_t *pool);
+imdd_scheduler_t const *test_pool_scheduler(test_pool_t *pool);
+
+// scratch for as many chunks as conversion can use, with non-temporal staging windows
+imdd_emit_scratch_t const *test_scratch(void);
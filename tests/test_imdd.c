@@ -0,0 +1,1128 @@
+#include "test_common.h"
+#include "example_common.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SHAPE_COUNT		50000
+#define TEST_STORE_COUNT		3
+#define TEST_POOL_THREAD_COUNT	4
+
+typedef struct {
+	imdd_shape_store_t *stores[TEST_STORE_COUNT];
+	uint32_t store_count;
+	test_output_t output;
+	imdd_emit_sort_item_t *sort_items;
+	uint32_t sort_item_capacity;
+	test_pool_t *pool;
+} test_context_t;
+
+static uint64_t test_convert(test_context_t *ctx, imdd_emit_options_t const *options, int unordered)
+{
+	test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)ctx->stores, ctx->store_count, options);
+	return unordered ? test_output_unordered_hash(&ctx->output) : test_output_hash(&ctx->output);
+}
+
+// conversion on the calling thread, a serial scheduler and a pool of threads with small stacks must all match
+static void test_schedulers(test_context_t *ctx, uint32_t flags, int alpha_sort)
+{
+	imdd_emit_alpha_sort_t sort;
+	sort.eye_pos[0] = 1.f;
+	sort.eye_pos[1] = 2.f;
+	sort.eye_pos[2] = 3.f;
+	sort.items = ctx->sort_items;
+	sort.item_capacity = ctx->sort_item_capacity;
+
+	imdd_emit_options_t options = { 0 };
+	options.flags = flags;
+	options.alpha_sort = alpha_sort ? &sort : NULL;
+
+	// the order within batches depends on how shapes are split into chunks when sorted
+	int const unordered = (flags & IMDD_EMIT_FLAG_SORTED) != 0;
+	uint64_t const expected = test_convert(ctx, &options, unordered);
+	TEST_CHECK(ctx->output.instance_count != 0);
+	TEST_CHECK(ctx->output.filled_vertex_count != 0);
+	TEST_CHECK(ctx->output.wire_vertex_count != 0);
+
+	options.scratch = test_scratch();
+	TEST_CHECK(test_convert(ctx, &options, unordered) == expected);
+
+	options.scheduler = &g_test_serial_scheduler;
+	TEST_CHECK(test_convert(ctx, &options, unordered) == expected);
+
+	options.scheduler = test_pool_scheduler(ctx->pool);
+	TEST_CHECK(test_convert(ctx, &options, unordered) == expected);
+	TEST_CHECK(test_convert(ctx, &options, unordered) == expected);
+}
+
+// the kernels chosen for this CPU must write exactly the same output as the imdd_v4 kernels
+static void test_simd_levels(test_context_t *ctx)
+{
+	for (uint32_t flags = 0; flags <= IMDD_EMIT_FLAG_COMPACT_INSTANCES; flags += IMDD_EMIT_FLAG_COMPACT_INSTANCES) {
+		imdd_emit_options_t options = { 0 };
+		options.flags = flags | IMDD_EMIT_FLAG_DEFAULT_SIMD;
+		uint64_t const expected = test_convert(ctx, &options, 0);
+		options.flags = flags;
+		TEST_CHECK(test_convert(ctx, &options, 0) == expected);
+	}
+}
+
+#define TEST_NORMAL_TOLERANCE	1e-5
+
+// filled triangle normals must be unit length and match a double precision cross product, which also holds with IMDD_FAST_MATH
+static void test_normals(test_context_t *ctx)
+{
+	imdd_shape_store_t *const store = test_store_create(TEST_SHAPE_COUNT);
+	test_scene_triangles(store, TEST_SHAPE_COUNT, 10.f, 1);
+	imdd_emit_options_t options = { 0 };
+	test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)&store, 1, &options);
+	TEST_CHECK(ctx->output.filled_vertex_count == 3*TEST_SHAPE_COUNT);
+
+	uint32_t checked_count = 0;
+	uint32_t error_count = 0;
+	for (uint32_t batch_index = 0; batch_index < IMDD_ARRAY_BATCH_COUNT; ++batch_index) {
+		imdd_batch_t const *const batch = &ctx->output.filled_array_batches[batch_index];
+		imdd_array_filled_vertex_t const *const vertices = ctx->output.filled_vertices + batch->offset;
+		for (uint32_t index = 0; index < batch->count; index += 3) {
+			float f[3][8];
+			memcpy(f, &vertices[index], sizeof(f));
+
+			// same float edges as imdd_emit_filled_triangle
+			double u[3];
+			double v[3];
+			for (uint32_t c = 0; c < 3; ++c) {
+				u[c] = f[2][c] - f[0][c];
+				v[c] = f[0][c] - f[1][c];
+			}
+			double n[3];
+			n[0] = u[1]*v[2] - u[2]*v[1];
+			n[1] = u[2]*v[0] - u[0]*v[2];
+			n[2] = u[0]*v[1] - u[1]*v[0];
+			double const len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			double const uv_len = sqrt(u[0]*u[0] + u[1]*u[1] + u[2]*u[2])*sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+
+			// skip slivers, where the float cross product loses too many bits to compare
+			if (len < .1*uv_len) {
+				continue;
+			}
+			++checked_count;
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (fabs((double)f[0][4 + c] - n[c]/len) > TEST_NORMAL_TOLERANCE
+					|| f[1][4 + c] != f[0][4 + c]
+					|| f[2][4 + c] != f[0][4 + c]) {
+					++error_count;
+				}
+			}
+		}
+	}
+	TEST_CHECK(checked_count != 0);
+	TEST_CHECK(error_count == 0);
+	test_store_destroy(store);
+}
+
+// sorting headers by bucket only changes the order within each batch
+static void test_sorted(test_context_t *ctx)
+{
+	imdd_emit_options_t options = { 0 };
+	uint64_t const expected = test_convert(ctx, &options, 1);
+	options.flags = IMDD_EMIT_FLAG_SORTED;
+	TEST_CHECK(test_convert(ctx, &options, 1) == expected);
+	options.scratch = test_scratch();
+	options.scheduler = test_pool_scheduler(ctx->pool);
+	TEST_CHECK(test_convert(ctx, &options, 1) == expected);
+}
+
+static uint32_t test_culled_count(imdd_emit_stats_t const *stats)
+{
+	uint32_t count = 0;
+	for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+		count += stats->culled_counts[shape];
+	}
+	return count;
+}
+
+static void test_frustum_init(imdd_frustum_t *frustum, float fov_y, float z_offset)
+{
+	mat4 proj_from_world;
+	mat4_identity(&proj_from_world);
+	mat4_rotate_x(&proj_from_world, PI/8.f);
+	mat4_translation(&proj_from_world, 0.f, 0.f, z_offset);
+	mat4_perspective_gl(&proj_from_world, fov_y, 1.f, .1f, 100.f);
+	imdd_frustum_init(frustum, proj_from_world.m[0]);
+}
+
+// shapes are culled only when outside every frustum, and culling never changes the shapes that are kept
+static void test_cull(test_context_t *ctx)
+{
+	imdd_frustum_t frustums[2];
+	test_frustum_init(&frustums[0], PI/2.f, -40.f);		// the whole scene
+	test_frustum_init(&frustums[1], PI/8.f, 40.f);		// behind the camera
+	imdd_emit_stats_t stats;
+	imdd_emit_options_t options = { 0 };
+	options.stats = &stats;
+	uint64_t const expected = test_convert(ctx, &options, 0);
+
+	options.frustums = frustums;
+	options.frustum_count = 1;
+	TEST_CHECK(test_convert(ctx, &options, 0) == expected);
+	TEST_CHECK(test_culled_count(&stats) == 0);
+
+	options.frustum_count = 2;
+	TEST_CHECK(test_convert(ctx, &options, 0) == expected);
+	TEST_CHECK(test_culled_count(&stats) == 0);
+
+	options.frustums = &frustums[1];
+	options.frustum_count = 1;
+	test_convert(ctx, &options, 0);
+	TEST_CHECK(test_culled_count(&stats) == TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+	TEST_CHECK(ctx->output.instance_count == 0);
+	TEST_CHECK(ctx->output.filled_vertex_count == 0);
+	TEST_CHECK(ctx->output.wire_vertex_count == 0);
+
+	// a narrow view of part of the scene, which must match with threads
+	imdd_frustum_t partial;
+	test_frustum_init(&partial, PI/8.f, -22.f);
+	options.frustums = &partial;
+	uint64_t const partial_hash = test_convert(ctx, &options, 0);
+	uint32_t const partial_culled_count = test_culled_count(&stats);
+	TEST_CHECK(partial_culled_count != 0);
+	TEST_CHECK(partial_culled_count < TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+	options.scratch = test_scratch();
+	options.scheduler = test_pool_scheduler(ctx->pool);
+	TEST_CHECK(test_convert(ctx, &options, 0) == partial_hash);
+	TEST_CHECK(test_culled_count(&stats) == partial_culled_count);
+}
+
+// a converted batch in the order of views and bounds, with the stride and primitive size to read it
+static imdd_batch_t const *test_output_batch(
+	test_output_t const *output,
+	uint32_t flags,
+	uint32_t view_batch_index,
+	imdd_v4 const **data,
+	uint32_t *qw_stride,
+	uint32_t *prim_size,
+	imdd_instance_format_enum_t *format)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		imdd_batch_t const *const batch = &output->instance_batches[view_batch_index];
+		*format = g_imdd_instance_groups[imdd_instance_group_from_batch_index(view_batch_index)].format;
+		*qw_stride = g_imdd_instance_format_qw_size[*format];
+		*prim_size = 1;
+		*data = (imdd_v4 const *)output->instance_transforms
+			+ imdd_instance_format_qw_bias(output->instance_batches, *format)
+			+ batch->offset*(*qw_stride);
+		return batch;
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	*format = IMDD_INSTANCE_FORMAT_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		imdd_batch_t const *const batch = &output->filled_array_batches[view_batch_index];
+		*qw_stride = (flags & IMDD_EMIT_FLAG_FLAT_TRIANGLES) ? IMDD_ARRAY_FLAT_VERTEX_QW_SIZE : IMDD_ARRAY_FILLED_VERTEX_QW_SIZE;
+		*prim_size = 3;
+		*data = (imdd_v4 const *)output->filled_vertices + batch->offset*(*qw_stride);
+		return batch;
+	}
+	view_batch_index -= IMDD_ARRAY_BATCH_COUNT;
+	imdd_batch_t const *const batch = &output->wire_array_batches[view_batch_index];
+	*qw_stride = 1;
+	*prim_size = (view_batch_index & 4) ? 3 : 2;
+	*data = &output->wire_vertices[batch->offset].pos_col;
+	return batch;
+}
+
+static imdd_batch_t const *test_view_range_list(imdd_emit_view_t const *view, uint32_t view_batch_index)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		return &view->instance_range_lists[view_batch_index];
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		return &view->filled_range_lists[view_batch_index];
+	}
+	return &view->wire_range_lists[view_batch_index - IMDD_ARRAY_BATCH_COUNT];
+}
+
+// ranges are in order within their batch, and every element visible in the view is inside one of them
+static void test_view_ranges(test_output_t const *output, uint32_t flags, imdd_emit_view_t const *view, imdd_frustum_t const *frustum)
+{
+	TEST_CHECK(view->range_count <= view->range_capacity);
+	for (uint32_t view_batch_index = 0; view_batch_index < IMDD_EMIT_VIEW_BATCH_COUNT; ++view_batch_index) {
+		imdd_v4 const *data;
+		uint32_t qw_stride;
+		uint32_t prim_size;
+		imdd_instance_format_enum_t format;
+		imdd_batch_t const *const batch = test_output_batch(output, flags, view_batch_index, &data, &qw_stride, &prim_size, &format);
+		imdd_batch_t const *const list = test_view_range_list(view, view_batch_index);
+		TEST_CHECK(list->offset + list->count <= view->range_count);
+		imdd_batch_t const *const ranges = view->ranges + list->offset;
+		uint32_t range_end = batch->offset;
+		int ranges_in_order = 1;
+		for (uint32_t range_index = 0; range_index < list->count; ++range_index) {
+			ranges_in_order &= (ranges[range_index].offset >= range_end && ranges[range_index].count > 0);
+			range_end = ranges[range_index].offset + ranges[range_index].count;
+		}
+		TEST_CHECK(ranges_in_order);
+		TEST_CHECK(range_end <= batch->offset + batch->count);
+
+		uint32_t range_index = 0;
+		uint32_t missing_count = 0;
+		for (uint32_t begin = 0; begin + prim_size <= batch->count; begin += prim_size, data += prim_size*qw_stride) {
+			int visible;
+			if (format == IMDD_INSTANCE_FORMAT_COUNT) {
+				imdd_v4 points[3];
+				for (uint32_t point_index = 0; point_index < prim_size; ++point_index) {
+					points[point_index] = data[point_index*qw_stride];
+				}
+				visible = imdd_frustum_test_points(frustum, points, prim_size);
+			} else {
+				visible = imdd_frustum_test_instance(frustum, format, data);
+			}
+			if (!visible) {
+				continue;
+			}
+			uint32_t const offset = batch->offset + begin;
+			while (range_index < list->count && ranges[range_index].offset + ranges[range_index].count < offset + prim_size) {
+				++range_index;
+			}
+			if (range_index == list->count || ranges[range_index].offset > offset) {
+				++missing_count;
+			}
+		}
+		TEST_CHECK(missing_count == 0);
+	}
+}
+
+#define TEST_VIEW_RANGE_CAPACITY	(4*TEST_STORE_COUNT*TEST_SHAPE_COUNT)
+
+// each view draws every shape it can see from its ranges, also when ranges run out and the last range of a batch grows
+static void test_views(test_context_t *ctx)
+{
+	imdd_frustum_t frustums[2];
+	test_frustum_init(&frustums[0], PI/8.f, -22.f);
+	test_frustum_init(&frustums[1], PI/6.f, -30.f);
+	imdd_emit_view_t views[2];
+	for (uint32_t view_index = 0; view_index < 2; ++view_index) {
+		memset(&views[view_index], 0, sizeof(imdd_emit_view_t));
+		views[view_index].ranges = (imdd_batch_t *)malloc(TEST_VIEW_RANGE_CAPACITY*sizeof(imdd_batch_t));
+	}
+
+	uint32_t const range_capacities[3] = { TEST_VIEW_RANGE_CAPACITY, IMDD_EMIT_VIEW_BATCH_COUNT + 40, IMDD_EMIT_VIEW_BATCH_COUNT };
+	uint32_t full_range_count = 0;
+	for (uint32_t flags = 0; flags <= IMDD_EMIT_FLAG_COMPACT_INSTANCES; flags += IMDD_EMIT_FLAG_COMPACT_INSTANCES)
+	for (uint32_t capacity_index = 0; capacity_index < 3; ++capacity_index) {
+		for (uint32_t view_index = 0; view_index < 2; ++view_index) {
+			views[view_index].range_capacity = range_capacities[capacity_index];
+		}
+		imdd_emit_options_t options = { 0 };
+		options.flags = flags;
+		options.frustums = frustums;
+		options.frustum_count = 2;
+		options.views = views;
+		test_convert(ctx, &options, 0);
+		for (uint32_t view_index = 0; view_index < 2; ++view_index) {
+			test_view_ranges(&ctx->output, flags, &views[view_index], &frustums[view_index]);
+		}
+		if (capacity_index == 0) {
+			// with enough ranges batches are split into more ranges than the smaller capacities allow
+			full_range_count = views[0].range_count;
+			TEST_CHECK(full_range_count > range_capacities[1]);
+		} else {
+			TEST_CHECK(views[0].range_count < full_range_count);
+		}
+	}
+
+	for (uint32_t view_index = 0; view_index < 2; ++view_index) {
+		free(views[view_index].ranges);
+	}
+}
+
+// the box of an instance or the point of a vertex, computed from the floats of the converted element
+static void test_element_box(imdd_instance_format_enum_t format, imdd_v4 const *data, float *min, float *max)
+{
+	float f[12];
+	memcpy(f, data, ((format == IMDD_INSTANCE_FORMAT_COUNT) ? 1 : g_imdd_instance_format_qw_size[format])*sizeof(imdd_v4));
+	for (uint32_t c = 0; c < 3; ++c) {
+		float centre;
+		float half_extent;
+		switch (format) {
+			case IMDD_INSTANCE_FORMAT_TRANSFORM:
+				centre = f[4*c + 3];
+				half_extent = fabsf(f[4*c]) + fabsf(f[4*c + 1]) + fabsf(f[4*c + 2]);
+				break;
+			case IMDD_INSTANCE_FORMAT_BOX:
+				centre = f[c];
+				half_extent = f[4 + c];
+				break;
+			case IMDD_INSTANCE_FORMAT_SPHERE:
+				centre = f[c];
+				half_extent = f[3];
+				break;
+			default:
+				centre = f[c];
+				half_extent = 0.f;
+				break;
+		}
+		min[c] = centre - half_extent;
+		max[c] = centre + half_extent;
+	}
+}
+
+static int test_bound_contains(imdd_emit_bound_t const *bound, float const *min, float const *max)
+{
+	float bound_min[4];
+	float bound_max[4];
+	memcpy(bound_min, &bound->min, sizeof(bound_min));
+	memcpy(bound_max, &bound->max, sizeof(bound_max));
+	return bound_min[0] <= min[0] && bound_min[1] <= min[1] && bound_min[2] <= min[2]
+		&& max[0] <= bound_max[0] && max[1] <= bound_max[1] && max[2] <= bound_max[2]
+		&& bound_min[3] == 0.f && bound_max[3] == 0.f;
+}
+
+static imdd_emit_bound_t const *test_bounds_batch_bound(imdd_emit_bounds_t const *bounds, uint32_t view_batch_index)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		return &bounds->instance_bounds[view_batch_index];
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		return &bounds->filled_bounds[view_batch_index];
+	}
+	return &bounds->wire_bounds[view_batch_index - IMDD_ARRAY_BATCH_COUNT];
+}
+
+static imdd_batch_t const *test_bounds_cluster_list(imdd_emit_bounds_t const *bounds, uint32_t view_batch_index)
+{
+	if (view_batch_index < IMDD_INSTANCE_BATCH_COUNT) {
+		return &bounds->instance_cluster_lists[view_batch_index];
+	}
+	view_batch_index -= IMDD_INSTANCE_BATCH_COUNT;
+	if (view_batch_index < IMDD_ARRAY_BATCH_COUNT) {
+		return &bounds->filled_cluster_lists[view_batch_index];
+	}
+	return &bounds->wire_cluster_lists[view_batch_index - IMDD_ARRAY_BATCH_COUNT];
+}
+
+// every element is inside the bounds of its batch and cluster, empty batches have min above max, and once
+// clusters run out no later batch has any
+static void test_bounds_check(test_output_t const *output, uint32_t flags, imdd_emit_bounds_t const *bounds)
+{
+	TEST_CHECK(bounds->cluster_count <= (bounds->clusters ? bounds->cluster_capacity : 0));
+	uint32_t cluster_end = 0;
+	int clusters_ran_out = 0;
+	for (uint32_t view_batch_index = 0; view_batch_index < IMDD_EMIT_VIEW_BATCH_COUNT; ++view_batch_index) {
+		imdd_v4 const *data;
+		uint32_t qw_stride;
+		uint32_t prim_size;
+		imdd_instance_format_enum_t format;
+		imdd_batch_t const *const batch = test_output_batch(output, flags, view_batch_index, &data, &qw_stride, &prim_size, &format);
+		imdd_emit_bound_t const *const batch_bound = test_bounds_batch_bound(bounds, view_batch_index);
+		imdd_batch_t const *const list = test_bounds_cluster_list(bounds, view_batch_index);
+		uint32_t const cluster_vertex_count = IMDD_EMIT_BOUNDS_CLUSTER_SIZE*prim_size;
+		uint32_t const cluster_count = (batch->count + cluster_vertex_count - 1)/cluster_vertex_count;
+
+		if (batch->count == 0) {
+			float min_x;
+			float max_x;
+			memcpy(&min_x, &batch_bound->min, sizeof(float));
+			memcpy(&max_x, &batch_bound->max, sizeof(float));
+			TEST_CHECK(min_x > max_x);
+		}
+		TEST_CHECK(list->offset == cluster_end);
+		if (clusters_ran_out) {
+			TEST_CHECK(list->count == 0);
+		} else if (list->count != cluster_count) {
+			TEST_CHECK(list->count == 0);
+			clusters_ran_out = 1;
+		}
+		cluster_end += list->count;
+
+		uint32_t outside_count = 0;
+		for (uint32_t index = 0; index < batch->count; ++index, data += qw_stride) {
+			float min[3];
+			float max[3];
+			test_element_box(format, data, min, max);
+			outside_count += !test_bound_contains(batch_bound, min, max);
+			uint32_t const cluster_index = index/cluster_vertex_count;
+			if (cluster_index < list->count) {
+				outside_count += !test_bound_contains(&bounds->clusters[list->offset + cluster_index], min, max);
+			}
+		}
+		TEST_CHECK(outside_count == 0);
+	}
+	TEST_CHECK(cluster_end == bounds->cluster_count);
+}
+
+#define TEST_BOUNDS_CLUSTER_CAPACITY	(TEST_STORE_COUNT*TEST_SHAPE_COUNT)
+
+static void test_bounds(test_context_t *ctx)
+{
+	imdd_emit_bounds_t bounds;
+	memset(&bounds, 0, sizeof(bounds));
+	imdd_emit_bound_t *const clusters = (imdd_emit_bound_t *)malloc(TEST_BOUNDS_CLUSTER_CAPACITY*sizeof(imdd_emit_bound_t));
+
+	// a frustum that culls part of the scene and empties some batches
+	imdd_frustum_t frustum;
+	test_frustum_init(&frustum, PI/8.f, -22.f);
+
+	uint32_t const cluster_capacities[3] = { TEST_BOUNDS_CLUSTER_CAPACITY, 100, 0 };
+	for (uint32_t flags = 0; flags <= IMDD_EMIT_FLAG_COMPACT_INSTANCES; flags += IMDD_EMIT_FLAG_COMPACT_INSTANCES)
+	for (uint32_t frustum_count = 0; frustum_count < 2; ++frustum_count)
+	for (uint32_t capacity_index = 0; capacity_index < 3; ++capacity_index) {
+		bounds.clusters = (cluster_capacities[capacity_index] > 0) ? clusters : NULL;
+		bounds.cluster_capacity = cluster_capacities[capacity_index];
+		imdd_emit_options_t options = { 0 };
+		options.flags = flags;
+		options.frustums = &frustum;
+		options.frustum_count = frustum_count;
+		options.bounds = &bounds;
+		test_convert(ctx, &options, 0);
+		test_bounds_check(&ctx->output, flags, &bounds);
+		if (capacity_index == 0) {
+			TEST_CHECK(bounds.cluster_count > cluster_capacities[1]);
+		} else {
+			TEST_CHECK(bounds.cluster_count <= cluster_capacities[capacity_index]);
+		}
+	}
+	free(clusters);
+}
+
+#define TEST_LOD_SHAPE_COUNT		10
+#define TEST_LOD_PIXELS_PER_UNIT	500.f
+
+// near, middle and far rows of spheres, cones and cylinders with a projected radius of about 50, 12 and 0.5 pixels
+static float const g_test_lod_distances[3] = { 5.f, 20.f, 500.f };
+
+static void test_lod_scene(imdd_shape_store_t *store, uint32_t row)
+{
+	float const z = -g_test_lod_distances[row];
+	for (uint32_t i = 0; i < TEST_LOD_SHAPE_COUNT; ++i) {
+		float const x = .01f*(float)i;
+		imdd_v4 const centre = imdd_v4_init_3f(x, 0.f, z);
+		imdd_v4 const x_axis = imdd_v4_init_3f(.5f, 0.f, 0.f);
+		imdd_v4 const y_axis = imdd_v4_init_3f(0.f, .5f, 0.f);
+		imdd_v4 const z_axis = imdd_v4_init_3f(0.f, 0.f, .5f);
+		imdd_sphere(store, IMDD_STYLE_FILLED, IMDD_ZMODE_TEST, imdd_v4_init_4f(x, 0.f, z, .5f), 0xffffffffU);
+		imdd_cone(store, IMDD_STYLE_FILLED, IMDD_ZMODE_TEST, x_axis, y_axis, z_axis, centre, 0xffffffffU);
+		imdd_cylinder(store, IMDD_STYLE_FILLED, IMDD_ZMODE_TEST, x_axis, y_axis, z_axis, centre, 0xffffffffU);
+	}
+}
+
+static uint32_t test_mesh_instance_count(test_output_t const *output, imdd_mesh_enum_t mesh)
+{
+	uint32_t count = 0;
+	for (uint32_t batch_index = 0; batch_index < IMDD_INSTANCE_BATCH_COUNT; ++batch_index) {
+		if (g_imdd_instance_groups[imdd_instance_group_from_batch_index(batch_index)].mesh == mesh) {
+			count += output->instance_batches[batch_index].count;
+		}
+	}
+	return count;
+}
+
+// each row of shapes must use the meshes of one LOD, or the most detailed meshes without a camera
+static void test_lod(test_context_t *ctx)
+{
+	static imdd_mesh_enum_t const meshes[3][3] = {
+		{ IMDD_MESH_SPHERE, IMDD_MESH_CONE, IMDD_MESH_CYLINDER },
+		{ IMDD_MESH_SPHERE_LOD1, IMDD_MESH_CONE_LOD1, IMDD_MESH_CYLINDER_LOD1 },
+		{ IMDD_MESH_SPHERE_LOD2, IMDD_MESH_CONE_LOD2, IMDD_MESH_CYLINDER_LOD2 }
+	};
+	imdd_shape_store_t *const store = test_store_create(3*TEST_LOD_SHAPE_COUNT);
+	imdd_emit_lod_t lod = { { 0.f, 0.f, 0.f }, TEST_LOD_PIXELS_PER_UNIT, 0.f };
+	for (uint32_t row = 0; row < 3; ++row) {
+		imdd_reset(store);
+		test_lod_scene(store, row);
+		for (uint32_t use_lod = 0; use_lod < 2; ++use_lod) {
+			imdd_emit_options_t options = { 0 };
+			options.lod = use_lod ? &lod : NULL;
+			test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)&store, 1, &options);
+			uint32_t const expected_row = use_lod ? row : 0;
+			for (uint32_t lod_index = 0; lod_index < 3; ++lod_index)
+			for (uint32_t mesh_index = 0; mesh_index < 3; ++mesh_index) {
+				uint32_t const expected = (lod_index == expected_row) ? TEST_LOD_SHAPE_COUNT : 0;
+				TEST_CHECK(test_mesh_instance_count(&ctx->output, meshes[lod_index][mesh_index]) == expected);
+			}
+		}
+	}
+	test_store_destroy(store);
+}
+
+// shapes below the minimum size are skipped or drawn as lines, and counted either way
+static void test_small(test_context_t *ctx)
+{
+	imdd_shape_store_t *const store = test_store_create(3*3*TEST_LOD_SHAPE_COUNT);
+	for (uint32_t row = 0; row < 3; ++row) {
+		test_lod_scene(store, row);
+	}
+	imdd_emit_lod_t lod = { { 0.f, 0.f, 0.f }, TEST_LOD_PIXELS_PER_UNIT, 2.f };
+	imdd_emit_stats_t stats;
+	imdd_emit_options_t options = { 0 };
+	options.lod = &lod;
+	options.stats = &stats;
+	for (uint32_t points = 0; points < 2; ++points) {
+		options.flags = points ? IMDD_EMIT_FLAG_SMALL_AS_POINTS : 0;
+		test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)&store, 1, &options);
+		TEST_CHECK(ctx->output.instance_count == 2*3*TEST_LOD_SHAPE_COUNT);
+		TEST_CHECK(ctx->output.wire_vertex_count == (points ? 2*3*TEST_LOD_SHAPE_COUNT : 0));
+		TEST_CHECK(stats.small_counts[IMDD_SHAPE_SPHERE] == TEST_LOD_SHAPE_COUNT);
+		TEST_CHECK(stats.small_counts[IMDD_SHAPE_CONE] == TEST_LOD_SHAPE_COUNT);
+		TEST_CHECK(stats.small_counts[IMDD_SHAPE_CYLINDER] == TEST_LOD_SHAPE_COUNT);
+	}
+	test_store_destroy(store);
+}
+
+// shapes of each layer go into batches of their own, so that renderers can draw each layer with its own state
+static void test_layers(test_context_t *ctx)
+{
+	imdd_shape_store_t *const store = test_store_create(2*3*TEST_LOD_SHAPE_COUNT);
+	test_lod_scene(store, 0);
+	imdd_set_layer(store, 2);
+	test_lod_scene(store, 0);
+	test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)&store, 1, NULL);
+	TEST_CHECK(ctx->output.instance_count == 2*3*TEST_LOD_SHAPE_COUNT);
+
+	uint32_t layer_counts[IMDD_LAYER_COUNT] = { 0 };
+	for (uint32_t group = 0; group < IMDD_INSTANCE_GROUP_COUNT; ++group)
+	for (uint32_t style = 0; style < IMDD_STYLE_COUNT; ++style)
+	for (uint32_t blend = 0; blend < IMDD_BLEND_COUNT; ++blend)
+	for (uint32_t zmode = 0; zmode < IMDD_ZMODE_COUNT; ++zmode) {
+		uint32_t counts[IMDD_LAYER_COUNT];
+		for (uint32_t layer = 0; layer < IMDD_LAYER_COUNT; ++layer) {
+			uint32_t const batch_index = imdd_instance_group_batch_index(
+				group,
+				layer,
+				(imdd_style_enum_t)style,
+				(imdd_blend_enum_t)blend,
+				(imdd_zmode_enum_t)zmode);
+			TEST_CHECK(imdd_instance_group_from_batch_index(batch_index) == group);
+			counts[layer] = ctx->output.instance_batches[batch_index].count;
+			layer_counts[layer] += counts[layer];
+		}
+		TEST_CHECK(counts[0] == counts[2]);
+	}
+	TEST_CHECK(layer_counts[0] == 3*TEST_LOD_SHAPE_COUNT);
+	TEST_CHECK(layer_counts[1] == 0);
+	TEST_CHECK(layer_counts[2] == 3*TEST_LOD_SHAPE_COUNT);
+	TEST_CHECK(layer_counts[3] == 0);
+	test_store_destroy(store);
+}
+
+// alpha blended shapes stay in store order when sorting cannot run, and the reasons are reported
+static void test_unsorted_alpha(test_context_t *ctx)
+{
+	imdd_emit_alpha_sort_t sort = { { 1.f, 2.f, 3.f }, ctx->sort_items, ctx->sort_item_capacity };
+	imdd_emit_stats_t stats;
+	imdd_emit_options_t options = { 0 };
+	options.stats = &stats;
+	uint64_t const expected = test_convert(ctx, &options, 0);
+
+	options.alpha_sort = &sort;
+	uint64_t const sorted = test_convert(ctx, &options, 0);
+	TEST_CHECK(sorted != expected);
+	TEST_CHECK(stats.unsorted_alpha_flags == 0);
+
+	sort.item_capacity = TEST_STORE_COUNT*TEST_SHAPE_COUNT;
+	TEST_CHECK(test_convert(ctx, &options, 0) == expected);
+	TEST_CHECK(stats.unsorted_alpha_flags == IMDD_EMIT_UNSORTED_ITEM_CAPACITY);
+	sort.item_capacity = ctx->sort_item_capacity;
+
+	imdd_emit_scratch_t scratch;
+	scratch.size = imdd_emit_scratch_size(1, 0);
+	scratch.memory = malloc(scratch.size);
+	options.scratch = &scratch;
+	TEST_CHECK(test_convert(ctx, &options, 0) == expected);
+	TEST_CHECK(stats.unsorted_alpha_flags == IMDD_EMIT_UNSORTED_CHUNK_CAPACITY);
+	options.scratch = NULL;
+	free(scratch.memory);
+
+	// many stores of a few shapes each
+	uint32_t const store_count = IMDD_EMIT_SORT_MAX_STORE_COUNT + 1;
+	imdd_shape_store_t **const stores = (imdd_shape_store_t **)malloc(store_count*sizeof(imdd_shape_store_t *));
+	for (uint32_t i = 0; i < store_count; ++i) {
+		stores[i] = test_store_create(4);
+		test_scene_random(stores[i], 4, 10.f, 1 + i);
+	}
+	test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)stores, store_count, &options);
+	TEST_CHECK(stats.unsorted_alpha_flags == IMDD_EMIT_UNSORTED_STORE_COUNT);
+	for (uint32_t i = 0; i < store_count; ++i) {
+		test_store_destroy(stores[i]);
+	}
+	free(stores);
+}
+
+// a store with more headers than sort items and dedupe slots can refer to is neither sorted nor deduplicated
+static void test_large_store(test_context_t *ctx)
+{
+	// zeroed headers are all copies of the same line, and the OS only maps the pages that are read
+	uint32_t const size = (1U << 30) + 4096;
+	void *const mem = calloc(1, size);
+	if (!mem) {
+		return;
+	}
+	imdd_shape_store_t *const store = imdd_init(mem, size);
+	TEST_CHECK(store->header_capacity > IMDD_EMIT_SORT_MAX_HEADER_COUNT);
+	imdd_atomic_store(&store->header_count, store->header_capacity);
+
+	// slots that are only touched if deduplication runs
+	imdd_emit_dedupe_t dedupe;
+	dedupe.slot_capacity = 4*store->header_capacity;
+	dedupe.slots = (imdd_atomic_uint *)calloc(dedupe.slot_capacity, sizeof(imdd_atomic_uint));
+
+	imdd_emit_alpha_sort_t sort = { { 1.f, 2.f, 3.f }, ctx->sort_items, ctx->sort_item_capacity };
+	imdd_emit_stats_t stats;
+	imdd_emit_options_t options = { 0 };
+	options.alpha_sort = &sort;
+	options.dedupe = dedupe.slots ? &dedupe : NULL;
+	options.stats = &stats;
+	test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)&store, 1, &options);
+	TEST_CHECK((stats.unsorted_alpha_flags & IMDD_EMIT_UNSORTED_HEADER_COUNT) != 0);
+	for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+		TEST_CHECK(stats.duplicate_counts[shape] == 0);
+	}
+
+	free(dedupe.slots);
+	free(mem);
+}
+
+// a layout with the same memory as the fixed formats, with the color in the w of each position
+static void test_layout_init(imdd_emit_layout_t *layout, test_output_t *output, int with_normals)
+{
+	uint8_t *const transforms = (uint8_t *)output->instance_transforms;
+	uint8_t *const filled = (uint8_t *)output->filled_vertices;
+	uint8_t *const wire = (uint8_t *)output->wire_vertices;
+	uint32_t const filled_stride = with_normals ? sizeof(imdd_array_filled_vertex_t) : sizeof(imdd_array_flat_vertex_t);
+	memset(layout, 0, sizeof(imdd_emit_layout_t));
+	for (uint32_t row = 0; row < 3; ++row) {
+		imdd_emit_attrib_t const attrib = { transforms + row*sizeof(imdd_v4), sizeof(imdd_instance_transform_t), IMDD_ATTRIB_FORMAT_FLOAT4 };
+		layout->instance_rows[row] = attrib;
+	}
+	imdd_emit_attrib_t const instance_color = { output->instance_colors, sizeof(imdd_instance_color_t), IMDD_ATTRIB_FORMAT_UNORM8X4 };
+	imdd_emit_attrib_t const filled_pos = { filled, filled_stride, IMDD_ATTRIB_FORMAT_FLOAT3 };
+	imdd_emit_attrib_t const filled_normal = { filled + sizeof(imdd_v4), filled_stride, with_normals ? IMDD_ATTRIB_FORMAT_FLOAT4 : IMDD_ATTRIB_FORMAT_NONE };
+	imdd_emit_attrib_t const filled_color = { filled + 3*sizeof(float), filled_stride, IMDD_ATTRIB_FORMAT_UNORM8X4 };
+	imdd_emit_attrib_t const wire_pos = { wire, sizeof(imdd_array_wire_vertex_t), IMDD_ATTRIB_FORMAT_FLOAT3 };
+	imdd_emit_attrib_t const wire_color = { wire + 3*sizeof(float), sizeof(imdd_array_wire_vertex_t), IMDD_ATTRIB_FORMAT_UNORM8X4 };
+	layout->instance_color = instance_color;
+	layout->filled_vertex_pos = filled_pos;
+	layout->filled_vertex_normal = filled_normal;
+	layout->filled_vertex_color = filled_color;
+	layout->wire_vertex_pos = wire_pos;
+	layout->wire_vertex_color = wire_color;
+}
+
+static void test_output_set_capacity(test_output_t *output, uint32_t shape_capacity)
+{
+	output->instance_capacity = shape_capacity;
+	output->filled_vertex_capacity = 3*shape_capacity;
+	output->wire_vertex_capacity = 6*shape_capacity;
+}
+
+// converting into the layout must write the same bytes and batches as the fixed arrays, a layout without normals
+// is compared with flat triangles
+static void test_layout_compare(test_context_t *ctx, test_output_t *layout_output, imdd_emit_options_t const *options, uint32_t shape_capacity)
+{
+	test_output_set_capacity(&ctx->output, shape_capacity);
+	test_output_set_capacity(layout_output, shape_capacity);
+	test_convert(ctx, options, 0);
+
+	int const with_normals = (options->flags & IMDD_EMIT_FLAG_FLAT_TRIANGLES) == 0;
+	imdd_emit_layout_t layout;
+	test_layout_init(&layout, layout_output, with_normals);
+	imdd_emit_options_t layout_options = *options;
+	layout_options.flags &= ~(uint32_t)IMDD_EMIT_FLAG_FLAT_TRIANGLES;
+	layout_options.layout = &layout;
+	memset(layout_output->instance_transforms, 0xcd, shape_capacity*sizeof(imdd_instance_transform_t));
+	memset(layout_output->instance_colors, 0xcd, shape_capacity*sizeof(imdd_instance_color_t));
+	memset(layout_output->filled_vertices, 0xcd, 3*shape_capacity*sizeof(imdd_array_filled_vertex_t));
+	memset(layout_output->wire_vertices, 0xcd, 6*shape_capacity*sizeof(imdd_array_wire_vertex_t));
+	test_output_convert(layout_output, (imdd_shape_store_t const *const *)ctx->stores, ctx->store_count, &layout_options);
+
+	test_output_t const *const expected = &ctx->output;
+	uint32_t const filled_size = with_normals ? sizeof(imdd_array_filled_vertex_t) : sizeof(imdd_array_flat_vertex_t);
+	TEST_CHECK(layout_output->instance_count == expected->instance_count);
+	TEST_CHECK(layout_output->filled_vertex_count == expected->filled_vertex_count);
+	TEST_CHECK(layout_output->wire_vertex_count == expected->wire_vertex_count);
+	TEST_CHECK(memcmp(layout_output->instance_batches, expected->instance_batches, sizeof(expected->instance_batches)) == 0);
+	TEST_CHECK(memcmp(layout_output->filled_array_batches, expected->filled_array_batches, sizeof(expected->filled_array_batches)) == 0);
+	TEST_CHECK(memcmp(layout_output->wire_array_batches, expected->wire_array_batches, sizeof(expected->wire_array_batches)) == 0);
+	TEST_CHECK(memcmp(layout_output->instance_transforms, expected->instance_transforms, expected->instance_count*sizeof(imdd_instance_transform_t)) == 0);
+	TEST_CHECK(memcmp(layout_output->instance_colors, expected->instance_colors, expected->instance_count*sizeof(imdd_instance_color_t)) == 0);
+	TEST_CHECK(memcmp(layout_output->filled_vertices, expected->filled_vertices, (size_t)expected->filled_vertex_count*filled_size) == 0);
+	TEST_CHECK(memcmp(layout_output->wire_vertices, expected->wire_vertices, expected->wire_vertex_count*sizeof(imdd_array_wire_vertex_t)) == 0);
+
+	test_output_set_capacity(&ctx->output, TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+	test_output_set_capacity(layout_output, TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+}
+
+static void test_layout(test_context_t *ctx)
+{
+	test_output_t layout_output;
+	test_output_init(&layout_output, TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+	uint32_t const full_capacity = TEST_STORE_COUNT*TEST_SHAPE_COUNT;
+	imdd_emit_options_t options = { 0 };
+	test_layout_compare(ctx, &layout_output, &options, full_capacity);
+	test_layout_compare(ctx, &layout_output, &options, TEST_SHAPE_COUNT/2);
+
+	options.flags = IMDD_EMIT_FLAG_FLAT_TRIANGLES;
+	test_layout_compare(ctx, &layout_output, &options, full_capacity);
+	test_layout_compare(ctx, &layout_output, &options, TEST_SHAPE_COUNT/2);
+
+	options.scratch = test_scratch();
+	options.scheduler = test_pool_scheduler(ctx->pool);
+	for (uint32_t flags = 0; flags <= IMDD_EMIT_FLAG_FLAT_TRIANGLES; flags += IMDD_EMIT_FLAG_FLAT_TRIANGLES) {
+		options.flags = flags;
+		test_layout_compare(ctx, &layout_output, &options, full_capacity);
+		options.flags = flags | IMDD_EMIT_FLAG_SORTED;
+		test_layout_compare(ctx, &layout_output, &options, full_capacity);
+		test_layout_compare(ctx, &layout_output, &options, TEST_SHAPE_COUNT/2);
+	}
+	test_output_destroy(&layout_output);
+}
+
+// a conversion that does not fit reports the counts that would have fitted every shape
+static void test_required_counts(test_context_t *ctx)
+{
+	imdd_emit_stats_t stats;
+	imdd_emit_options_t options = { 0 };
+	options.stats = &stats;
+	test_convert(ctx, &options, 0);
+	uint32_t const instance_count = ctx->output.instance_count;
+	uint32_t const filled_vertex_count = ctx->output.filled_vertex_count;
+	uint32_t const wire_vertex_count = ctx->output.wire_vertex_count;
+	TEST_CHECK(stats.required_instance_count == instance_count);
+	TEST_CHECK(stats.required_filled_vertex_count == filled_vertex_count);
+	TEST_CHECK(stats.required_wire_vertex_count == wire_vertex_count);
+
+	uint32_t const shape_capacity = TEST_SHAPE_COUNT/8;
+	test_output_set_capacity(&ctx->output, shape_capacity);
+	for (uint32_t run = 0; run < 2; ++run) {
+		if (run == 1) {
+			options.scratch = test_scratch();
+			options.scheduler = test_pool_scheduler(ctx->pool);
+		}
+		test_convert(ctx, &options, 0);
+		TEST_CHECK(ctx->output.instance_count <= shape_capacity);
+		TEST_CHECK(ctx->output.filled_vertex_count <= 3*shape_capacity);
+		TEST_CHECK(ctx->output.wire_vertex_count <= 6*shape_capacity);
+		TEST_CHECK(stats.required_instance_count == instance_count);
+		TEST_CHECK(stats.required_filled_vertex_count == filled_vertex_count);
+		TEST_CHECK(stats.required_wire_vertex_count == wire_vertex_count);
+	}
+	test_output_set_capacity(&ctx->output, TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+}
+
+// capacity grows straight away, but only shrinks after IMDD_CAPACITY_SHRINK_FRAME_COUNT frames of low usage in a row
+static void test_capacity_tracker(void)
+{
+	imdd_capacity_tracker_t tracker;
+	imdd_capacity_tracker_init(&tracker, 100);
+	uint32_t capacity = imdd_capacity_tracker_update(&tracker, 100, 1000);
+	TEST_CHECK(capacity == 1500);
+	TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, 1500) == 1500);
+
+	// a frame that needs more than a quarter starts the count again
+	for (uint32_t frame = 0; frame + 1 < IMDD_CAPACITY_SHRINK_FRAME_COUNT; ++frame) {
+		TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, 10) == capacity);
+	}
+	TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, 500) == capacity);
+	for (uint32_t frame = 0; frame + 1 < IMDD_CAPACITY_SHRINK_FRAME_COUNT; ++frame) {
+		TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, 300) == capacity);
+	}
+	capacity = imdd_capacity_tracker_update(&tracker, capacity, 300);
+	TEST_CHECK(capacity == 600);
+
+	// never below the initial capacity
+	for (uint32_t frame = 0; frame < 2*IMDD_CAPACITY_SHRINK_FRAME_COUNT; ++frame) {
+		capacity = imdd_capacity_tracker_update(&tracker, capacity, 0);
+	}
+	TEST_CHECK(capacity == 100);
+
+	// growth saturates instead of wrapping
+	TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, 0xb0000000U) == UINT32_MAX);
+	TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, UINT32_MAX) == UINT32_MAX);
+	TEST_CHECK(imdd_capacity_tracker_update(&tracker, capacity, 0xa0000000U) == 0xf0000000U);
+}
+
+#define TEST_STREAM_WINDOW_SHAPE_COUNT	7000
+
+// the hash and count of each batch, continued over every window that writes to it
+typedef struct {
+	uint64_t instance_hashes[IMDD_INSTANCE_BATCH_COUNT];
+	uint64_t instance_color_hashes[IMDD_INSTANCE_BATCH_COUNT];
+	uint64_t filled_hashes[IMDD_ARRAY_BATCH_COUNT];
+	uint64_t wire_hashes[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t instance_counts[IMDD_INSTANCE_BATCH_COUNT];
+	uint32_t filled_counts[IMDD_ARRAY_BATCH_COUNT];
+	uint32_t wire_counts[IMDD_ARRAY_BATCH_COUNT];
+} test_batch_hashes_t;
+
+typedef struct {
+	test_output_t const *output;
+	test_batch_hashes_t hashes;
+	uint32_t flush_count;
+	uint32_t prev_pass_index;
+	int out_of_order;
+	int outside_pass;
+	uint32_t max_instance_count;
+	uint32_t max_filled_vertex_count;
+	uint32_t max_wire_vertex_count;
+} test_stream_t;
+
+// batches of each layer are the same 8 combinations of style, blend and zmode, instance batches repeat these per group
+static uint32_t test_batch_pass_index(uint32_t batch_index)
+{
+	uint32_t const layer = (batch_index >> 3) % IMDD_LAYER_COUNT;
+	return imdd_emit_pass_index(layer, (imdd_zmode_enum_t)(batch_index & 1), (imdd_blend_enum_t)((batch_index >> 1) & 1));
+}
+
+static void test_batch_hashes_init(test_batch_hashes_t *hashes)
+{
+	memset(hashes, 0, sizeof(test_batch_hashes_t));
+	for (uint32_t i = 0; i < IMDD_INSTANCE_BATCH_COUNT; ++i) {
+		hashes->instance_hashes[i] = TEST_HASH_INIT;
+		hashes->instance_color_hashes[i] = TEST_HASH_INIT;
+	}
+	for (uint32_t i = 0; i < IMDD_ARRAY_BATCH_COUNT; ++i) {
+		hashes->filled_hashes[i] = TEST_HASH_INIT;
+		hashes->wire_hashes[i] = TEST_HASH_INIT;
+	}
+}
+
+// appends the elements of each batch of the output, which must only use full transforms
+static void test_batch_hashes_append(test_batch_hashes_t *hashes, test_output_t const *output)
+{
+	for (uint32_t i = 0; i < IMDD_INSTANCE_BATCH_COUNT; ++i) {
+		imdd_batch_t const batch = output->instance_batches[i];
+		hashes->instance_hashes[i] = test_hash(hashes->instance_hashes[i], output->instance_transforms + batch.offset, batch.count*sizeof(imdd_instance_transform_t));
+		hashes->instance_color_hashes[i] = test_hash(hashes->instance_color_hashes[i], output->instance_colors + batch.offset, batch.count*sizeof(imdd_instance_color_t));
+		hashes->instance_counts[i] += batch.count;
+	}
+	for (uint32_t i = 0; i < IMDD_ARRAY_BATCH_COUNT; ++i) {
+		imdd_batch_t const filled_batch = output->filled_array_batches[i];
+		imdd_batch_t const wire_batch = output->wire_array_batches[i];
+		hashes->filled_hashes[i] = test_hash(hashes->filled_hashes[i], output->filled_vertices + filled_batch.offset, filled_batch.count*sizeof(imdd_array_filled_vertex_t));
+		hashes->wire_hashes[i] = test_hash(hashes->wire_hashes[i], output->wire_vertices + wire_batch.offset, wire_batch.count*sizeof(imdd_array_wire_vertex_t));
+		hashes->filled_counts[i] += filled_batch.count;
+		hashes->wire_counts[i] += wire_batch.count;
+	}
+}
+
+static void test_stream_flush(void *user_data, uint32_t layer, imdd_zmode_enum_t zmode, imdd_blend_enum_t blend)
+{
+	test_stream_t *const stream = (test_stream_t *)user_data;
+	test_output_t const *const output = stream->output;
+	uint32_t const pass_index = imdd_emit_pass_index(layer, zmode, blend);
+	if (stream->flush_count > 0 && pass_index < stream->prev_pass_index) {
+		stream->out_of_order = 1;
+	}
+	for (uint32_t i = 0; i < IMDD_INSTANCE_BATCH_COUNT; ++i) {
+		if (output->instance_batches[i].count > 0 && test_batch_pass_index(i) != pass_index) {
+			stream->outside_pass = 1;
+		}
+	}
+	for (uint32_t i = 0; i < IMDD_ARRAY_BATCH_COUNT; ++i) {
+		if ((output->filled_array_batches[i].count > 0 || output->wire_array_batches[i].count > 0) && test_batch_pass_index(i) != pass_index) {
+			stream->outside_pass = 1;
+		}
+	}
+	test_batch_hashes_append(&stream->hashes, output);
+	stream->max_instance_count = (output->instance_count > stream->max_instance_count) ? output->instance_count : stream->max_instance_count;
+	stream->max_filled_vertex_count = (output->filled_vertex_count > stream->max_filled_vertex_count) ? output->filled_vertex_count : stream->max_filled_vertex_count;
+	stream->max_wire_vertex_count = (output->wire_vertex_count > stream->max_wire_vertex_count) ? output->wire_vertex_count : stream->max_wire_vertex_count;
+	stream->prev_pass_index = pass_index;
+	++stream->flush_count;
+}
+
+// windows of each pass are flushed in pass order, and concatenating them gives the batches of a single conversion
+static void test_streamed(test_context_t *ctx)
+{
+	imdd_frustum_t frustum;
+	test_frustum_init(&frustum, PI/3.f, -20.f);
+	imdd_emit_stats_t expected_stats;
+	imdd_emit_options_t options = { 0 };
+	options.frustums = &frustum;
+	options.frustum_count = 1;
+	options.stats = &expected_stats;
+	test_convert(ctx, &options, 0);
+	test_batch_hashes_t expected;
+	test_batch_hashes_init(&expected);
+	test_batch_hashes_append(&expected, &ctx->output);
+	TEST_CHECK(test_culled_count(&expected_stats) != 0);
+
+	for (uint32_t run = 0; run < 2; ++run) {
+		test_stream_t stream;
+		memset(&stream, 0, sizeof(stream));
+		stream.output = &ctx->output;
+		test_batch_hashes_init(&stream.hashes);
+		imdd_emit_stream_t const stream_options = { TEST_STREAM_WINDOW_SHAPE_COUNT, &test_stream_flush, &stream };
+		imdd_emit_stats_t stats;
+		options.stats = &stats;
+		options.stream = &stream_options;
+		if (run == 1) {
+			options.scratch = test_scratch();
+			options.scheduler = test_pool_scheduler(ctx->pool);
+		}
+		test_convert(ctx, &options, 0);
+
+		TEST_CHECK(stream.flush_count > IMDD_EMIT_PASS_COUNT);
+		TEST_CHECK(!stream.out_of_order);
+		TEST_CHECK(!stream.outside_pass);
+		TEST_CHECK(memcmp(&stream.hashes, &expected, sizeof(expected)) == 0);
+		TEST_CHECK(memcmp(stats.culled_counts, expected_stats.culled_counts, sizeof(stats.culled_counts)) == 0);
+		TEST_CHECK(stats.required_instance_count == stream.max_instance_count);
+		TEST_CHECK(stats.required_filled_vertex_count == stream.max_filled_vertex_count);
+		TEST_CHECK(stats.required_wire_vertex_count == stream.max_wire_vertex_count);
+		TEST_CHECK(stats.required_instance_count < expected_stats.required_instance_count);
+	}
+}
+
+#define TEST_DEDUPE_SHAPE_COUNT		20000
+#define TEST_DEDUPE_RUN_COUNT		8
+
+static void test_dedupe_convert(
+	test_context_t *ctx,
+	imdd_shape_store_t *const *stores,
+	uint32_t store_count,
+	imdd_emit_dedupe_t const *dedupe,
+	imdd_emit_stats_t *stats,
+	imdd_scheduler_t const *scheduler)
+{
+	imdd_emit_options_t options = { 0 };
+	options.dedupe = dedupe;
+	options.stats = stats;
+	options.scheduler = scheduler;
+	options.scratch = scheduler ? test_scratch() : NULL;
+	test_output_convert(&ctx->output, (imdd_shape_store_t const *const *)stores, store_count, &options);
+}
+
+// copies are skipped on every thread schedule to leave the first copy of each shape, and near copies are kept
+static void test_dedupe(test_context_t *ctx)
+{
+	// copies of one scene after another scene in the first store and in the second store, so the first copies are
+	// only written in the expected order if they are the ones kept
+	uint32_t const seeds[2][3] = { { 1, 2, 1 }, { 1, 3, 0 } };
+	imdd_shape_store_t *copies[2];
+	imdd_shape_store_t *firsts[2];
+	for (uint32_t i = 0; i < 2; ++i) {
+		copies[i] = test_store_create(3*TEST_DEDUPE_SHAPE_COUNT);
+		firsts[i] = test_store_create(3*TEST_DEDUPE_SHAPE_COUNT);
+		for (uint32_t j = 0; j < 3 && seeds[i][j] != 0; ++j) {
+			imdd_set_layer(copies[i], 0);
+			test_scene_random(copies[i], TEST_DEDUPE_SHAPE_COUNT, 10.f, seeds[i][j]);
+		}
+	}
+	test_scene_random(firsts[0], TEST_DEDUPE_SHAPE_COUNT, 10.f, 1);
+	imdd_set_layer(firsts[0], 0);
+	test_scene_random(firsts[0], TEST_DEDUPE_SHAPE_COUNT, 10.f, 2);
+	test_scene_random(firsts[1], TEST_DEDUPE_SHAPE_COUNT, 10.f, 3);
+
+	// the scene of seed 1 is the first TEST_DEDUPE_SHAPE_COUNT shapes of the first store, and is copied twice
+	uint32_t copy_counts[IMDD_SHAPE_COUNT] = { 0 };
+	for (uint32_t header_offset = 0; header_offset < TEST_DEDUPE_SHAPE_COUNT; ++header_offset) {
+		copy_counts[firsts[0]->header_store[header_offset].shape] += 2;
+	}
+
+	imdd_emit_stats_t stats;
+	test_dedupe_convert(ctx, firsts, 2, NULL, &stats, NULL);
+	uint64_t const expected = test_output_hash(&ctx->output);
+	test_dedupe_convert(ctx, copies, 2, NULL, &stats, NULL);
+	uint64_t const unskipped = test_output_hash(&ctx->output);
+	TEST_CHECK(unskipped != expected);
+
+	uint32_t const shape_count = 5*TEST_DEDUPE_SHAPE_COUNT;
+	imdd_emit_dedupe_t dedupe;
+	dedupe.slot_capacity = 4*shape_count;
+	dedupe.slots = (imdd_atomic_uint *)malloc(dedupe.slot_capacity*sizeof(imdd_atomic_uint));
+	for (uint32_t run = 0; run < TEST_DEDUPE_RUN_COUNT; ++run) {
+		imdd_scheduler_t const *scheduler = test_pool_scheduler(ctx->pool);
+		if (run == 0) {
+			scheduler = NULL;
+		} else if (run == 1) {
+			scheduler = &g_test_reverse_scheduler;
+		}
+		test_dedupe_convert(ctx, copies, 2, &dedupe, &stats, scheduler);
+		TEST_CHECK(test_output_hash(&ctx->output) == expected);
+		for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+			TEST_CHECK(stats.duplicate_counts[shape] == copy_counts[shape]);
+		}
+	}
+
+	// a table without room for four slots per shape is not used
+	dedupe.slot_capacity = 4*shape_count - 1;
+	test_dedupe_convert(ctx, copies, 2, &dedupe, &stats, test_pool_scheduler(ctx->pool));
+	TEST_CHECK(test_output_hash(&ctx->output) == unskipped);
+	for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+		TEST_CHECK(stats.duplicate_counts[shape] == 0);
+	}
+	dedupe.slot_capacity = 4*shape_count;
+
+	// boxes that differ only in the low bit of the colour or in the layer, then one exact copy of each
+	imdd_shape_store_t *const near = test_store_create(4*TEST_DEDUPE_SHAPE_COUNT);
+	for (uint32_t copy = 0; copy < 4; ++copy) {
+		imdd_set_layer(near, (copy == 2) ? 1 : 0);
+		for (uint32_t i = 0; i < TEST_DEDUPE_SHAPE_COUNT; ++i) {
+			imdd_v4 const min = imdd_v4_init_3f((float)i, 0.f, 0.f);
+			imdd_v4 const max = imdd_v4_init_3f((float)i + .5f, 1.f, 1.f);
+			imdd_aabb(near, IMDD_STYLE_FILLED, IMDD_ZMODE_TEST, min, max, 0xff204080U ^ ((copy == 1) ? 1U : 0U));
+		}
+	}
+	for (uint32_t run = 0; run < TEST_DEDUPE_RUN_COUNT; ++run) {
+		test_dedupe_convert(ctx, &near, 1, &dedupe, &stats, test_pool_scheduler(ctx->pool));
+		for (uint32_t shape = 0; shape < IMDD_SHAPE_COUNT; ++shape) {
+			TEST_CHECK(stats.duplicate_counts[shape] == ((shape == IMDD_SHAPE_AABB) ? TEST_DEDUPE_SHAPE_COUNT : 0));
+		}
+	}
+
+	test_store_destroy(near);
+	free(dedupe.slots);
+	for (uint32_t i = 0; i < 2; ++i) {
+		test_store_destroy(copies[i]);
+		test_store_destroy(firsts[i]);
+	}
+}
+
+int main(void)
+{
+	test_context_t ctx;
+	ctx.store_count = TEST_STORE_COUNT;
+	for (uint32_t i = 0; i < TEST_STORE_COUNT; ++i) {
+		ctx.stores[i] = test_store_create(TEST_SHAPE_COUNT);
+		test_scene_random(ctx.stores[i], TEST_SHAPE_COUNT, 10.f, 1 + i);
+	}
+	test_output_init(&ctx.output, TEST_STORE_COUNT*TEST_SHAPE_COUNT);
+	ctx.sort_item_capacity = 2*TEST_STORE_COUNT*TEST_SHAPE_COUNT;
+	ctx.sort_items = (imdd_emit_sort_item_t *)malloc(ctx.sort_item_capacity*sizeof(imdd_emit_sort_item_t));
+	ctx.pool = test_pool_create(TEST_POOL_THREAD_COUNT);
+
+	test_simd_levels(&ctx);
+	test_normals(&ctx);
+	test_sorted(&ctx);
+	test_cull(&ctx);
+	test_views(&ctx);
+	test_bounds(&ctx);
+	test_lod(&ctx);
+	test_small(&ctx);
+	test_layers(&ctx);
+	test_unsorted_alpha(&ctx);
+	test_large_store(&ctx);
+	test_layout(&ctx);
+	test_streamed(&ctx);
+	test_required_counts(&ctx);
+	test_capacity_tracker();
+	test_dedupe(&ctx);
+	test_schedulers(&ctx, 0, 0);
+	test_schedulers(&ctx, IMDD_EMIT_FLAG_NON_TEMPORAL, 0);
+	test_schedulers(&ctx, IMDD_EMIT_FLAG_SORTED, 0);
+	test_schedulers(&ctx, IMDD_EMIT_FLAG_NON_TEMPORAL, 1);
+
+	test_pool_destroy(ctx.pool);
+	free(ctx.sort_items);
+	test_output_destroy(&ctx.output);
+	for (uint32_t i = 0; i < TEST_STORE_COUNT; ++i) {
+		test_store_destroy(ctx.stores[i]);
+	}
+
+	int const failure_count = test_failure_count();
+	printf("%s: %d failures\n", failure_count ? "FAILED" : "passed", failure_count);
+	return failure_count ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+#include "test_common.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	Prints a hash of the results of each imdd_v4 operation over random
+	inputs, and of the output of conversion in a few modes.  With an
+	expected file (written from an SSE build), checks that every line
+	matches instead, so that other SIMD backends can be run against it
+	(see tests/toolchain_aarch64.cmake).
+*/
+
+#define PARITY_OP_INPUT_COUNT		100000
+#define PARITY_SHAPE_COUNT			20000
+#define PARITY_MAX_LINE_COUNT		64
+
+typedef struct {
+	char lines[PARITY_MAX_LINE_COUNT][64];
+	uint32_t line_count;
+} parity_results_t;
+
+static void parity_add(parity_results_t *results, char const *name, uint64_t hash)
+{
+	if (results->line_count < PARITY_MAX_LINE_COUNT) {
+		snprintf(results->lines[results->line_count++], sizeof(results->lines[0]), "%s %016" PRIx64, name, hash);
+	}
+}
+
+static uint64_t parity_hash_v4(uint64_t hash, imdd_v4 v)
+{
+	float f[4];
+	memcpy(f, &v, sizeof(f));
+	for (uint32_t i = 0; i < 4; ++i) {
+		uint32_t const bits = imdd_asuint(f[i]);
+		for (uint32_t j = 0; j < 4; ++j) {
+			hash ^= (bits >> (8*j)) & 0xff;
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+static float parity_rand(uint32_t *state)
+{
+	*state = *state*1664525U + 1013904223U;
+	return 20.f*(float)(*state >> 8)/16777216.f - 10.f;
+}
+
+static imdd_v4 parity_rand_v4(uint32_t *state)
+{
+	float const x = parity_rand(state);
+	float const y = parity_rand(state);
+	float const z = parity_rand(state);
+	float const w = parity_rand(state);
+	return imdd_v4_init_4f(x, y, z, w);
+}
+
+typedef enum {
+	PARITY_OP_ADD,
+	PARITY_OP_SUB,
+	PARITY_OP_MUL,
+	PARITY_OP_DIV,
+	PARITY_OP_MIN,
+	PARITY_OP_MAX,
+	PARITY_OP_ABS,
+	PARITY_OP_DOT3,
+	PARITY_OP_CROSS,
+	PARITY_OP_NORMALIZE3,
+	PARITY_OP_MUL_SIGN,
+	PARITY_OP_SELECT,
+	PARITY_OP_SET,
+	PARITY_OP_SWIZZLE,
+	PARITY_OP_TRANSPOSE,
+	PARITY_OP_LOAD_STORE,
+	PARITY_OP_COUNT
+} parity_op_enum_t;
+
+static char const *const g_parity_op_names[PARITY_OP_COUNT] = {
+	"add", "sub", "mul", "div", "min", "max", "abs", "dot3", "cross", "normalize3",
+	"mul_sign", "select", "set", "swizzle", "transpose", "load_store"
+};
+
+static void parity_ops(parity_results_t *results)
+{
+	uint64_t hashes[PARITY_OP_COUNT];
+	for (uint32_t op = 0; op < PARITY_OP_COUNT; ++op) {
+		hashes[op] = 1469598103934665603ULL;
+	}
+	uint32_t s = 1;
+	for (uint32_t i = 0; i < PARITY_OP_INPUT_COUNT; ++i) {
+		imdd_v4 a = parity_rand_v4(&s);
+		imdd_v4 b = parity_rand_v4(&s);
+		imdd_v4 c = parity_rand_v4(&s);
+		imdd_v4 d = parity_rand_v4(&s);
+		hashes[PARITY_OP_ADD] = parity_hash_v4(hashes[PARITY_OP_ADD], imdd_v4_add(a, b));
+		hashes[PARITY_OP_SUB] = parity_hash_v4(hashes[PARITY_OP_SUB], imdd_v4_sub(a, b));
+		hashes[PARITY_OP_MUL] = parity_hash_v4(hashes[PARITY_OP_MUL], imdd_v4_mul(a, b));
+		hashes[PARITY_OP_DIV] = parity_hash_v4(hashes[PARITY_OP_DIV], imdd_v4_div(a, b));
+		hashes[PARITY_OP_MIN] = parity_hash_v4(hashes[PARITY_OP_MIN], imdd_v4_min(a, b));
+		hashes[PARITY_OP_MAX] = parity_hash_v4(hashes[PARITY_OP_MAX], imdd_v4_max(a, b));
+		hashes[PARITY_OP_ABS] = parity_hash_v4(hashes[PARITY_OP_ABS], imdd_v4_abs(a));
+		hashes[PARITY_OP_DOT3] = parity_hash_v4(hashes[PARITY_OP_DOT3], imdd_v4_dot3(a, b));
+		hashes[PARITY_OP_CROSS] = parity_hash_v4(hashes[PARITY_OP_CROSS], imdd_v4_cross(a, b));
+		hashes[PARITY_OP_NORMALIZE3] = parity_hash_v4(hashes[PARITY_OP_NORMALIZE3], imdd_v4_normalize3(a));
+		hashes[PARITY_OP_MUL_SIGN] = parity_hash_v4(hashes[PARITY_OP_MUL_SIGN], imdd_v4_mul_sign(a, b));
+		hashes[PARITY_OP_SELECT] = parity_hash_v4(hashes[PARITY_OP_SELECT], imdd_v4_select(imdd_v4_const_mask_y(), a, b));
+		hashes[PARITY_OP_SET] = parity_hash_v4(hashes[PARITY_OP_SET], imdd_v4_set_x(imdd_v4_set_z(a, b), c));
+		hashes[PARITY_OP_SET] = parity_hash_v4(hashes[PARITY_OP_SET], imdd_v4_set_y(imdd_v4_set_w(a, b), c));
+		hashes[PARITY_OP_SWIZZLE] = parity_hash_v4(hashes[PARITY_OP_SWIZZLE], imdd_v4_swiz_yzxw(a));
+		hashes[PARITY_OP_SWIZZLE] = parity_hash_v4(hashes[PARITY_OP_SWIZZLE], imdd_v4_swiz_wwww(b));
+		hashes[PARITY_OP_SWIZZLE] = parity_hash_v4(hashes[PARITY_OP_SWIZZLE], imdd_v4_swiz_xyab(a, b));
+		hashes[PARITY_OP_SWIZZLE] = parity_hash_v4(hashes[PARITY_OP_SWIZZLE], imdd_v4_swiz_zwcd(a, b));
+		imdd_v4_transpose_inplace(a, b, c, d);
+		hashes[PARITY_OP_TRANSPOSE] = parity_hash_v4(hashes[PARITY_OP_TRANSPOSE], a);
+		hashes[PARITY_OP_TRANSPOSE] = parity_hash_v4(hashes[PARITY_OP_TRANSPOSE], b);
+		hashes[PARITY_OP_TRANSPOSE] = parity_hash_v4(hashes[PARITY_OP_TRANSPOSE], c);
+		hashes[PARITY_OP_TRANSPOSE] = parity_hash_v4(hashes[PARITY_OP_TRANSPOSE], d);
+		float f[4] = { 0.f, 0.f, 0.f, 0.f };
+		imdd_v4_store_3f(f, a);
+		hashes[PARITY_OP_LOAD_STORE] = parity_hash_v4(hashes[PARITY_OP_LOAD_STORE], imdd_v4_load_3f(f));
+	}
+	for (uint32_t op = 0; op < PARITY_OP_COUNT; ++op) {
+		parity_add(results, g_parity_op_names[op], hashes[op]);
+	}
+}
+
+static void parity_emit(parity_results_t *results)
+{
+	static struct {
+		char const *name;
+		uint32_t flags;
+	} const modes[] = {
+		{ "emit", 0 },
+		{ "emit_compact", IMDD_EMIT_FLAG_COMPACT_INSTANCES },
+		{ "emit_flat", IMDD_EMIT_FLAG_FLAT_TRIANGLES },
+		{ "emit_indexed", IMDD_EMIT_FLAG_INDEXED_WIRE_TRIANGLES },
+		{ "emit_non_temporal", IMDD_EMIT_FLAG_NON_TEMPORAL }
+	};
+	imdd_shape_store_t *const store = test_store_create(PARITY_SHAPE_COUNT);
+	test_scene_random(store, PARITY_SHAPE_COUNT, 10.f, 1);
+	test_output_t output;
+	test_output_init(&output, PARITY_SHAPE_COUNT);
+	for (uint32_t i = 0; i < sizeof(modes)/sizeof(modes[0]); ++i) {
+		imdd_emit_options_t options = { 0 };
+		options.flags = modes[i].flags;
+		options.scratch = test_scratch();
+		test_output_convert(&output, (imdd_shape_store_t const *const *)&store, 1, &options);
+		parity_add(results, modes[i].name, test_output_hash(&output));
+	}
+	test_output_destroy(&output);
+	test_store_destroy(store);
+}
+
+int main(int argc, char **argv)
+{
+	parity_results_t results;
+	results.line_count = 0;
+	parity_ops(&results);
+	parity_emit(&results);
+
+	if (argc < 2) {
+		for (uint32_t i = 0; i < results.line_count; ++i) {
+			printf("%s\n", results.lines[i]);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	FILE *const fp = fopen(argv[1], "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	char line[64];
+	uint32_t line_index = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0') {
+			continue;
+		}
+		TEST_CHECK(line_index < results.line_count);
+		if (line_index < results.line_count && strcmp(line, results.lines[line_index]) != 0) {
+			fprintf(stderr, "expected \"%s\", got \"%s\"\n", line, results.lines[line_index]);
+			TEST_CHECK(0);
+		}
+		++line_index;
+	}
+	fclose(fp);
+	TEST_CHECK(line_index == results.line_count);
+
+	int const failure_count = test_failure_count();
+	printf("%s: %d failures\n", failure_count ? "FAILED" : "passed", failure_count);
+	return failure_count ? EXIT_FAILURE : EXIT_SUCCESS;
+}
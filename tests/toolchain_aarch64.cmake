@@ -0,0 +1,18 @@
+# Cross build for AArch64 Linux, with tests run under qemu.  Use with:
+#   cmake -S . -B build_aarch64 -DCMAKE_TOOLCHAIN_FILE=tests/toolchain_aarch64.cmake
+#   cmake --build build_aarch64 && ctest --test-dir build_aarch64
+# imdd_parity then checks the NEON backend against tests/parity_expected.txt from an SSE build.
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR aarch64)
+
+set(IMDD_AARCH64_PREFIX "aarch64-linux-gnu" CACHE STRING "Prefix of the AArch64 cross compiler")
+set(IMDD_AARCH64_SYSROOT "/usr/${IMDD_AARCH64_PREFIX}" CACHE PATH "Root of the AArch64 libraries for qemu")
+
+set(CMAKE_C_COMPILER ${IMDD_AARCH64_PREFIX}-gcc)
+set(CMAKE_CXX_COMPILER ${IMDD_AARCH64_PREFIX}-g++)
+set(CMAKE_FIND_ROOT_PATH ${IMDD_AARCH64_SYSROOT})
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+
+set(CMAKE_CROSSCOMPILING_EMULATOR qemu-aarch64 -L ${IMDD_AARCH64_SYSROOT})